@@ -0,0 +1,66 @@
+/* --- INCLUDES ------------------------------------------------------------- */
+#include "DirCrawlerBudget.h"
+
+/* --- PRIVATE VARIABLES ---------------------------------------------------- */
+static SRWLOCK gs_sBudgetLock = SRWLOCK_INIT;
+static CONDITION_VARIABLE gs_sBudgetReleased = CONDITION_VARIABLE_INIT;
+static ULONGLONG gs_ullReserved = 0;
+static DIR_CRAWLER_BUDGET_STATS gs_sBudgetStats = { 0 };   // protected by the budget lock
+
+/* --- PUBLIC VARIABLES ----------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS ---------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS ----------------------------------------------------- */
+void DirCrawlerBudgetInit(
+    _In_ const ULONGLONG ullBudget
+    ) {
+    gs_sBudgetStats.ullBudget = ullBudget;
+    if (ullBudget != DIR_CRAWLER_BUDGET_UNLIMITED) {
+        LOG(Info, SUB_LOG(_T("Formatted records limited to <%lluMB> at once")), ullBudget / DIR_CRAWLER_BUDGET_MB);
+    }
+}
+
+BOOL DirCrawlerBudgetReserve(
+    _In_ const PDIR_CRAWLER_REQ_DESCR pReqDescr,
+    _In_ const ULONGLONG ullBytes
+    ) {
+    BOOL bWaited = FALSE;
+
+    if (ullBytes < DIR_CRAWLER_BUDGET_MIN_BYTES) {
+        return FALSE;
+    }
+
+    AcquireSRWLockExclusive(&gs_sBudgetLock);
+    // A thread holds at most one reservation: waiting only while others hold some cannot deadlock
+    while (gs_sBudgetStats.ullBudget != DIR_CRAWLER_BUDGET_UNLIMITED && gs_ullReserved > 0 && gs_ullReserved + ullBytes > gs_sBudgetStats.ullBudget) {
+        if (bWaited == FALSE) {
+            REQ_LOG(pReqDescr, Dbg, _T("Waiting for <%llu> bytes of memory budget <reserved:%llu>"), ullBytes, gs_ullReserved);
+            gs_sBudgetStats.llWaits += 1;
+            bWaited = TRUE;
+        }
+        SleepConditionVariableSRW(&gs_sBudgetReleased, &gs_sBudgetLock, INFINITE, 0);
+    }
+    gs_ullReserved += ullBytes;
+    gs_sBudgetStats.llReservations += 1;
+    gs_sBudgetStats.ullPeakReserved = max(gs_sBudgetStats.ullPeakReserved, gs_ullReserved);
+    gs_sBudgetStats.ullLargestRecord = max(gs_sBudgetStats.ullLargestRecord, ullBytes);
+    ReleaseSRWLockExclusive(&gs_sBudgetLock);
+
+    return TRUE;
+}
+
+void DirCrawlerBudgetRelease(
+    _In_ const ULONGLONG ullBytes
+    ) {
+    AcquireSRWLockExclusive(&gs_sBudgetLock);
+    gs_ullReserved -= ullBytes;
+    ReleaseSRWLockExclusive(&gs_sBudgetLock);
+    WakeAllConditionVariable(&gs_sBudgetReleased);
+}
+
+void DirCrawlerBudgetGetStats(
+    _Out_ PDIR_CRAWLER_BUDGET_STATS pStats
+    ) {
+    AcquireSRWLockShared(&gs_sBudgetLock);
+    *pStats = gs_sBudgetStats;
+    ReleaseSRWLockShared(&gs_sBudgetLock);
+}
@@ -0,0 +1,46 @@
+#ifndef __DIR_CRAWLER_BUDGET_H__
+#define __DIR_CRAWLER_BUDGET_H__
+
+/* --- INCLUDES ------------------------------------------------------------- */
+#include "DirectoryCrawler.h"
+
+/* --- DEFINES -------------------------------------------------------------- */
+//
+// Memory budget of the formatted CSV records held at once by all the worker threads ('--memory-budget <MB>').
+// A record is reserved before its attributes are formatted, and released once written: a thread waits while the
+// other threads hold too much, unless it would wait for nothing (a record larger than the whole budget still goes
+// through alone). Records smaller than DIR_CRAWLER_BUDGET_MIN_BYTES are neither counted nor delayed.
+//
+#define DIR_CRAWLER_BUDGET_MIN_BYTES        (64 * 1024)
+#define DIR_CRAWLER_BUDGET_UNLIMITED        0
+#define DIR_CRAWLER_BUDGET_MB               (1024 * 1024)
+
+/* --- TYPES ---------------------------------------------------------------- */
+typedef struct _DIR_CRAWLER_BUDGET_STATS {
+    ULONGLONG ullBudget;            // DIR_CRAWLER_BUDGET_UNLIMITED when only tracked
+    ULONGLONG ullPeakReserved;      // high-water mark of the reserved bytes
+    ULONGLONG ullLargestRecord;
+    LONGLONG llReservations;
+    LONGLONG llWaits;               // reservations delayed by the budget
+} DIR_CRAWLER_BUDGET_STATS, *PDIR_CRAWLER_BUDGET_STATS;
+
+/* --- VARIABLES ------------------------------------------------------------ */
+/* --- PROTOTYPES ----------------------------------------------------------- */
+void DirCrawlerBudgetInit(
+    _In_ const ULONGLONG ullBudget
+    );
+
+BOOL DirCrawlerBudgetReserve(   // FALSE if the record is too small to be counted, nothing to release then
+    _In_ const PDIR_CRAWLER_REQ_DESCR pReqDescr,
+    _In_ const ULONGLONG ullBytes
+    );
+
+void DirCrawlerBudgetRelease(
+    _In_ const ULONGLONG ullBytes
+    );
+
+void DirCrawlerBudgetGetStats(
+    _Out_ PDIR_CRAWLER_BUDGET_STATS pStats
+    );
+
+#endif // __DIR_CRAWLER_BUDGET_H__
@@ -0,0 +1,446 @@
+/* --- INCLUDES ------------------------------------------------------------- */
+#include "DirCrawlerCapture.h"
+
+/* --- PRIVATE VARIABLES ---------------------------------------------------- */
+static HANDLE gs_hCaptureFile = INVALID_HANDLE_VALUE;
+static CRITICAL_SECTION gs_sCaptureLock = { 0 };
+
+static HANDLE gs_hReplayFile = INVALID_HANDLE_VALUE;
+static HANDLE gs_hReplayMapping = NULL;
+static PBYTE gs_pbReplayView = NULL;
+static ULONGLONG gs_ullReplayViewSize = 0;
+
+/* --- PUBLIC VARIABLES ----------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS ---------------------------------------------------- */
+static DWORD DirCrawlerCaptureBlobSize(
+    _In_ const DWORD dwDataSize
+    ) {
+    return sizeof(DWORD) + DIR_CRAWLER_CAPTURE_ALIGN(dwDataSize + 1); // +1: there is always at least one NULL byte after the data
+}
+
+static PBYTE DirCrawlerCapturePutDword(
+    _Inout_ PBYTE pbOut,
+    _In_ const DWORD dwValue
+    ) {
+    *(UNALIGNED DWORD *)pbOut = dwValue;
+    return pbOut + sizeof(DWORD);
+}
+
+static PBYTE DirCrawlerCapturePutBlob(
+    _Inout_ PBYTE pbOut,
+    _In_reads_bytes_(dwDataSize) const PVOID pvData,
+    _In_ const DWORD dwDataSize
+    ) {
+    DWORD dwAlignedSize = DIR_CRAWLER_CAPTURE_ALIGN(dwDataSize + 1);
+
+    pbOut = DirCrawlerCapturePutDword(pbOut, dwDataSize);
+    CopyMemory(pbOut, pvData, dwDataSize);
+    ZeroMemory(pbOut + dwDataSize, dwAlignedSize - dwDataSize);
+    return pbOut + dwAlignedSize;
+}
+
+static void DirCrawlerCaptureFlush(
+    _In_ const PDIR_CRAWLER_CAPTURE_STREAM pStream
+    ) {
+    BOOL bResult = FALSE;
+    DWORD dwWritten = 0;
+    PDIR_CRAWLER_CAPTURE_CHUNK_HEADER pChunkHeader = (PDIR_CRAWLER_CAPTURE_CHUNK_HEADER)pStream->pbBuffer;
+
+    if (pStream->dwUsed == pStream->dwHeaderSize) {
+        return;
+    }
+
+    pChunkHeader->dwPayloadSize = pStream->dwUsed - pStream->dwHeaderSize;
+
+    // Chunks are written in one call so that they are never interleaved between worker threads
+    EnterCriticalSection(&gs_sCaptureLock);
+    bResult = WriteFile(gs_hCaptureFile, pStream->pbBuffer, pStream->dwUsed, &dwWritten, NULL);
+    LeaveCriticalSection(&gs_sCaptureLock);
+    if (bResult == FALSE || dwWritten != pStream->dwUsed) {
+        REQ_FATAL(pStream->pReqDescr, _T("Failed to write capture chunk <size:%u>: <gle:%#08x>"), pStream->dwUsed, GLE());
+    }
+
+    pStream->dwUsed = pStream->dwHeaderSize;
+}
+
+static PBYTE DirCrawlerCaptureReserve(
+    _In_ const PDIR_CRAWLER_CAPTURE_STREAM pStream,
+    _In_ const DWORD dwRecordSize
+    ) {
+    PBYTE pbRecord = NULL;
+
+    if (pStream->dwUsed + dwRecordSize > pStream->dwSize) {
+        DirCrawlerCaptureFlush(pStream);
+        if (pStream->dwHeaderSize + dwRecordSize > pStream->dwSize) {
+            // Records never span two chunks: huge entries get a chunk of their own
+            pStream->dwSize = pStream->dwHeaderSize + dwRecordSize;
+            pStream->pbBuffer = UtilsHeapAllocOrReallocHelper(g_pDirCrawlerHeap, pStream->pbBuffer, pStream->dwSize);
+        }
+    }
+
+    pbRecord = pStream->pbBuffer + pStream->dwUsed;
+    pStream->dwUsed += dwRecordSize;
+    return pbRecord;
+}
+
+static BOOL DirCrawlerReplayNextChunk(
+    _In_ const PDIR_CRAWLER_REPLAY_CURSOR pCursor
+    ) {
+    PDIR_CRAWLER_CAPTURE_CHUNK_HEADER pChunkHeader = NULL;
+    ULONGLONG ullOffset = pCursor->ullNextChunkOffset;
+    ULONGLONG ullChunkEnd = 0;
+    PTCHAR ptChunkName = NULL;
+
+    while (ullOffset + sizeof(DIR_CRAWLER_CAPTURE_CHUNK_HEADER) <= gs_ullReplayViewSize) {
+        pChunkHeader = (PDIR_CRAWLER_CAPTURE_CHUNK_HEADER)(gs_pbReplayView + ullOffset);
+        ullChunkEnd = ullOffset + sizeof(DIR_CRAWLER_CAPTURE_CHUNK_HEADER) + pChunkHeader->dwNameSize + pChunkHeader->dwPayloadSize;
+        if (pChunkHeader->dwMagic != DIR_CRAWLER_CAPTURE_CHUNK_MAGIC || ullChunkEnd > gs_ullReplayViewSize) {
+            REQ_FATAL(pCursor->pReqDescr, _T("Corrupted capture file: invalid chunk at <offset:%#llx>"), ullOffset);
+        }
+
+        // The request name must be terminated within its own field
+        ptChunkName = (PTCHAR)(pChunkHeader + 1);
+        if (pChunkHeader->dwNameSize < sizeof(TCHAR) || _tcsnlen(ptChunkName, pChunkHeader->dwNameSize / sizeof(TCHAR)) == pChunkHeader->dwNameSize / sizeof(TCHAR)) {
+            REQ_FATAL(pCursor->pReqDescr, _T("Corrupted capture file: invalid chunk name at <offset:%#llx>"), ullOffset);
+        }
+        ullOffset = ullChunkEnd;
+        if (_tcscmp(ptChunkName, pCursor->pReqDescr->infos.ptName) == 0) {
+            pCursor->pbCurrent = (PBYTE)ptChunkName + pChunkHeader->dwNameSize;
+            pCursor->pbEnd = pCursor->pbCurrent + pChunkHeader->dwPayloadSize;
+            pCursor->ullNextChunkOffset = ullOffset;
+            return TRUE;
+        }
+    }
+
+    pCursor->ullNextChunkOffset = ullOffset;
+    return FALSE;
+}
+
+static DWORD DirCrawlerReplayGetDword(
+    _In_ const PDIR_CRAWLER_REPLAY_CURSOR pCursor,
+    _Inout_ PBYTE *ppbIn,
+    _In_ const PBYTE pbRecordEnd
+    ) {
+    DWORD dwValue = 0;
+
+    if ((*ppbIn) + sizeof(DWORD) > pbRecordEnd) {
+        REQ_FATAL(pCursor->pReqDescr, _T("Corrupted capture file: truncated record"));
+    }
+    dwValue = *(UNALIGNED DWORD *)(*ppbIn);
+    (*ppbIn) += sizeof(DWORD);
+    return dwValue;
+}
+
+static PBYTE DirCrawlerReplayGetBlob(
+    _In_ const PDIR_CRAWLER_REPLAY_CURSOR pCursor,
+    _Inout_ PBYTE *ppbIn,
+    _In_ const PBYTE pbRecordEnd,
+    _Out_ PDWORD pdwDataSize
+    ) {
+    PBYTE pbData = NULL;
+    ULONGLONG ullAlignedSize = 0;
+
+    (*pdwDataSize) = DirCrawlerReplayGetDword(pCursor, ppbIn, pbRecordEnd);
+    pbData = (*ppbIn);
+    // Sizes come from the file: checked before the terminator and padding are added, which could wrap a DWORD
+    if ((*pdwDataSize) >= (DWORD)(pbRecordEnd - pbData)) {
+        REQ_FATAL(pCursor->pReqDescr, _T("Corrupted capture file: truncated value <size:%u>"), (*pdwDataSize));
+    }
+    ullAlignedSize = ((ULONGLONG)(*pdwDataSize) + 1 + 3) & ~(ULONGLONG)3;
+    if (ullAlignedSize > (ULONGLONG)(pbRecordEnd - pbData)) {
+        REQ_FATAL(pCursor->pReqDescr, _T("Corrupted capture file: truncated value <size:%u>"), (*pdwDataSize));
+    }
+    (*ppbIn) += ullAlignedSize;
+    return pbData;
+}
+
+static void DirCrawlerReplayParseEntry(
+    _In_ const PDIR_CRAWLER_REPLAY_CURSOR pCursor,
+    _In_ PBYTE pbIn,
+    _In_ const PBYTE pbRecordEnd
+    ) {
+    PBYTE pbAttributes = NULL;
+    DWORD dwDataSize = 0;
+    DWORD dwValuesCount = 0;
+    DWORD dwTotalValuesCount = 0;
+    DWORD dwCurrentValue = 0;
+    DWORD i = 0, j = 0;
+
+    pCursor->sRecord.ptDn = (PTCHAR)DirCrawlerReplayGetBlob(pCursor, &pbIn, pbRecordEnd, &dwDataSize);
+    pCursor->sRecord.dwAttributesCount = DirCrawlerReplayGetDword(pCursor, &pbIn, pbRecordEnd);
+    pbAttributes = pbIn;
+
+    // First pass: count values so that the reused storage is grown once, before pointers are taken into it
+    for (i = 0; i < pCursor->sRecord.dwAttributesCount; i++) {
+        dwValuesCount = DirCrawlerReplayGetDword(pCursor, &pbIn, pbRecordEnd);
+        for (j = 0; j < dwValuesCount; j++) {
+            DirCrawlerReplayGetBlob(pCursor, &pbIn, pbRecordEnd, &dwDataSize);
+        }
+        dwTotalValuesCount += dwValuesCount;
+    }
+
+    if (pCursor->sRecord.dwAttributesCount > pCursor->storage.dwAttrCapacity) {
+        pCursor->storage.dwAttrCapacity = pCursor->sRecord.dwAttributesCount;
+        pCursor->storage.pAttrArray = UtilsHeapAllocOrReallocHelper(g_pDirCrawlerHeap, pCursor->storage.pAttrArray, SIZEOF_ARRAY(LDAP_ATTRIBUTE, pCursor->storage.dwAttrCapacity));
+        pCursor->storage.ppAttrArray = UtilsHeapAllocOrReallocHelper(g_pDirCrawlerHeap, pCursor->storage.ppAttrArray, SIZEOF_ARRAY(PLDAP_ATTRIBUTE, pCursor->storage.dwAttrCapacity));
+    }
+    if (dwTotalValuesCount > pCursor->storage.dwValCapacity) {
+        pCursor->storage.dwValCapacity = dwTotalValuesCount;
+        pCursor->storage.pValArray = UtilsHeapAllocOrReallocHelper(g_pDirCrawlerHeap, pCursor->storage.pValArray, SIZEOF_ARRAY(LDAP_VALUE, pCursor->storage.dwValCapacity));
+        pCursor->storage.ppValArray = UtilsHeapAllocOrReallocHelper(g_pDirCrawlerHeap, pCursor->storage.ppValArray, SIZEOF_ARRAY(PLDAP_VALUE, pCursor->storage.dwValCapacity));
+    }
+
+    // Second pass: values point directly into the mapped view, nothing is copied
+    pbIn = pbAttributes;
+    for (i = 0; i < pCursor->sRecord.dwAttributesCount; i++) {
+        dwValuesCount = DirCrawlerReplayGetDword(pCursor, &pbIn, pbRecordEnd);
+        ZeroMemory(&pCursor->storage.pAttrArray[i], sizeof(LDAP_ATTRIBUTE));
+        pCursor->storage.pAttrArray[i].dwValuesCount = dwValuesCount;
+        pCursor->storage.pAttrArray[i].ppValues = &pCursor->storage.ppValArray[dwCurrentValue];
+        pCursor->storage.ppAttrArray[i] = &pCursor->storage.pAttrArray[i];
+
+        for (j = 0; j < dwValuesCount; j++, dwCurrentValue++) {
+            pCursor->storage.pValArray[dwCurrentValue].pbData = DirCrawlerReplayGetBlob(pCursor, &pbIn, pbRecordEnd, &pCursor->storage.pValArray[dwCurrentValue].dwSize);
+            pCursor->storage.ppValArray[dwCurrentValue] = &pCursor->storage.pValArray[dwCurrentValue];
+        }
+    }
+
+    pCursor->sRecord.ppAttributes = pCursor->storage.ppAttrArray;
+}
+
+/* --- PUBLIC FUNCTIONS ----------------------------------------------------- */
+void DirCrawlerCaptureInit(
+    _In_ const PTCHAR ptCaptureFile
+    ) {
+    BOOL bResult = FALSE;
+    DWORD dwWritten = 0;
+    DIR_CRAWLER_CAPTURE_FILE_HEADER sFileHeader = { .dwMagic = DIR_CRAWLER_CAPTURE_FILE_MAGIC, .dwVersion = DIR_CRAWLER_CAPTURE_VERSION };
+
+    static_assert(sizeof(TCHAR) == sizeof(WCHAR), "Capture files store WCHAR strings");
+
+    gs_hCaptureFile = CreateFile(ptCaptureFile, GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (gs_hCaptureFile == INVALID_HANDLE_VALUE) {
+        FATAL(_T("Failed to create capture file <%s>: <gle:%#08x>"), ptCaptureFile, GLE());
+    }
+
+    bResult = WriteFile(gs_hCaptureFile, &sFileHeader, sizeof(sFileHeader), &dwWritten, NULL);
+    if (bResult == FALSE || dwWritten != sizeof(sFileHeader)) {
+        FATAL(_T("Failed to write capture file header <%s>: <gle:%#08x>"), ptCaptureFile, GLE());
+    }
+
+    InitializeCriticalSection(&gs_sCaptureLock);
+    LOG(Info, SUB_LOG(_T("Capturing LDAP results to <%s>")), ptCaptureFile);
+}
+
+void DirCrawlerCaptureCleanup(
+    ) {
+    if (gs_hCaptureFile != INVALID_HANDLE_VALUE) {
+        DeleteCriticalSection(&gs_sCaptureLock);
+        CloseHandle(gs_hCaptureFile);
+        gs_hCaptureFile = INVALID_HANDLE_VALUE;
+    }
+}
+
+PDIR_CRAWLER_CAPTURE_STREAM DirCrawlerCaptureStartRequest(
+    _In_ const PDIR_CRAWLER_REQ_DESCR pReqDescr
+    ) {
+    PDIR_CRAWLER_CAPTURE_STREAM pStream = NULL;
+    PDIR_CRAWLER_CAPTURE_CHUNK_HEADER pChunkHeader = NULL;
+    DWORD dwNameLen = (DWORD)((_tcslen(pReqDescr->infos.ptName) + 1) * sizeof(TCHAR));
+
+    pStream = UtilsHeapAllocStructHelper(g_pDirCrawlerHeap, DIR_CRAWLER_CAPTURE_STREAM);
+    pStream->pReqDescr = pReqDescr;
+    pStream->dwHeaderSize = sizeof(DIR_CRAWLER_CAPTURE_CHUNK_HEADER) + DIR_CRAWLER_CAPTURE_ALIGN(dwNameLen);
+    pStream->dwSize = DIR_CRAWLER_CAPTURE_CHUNK_SIZE;
+    pStream->dwUsed = pStream->dwHeaderSize;
+    pStream->pbBuffer = UtilsHeapAllocHelper(g_pDirCrawlerHeap, pStream->dwSize);
+
+    // The chunk header and the request name are built once and reused for every chunk of this request
+    pChunkHeader = (PDIR_CRAWLER_CAPTURE_CHUNK_HEADER)pStream->pbBuffer;
+    pChunkHeader->dwMagic = DIR_CRAWLER_CAPTURE_CHUNK_MAGIC;
+    pChunkHeader->dwNameSize = DIR_CRAWLER_CAPTURE_ALIGN(dwNameLen);
+    ZeroMemory(pChunkHeader + 1, pChunkHeader->dwNameSize);
+    CopyMemory(pChunkHeader + 1, pReqDescr->infos.ptName, dwNameLen);
+
+    return pStream;
+}
+
+void DirCrawlerCaptureSearch(
+    _In_ const PDIR_CRAWLER_CAPTURE_STREAM pStream,
+    _In_ const PTCHAR ptNc
+    ) {
+    PBYTE pbOut = NULL;
+    DWORD dwNcSize = (DWORD)((_tcslen(ptNc) + 1) * sizeof(TCHAR));
+    DWORD dwRecordSize = sizeof(DIR_CRAWLER_CAPTURE_RECORD_HEADER) + DirCrawlerCaptureBlobSize(dwNcSize);
+
+    pbOut = DirCrawlerCaptureReserve(pStream, dwRecordSize);
+    pbOut = DirCrawlerCapturePutDword(pbOut, DirCrawlerCaptureRecordSearch);
+    pbOut = DirCrawlerCapturePutDword(pbOut, dwRecordSize);
+    DirCrawlerCapturePutBlob(pbOut, ptNc, dwNcSize);
+}
+
+void DirCrawlerCaptureEntry(
+    _In_ const PDIR_CRAWLER_CAPTURE_STREAM pStream,
+    _In_ const PTCHAR ptDn,
+    _In_ const PLDAP_ATTRIBUTE ppAttributes[],
+    _In_ const DWORD dwAttributesCount
+    ) {
+    PBYTE pbOut = NULL;
+    DWORD dwDnSize = (DWORD)((_tcslen(ptDn) + 1) * sizeof(TCHAR));
+    DWORD dwRecordSize = sizeof(DIR_CRAWLER_CAPTURE_RECORD_HEADER) + DirCrawlerCaptureBlobSize(dwDnSize) + sizeof(DWORD);
+    DWORD i = 0, j = 0;
+
+    for (i = 0; i < dwAttributesCount; i++) {
+        dwRecordSize += sizeof(DWORD);
+        if (ppAttributes[i] != NULL) {
+            for (j = 0; j < ppAttributes[i]->dwValuesCount; j++) {
+                dwRecordSize += DirCrawlerCaptureBlobSize(ppAttributes[i]->ppValues[j]->dwSize);
+            }
+        }
+    }
+
+    pbOut = DirCrawlerCaptureReserve(pStream, dwRecordSize);
+    pbOut = DirCrawlerCapturePutDword(pbOut, DirCrawlerCaptureRecordEntry);
+    pbOut = DirCrawlerCapturePutDword(pbOut, dwRecordSize);
+    pbOut = DirCrawlerCapturePutBlob(pbOut, ptDn, dwDnSize);
+    pbOut = DirCrawlerCapturePutDword(pbOut, dwAttributesCount);
+
+    for (i = 0; i < dwAttributesCount; i++) {
+        // Missing attributes are recorded as attributes without values
+        if (ppAttributes[i] == NULL) {
+            pbOut = DirCrawlerCapturePutDword(pbOut, 0);
+            continue;
+        }
+        pbOut = DirCrawlerCapturePutDword(pbOut, ppAttributes[i]->dwValuesCount);
+        for (j = 0; j < ppAttributes[i]->dwValuesCount; j++) {
+            pbOut = DirCrawlerCapturePutBlob(pbOut, ppAttributes[i]->ppValues[j]->pbData, ppAttributes[i]->ppValues[j]->dwSize);
+        }
+    }
+}
+
+void DirCrawlerCaptureEndRequest(
+    _Inout_ PDIR_CRAWLER_CAPTURE_STREAM *ppStream
+    ) {
+    if ((*ppStream) != NULL) {
+        DirCrawlerCaptureFlush(*ppStream);
+        UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, (*ppStream)->pbBuffer);
+        UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, (*ppStream));
+    }
+}
+
+void DirCrawlerReplayInit(
+    _In_ const PTCHAR ptReplayFile
+    ) {
+    BOOL bResult = FALSE;
+    LARGE_INTEGER liFileSize = { 0 };
+    PDIR_CRAWLER_CAPTURE_FILE_HEADER pFileHeader = NULL;
+
+    gs_hReplayFile = CreateFile(ptReplayFile, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (gs_hReplayFile == INVALID_HANDLE_VALUE) {
+        FATAL(_T("Failed to open capture file <%s>: <gle:%#08x>"), ptReplayFile, GLE());
+    }
+
+    bResult = GetFileSizeEx(gs_hReplayFile, &liFileSize);
+    if (bResult == FALSE || (ULONGLONG)liFileSize.QuadPart < sizeof(DIR_CRAWLER_CAPTURE_FILE_HEADER) || (ULONGLONG)liFileSize.QuadPart > (SIZE_T)-1) {
+        FATAL(_T("Invalid capture file size <%s>: <size:%lld> <gle:%#08x>"), ptReplayFile, liFileSize.QuadPart, GLE());
+    }
+    gs_ullReplayViewSize = (ULONGLONG)liFileSize.QuadPart;
+
+    gs_hReplayMapping = CreateFileMapping(gs_hReplayFile, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (gs_hReplayMapping == NULL) {
+        FATAL(_T("Failed to create mapping of capture file <%s>: <gle:%#08x>"), ptReplayFile, GLE());
+    }
+
+    gs_pbReplayView = MapViewOfFile(gs_hReplayMapping, FILE_MAP_READ, 0, 0, 0);
+    if (gs_pbReplayView == NULL) {
+        FATAL(_T("Failed to map capture file <%s>: <gle:%#08x>"), ptReplayFile, GLE());
+    }
+
+    pFileHeader = (PDIR_CRAWLER_CAPTURE_FILE_HEADER)gs_pbReplayView;
+    if (pFileHeader->dwMagic != DIR_CRAWLER_CAPTURE_FILE_MAGIC || pFileHeader->dwVersion != DIR_CRAWLER_CAPTURE_VERSION) {
+        FATAL(_T("Invalid capture file <%s>: <magic:%#08x> <version:%u>"), ptReplayFile, pFileHeader->dwMagic, pFileHeader->dwVersion);
+    }
+
+    LOG(Info, SUB_LOG(_T("Replaying LDAP results from <%s> <size:%llu>")), ptReplayFile, gs_ullReplayViewSize);
+}
+
+void DirCrawlerReplayCleanup(
+    ) {
+    if (gs_pbReplayView != NULL) {
+        UnmapViewOfFile(gs_pbReplayView);
+        gs_pbReplayView = NULL;
+    }
+    if (gs_hReplayMapping != NULL) {
+        CloseHandle(gs_hReplayMapping);
+        gs_hReplayMapping = NULL;
+    }
+    if (gs_hReplayFile != INVALID_HANDLE_VALUE) {
+        CloseHandle(gs_hReplayFile);
+        gs_hReplayFile = INVALID_HANDLE_VALUE;
+    }
+}
+
+PDIR_CRAWLER_REPLAY_CURSOR DirCrawlerReplayStartRequest(
+    _In_ const PDIR_CRAWLER_REQ_DESCR pReqDescr
+    ) {
+    PDIR_CRAWLER_REPLAY_CURSOR pCursor = NULL;
+
+    pCursor = UtilsHeapAllocStructHelper(g_pDirCrawlerHeap, DIR_CRAWLER_REPLAY_CURSOR);
+    pCursor->pReqDescr = pReqDescr;
+    pCursor->ullNextChunkOffset = sizeof(DIR_CRAWLER_CAPTURE_FILE_HEADER);
+    pCursor->pbCurrent = NULL;
+    pCursor->pbEnd = NULL;
+
+    return pCursor;
+}
+
+PDIR_CRAWLER_REPLAY_RECORD DirCrawlerReplayNextRecord(
+    _In_ const PDIR_CRAWLER_REPLAY_CURSOR pCursor
+    ) {
+    PDIR_CRAWLER_CAPTURE_RECORD_HEADER pRecordHeader = NULL;
+    PBYTE pbRecordEnd = NULL;
+    PBYTE pbIn = NULL;
+    DWORD dwDataSize = 0;
+
+    while (pCursor->pbCurrent >= pCursor->pbEnd) {
+        if (DirCrawlerReplayNextChunk(pCursor) == FALSE) {
+            return NULL;
+        }
+    }
+
+    pRecordHeader = (PDIR_CRAWLER_CAPTURE_RECORD_HEADER)pCursor->pbCurrent;
+    pbRecordEnd = pCursor->pbCurrent + pRecordHeader->dwRecordSize;
+    if (pRecordHeader->dwRecordSize < sizeof(DIR_CRAWLER_CAPTURE_RECORD_HEADER) || pbRecordEnd > pCursor->pbEnd) {
+        REQ_FATAL(pCursor->pReqDescr, _T("Corrupted capture file: invalid record size <%u>"), pRecordHeader->dwRecordSize);
+    }
+    pbIn = (PBYTE)(pRecordHeader + 1);
+    pCursor->pbCurrent = pbRecordEnd;
+
+    ZeroMemory(&pCursor->sRecord, sizeof(DIR_CRAWLER_REPLAY_RECORD));
+    pCursor->sRecord.eType = pRecordHeader->dwType;
+
+    switch (pCursor->sRecord.eType) {
+    case DirCrawlerCaptureRecordSearch:
+        pCursor->sRecord.ptNc = (PTCHAR)DirCrawlerReplayGetBlob(pCursor, &pbIn, pbRecordEnd, &dwDataSize);
+        break;
+    case DirCrawlerCaptureRecordEntry:
+        DirCrawlerReplayParseEntry(pCursor, pbIn, pbRecordEnd);
+        break;
+    default:
+        REQ_FATAL(pCursor->pReqDescr, _T("Corrupted capture file: invalid record type <%u>"), pRecordHeader->dwType);
+    }
+
+    return &pCursor->sRecord;
+}
+
+void DirCrawlerReplayEndRequest(
+    _Inout_ PDIR_CRAWLER_REPLAY_CURSOR *ppCursor
+    ) {
+    if ((*ppCursor) != NULL) {
+        UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, (*ppCursor)->storage.pAttrArray);
+        UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, (*ppCursor)->storage.ppAttrArray);
+        UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, (*ppCursor)->storage.pValArray);
+        UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, (*ppCursor)->storage.ppValArray);
+        UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, (*ppCursor));
+    }
+}
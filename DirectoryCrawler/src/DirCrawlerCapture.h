@@ -0,0 +1,132 @@
+#ifndef __DIR_CRAWLER_CAPTURE_H__
+#define __DIR_CRAWLER_CAPTURE_H__
+
+/* --- INCLUDES ------------------------------------------------------------- */
+#include "DirectoryCrawler.h"
+
+/* --- DEFINES -------------------------------------------------------------- */
+//
+// Capture file layout (all integers are little-endian DWORDs, all blocks are 4-bytes aligned):
+//  - file header  : magic, version
+//  - N chunks     : chunk header (magic, name size, payload size), request name (WCHAR, NULL terminated), payload
+//  - chunk payload: sequence of records (search or entry), a record never spans two chunks
+// Chunks of a given request appear in the file in the order they were produced by the crawler.
+//
+#define DIR_CRAWLER_CAPTURE_FILE_MAGIC      0x50414344  // 'DCAP'
+#define DIR_CRAWLER_CAPTURE_CHUNK_MAGIC     0x4B4E4843  // 'CHNK'
+#define DIR_CRAWLER_CAPTURE_VERSION         1
+#define DIR_CRAWLER_CAPTURE_CHUNK_SIZE      (1024 * 1024)
+#define DIR_CRAWLER_CAPTURE_ALIGN(x)        (((x) + 3) & ~((DWORD)3))
+
+/* --- TYPES ---------------------------------------------------------------- */
+typedef enum _DIR_CRAWLER_CAPTURE_RECORD_TYPE {
+    DirCrawlerCaptureRecordSearch = 1,
+    DirCrawlerCaptureRecordEntry = 2,
+} DIR_CRAWLER_CAPTURE_RECORD_TYPE;
+
+typedef struct _DIR_CRAWLER_CAPTURE_FILE_HEADER {
+    DWORD dwMagic;
+    DWORD dwVersion;
+} DIR_CRAWLER_CAPTURE_FILE_HEADER, *PDIR_CRAWLER_CAPTURE_FILE_HEADER;
+
+typedef struct _DIR_CRAWLER_CAPTURE_CHUNK_HEADER {
+    DWORD dwMagic;
+    DWORD dwNameSize;       // in bytes, aligned, includes the NULL terminator
+    DWORD dwPayloadSize;    // in bytes
+} DIR_CRAWLER_CAPTURE_CHUNK_HEADER, *PDIR_CRAWLER_CAPTURE_CHUNK_HEADER;
+
+typedef struct _DIR_CRAWLER_CAPTURE_RECORD_HEADER {
+    DWORD dwType;           // DIR_CRAWLER_CAPTURE_RECORD_TYPE
+    DWORD dwRecordSize;     // in bytes, aligned, includes this header
+} DIR_CRAWLER_CAPTURE_RECORD_HEADER, *PDIR_CRAWLER_CAPTURE_RECORD_HEADER;
+
+typedef struct _DIR_CRAWLER_CAPTURE_STREAM {
+    PDIR_CRAWLER_REQ_DESCR pReqDescr;
+    PBYTE pbBuffer;         // starts with the chunk header and the request name
+    DWORD dwHeaderSize;
+    DWORD dwUsed;
+    DWORD dwSize;
+} DIR_CRAWLER_CAPTURE_STREAM, *PDIR_CRAWLER_CAPTURE_STREAM;
+
+typedef struct _DIR_CRAWLER_REPLAY_RECORD {
+    DIR_CRAWLER_CAPTURE_RECORD_TYPE eType;
+    PTCHAR ptNc;            // DirCrawlerCaptureRecordSearch only
+    PTCHAR ptDn;            // DirCrawlerCaptureRecordEntry only
+    DWORD dwAttributesCount;
+    PLDAP_ATTRIBUTE *ppAttributes;
+} DIR_CRAWLER_REPLAY_RECORD, *PDIR_CRAWLER_REPLAY_RECORD;
+
+typedef struct _DIR_CRAWLER_REPLAY_CURSOR {
+    PDIR_CRAWLER_REQ_DESCR pReqDescr;
+    ULONGLONG ullNextChunkOffset;
+    PBYTE pbCurrent;
+    PBYTE pbEnd;
+
+    // Storage reused from one entry to another, values point directly into the mapped capture file
+    struct {
+        DWORD dwAttrCapacity;
+        LDAP_ATTRIBUTE *pAttrArray;
+        PLDAP_ATTRIBUTE *ppAttrArray;
+        DWORD dwValCapacity;
+        LDAP_VALUE *pValArray;
+        PLDAP_VALUE *ppValArray;
+    } storage;
+
+    DIR_CRAWLER_REPLAY_RECORD sRecord;
+} DIR_CRAWLER_REPLAY_CURSOR, *PDIR_CRAWLER_REPLAY_CURSOR;
+
+/* --- VARIABLES ------------------------------------------------------------ */
+/* --- PROTOTYPES ----------------------------------------------------------- */
+//
+// Capture
+//
+void DirCrawlerCaptureInit(
+    _In_ const PTCHAR ptCaptureFile
+    );
+
+void DirCrawlerCaptureCleanup(
+    );
+
+PDIR_CRAWLER_CAPTURE_STREAM DirCrawlerCaptureStartRequest(
+    _In_ const PDIR_CRAWLER_REQ_DESCR pReqDescr
+    );
+
+void DirCrawlerCaptureSearch(
+    _In_ const PDIR_CRAWLER_CAPTURE_STREAM pStream,
+    _In_ const PTCHAR ptNc
+    );
+
+void DirCrawlerCaptureEntry(
+    _In_ const PDIR_CRAWLER_CAPTURE_STREAM pStream,
+    _In_ const PTCHAR ptDn,
+    _In_ const PLDAP_ATTRIBUTE ppAttributes[],
+    _In_ const DWORD dwAttributesCount
+    );
+
+void DirCrawlerCaptureEndRequest(
+    _Inout_ PDIR_CRAWLER_CAPTURE_STREAM *ppStream
+    );
+
+//
+// Replay
+//
+void DirCrawlerReplayInit(
+    _In_ const PTCHAR ptReplayFile
+    );
+
+void DirCrawlerReplayCleanup(
+    );
+
+PDIR_CRAWLER_REPLAY_CURSOR DirCrawlerReplayStartRequest(
+    _In_ const PDIR_CRAWLER_REQ_DESCR pReqDescr
+    );
+
+PDIR_CRAWLER_REPLAY_RECORD DirCrawlerReplayNextRecord(
+    _In_ const PDIR_CRAWLER_REPLAY_CURSOR pCursor
+    );
+
+void DirCrawlerReplayEndRequest(
+    _Inout_ PDIR_CRAWLER_REPLAY_CURSOR *ppCursor
+    );
+
+#endif // __DIR_CRAWLER_CAPTURE_H__
@@ -0,0 +1,571 @@
+/* --- INCLUDES ------------------------------------------------------------- */
+#include <WinSock2.h>   // before the Windows headers pulled by DirectoryCrawler.h
+#include <WS2tcpip.h>
+#include "DirCrawlerCluster.h"
+#include "DirCrawlerStats.h"
+
+/* --- PRIVATE VARIABLES ---------------------------------------------------- */
+typedef struct _DIR_CRAWLER_CLUSTER_LINK {
+    SOCKET hSocket;
+    PTCHAR ptPeer;              // coordinator side: address of the worker, until its hello
+} DIR_CRAWLER_CLUSTER_LINK;
+
+static BOOL gs_bClusterInit = FALSE;
+static CRITICAL_SECTION gs_sClusterLock = { 0 };
+
+// Coordinator state
+static SOCKET gs_hListenSocket = INVALID_SOCKET;
+static PSLIST_HEADER gs_pClusterListHead = NULL;
+static PDIR_CRAWLER_REQ_DESCR_ARRAY gs_pClusterRequests = NULL;
+static PDIR_CRAWLER_TARGET gs_pClusterTargets = NULL;
+static DWORD gs_dwClusterTargetCount = 0;
+static ULONGLONG gs_ullClusterRunHash = 0;
+static LONG gs_lRemainingItems = 0;
+static LONG gs_lSucceededItems = 0;
+static HANDLE gs_hAllItemsDone = NULL;
+static HANDLE *gs_phLinkThreads = NULL;     // protected by the cluster lock
+static DWORD gs_dwLinkThreadCount = 0;
+static PTCHAR *gs_pptWorkers = NULL;
+static DWORD gs_dwWorkerCount = 0;
+static PDIR_CRAWLER_CLUSTER_ITEM gs_pItems = NULL;
+static DWORD gs_dwItemCount = 0;
+
+/* --- PUBLIC VARIABLES ----------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS ---------------------------------------------------- */
+static BOOL DirCrawlerClusterSend(
+    _In_ const SOCKET hSocket,
+    _In_ const PDIR_CRAWLER_CLUSTER_MSG pMsg
+    ) {
+    PCHAR pcData = (PCHAR)pMsg;
+    int iSent = 0;
+    int iTotal = 0;
+
+    pMsg->dwMagic = DIR_CRAWLER_CLUSTER_MAGIC;
+    while (iTotal < (int)sizeof(DIR_CRAWLER_CLUSTER_MSG)) {
+        iSent = send(hSocket, pcData + iTotal, (int)sizeof(DIR_CRAWLER_CLUSTER_MSG) - iTotal, 0);
+        if (iSent == SOCKET_ERROR) {
+            return FALSE;
+        }
+        iTotal += iSent;
+    }
+    return TRUE;
+}
+
+static BOOL DirCrawlerClusterRecv(
+    _In_ const SOCKET hSocket,
+    _Out_ PDIR_CRAWLER_CLUSTER_MSG pMsg
+    ) {
+    PCHAR pcData = (PCHAR)pMsg;
+    int iRecv = 0;
+    int iTotal = 0;
+
+    while (iTotal < (int)sizeof(DIR_CRAWLER_CLUSTER_MSG)) {
+        iRecv = recv(hSocket, pcData + iTotal, (int)sizeof(DIR_CRAWLER_CLUSTER_MSG) - iTotal, 0);
+        if (iRecv == SOCKET_ERROR || iRecv == 0) {
+            return FALSE;
+        }
+        iTotal += iRecv;
+    }
+    return (BOOL)(pMsg->dwMagic == DIR_CRAWLER_CLUSTER_MAGIC);
+}
+
+static ULONGLONG DirCrawlerClusterHashString(
+    _In_ const ULONGLONG ullHash,
+    _In_opt_ const PTCHAR ptValue
+    ) {
+    ULONGLONG ullResult = ullHash;
+    PBYTE pbValue = (PBYTE)ptValue;
+    size_t i = 0;
+
+    // FNV-1a, the final NULL char included to separate the strings
+    for (i = 0; ptValue != NULL && i < (_tcslen(ptValue) + 1) * sizeof(TCHAR); i++) {
+        ullResult ^= pbValue[i];
+        ullResult *= 0x100000001B3ULL;
+    }
+    return ullResult;
+}
+
+static void DirCrawlerClusterRecordItem(
+    _In_ const PDIR_CRAWLER_CLUSTER_ITEM pItem
+    ) {
+    EnterCriticalSection(&gs_sClusterLock);
+    gs_pItems = UtilsHeapAllocOrReallocHelper(g_pDirCrawlerHeap, gs_pItems, SIZEOF_ARRAY(DIR_CRAWLER_CLUSTER_ITEM, gs_dwItemCount + 1));
+    gs_pItems[gs_dwItemCount] = *pItem;
+    gs_dwItemCount += 1;
+    LeaveCriticalSection(&gs_sClusterLock);
+}
+
+static PSLIST_ENTRY DirCrawlerClusterPopItem(
+    ) {
+    PSLIST_ENTRY pListEntry = NULL;
+
+    // Items of lost workers are pushed back: wait for them until every item is done
+    while ((pListEntry = InterlockedPopEntrySList(gs_pClusterListHead)) == NULL) {
+        if (WaitForSingleObject(gs_hAllItemsDone, DIR_CRAWLER_CLUSTER_IDLE_DELAY) == WAIT_OBJECT_0) {
+            return NULL;
+        }
+    }
+    return pListEntry;
+}
+
+static DWORD WINAPI DirCrawlerClusterServeLink(
+    LPVOID lpThreadParameter
+    ) {
+    DIR_CRAWLER_CLUSTER_LINK sLink = *(PDIR_CRAWLER_CLUSTER_LINK)lpThreadParameter;
+    DIR_CRAWLER_CLUSTER_MSG sMsg = { 0 };
+    DIR_CRAWLER_CLUSTER_ITEM sItem = { 0 };
+    PSLIST_ENTRY pListEntry = NULL;
+    PDIR_CRAWLER_REQ_LIST_ENTRY pReqListEntry = NULL;
+    TCHAR atPeer[MAX_LINE] = { 0 };
+
+    UtilsHeapFreeHelper(g_pDirCrawlerHeap, lpThreadParameter);
+
+    if (DirCrawlerClusterRecv(sLink.hSocket, &sMsg) == FALSE || sMsg.dwType != DirCrawlerClusterMsgHello) {
+        LOG(Warn, SUB_LOG(_T("Ignoring connection from <%s>: not a worker")), sLink.ptPeer);
+        closesocket(sLink.hSocket);
+        UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, sLink.ptPeer);
+        return EXIT_FAILURE;
+    }
+
+    _stprintf_s(atPeer, _countof(atPeer), _T("%s/%u"), sLink.ptPeer, sMsg.dwValue);
+    UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, sLink.ptPeer);
+    EnterCriticalSection(&gs_sClusterLock);
+    gs_pptWorkers = UtilsHeapAllocOrReallocHelper(g_pDirCrawlerHeap, gs_pptWorkers, SIZEOF_ARRAY(PTCHAR, gs_dwWorkerCount + 1));
+    gs_pptWorkers[gs_dwWorkerCount] = UtilsHeapStrDupHelper(g_pDirCrawlerHeap, atPeer);
+    sItem.ptWorker = gs_pptWorkers[gs_dwWorkerCount];
+    gs_dwWorkerCount += 1;
+    LeaveCriticalSection(&gs_sClusterLock);
+
+    // Item indexes only make sense if both ends read the same requests and targets
+    if (sMsg.dwRequest != gs_pClusterRequests->dwRequestCount || sMsg.dwTarget != gs_dwClusterTargetCount || sMsg.ullValue != gs_ullClusterRunHash) {
+        LOG(Err, SUB_LOG(_T("Rejecting worker <%s>: different requests, targets or prefix <requests:%u/%u> <targets:%u/%u>")),
+            sItem.ptWorker, sMsg.dwRequest, gs_pClusterRequests->dwRequestCount, sMsg.dwTarget, gs_dwClusterTargetCount);
+        ZeroMemory(&sMsg, sizeof(sMsg));
+        sMsg.dwType = DirCrawlerClusterMsgStop;
+        sMsg.dwStatus = FALSE;
+        DirCrawlerClusterSend(sLink.hSocket, &sMsg);
+        closesocket(sLink.hSocket);
+        return EXIT_FAILURE;
+    }
+    LOG(Info, SUB_LOG(_T("Worker <%s> connected")), sItem.ptWorker);
+
+    while ((pListEntry = DirCrawlerClusterPopItem()) != NULL) {
+        pReqListEntry = CONTAINING_RECORD(pListEntry, DIR_CRAWLER_REQ_LIST_ENTRY, sListEntry);
+        sItem.dwRequest = (DWORD)(pReqListEntry->pReqDescr - gs_pClusterRequests->pRequestsDescriptions);
+        sItem.dwTarget = (DWORD)(pReqListEntry->pTarget - gs_pClusterTargets);
+
+        ZeroMemory(&sMsg, sizeof(sMsg));
+        sMsg.dwType = DirCrawlerClusterMsgWork;
+        sMsg.dwRequest = sItem.dwRequest;
+        sMsg.dwTarget = sItem.dwTarget;
+        if (DirCrawlerClusterSend(sLink.hSocket, &sMsg) == FALSE
+            || DirCrawlerClusterRecv(sLink.hSocket, &sMsg) == FALSE
+            || sMsg.dwType != DirCrawlerClusterMsgDone || sMsg.dwRequest != sItem.dwRequest || sMsg.dwTarget != sItem.dwTarget) {
+            REQ_LOG(pReqListEntry->pReqDescr, Warn, _T("Worker <%s> lost, giving the request to another worker"), sItem.ptWorker);
+            InterlockedPushEntrySList(gs_pClusterListHead, pListEntry);
+            closesocket(sLink.hSocket);
+            return EXIT_FAILURE;
+        }
+
+        sItem.bSucceeded = (BOOL)(sMsg.dwStatus != FALSE);
+        sItem.dwEntryCount = sMsg.dwValue;
+        sItem.ullTimeMs = sMsg.ullValue;
+        DirCrawlerClusterRecordItem(&sItem);
+        if (sItem.bSucceeded == TRUE) {
+            InterlockedIncrement(&gs_lSucceededItems);
+        }
+        REQ_LOG(pReqListEntry->pReqDescr, Info, _T("Done by worker <%s>: <succ:%u> <count:%u>"), sItem.ptWorker, sItem.bSucceeded, sItem.dwEntryCount);
+
+        _aligned_free(pReqListEntry);
+        if (InterlockedDecrement(&gs_lRemainingItems) == 0) {
+            SetEvent(gs_hAllItemsDone);
+        }
+    }
+
+    ZeroMemory(&sMsg, sizeof(sMsg));
+    sMsg.dwType = DirCrawlerClusterMsgStop;
+    sMsg.dwStatus = TRUE;
+    DirCrawlerClusterSend(sLink.hSocket, &sMsg);
+    closesocket(sLink.hSocket);
+    LOG(Dbg, SUB_LOG(_T("Worker <%s> done")), sItem.ptWorker);
+    return EXIT_SUCCESS;
+}
+
+static DWORD WINAPI DirCrawlerClusterAccept(
+    LPVOID lpThreadParameter
+    ) {
+    UNREFERENCED_PARAMETER(lpThreadParameter);
+
+    PDIR_CRAWLER_CLUSTER_LINK pLink = NULL;
+    SOCKADDR_STORAGE sPeerAddr = { 0 };
+    int iPeerAddrLen = 0;
+    SOCKET hSocket = INVALID_SOCKET;
+    TCHAR atPeer[MAX_LINE] = { 0 };
+    DWORD dwPeerLen = 0;
+    BOOL bKeepAlive = TRUE;
+    HANDLE hThread = NULL;
+
+    // Until the listening socket is closed by DirCrawlerClusterServe
+    for (;;) {
+        iPeerAddrLen = sizeof(sPeerAddr);
+        hSocket = accept(gs_hListenSocket, (PSOCKADDR)&sPeerAddr, &iPeerAddrLen);
+        if (hSocket == INVALID_SOCKET) {
+            break;
+        }
+        // Dead hosts are detected by keep-alives, the worker of a long request stays silent
+        setsockopt(hSocket, SOL_SOCKET, SO_KEEPALIVE, (PCHAR)&bKeepAlive, sizeof(bKeepAlive));
+
+        dwPeerLen = _countof(atPeer);
+        if (WSAAddressToString((PSOCKADDR)&sPeerAddr, iPeerAddrLen, NULL, atPeer, &dwPeerLen) != 0) {
+            _tcscpy_s(atPeer, _countof(atPeer), _T("?"));
+        }
+
+        pLink = UtilsHeapAllocStructHelper(g_pDirCrawlerHeap, DIR_CRAWLER_CLUSTER_LINK);
+        pLink->hSocket = hSocket;
+        pLink->ptPeer = UtilsHeapStrDupHelper(g_pDirCrawlerHeap, atPeer);  // freed by the link thread
+
+        EnterCriticalSection(&gs_sClusterLock);
+        hThread = CreateThread(NULL, 0, DirCrawlerClusterServeLink, pLink, 0, NULL);
+        if (hThread == NULL) {
+            LeaveCriticalSection(&gs_sClusterLock);
+            LOG(Err, SUB_LOG(_T("Failed to create thread for worker <%s>: <gle:%#08x>")), atPeer, GLE());
+            closesocket(hSocket);
+            UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, pLink->ptPeer);
+            UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, pLink);
+            continue;
+        }
+        gs_phLinkThreads = UtilsHeapAllocOrReallocHelper(g_pDirCrawlerHeap, gs_phLinkThreads, SIZEOF_ARRAY(HANDLE, gs_dwLinkThreadCount + 1));
+        gs_phLinkThreads[gs_dwLinkThreadCount] = hThread;
+        gs_dwLinkThreadCount += 1;
+        LeaveCriticalSection(&gs_sClusterLock);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+static SOCKET DirCrawlerClusterListen(
+    _In_ const PTCHAR ptPort
+    ) {
+    ADDRINFOT sHints = { 0 };
+    PADDRINFOT pAddrInfo = NULL;
+    SOCKET hSocket = INVALID_SOCKET;
+    DWORD dwV6Only = FALSE;
+    int iResult = 0;
+
+    // Dual-stack wildcard address: workers reach the coordinator over IPv4 or IPv6
+    sHints.ai_family = AF_INET6;
+    sHints.ai_socktype = SOCK_STREAM;
+    sHints.ai_protocol = IPPROTO_TCP;
+    sHints.ai_flags = AI_PASSIVE;
+    iResult = GetAddrInfo(NULL, ptPort, &sHints, &pAddrInfo);
+    if (iResult != 0) {
+        FATAL(_T("Failed to resolve coordinator port <%s>: <err:%#08x>"), ptPort, iResult);
+    }
+
+    hSocket = socket(pAddrInfo->ai_family, pAddrInfo->ai_socktype, pAddrInfo->ai_protocol);
+    if (hSocket == INVALID_SOCKET) {
+        FATAL(_T("Failed to create coordinator socket: <err:%#08x>"), WSAGetLastError());
+    }
+    setsockopt(hSocket, IPPROTO_IPV6, IPV6_V6ONLY, (PCHAR)&dwV6Only, sizeof(dwV6Only));
+
+    if (bind(hSocket, pAddrInfo->ai_addr, (int)pAddrInfo->ai_addrlen) == SOCKET_ERROR || listen(hSocket, SOMAXCONN) == SOCKET_ERROR) {
+        FATAL(_T("Failed to listen on coordinator port <%s>: <err:%#08x>"), ptPort, WSAGetLastError());
+    }
+    FreeAddrInfo(pAddrInfo);
+
+    return hSocket;
+}
+
+/* --- PUBLIC FUNCTIONS ----------------------------------------------------- */
+void DirCrawlerClusterInit(
+    ) {
+    WSADATA sWsaData = { 0 };
+    int iResult = 0;
+
+    iResult = WSAStartup(MAKEWORD(2, 2), &sWsaData);
+    if (iResult != 0) {
+        FATAL(_T("Failed to initialize Winsock: <err:%#08x>"), iResult);
+    }
+    InitializeCriticalSection(&gs_sClusterLock);
+    gs_bClusterInit = TRUE;
+}
+
+void DirCrawlerClusterCleanup(
+    ) {
+    DWORD i = 0;
+
+    if (gs_bClusterInit == FALSE) {
+        return;
+    }
+
+    if (gs_pptWorkers != NULL) {
+        UtilsHeapFreeAndNullArrayHelper(g_pDirCrawlerHeap, gs_pptWorkers, gs_dwWorkerCount, i);
+    }
+    if (gs_pItems != NULL) {
+        UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, gs_pItems);
+    }
+    if (gs_hAllItemsDone != NULL) {
+        CloseHandle(gs_hAllItemsDone);
+        gs_hAllItemsDone = NULL;
+    }
+    gs_dwWorkerCount = 0;
+    gs_dwItemCount = 0;
+    DeleteCriticalSection(&gs_sClusterLock);
+    WSACleanup();
+    gs_bClusterInit = FALSE;
+}
+
+ULONGLONG DirCrawlerClusterRunHash(
+    _In_ const PDIR_CRAWLER_REQ_DESCR_ARRAY pRequests,
+    _In_ const PDIR_CRAWLER_TARGET pTargets,
+    _In_ const DWORD dwTargetCount
+    ) {
+    PDIR_CRAWLER_REQ_DESCR pReqDescr = NULL;
+    ULONGLONG ullHash = 0xCBF29CE484222325ULL;
+    DWORD i = 0, j = 0;
+
+    // Only the requests and options are hashed: the root folder name holds the start date of each process
+    for (i = 0; i < pRequests->dwRequestCount; i++) {
+        pReqDescr = &pRequests->pRequestsDescriptions[i];
+        ullHash = DirCrawlerClusterHashString(ullHash, pReqDescr->infos.ptName);
+        ullHash = DirCrawlerClusterHashString(ullHash, pReqDescr->ldap.ptFilter);
+        for (j = 0; j < pReqDescr->ldap.attributes.dwAttrCount; j++) {
+            ullHash = DirCrawlerClusterHashString(ullHash, pReqDescr->ldap.attributes.pAttrArray[j].ptName);
+        }
+    }
+    for (i = 0; i < dwTargetCount; i++) {
+        ullHash = DirCrawlerClusterHashString(ullHash, pTargets[i].ldap.ptDnsName);
+        ullHash = DirCrawlerClusterHashString(ullHash, pTargets[i].ptOutfilesPrefix);
+    }
+    return ullHash;
+}
+
+DWORD DirCrawlerClusterServe(
+    _In_ const PTCHAR ptPort,
+    _In_ const PSLIST_HEADER pReqListHead,
+    _In_ const DWORD dwItemCount,
+    _In_ const PDIR_CRAWLER_REQ_DESCR_ARRAY pRequests,
+    _In_ const PDIR_CRAWLER_TARGET pTargets,
+    _In_ const DWORD dwTargetCount,
+    _In_ const ULONGLONG ullRunHash
+    ) {
+    HANDLE hAcceptThread = NULL;
+    DWORD i = 0;
+
+    gs_pClusterListHead = pReqListHead;
+    gs_pClusterRequests = pRequests;
+    gs_pClusterTargets = pTargets;
+    gs_dwClusterTargetCount = dwTargetCount;
+    gs_ullClusterRunHash = ullRunHash;
+    gs_lRemainingItems = (LONG)dwItemCount;
+    gs_lSucceededItems = 0;
+
+    gs_hAllItemsDone = CreateEvent(NULL, TRUE, (BOOL)(dwItemCount == 0), NULL);
+    if (gs_hAllItemsDone == NULL) {
+        FATAL(_T("Failed to create coordinator event: <gle:%#08x>"), GLE());
+    }
+
+    gs_hListenSocket = DirCrawlerClusterListen(ptPort);
+    hAcceptThread = CreateThread(NULL, 0, DirCrawlerClusterAccept, NULL, 0, NULL);
+    if (hAcceptThread == NULL) {
+        FATAL(_T("Failed to create coordinator thread: <gle:%#08x>"), GLE());
+    }
+    LOG(Succ, SUB_LOG(_T("Waiting for workers on port <%s>: <items:%u>")), ptPort, dwItemCount);
+
+    if (WaitForSingleObject(gs_hAllItemsDone, INFINITE) != WAIT_OBJECT_0) {
+        FATAL(_T("Failed to wait for the workers: <gle:%#08x>"), GLE());
+    }
+
+    // No more connections, then let the connected workers receive their 'stop'
+    closesocket(gs_hListenSocket);
+    gs_hListenSocket = INVALID_SOCKET;
+    WaitForSingleObject(hAcceptThread, INFINITE);
+    CloseHandle(hAcceptThread);
+    for (i = 0; i < gs_dwLinkThreadCount; i++) {
+        WaitForSingleObject(gs_phLinkThreads[i], INFINITE);
+        CloseHandle(gs_phLinkThreads[i]);
+    }
+    if (gs_phLinkThreads != NULL) {
+        UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, gs_phLinkThreads);
+    }
+    LOG(Info, SUB_LOG(_T("Items done by <%u> worker connections")), gs_dwLinkThreadCount);
+    gs_dwLinkThreadCount = 0;
+
+    return (DWORD)gs_lSucceededItems;
+}
+
+void DirCrawlerClusterWriteManifest(
+    _In_ const PTCHAR ptOutFile
+    ) {
+    FILE *pFile = NULL;
+    errno_t err = 0;
+    PDIR_CRAWLER_CLUSTER_ITEM pItem = NULL;
+    PDIR_CRAWLER_TARGET pTarget = NULL;
+    TCHAR atOutfile[MAX_PATH] = { 0 };
+    DWORD i = 0;
+
+    err = DirCrawlerStatsOpenJson(&pFile, ptOutFile);
+    if (err != 0) {
+        LOG(Err, _T("Failed to open manifest file <%s>: <errno:%#08x>"), ptOutFile, err);
+        return;
+    }
+
+    // Outfiles are relative to the output directory shared by the workers
+    _ftprintf(pFile, _T("{\n  \"items\": ["));
+    for (i = 0; i < gs_dwItemCount; i++) {
+        pItem = &gs_pItems[i];
+        pTarget = &gs_pClusterTargets[pItem->dwTarget];
+        _stprintf_s(atOutfile, _countof(atOutfile), _T("%s\\%s\\%s_%s_%s.%s"), pTarget->ptRootFolderName, DIR_CRAWLER_OUTPUT_DIR, pTarget->ptOutfilesPrefix,
+            DIR_CRAWLER_OUTFILES_KEYWORD, gs_pClusterRequests->pRequestsDescriptions[pItem->dwRequest].infos.ptName, DIR_CRAWLER_OUTFILES_EXT);
+
+        _ftprintf(pFile, _T("%s\n    {\n      \"request\": "), i == 0 ? EMPTY_STR : _T(","));
+        DirCrawlerStatsWriteJsonString(pFile, gs_pClusterRequests->pRequestsDescriptions[pItem->dwRequest].infos.ptName);
+        _ftprintf(pFile, _T(",\n      \"target\": "));
+        DirCrawlerStatsWriteJsonString(pFile, pTarget->ldap.ptDnsName != NULL ? pTarget->ldap.ptDnsName : EMPTY_STR);
+        _ftprintf(pFile, _T(",\n      \"outfile\": "));
+        DirCrawlerStatsWriteJsonString(pFile, atOutfile);
+        _ftprintf(pFile, _T(",\n      \"worker\": "));
+        DirCrawlerStatsWriteJsonString(pFile, pItem->ptWorker);
+        _ftprintf(pFile, _T(",\n      \"succeeded\": %s,\n      \"entries\": %u,\n      \"timeMs\": %llu\n    }"),
+            pItem->bSucceeded ? _T("true") : _T("false"),
+            pItem->dwEntryCount,
+            pItem->ullTimeMs);
+    }
+    _ftprintf(pFile, _T("\n  ]\n}\n"));
+
+    fclose(pFile);
+    LOG(Info, SUB_LOG(_T("Manifest written to <%s>")), ptOutFile);
+}
+
+PDIR_CRAWLER_CLUSTER_LINK DirCrawlerClusterConnect(
+    _In_ const PTCHAR ptCoordinator,
+    _In_ const DWORD dwRequestCount,
+    _In_ const DWORD dwTargetCount,
+    _In_ const ULONGLONG ullRunHash
+    ) {
+    PDIR_CRAWLER_CLUSTER_LINK pLink = NULL;
+    DIR_CRAWLER_CLUSTER_MSG sMsg = { 0 };
+    ADDRINFOT sHints = { 0 };
+    PADDRINFOT pAddrInfo = NULL;
+    PADDRINFOT pCurrent = NULL;
+    SOCKET hSocket = INVALID_SOCKET;
+    TCHAR atHost[MAX_LINE] = { 0 };
+    PTCHAR ptPort = NULL;
+    DWORD dwTry = 0;
+    int iResult = 0;
+
+    _tcscpy_s(atHost, _countof(atHost), ptCoordinator);
+    ptPort = _tcsrchr(atHost, DIR_CRAWLER_CLUSTER_PORT_SEPARATOR);
+    if (ptPort == NULL) {
+        FATAL(_T("Invalid coordinator <%s>: expecting <host>:<port>"), ptCoordinator);
+    }
+    *ptPort = NULL_CHAR;
+    ptPort += 1;
+
+    sHints.ai_family = AF_UNSPEC;
+    sHints.ai_socktype = SOCK_STREAM;
+    sHints.ai_protocol = IPPROTO_TCP;
+    iResult = GetAddrInfo(atHost, ptPort, &sHints, &pAddrInfo);
+    if (iResult != 0) {
+        FATAL(_T("Failed to resolve coordinator <%s>: <err:%#08x>"), ptCoordinator, iResult);
+    }
+
+    // The coordinator may still be reading its RootDSEs
+    for (dwTry = 0; dwTry < DIR_CRAWLER_CLUSTER_CONNECT_RETRIES && hSocket == INVALID_SOCKET; dwTry++) {
+        if (dwTry > 0) {
+            Sleep(DIR_CRAWLER_CLUSTER_RETRY_DELAY);
+        }
+        for (pCurrent = pAddrInfo; pCurrent != NULL && hSocket == INVALID_SOCKET; pCurrent = pCurrent->ai_next) {
+            hSocket = socket(pCurrent->ai_family, pCurrent->ai_socktype, pCurrent->ai_protocol);
+            if (hSocket != INVALID_SOCKET && connect(hSocket, pCurrent->ai_addr, (int)pCurrent->ai_addrlen) == SOCKET_ERROR) {
+                closesocket(hSocket);
+                hSocket = INVALID_SOCKET;
+            }
+        }
+    }
+    FreeAddrInfo(pAddrInfo);
+    if (hSocket == INVALID_SOCKET) {
+        LOG(Err, _T("Failed to connect to coordinator <%s>: <err:%#08x>"), ptCoordinator, WSAGetLastError());
+        return NULL;
+    }
+
+    sMsg.dwType = DirCrawlerClusterMsgHello;
+    sMsg.dwRequest = dwRequestCount;
+    sMsg.dwTarget = dwTargetCount;
+    sMsg.dwValue = GetCurrentProcessId();
+    sMsg.ullValue = ullRunHash;
+    if (DirCrawlerClusterSend(hSocket, &sMsg) == FALSE) {
+        LOG(Err, _T("Failed to send hello to coordinator <%s>: <err:%#08x>"), ptCoordinator, WSAGetLastError());
+        closesocket(hSocket);
+        return NULL;
+    }
+
+    pLink = UtilsHeapAllocStructHelper(g_pDirCrawlerHeap, DIR_CRAWLER_CLUSTER_LINK);
+    pLink->hSocket = hSocket;
+    pLink->ptPeer = NULL;
+    return pLink;
+}
+
+BOOL DirCrawlerClusterNextItem(
+    _In_ const PDIR_CRAWLER_CLUSTER_LINK pLink,
+    _Out_ PDWORD pdwRequest,
+    _Out_ PDWORD pdwTarget,
+    _Out_ PBOOL pbFailed
+    ) {
+    DIR_CRAWLER_CLUSTER_MSG sMsg = { 0 };
+
+    *pdwRequest = DIR_CRAWLER_CLUSTER_NONE;
+    *pdwTarget = DIR_CRAWLER_CLUSTER_NONE;
+    *pbFailed = TRUE;
+
+    if (DirCrawlerClusterRecv(pLink->hSocket, &sMsg) == FALSE) {
+        LOG(Err, _T("Connection to coordinator lost: <err:%#08x>"), WSAGetLastError());
+        return FALSE;
+    }
+    if (sMsg.dwType == DirCrawlerClusterMsgStop) {
+        if (sMsg.dwStatus == FALSE) {
+            LOG(Err, _T("Rejected by coordinator: the JSON file, targets and prefix must be the same as its own"));
+        }
+        *pbFailed = (BOOL)(sMsg.dwStatus == FALSE);
+        return FALSE;
+    }
+    if (sMsg.dwType != DirCrawlerClusterMsgWork) {
+        LOG(Err, _T("Unexpected message from coordinator <type:%u>"), sMsg.dwType);
+        return FALSE;
+    }
+
+    *pdwRequest = sMsg.dwRequest;
+    *pdwTarget = sMsg.dwTarget;
+    *pbFailed = FALSE;
+    return TRUE;
+}
+
+BOOL DirCrawlerClusterReportItem(
+    _In_ const PDIR_CRAWLER_CLUSTER_LINK pLink,
+    _In_ const DWORD dwRequest,
+    _In_ const DWORD dwTarget,
+    _In_ const BOOL bSucceeded,
+    _In_ const DWORD dwEntryCount,
+    _In_ const ULONGLONG ullTimeMs
+    ) {
+    DIR_CRAWLER_CLUSTER_MSG sMsg = { 0 };
+
+    sMsg.dwType = DirCrawlerClusterMsgDone;
+    sMsg.dwRequest = dwRequest;
+    sMsg.dwTarget = dwTarget;
+    sMsg.dwStatus = (DWORD)bSucceeded;
+    sMsg.dwValue = dwEntryCount;
+    sMsg.ullValue = ullTimeMs;
+    return DirCrawlerClusterSend(pLink->hSocket, &sMsg);
+}
+
+void DirCrawlerClusterDisconnect(
+    _Inout_ PDIR_CRAWLER_CLUSTER_LINK *ppLink
+    ) {
+    if (*ppLink == NULL) {
+        return;
+    }
+    shutdown((*ppLink)->hSocket, SD_BOTH);
+    closesocket((*ppLink)->hSocket);
+    UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, *ppLink);
+}
@@ -0,0 +1,116 @@
+#ifndef __DIR_CRAWLER_CLUSTER_H__
+#define __DIR_CRAWLER_CLUSTER_H__
+
+/* --- INCLUDES ------------------------------------------------------------- */
+#include "DirectoryCrawler.h"
+
+/* --- DEFINES -------------------------------------------------------------- */
+//
+// Crawl distributed over several processes. The coordinator ('--coordinator <port>') reads the requests and the RootDSEs
+// as usual, then hands out work items (request x target) over TCP to the worker processes ('--worker <host>:<port>'),
+// one connection per worker thread. Workers run the same command line (same JSON file, targets and prefix, checked with
+// a hash of the request names, outfiles folders and prefixes) and write their outfiles in the same output directory
+// (a share when they run on other hosts). The coordinator gives the items of a lost worker to the others, and writes
+// <prefix>_LDAP_manifest.json in the stats folder: the outfile, worker, status and entry count of every item.
+//
+#define DIR_CRAWLER_CLUSTER_MAGIC           0x4C434344  // 'DCCL'
+#define DIR_CRAWLER_CLUSTER_MANIFEST_OUTFILE _T("manifest")
+#define DIR_CRAWLER_CLUSTER_WORKER_PREFIX   _T("worker")    // worker logs and stats outfiles: <prefix>_LDAP_worker<pid>
+#define DIR_CRAWLER_CLUSTER_PORT_SEPARATOR  _T(':')
+#define DIR_CRAWLER_CLUSTER_CONNECT_RETRIES 30          // the coordinator reads the RootDSEs before listening
+#define DIR_CRAWLER_CLUSTER_RETRY_DELAY     1000        // ms
+#define DIR_CRAWLER_CLUSTER_IDLE_DELAY      500         // ms, idle workers wait for the items of lost workers
+#define DIR_CRAWLER_CLUSTER_NONE            ((DWORD)-1)
+
+/* --- TYPES ---------------------------------------------------------------- */
+typedef enum _DIR_CRAWLER_CLUSTER_MSG_TYPE {
+    DirCrawlerClusterMsgHello,      // worker -> coordinator: dwRequest/dwTarget are the counts, dwValue the pid, ullValue the run hash
+    DirCrawlerClusterMsgWork,       // coordinator -> worker: run dwRequest on dwTarget
+    DirCrawlerClusterMsgDone,       // worker -> coordinator: dwStatus, dwValue entries, ullValue milliseconds
+    DirCrawlerClusterMsgStop,       // coordinator -> worker: no more items (dwStatus FALSE if the worker was rejected)
+} DIR_CRAWLER_CLUSTER_MSG_TYPE;
+
+// Fixed-size message, both ends run the same build
+typedef struct _DIR_CRAWLER_CLUSTER_MSG {
+    DWORD dwMagic;
+    DWORD dwType;                   // DIR_CRAWLER_CLUSTER_MSG_TYPE
+    DWORD dwRequest;
+    DWORD dwTarget;
+    DWORD dwStatus;
+    DWORD dwValue;
+    ULONGLONG ullValue;
+} DIR_CRAWLER_CLUSTER_MSG, *PDIR_CRAWLER_CLUSTER_MSG;
+
+typedef struct _DIR_CRAWLER_CLUSTER_ITEM {
+    DWORD dwRequest;
+    DWORD dwTarget;
+    PTCHAR ptWorker;                // '<address>/<pid>', shared by the items of a connection
+    BOOL bSucceeded;
+    DWORD dwEntryCount;
+    ULONGLONG ullTimeMs;
+} DIR_CRAWLER_CLUSTER_ITEM, *PDIR_CRAWLER_CLUSTER_ITEM;
+
+typedef struct _DIR_CRAWLER_CLUSTER_LINK *PDIR_CRAWLER_CLUSTER_LINK;   // a worker thread connection, Winsock types stay in DirCrawlerCluster.c
+
+/* --- VARIABLES ------------------------------------------------------------ */
+/* --- PROTOTYPES ----------------------------------------------------------- */
+void DirCrawlerClusterInit(
+    );
+
+void DirCrawlerClusterCleanup(
+    );
+
+ULONGLONG DirCrawlerClusterRunHash(
+    _In_ const PDIR_CRAWLER_REQ_DESCR_ARRAY pRequests,
+    _In_ const PDIR_CRAWLER_TARGET pTargets,
+    _In_ const DWORD dwTargetCount
+    );
+
+//
+// Coordinator
+//
+DWORD DirCrawlerClusterServe(   // returns the count of succeeded items
+    _In_ const PTCHAR ptPort,
+    _In_ const PSLIST_HEADER pReqListHead,
+    _In_ const DWORD dwItemCount,
+    _In_ const PDIR_CRAWLER_REQ_DESCR_ARRAY pRequests,
+    _In_ const PDIR_CRAWLER_TARGET pTargets,
+    _In_ const DWORD dwTargetCount,
+    _In_ const ULONGLONG ullRunHash
+    );
+
+void DirCrawlerClusterWriteManifest(
+    _In_ const PTCHAR ptOutFile
+    );
+
+//
+// Worker
+//
+PDIR_CRAWLER_CLUSTER_LINK DirCrawlerClusterConnect(
+    _In_ const PTCHAR ptCoordinator,
+    _In_ const DWORD dwRequestCount,
+    _In_ const DWORD dwTargetCount,
+    _In_ const ULONGLONG ullRunHash
+    );
+
+BOOL DirCrawlerClusterNextItem(   // FALSE when there is no more item, pbFailed set if the link was lost or rejected
+    _In_ const PDIR_CRAWLER_CLUSTER_LINK pLink,
+    _Out_ PDWORD pdwRequest,
+    _Out_ PDWORD pdwTarget,
+    _Out_ PBOOL pbFailed
+    );
+
+BOOL DirCrawlerClusterReportItem(
+    _In_ const PDIR_CRAWLER_CLUSTER_LINK pLink,
+    _In_ const DWORD dwRequest,
+    _In_ const DWORD dwTarget,
+    _In_ const BOOL bSucceeded,
+    _In_ const DWORD dwEntryCount,
+    _In_ const ULONGLONG ullTimeMs
+    );
+
+void DirCrawlerClusterDisconnect(
+    _Inout_ PDIR_CRAWLER_CLUSTER_LINK *ppLink
+    );
+
+#endif // __DIR_CRAWLER_CLUSTER_H__
@@ -0,0 +1,433 @@
+/* --- INCLUDES ------------------------------------------------------------- */
+#include "DirCrawlerDiff.h"
+
+/* --- PRIVATE VARIABLES ---------------------------------------------------- */
+static const PTCHAR gsc_aptDiffOutfileHeader[] = { _T("request"), _T("change"), _T("dn"), _T("attribute"), _T("old"), _T("new") };
+static const PTCHAR gsc_aptChangeNames[] = { _T("added"), _T("removed"), _T("modified") };
+
+// GUID pass, then DN pass for the entries without objectGUID
+static const DIR_CRAWLER_SNAPSHOT_INDEX gsc_aePasses[] = { DirCrawlerSnapshotIndexGuid, DirCrawlerSnapshotIndexDn };
+
+/* --- PUBLIC VARIABLES ----------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS ---------------------------------------------------- */
+static PTCHAR DirCrawlerDiffKey(
+    _In_ const PDIR_CRAWLER_SNAPSHOT pSnapshot,
+    _In_ const DIR_CRAWLER_SNAPSHOT_INDEX eIndex,
+    _In_ const DWORD dwPosition
+    ) {
+    return DIR_CRAWLER_SNAPSHOT_STRING(pSnapshot->pbBase, pSnapshot->pEntries[pSnapshot->apdwIndex[eIndex][dwPosition]].aullKeys[eIndex]);
+}
+
+static PTCHAR DirCrawlerDiffString(
+    _In_ const PDIR_CRAWLER_SNAPSHOT pSnapshot,
+    _In_ const ULONGLONG ullOffset
+    ) {
+    return (ullOffset == DIR_CRAWLER_SNAPSHOT_NO_STRING) ? EMPTY_STR : DIR_CRAWLER_SNAPSHOT_STRING(pSnapshot->pbBase, ullOffset);
+}
+
+static BOOL DirCrawlerDiffSkip(
+    _In_ const PDIR_CRAWLER_SNAPSHOT pSnapshot,
+    _In_ const DIR_CRAWLER_SNAPSHOT_INDEX eIndex,
+    _In_ const DWORD dwPosition
+    ) {
+    // Entries with an objectGUID are matched by the GUID pass only
+    return eIndex == DirCrawlerSnapshotIndexDn && pSnapshot->pEntries[pSnapshot->apdwIndex[eIndex][dwPosition]].aullKeys[DirCrawlerSnapshotIndexGuid] != DIR_CRAWLER_SNAPSHOT_NO_STRING;
+}
+
+static void DirCrawlerDiffAddChange(
+    _Inout_ PDIR_CRAWLER_DIFF_WORKER pWorker,
+    _In_ const DIR_CRAWLER_DIFF_CHANGE_TYPE eType,
+    _In_ const DWORD dwOldEntry,
+    _In_ const DWORD dwNewEntry,
+    _In_ const DWORD dwColumn,
+    _In_ const ULONGLONG ullOldValue,
+    _In_ const ULONGLONG ullNewValue
+    ) {
+    PDIR_CRAWLER_DIFF_CHANGE pChange = NULL;
+
+    if (pWorker->dwChangeCount == pWorker->dwChangeCapacity) {
+        pWorker->dwChangeCapacity = max(pWorker->dwChangeCapacity * 2, DIR_CRAWLER_DIFF_MIN_CHANGES);
+        pWorker->pChanges = UtilsHeapAllocOrReallocHelper(g_pDirCrawlerHeap, pWorker->pChanges, SIZEOF_ARRAY(DIR_CRAWLER_DIFF_CHANGE, pWorker->dwChangeCapacity));
+    }
+    pChange = &pWorker->pChanges[pWorker->dwChangeCount++];
+    pChange->dwType = eType;
+    pChange->dwOldEntry = dwOldEntry;
+    pChange->dwNewEntry = dwNewEntry;
+    pChange->dwColumn = dwColumn;
+    pChange->ullOldValue = ullOldValue;
+    pChange->ullNewValue = ullNewValue;
+
+    if (eType != DirCrawlerDiffModified) {
+        pWorker->adwCounts[eType] += 1;
+    }
+}
+
+static void DirCrawlerDiffCompareEntries(
+    _Inout_ PDIR_CRAWLER_DIFF_WORKER pWorker,
+    _In_ const DWORD dwOldEntry,
+    _In_ const DWORD dwNewEntry
+    ) {
+    PDIR_CRAWLER_SNAPSHOT pOld = &pWorker->pDiff->sOld;
+    PDIR_CRAWLER_SNAPSHOT pNew = &pWorker->pDiff->sNew;
+    PDIR_CRAWLER_SNAPSHOT_ENTRY pOldEntry = &pOld->pEntries[dwOldEntry];
+    PDIR_CRAWLER_SNAPSHOT_ENTRY pNewEntry = &pNew->pEntries[dwNewEntry];
+    PDIR_CRAWLER_DIFF_REQUEST_MAP pMap = &pWorker->pDiff->pRequestMaps[pNewEntry->dwRequest];
+    ULONGLONG ullOld = pOldEntry->aullKeys[DirCrawlerSnapshotIndexDn];
+    ULONGLONG ullNew = pNewEntry->aullKeys[DirCrawlerSnapshotIndexDn];
+    ULONGLONG ullOldValue = 0;
+    BOOL bModified = FALSE;
+    DWORD i = 0;
+
+    // Renames are only visible when matching on objectGUID
+    if (_tcscmp(DIR_CRAWLER_SNAPSHOT_STRING(pOld->pbBase, ullOld), DIR_CRAWLER_SNAPSHOT_STRING(pNew->pbBase, ullNew)) != 0) {
+        DirCrawlerDiffAddChange(pWorker, DirCrawlerDiffModified, dwOldEntry, dwNewEntry, DIR_CRAWLER_DIFF_DN_COLUMN, ullOld, ullNew);
+        bModified = TRUE;
+    }
+
+    // Values are compared in place, the old ones are located first since attribute orders can differ between runs
+    for (i = 0; i < pOld->pRequests[pOldEntry->dwRequest].dwAttrCount; i++) {
+        ullOld += (_tcslen(DIR_CRAWLER_SNAPSHOT_STRING(pOld->pbBase, ullOld)) + 1) * sizeof(TCHAR);
+        pWorker->pullOldValues[i] = ullOld;
+    }
+    for (i = 0; i < pNew->pRequests[pNewEntry->dwRequest].dwAttrCount; i++) {
+        ullNew += (_tcslen(DIR_CRAWLER_SNAPSHOT_STRING(pNew->pbBase, ullNew)) + 1) * sizeof(TCHAR);
+        ullOldValue = (pMap->pdwOldColumns[i] != DIR_CRAWLER_DIFF_NONE) ? pWorker->pullOldValues[pMap->pdwOldColumns[i]] : DIR_CRAWLER_SNAPSHOT_NO_STRING;
+        if (_tcscmp(DirCrawlerDiffString(pOld, ullOldValue), DIR_CRAWLER_SNAPSHOT_STRING(pNew->pbBase, ullNew)) != 0) {
+            DirCrawlerDiffAddChange(pWorker, DirCrawlerDiffModified, dwOldEntry, dwNewEntry, i, ullOldValue, ullNew);
+            bModified = TRUE;
+        }
+    }
+
+    if (bModified == TRUE) {
+        pWorker->adwCounts[DirCrawlerDiffModified] += 1;
+    }
+}
+
+static void DirCrawlerDiffMatchKey(
+    _Inout_ PDIR_CRAWLER_DIFF_WORKER pWorker,
+    _In_ const DWORD dwOldFirst,
+    _In_ const DWORD dwOldEnd,
+    _In_ const DWORD dwNewFirst,
+    _In_ const DWORD dwNewEnd
+    ) {
+    PDIR_CRAWLER_SNAPSHOT pOld = &pWorker->pDiff->sOld;
+    PDIR_CRAWLER_SNAPSHOT pNew = &pWorker->pDiff->sNew;
+    DIR_CRAWLER_SNAPSHOT_INDEX eIndex = pWorker->eIndex;
+    DWORD dwOldRequest = 0;
+    DWORD dwNewEntry = 0;
+    DWORD dwOldEntry = 0;
+    DWORD i = 0, j = 0;
+
+    // Entries sharing a key (a DN returned by several requests) are matched by request
+    if (dwOldEnd - dwOldFirst > pWorker->dwOldMatchedSize) {
+        pWorker->dwOldMatchedSize = dwOldEnd - dwOldFirst;
+        pWorker->pbOldMatched = UtilsHeapAllocOrReallocHelper(g_pDirCrawlerHeap, pWorker->pbOldMatched, pWorker->dwOldMatchedSize);
+    }
+    ZeroMemory(pWorker->pbOldMatched, dwOldEnd - dwOldFirst);
+
+    for (j = dwNewFirst; j < dwNewEnd; j++) {
+        if (DirCrawlerDiffSkip(pNew, eIndex, j) == TRUE) {
+            continue;
+        }
+        dwNewEntry = pNew->apdwIndex[eIndex][j];
+        dwOldRequest = pWorker->pDiff->pRequestMaps[pNew->pEntries[dwNewEntry].dwRequest].dwOldRequest;
+
+        for (i = dwOldFirst; i < dwOldEnd; i++) {
+            dwOldEntry = pOld->apdwIndex[eIndex][i];
+            if (pWorker->pbOldMatched[i - dwOldFirst] == FALSE && DirCrawlerDiffSkip(pOld, eIndex, i) == FALSE && pOld->pEntries[dwOldEntry].dwRequest == dwOldRequest) {
+                break;
+            }
+        }
+        if (i < dwOldEnd) {
+            pWorker->pbOldMatched[i - dwOldFirst] = TRUE;
+            DirCrawlerDiffCompareEntries(pWorker, dwOldEntry, dwNewEntry);
+        }
+        else {
+            DirCrawlerDiffAddChange(pWorker, DirCrawlerDiffAdded, DIR_CRAWLER_DIFF_NONE, dwNewEntry, DIR_CRAWLER_DIFF_NONE, DIR_CRAWLER_SNAPSHOT_NO_STRING, DIR_CRAWLER_SNAPSHOT_NO_STRING);
+        }
+    }
+
+    for (i = dwOldFirst; i < dwOldEnd; i++) {
+        if (pWorker->pbOldMatched[i - dwOldFirst] == FALSE && DirCrawlerDiffSkip(pOld, eIndex, i) == FALSE) {
+            DirCrawlerDiffAddChange(pWorker, DirCrawlerDiffRemoved, pOld->apdwIndex[eIndex][i], DIR_CRAWLER_DIFF_NONE, DIR_CRAWLER_DIFF_NONE, DIR_CRAWLER_SNAPSHOT_NO_STRING, DIR_CRAWLER_SNAPSHOT_NO_STRING);
+        }
+    }
+}
+
+static DWORD WINAPI DirCrawlerDiffWorker(
+    _In_ PVOID pvParameter
+    ) {
+    PDIR_CRAWLER_DIFF_WORKER pWorker = pvParameter;
+    PDIR_CRAWLER_SNAPSHOT pOld = &pWorker->pDiff->sOld;
+    PDIR_CRAWLER_SNAPSHOT pNew = &pWorker->pDiff->sNew;
+    DIR_CRAWLER_SNAPSHOT_INDEX eIndex = pWorker->eIndex;
+    DWORD i = pWorker->dwOldFirst;
+    DWORD j = pWorker->dwNewFirst;
+    DWORD dwOldKeyEnd = 0;
+    DWORD dwNewKeyEnd = 0;
+    int iCompare = 0;
+
+    // Merge join of the two sorted indexes on the range of the worker
+    while (i < pWorker->dwOldEnd || j < pWorker->dwNewEnd) {
+        if (i < pWorker->dwOldEnd && DirCrawlerDiffSkip(pOld, eIndex, i) == TRUE) {
+            i++;
+            continue;
+        }
+        if (j < pWorker->dwNewEnd && DirCrawlerDiffSkip(pNew, eIndex, j) == TRUE) {
+            j++;
+            continue;
+        }
+
+        if (i >= pWorker->dwOldEnd) {
+            iCompare = 1;
+        }
+        else if (j >= pWorker->dwNewEnd) {
+            iCompare = -1;
+        }
+        else {
+            iCompare = _tcsicmp(DirCrawlerDiffKey(pOld, eIndex, i), DirCrawlerDiffKey(pNew, eIndex, j));
+        }
+
+        if (iCompare < 0) {
+            DirCrawlerDiffAddChange(pWorker, DirCrawlerDiffRemoved, pOld->apdwIndex[eIndex][i], DIR_CRAWLER_DIFF_NONE, DIR_CRAWLER_DIFF_NONE, DIR_CRAWLER_SNAPSHOT_NO_STRING, DIR_CRAWLER_SNAPSHOT_NO_STRING);
+            i++;
+        }
+        else if (iCompare > 0) {
+            DirCrawlerDiffAddChange(pWorker, DirCrawlerDiffAdded, DIR_CRAWLER_DIFF_NONE, pNew->apdwIndex[eIndex][j], DIR_CRAWLER_DIFF_NONE, DIR_CRAWLER_SNAPSHOT_NO_STRING, DIR_CRAWLER_SNAPSHOT_NO_STRING);
+            j++;
+        }
+        else {
+            for (dwOldKeyEnd = i + 1; dwOldKeyEnd < pWorker->dwOldEnd && _tcsicmp(DirCrawlerDiffKey(pOld, eIndex, dwOldKeyEnd), DirCrawlerDiffKey(pOld, eIndex, i)) == 0; dwOldKeyEnd++);
+            for (dwNewKeyEnd = j + 1; dwNewKeyEnd < pWorker->dwNewEnd && _tcsicmp(DirCrawlerDiffKey(pNew, eIndex, dwNewKeyEnd), DirCrawlerDiffKey(pNew, eIndex, j)) == 0; dwNewKeyEnd++);
+            DirCrawlerDiffMatchKey(pWorker, i, dwOldKeyEnd, j, dwNewKeyEnd);
+            i = dwOldKeyEnd;
+            j = dwNewKeyEnd;
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
+
+static void DirCrawlerDiffMapRequests(
+    _Inout_ PDIR_CRAWLER_DIFF pDiff
+    ) {
+    PDIR_CRAWLER_SNAPSHOT pOld = &pDiff->sOld;
+    PDIR_CRAWLER_SNAPSHOT pNew = &pDiff->sNew;
+    PDIR_CRAWLER_DIFF_REQUEST_MAP pMap = NULL;
+    PTCHAR ptNewName = NULL;
+    PTCHAR ptOldName = NULL;
+    DWORD r = 0, s = 0, i = 0, k = 0;
+
+    pDiff->dwMaxOldAttrCount = 1;
+    for (s = 0; s < pOld->pHeader->dwRequestCount; s++) {
+        pDiff->dwMaxOldAttrCount = max(pDiff->dwMaxOldAttrCount, pOld->pRequests[s].dwAttrCount);
+    }
+
+    // Requests are matched by name, then their attributes by name: the JSON file can change between two runs
+    pDiff->pRequestMaps = UtilsHeapAllocArrayHelper(g_pDirCrawlerHeap, DIR_CRAWLER_DIFF_REQUEST_MAP, max(pNew->pHeader->dwRequestCount, 1));
+    for (r = 0; r < pNew->pHeader->dwRequestCount; r++) {
+        pMap = &pDiff->pRequestMaps[r];
+        pMap->dwOldRequest = DIR_CRAWLER_DIFF_NONE;
+        pMap->pdwOldColumns = UtilsHeapAllocArrayHelper(g_pDirCrawlerHeap, DWORD, max(pNew->pRequests[r].dwAttrCount, 1));
+        pMap->pptAttrNames = UtilsHeapAllocArrayHelper(g_pDirCrawlerHeap, PTCHAR, max(pNew->pRequests[r].dwAttrCount, 1));
+
+        ptNewName = DIR_CRAWLER_SNAPSHOT_STRING(pNew->pbBase, pNew->pRequests[r].ullName);
+        for (s = 0; s < pOld->pHeader->dwRequestCount; s++) {
+            if (_tcsicmp(ptNewName, DIR_CRAWLER_SNAPSHOT_STRING(pOld->pbBase, pOld->pRequests[s].ullName)) == 0) {
+                pMap->dwOldRequest = s;
+                break;
+            }
+        }
+
+        for (i = 0; i < pNew->pRequests[r].dwAttrCount; i++) {
+            ptNewName += _tcslen(ptNewName) + 1;
+            pMap->pptAttrNames[i] = ptNewName;
+            pMap->pdwOldColumns[i] = DIR_CRAWLER_DIFF_NONE;
+            if (pMap->dwOldRequest == DIR_CRAWLER_DIFF_NONE) {
+                continue;
+            }
+            ptOldName = DIR_CRAWLER_SNAPSHOT_STRING(pOld->pbBase, pOld->pRequests[pMap->dwOldRequest].ullName);
+            for (k = 0; k < pOld->pRequests[pMap->dwOldRequest].dwAttrCount; k++) {
+                ptOldName += _tcslen(ptOldName) + 1;
+                if (_tcsicmp(ptNewName, ptOldName) == 0) {
+                    pMap->pdwOldColumns[i] = k;
+                    break;
+                }
+            }
+        }
+    }
+}
+
+static void DirCrawlerDiffSplit(
+    _In_ const PDIR_CRAWLER_DIFF pDiff,
+    _In_ const DIR_CRAWLER_SNAPSHOT_INDEX eIndex,
+    _In_ const DWORD dwWorkers,
+    _Inout_ PDIR_CRAWLER_DIFF_WORKER pWorkers
+    ) {
+    DWORD dwNewCount = pDiff->sNew.pHeader->adwIndexCount[eIndex];
+    DWORD dwOldCount = pDiff->sOld.pHeader->adwIndexCount[eIndex];
+    DWORD dwNewBound = 0;
+    DWORD dwOldBound = 0;
+    DWORD dwPrevNewBound = 0;
+    DWORD dwPrevOldBound = 0;
+    DWORD t = 0;
+
+    // Ranges are cut on the new index, never inside a key, and the old index is cut at the same keys
+    for (t = 0; t < dwWorkers; t++) {
+        if (t == dwWorkers - 1) {
+            dwNewBound = dwNewCount;
+            dwOldBound = dwOldCount;
+        }
+        else {
+            dwNewBound = max((DWORD)(((ULONGLONG)dwNewCount * (t + 1)) / dwWorkers), dwPrevNewBound);
+            while (dwNewBound > 0 && dwNewBound < dwNewCount && _tcsicmp(DirCrawlerDiffKey(&pDiff->sNew, eIndex, dwNewBound - 1), DirCrawlerDiffKey(&pDiff->sNew, eIndex, dwNewBound)) == 0) {
+                dwNewBound++;
+            }
+            if (dwNewBound < dwNewCount) {
+                DirCrawlerSnapshotFind(&pDiff->sOld, eIndex, DirCrawlerDiffKey(&pDiff->sNew, eIndex, dwNewBound), &dwOldBound);
+            }
+            else {
+                dwOldBound = dwOldCount;
+            }
+        }
+
+        pWorkers[t].eIndex = eIndex;
+        pWorkers[t].dwNewFirst = dwPrevNewBound;
+        pWorkers[t].dwNewEnd = dwNewBound;
+        pWorkers[t].dwOldFirst = dwPrevOldBound;
+        pWorkers[t].dwOldEnd = dwOldBound;
+        dwPrevNewBound = dwNewBound;
+        dwPrevOldBound = dwOldBound;
+    }
+}
+
+static void DirCrawlerDiffWriteChanges(
+    _In_ const PDIR_CRAWLER_DIFF pDiff,
+    _In_ const PDIR_CRAWLER_DIFF_WORKER pWorker,
+    _In_ const CSV_HANDLE hOutfile,
+    _In_ const PTCHAR ptOutfile
+    ) {
+    PDIR_CRAWLER_DIFF_CHANGE pChange = NULL;
+    PDIR_CRAWLER_SNAPSHOT pSnapshot = NULL;
+    PDIR_CRAWLER_SNAPSHOT_ENTRY pEntry = NULL;
+    PTCHAR aptRecord[_countof(gsc_aptDiffOutfileHeader)] = { 0 };
+    BOOL bResult = FALSE;
+    DWORD i = 0;
+
+    for (i = 0; i < pWorker->dwChangeCount; i++) {
+        pChange = &pWorker->pChanges[i];
+        pSnapshot = (pChange->dwNewEntry != DIR_CRAWLER_DIFF_NONE) ? &pDiff->sNew : &pDiff->sOld;
+        pEntry = &pSnapshot->pEntries[(pChange->dwNewEntry != DIR_CRAWLER_DIFF_NONE) ? pChange->dwNewEntry : pChange->dwOldEntry];
+
+        aptRecord[0] = DIR_CRAWLER_SNAPSHOT_STRING(pSnapshot->pbBase, pSnapshot->pRequests[pEntry->dwRequest].ullName);
+        aptRecord[1] = gsc_aptChangeNames[pChange->dwType];
+        aptRecord[2] = DIR_CRAWLER_SNAPSHOT_STRING(pSnapshot->pbBase, pEntry->aullKeys[DirCrawlerSnapshotIndexDn]);
+        if (pChange->dwColumn == DIR_CRAWLER_DIFF_NONE) {
+            aptRecord[3] = EMPTY_STR;
+        }
+        else if (pChange->dwColumn == DIR_CRAWLER_DIFF_DN_COLUMN) {
+            aptRecord[3] = gsc_aptDiffOutfileHeader[2];
+        }
+        else {
+            aptRecord[3] = pDiff->pRequestMaps[pEntry->dwRequest].pptAttrNames[pChange->dwColumn];
+        }
+        aptRecord[4] = DirCrawlerDiffString(&pDiff->sOld, pChange->ullOldValue);
+        aptRecord[5] = DirCrawlerDiffString(&pDiff->sNew, pChange->ullNewValue);
+
+        bResult = CsvWriteNextRecord(hOutfile, aptRecord, NULL);
+        if (API_FAILED(bResult)) {
+            FATAL(_T("Failed to write diff record to <%s>: <err:%#08x>"), ptOutfile, CsvGetLastError(hOutfile));
+        }
+    }
+}
+
+/* --- PUBLIC FUNCTIONS ----------------------------------------------------- */
+BOOL DirCrawlerDiffSnapshots(
+    _In_ const PTCHAR ptOldSnapshotFile,
+    _In_ const PTCHAR ptNewSnapshotFile,
+    _In_ const DWORD dwThreadCount
+    ) {
+    DIR_CRAWLER_DIFF sDiff = { 0 };
+    PDIR_CRAWLER_DIFF_WORKER pWorkers = NULL;
+    PHANDLE phThreads = NULL;
+    CSV_HANDLE hOutfile = CSV_INVALID_HANDLE_VALUE;
+    TCHAR atOutfile[MAX_PATH] = { 0 };
+    DWORD adwCounts[DirCrawlerDiffModified + 1] = { 0 };
+    DWORD dwWorkers = min(max(dwThreadCount, 1), MAXIMUM_WAIT_OBJECTS);
+    ULONGLONG ullChangeCount = 0;
+    ULONGLONG ullTimeStart = GetTickCount64();
+    DWORD dwResult = 0;
+    BOOL bResult = FALSE;
+    DWORD e = 0, t = 0;
+
+    if (DirCrawlerSnapshotOpen(ptOldSnapshotFile, &sDiff.sOld) == FALSE) {
+        return FALSE;
+    }
+    if (DirCrawlerSnapshotOpen(ptNewSnapshotFile, &sDiff.sNew) == FALSE) {
+        DirCrawlerSnapshotClose(&sDiff.sOld);
+        return FALSE;
+    }
+    LOG(Info, _T("Diffing snapshots <%s> <entries:%u> and <%s> <entries:%u> using <%u> threads"), ptOldSnapshotFile, sDiff.sOld.pHeader->dwEntryCount, ptNewSnapshotFile, sDiff.sNew.pHeader->dwEntryCount, dwWorkers);
+    DirCrawlerDiffMapRequests(&sDiff);
+
+    _stprintf_s(atOutfile, _countof(atOutfile), _T("%s%s"), ptNewSnapshotFile, DIR_CRAWLER_DIFF_OUTFILE_SUFFIX);
+    bResult = CsvOpenWrite(atOutfile, _countof(gsc_aptDiffOutfileHeader), (PTCHAR *)gsc_aptDiffOutfileHeader, &hOutfile);
+    if (API_FAILED(bResult)) {
+        FATAL(_T("Failed to open CSV outfile <%s>: <err:%#08x>"), atOutfile, CsvGetLastError(hOutfile));
+    }
+
+    pWorkers = UtilsHeapAllocArrayHelper(g_pDirCrawlerHeap, DIR_CRAWLER_DIFF_WORKER, dwWorkers);
+    phThreads = UtilsHeapAllocArrayHelper(g_pDirCrawlerHeap, HANDLE, dwWorkers);
+    ZeroMemory(pWorkers, SIZEOF_ARRAY(DIR_CRAWLER_DIFF_WORKER, dwWorkers));
+    for (t = 0; t < dwWorkers; t++) {
+        pWorkers[t].pDiff = &sDiff;
+        pWorkers[t].pullOldValues = UtilsHeapAllocArrayHelper(g_pDirCrawlerHeap, ULONGLONG, sDiff.dwMaxOldAttrCount);
+    }
+
+    // Changes are written in key order, range after range
+    for (e = 0; e < _countof(gsc_aePasses); e++) {
+        DirCrawlerDiffSplit(&sDiff, gsc_aePasses[e], dwWorkers, pWorkers);
+        for (t = 0; t < dwWorkers; t++) {
+            pWorkers[t].dwChangeCount = 0;
+            phThreads[t] = CreateThread(NULL, 0, DirCrawlerDiffWorker, &pWorkers[t], 0, NULL);
+            if (phThreads[t] == NULL) {
+                FATAL(_T("Failed to create diff thread <%u/%u>: <gle:%#08x>"), t + 1, dwWorkers, GLE());
+            }
+        }
+        dwResult = WaitForMultipleObjects(dwWorkers, phThreads, TRUE, INFINITE);
+        if (dwResult != WAIT_OBJECT_0) {
+            FATAL(_T("Failed to wait on diff threads: <%#08x>"), GLE());
+        }
+        for (t = 0; t < dwWorkers; t++) {
+            CloseHandle(phThreads[t]);
+            DirCrawlerDiffWriteChanges(&sDiff, &pWorkers[t], hOutfile, atOutfile);
+            ullChangeCount += pWorkers[t].dwChangeCount;
+        }
+    }
+    CsvClose(&hOutfile);
+
+    for (t = 0; t < dwWorkers; t++) {
+        for (e = 0; e < _countof(adwCounts); e++) {
+            adwCounts[e] += pWorkers[t].adwCounts[e];
+        }
+        if (pWorkers[t].pChanges != NULL) {
+            UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, pWorkers[t].pChanges);
+        }
+        if (pWorkers[t].pbOldMatched != NULL) {
+            UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, pWorkers[t].pbOldMatched);
+        }
+        UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, pWorkers[t].pullOldValues);
+    }
+    for (t = 0; t < sDiff.sNew.pHeader->dwRequestCount; t++) {
+        UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, sDiff.pRequestMaps[t].pdwOldColumns);
+        UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, sDiff.pRequestMaps[t].pptAttrNames);
+    }
+    UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, sDiff.pRequestMaps);
+    UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, phThreads);
+    UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, pWorkers);
+    DirCrawlerSnapshotClose(&sDiff.sOld);
+    DirCrawlerSnapshotClose(&sDiff.sNew);
+
+    LOG(Succ, _T("Diff written to <%s>: <added:%u> <removed:%u> <modified:%u> <records:%llu> <time:%.3fs>"), atOutfile, adwCounts[DirCrawlerDiffAdded], adwCounts[DirCrawlerDiffRemoved], adwCounts[DirCrawlerDiffModified], ullChangeCount, TIME_DIFF_SEC(ullTimeStart, GetTickCount64()));
+    return TRUE;
+}
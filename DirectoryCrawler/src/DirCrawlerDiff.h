@@ -0,0 +1,73 @@
+#ifndef __DIR_CRAWLER_DIFF_H__
+#define __DIR_CRAWLER_DIFF_H__
+
+/* --- INCLUDES ------------------------------------------------------------- */
+#include "DirectoryCrawler.h"
+#include "DirCrawlerSnapshot.h"
+
+/* --- DEFINES -------------------------------------------------------------- */
+//
+// Differences between two snapshots of the same requests. Entries are matched by request name and objectGUID when
+// both have one, by request name and DN otherwise. The outfile (<new snapshot>.diff.csv) has one record per added or
+// removed entry, and one record per modified attribute ('dn' for renamed entries).
+//
+#define DIR_CRAWLER_DIFF_OUTFILE_SUFFIX     _T(".diff.csv")
+#define DIR_CRAWLER_DIFF_MIN_CHANGES        1024        // initial size of the per-thread change arrays
+#define DIR_CRAWLER_DIFF_NONE               ((DWORD)-1)
+#define DIR_CRAWLER_DIFF_DN_COLUMN          ((DWORD)-2)
+
+/* --- TYPES ---------------------------------------------------------------- */
+typedef enum _DIR_CRAWLER_DIFF_CHANGE_TYPE {
+    DirCrawlerDiffAdded,
+    DirCrawlerDiffRemoved,
+    DirCrawlerDiffModified,
+} DIR_CRAWLER_DIFF_CHANGE_TYPE;
+
+typedef struct _DIR_CRAWLER_DIFF_CHANGE {
+    DWORD dwOldEntry;           // DIR_CRAWLER_DIFF_NONE for added entries
+    DWORD dwNewEntry;           // DIR_CRAWLER_DIFF_NONE for removed entries
+    DWORD dwColumn;             // attribute index in the new request, DIR_CRAWLER_DIFF_DN_COLUMN or DIR_CRAWLER_DIFF_NONE
+    DWORD dwType;               // DIR_CRAWLER_DIFF_CHANGE_TYPE
+    ULONGLONG ullOldValue;      // modified attributes only, offsets in the snapshots (DIR_CRAWLER_SNAPSHOT_NO_STRING if empty)
+    ULONGLONG ullNewValue;
+} DIR_CRAWLER_DIFF_CHANGE, *PDIR_CRAWLER_DIFF_CHANGE;
+
+typedef struct _DIR_CRAWLER_DIFF_REQUEST_MAP {
+    DWORD dwOldRequest;         // DIR_CRAWLER_DIFF_NONE if the request is not in the old snapshot
+    PDWORD pdwOldColumns;       // one per attribute of the new request: attribute index in the old request, or DIR_CRAWLER_DIFF_NONE
+    PTCHAR *pptAttrNames;       // attribute names of the new request, in the new snapshot
+} DIR_CRAWLER_DIFF_REQUEST_MAP, *PDIR_CRAWLER_DIFF_REQUEST_MAP;
+
+typedef struct _DIR_CRAWLER_DIFF {
+    DIR_CRAWLER_SNAPSHOT sOld;
+    DIR_CRAWLER_SNAPSHOT sNew;
+    PDIR_CRAWLER_DIFF_REQUEST_MAP pRequestMaps;     // one per request of the new snapshot
+    DWORD dwMaxOldAttrCount;
+} DIR_CRAWLER_DIFF, *PDIR_CRAWLER_DIFF;
+
+typedef struct _DIR_CRAWLER_DIFF_WORKER {
+    PDIR_CRAWLER_DIFF pDiff;
+    DIR_CRAWLER_SNAPSHOT_INDEX eIndex;
+    DWORD dwOldFirst;           // index positions, end excluded
+    DWORD dwOldEnd;
+    DWORD dwNewFirst;
+    DWORD dwNewEnd;
+    PULONGLONG pullOldValues;   // scratch: attribute values offsets of the old entry being compared
+    PBYTE pbOldMatched;         // scratch: old entries of the current key already matched
+    DWORD dwOldMatchedSize;
+
+    PDIR_CRAWLER_DIFF_CHANGE pChanges;
+    DWORD dwChangeCount;
+    DWORD dwChangeCapacity;
+    DWORD adwCounts[DirCrawlerDiffModified + 1];    // entries (not attributes) per change type
+} DIR_CRAWLER_DIFF_WORKER, *PDIR_CRAWLER_DIFF_WORKER;
+
+/* --- VARIABLES ------------------------------------------------------------ */
+/* --- PROTOTYPES ----------------------------------------------------------- */
+BOOL DirCrawlerDiffSnapshots(
+    _In_ const PTCHAR ptOldSnapshotFile,
+    _In_ const PTCHAR ptNewSnapshotFile,
+    _In_ const DWORD dwThreadCount
+    );
+
+#endif // __DIR_CRAWLER_DIFF_H__
@@ -0,0 +1,537 @@
+/* --- INCLUDES ------------------------------------------------------------- */
+#include "DirCrawlerEdges.h"
+#include "DirCrawlerFormatters.h"
+
+/* --- PRIVATE VARIABLES ---------------------------------------------------- */
+static const DIR_CRAWLER_EDGE_ATTRIBUTE gsc_asEdgeAttributes[] = {
+    { .ptName = _T("member"), .eKind = DirCrawlerEdgeValueDn, .eRelation = DirCrawlerEdgeMember },
+    { .ptName = _T("managedBy"), .eKind = DirCrawlerEdgeValueDn, .eRelation = DirCrawlerEdgeManagedBy },
+    { .ptName = _T("msDS-RevealOnDemandGroup"), .eKind = DirCrawlerEdgeValueDn, .eRelation = DirCrawlerEdgeRevealOnDemand },
+    { .ptName = _T("msDS-NeverRevealGroup"), .eKind = DirCrawlerEdgeValueDn, .eRelation = DirCrawlerEdgeNeverReveal },
+    { .ptName = _T("homeMDB"), .eKind = DirCrawlerEdgeValueDn, .eRelation = DirCrawlerEdgeHomeMdb },
+    { .ptName = _T("msExchUserLink"), .eKind = DirCrawlerEdgeValueDn, .eRelation = DirCrawlerEdgeExchUserLink },
+    { .ptName = _T("msExchRoleLink"), .eKind = DirCrawlerEdgeValueDn, .eRelation = DirCrawlerEdgeExchRoleLink },
+    { .ptName = _T("gPLink"), .eKind = DirCrawlerEdgeValueGpLink, .eRelation = DirCrawlerEdgeGpLink },
+    { .ptName = _T("primaryGroupID"), .eKind = DirCrawlerEdgeValuePrimaryGroup, .eRelation = DirCrawlerEdgePrimaryGroup },
+    { .ptName = _T("objectSid"), .eKind = DirCrawlerEdgeValueSid, .eRelation = DirCrawlerEdgeSid },
+    { .ptName = _T("sIDHistory"), .eKind = DirCrawlerEdgeValueSid, .eRelation = DirCrawlerEdgeSidHistory },
+    { .ptName = _T("nTSecurityDescriptor"), .eKind = DirCrawlerEdgeValueSd, .eRelation = DirCrawlerEdgeAce },
+    { .ptName = _T("msExchMailboxSecurityDescriptor"), .eKind = DirCrawlerEdgeValueSd, .eRelation = DirCrawlerEdgeMailboxAce },
+    { .ptName = _T("msDS-AllowedToActOnBehalfOfOtherIdentity"), .eKind = DirCrawlerEdgeValueSd, .eRelation = DirCrawlerEdgeAllowedToActAce },
+};
+
+static PDIR_CRAWLER_EDGE_NODE *gs_ppNodeBuckets = NULL;
+static CRITICAL_SECTION gs_asNodeLocks[DIR_CRAWLER_EDGES_STRIPES] = { 0 };
+static volatile LONG gs_lNodeCount = 0;
+
+// Member, primary group and objectSid edges of the whole run, kept in memory for the memberships expansion
+static BOOL gs_bKeepMemberships = FALSE;
+static CRITICAL_SECTION gs_sKeptLock = { 0 };
+static PDIR_CRAWLER_EDGE_RECORD gs_pKeptEdges = NULL;
+static ULONGLONG gs_ullKeptCount = 0;
+
+/* --- PUBLIC VARIABLES ----------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS ---------------------------------------------------- */
+static DWORD DirCrawlerEdgesHashKey(
+    _In_ const LPCSTR pKey,
+    _In_ const DWORD dwKeySize
+    ) {
+    // FNV-1a on ASCII-uppercased bytes: DNs, SIDs and GUIDs compare case insensitively
+    DWORD dwHash = 2166136261;
+    DWORD i = 0;
+    CHAR c = 0;
+
+    for (i = 0; i < dwKeySize; i++) {
+        c = pKey[i];
+        if (c >= 'a' && c <= 'z') {
+            c -= 'a' - 'A';
+        }
+        dwHash = (dwHash ^ (BYTE)c) * 16777619;
+    }
+    return dwHash;
+}
+
+static DWORD DirCrawlerEdgesFindAttribute(
+    _In_ const PTCHAR ptName
+    ) {
+    DWORD i = 0;
+
+    for (i = 0; i < _countof(gsc_asEdgeAttributes); i++) {
+        if (_tcsicmp(ptName, gsc_asEdgeAttributes[i].ptName) == 0) {
+            return i;
+        }
+    }
+    return DIR_CRAWLER_EDGES_NO_ATTRIBUTE;
+}
+
+static void DirCrawlerEdgesFlush(
+    _In_ const PDIR_CRAWLER_EDGES_OUTPUT pOutput
+    ) {
+    BOOL bResult = FALSE;
+    DWORD dwWritten = 0;
+
+    if (pOutput->dwUsed == 0) {
+        return;
+    }
+
+    bResult = WriteFile(pOutput->hFile, pOutput->abBuffer, pOutput->dwUsed, &dwWritten, NULL);
+    if (bResult == FALSE || dwWritten != pOutput->dwUsed) {
+        REQ_FATAL(pOutput->pReqDescr, _T("Failed to write edges <size:%u>: <gle:%#08x>"), pOutput->dwUsed, GLE());
+    }
+    pOutput->dwUsed = 0;
+}
+
+static void DirCrawlerEdgesAdd(
+    _In_ const PDIR_CRAWLER_EDGES_OUTPUT pOutput,
+    _In_ const DWORD dwSource,
+    _In_ const DWORD dwTarget,
+    _In_ const DIR_CRAWLER_EDGE_RELATION eRelation,
+    _In_ const DWORD dwValue,
+    _In_opt_ const PDIR_CRAWLER_ACE pAce,
+    _In_ const DWORD dwObjectType
+    ) {
+    PDIR_CRAWLER_EDGE_RECORD pRecord = NULL;
+
+    if (pOutput->dwUsed + sizeof(DIR_CRAWLER_EDGE_RECORD) > DIR_CRAWLER_EDGES_BUFFER_SIZE) {
+        DirCrawlerEdgesFlush(pOutput);
+    }
+
+    pRecord = (PDIR_CRAWLER_EDGE_RECORD)(pOutput->abBuffer + pOutput->dwUsed);
+    pRecord->dwSource = dwSource;
+    pRecord->dwTarget = dwTarget;
+    pRecord->wRelation = (WORD)eRelation;
+    pRecord->bAceType = pAce != NULL ? pAce->bType : 0;
+    pRecord->bAceFlags = pAce != NULL ? pAce->bFlags : 0;
+    pRecord->dwValue = dwValue;
+    pRecord->dwObjectType = dwObjectType;
+
+    pOutput->dwUsed += sizeof(DIR_CRAWLER_EDGE_RECORD);
+    pOutput->ullEdgeCount += 1;
+
+    if (gs_bKeepMemberships == TRUE && (eRelation == DirCrawlerEdgeMember || eRelation == DirCrawlerEdgePrimaryGroup || eRelation == DirCrawlerEdgeSid)) {
+        if (pOutput->dwKeptCount == pOutput->dwKeptCapacity) {
+            pOutput->dwKeptCapacity = max(pOutput->dwKeptCapacity * 2, DIR_CRAWLER_EDGES_KEPT_MIN_SIZE);
+            pOutput->pKeptEdges = UtilsHeapAllocOrReallocHelper(g_pDirCrawlerHeap, pOutput->pKeptEdges, SIZEOF_ARRAY(DIR_CRAWLER_EDGE_RECORD, pOutput->dwKeptCapacity));
+        }
+        pOutput->pKeptEdges[pOutput->dwKeptCount++] = *pRecord;
+    }
+}
+
+static DWORD DirCrawlerEdgesSidNode(
+    _In_ const PBYTE pbSid,
+    _In_ const DWORD dwSize
+    ) {
+    CHAR acSid[DIR_CRAWLER_SD_SID_MAX_LEN] = { 0 };
+    DWORD dwLen = DirCrawlerSdFormatSid(pbSid, dwSize, acSid);
+
+    // Formatters lengths include the NULL terminator, invalid SIDs are formatted as an empty string
+    return (dwLen > 1) ? DirCrawlerEdgesGetNodeId(acSid, dwLen - 1) : DIR_CRAWLER_EDGES_NO_NODE;
+}
+
+static void DirCrawlerEdgesAddGpLinks(
+    _In_ const PDIR_CRAWLER_EDGES_OUTPUT pOutput,
+    _In_ const DWORD dwSource,
+    _In_ const LPSTR pValue
+    ) {
+    // [LDAP://cn={GUID},cn=policies,cn=system,DC=...;<options>][LDAP://...;<options>]...
+    LPSTR pCurrent = pValue;
+    LPSTR pDn = NULL;
+    DWORD dwDnSize = 0;
+    DWORD dwOptions = 0;
+
+    while ((pCurrent = strchr(pCurrent, '[')) != NULL) {
+        pCurrent += 1;
+        if (_strnicmp(pCurrent, DIR_CRAWLER_EDGES_GPLINK_PREFIX, sizeof(DIR_CRAWLER_EDGES_GPLINK_PREFIX) - 1) == 0) {
+            pCurrent += sizeof(DIR_CRAWLER_EDGES_GPLINK_PREFIX) - 1;
+        }
+        pDn = pCurrent;
+        while (*pCurrent != '\0' && *pCurrent != ';' && *pCurrent != ']') {
+            pCurrent += 1;
+        }
+        dwDnSize = (DWORD)(pCurrent - pDn);
+        dwOptions = (*pCurrent == ';') ? (DWORD)strtoul(pCurrent + 1, NULL, 10) : 0;
+        if (dwDnSize > 0) {
+            DirCrawlerEdgesAdd(pOutput, dwSource, DirCrawlerEdgesGetNodeId(pDn, dwDnSize), DirCrawlerEdgeGpLink, dwOptions, NULL, DIR_CRAWLER_EDGES_NO_NODE);
+        }
+    }
+}
+
+static void DirCrawlerEdgesAddPrimaryGroup(
+    _In_ const PDIR_CRAWLER_EDGES_OUTPUT pOutput,
+    _In_ const DWORD dwSource,
+    _In_ const LPSTR pRid,
+    _In_opt_ const PLDAP_ATTRIBUTE pObjectSid
+    ) {
+    CHAR acSid[DIR_CRAWLER_EDGES_KEY_MAX_LEN] = { 0 };
+    LPSTR pLastDash = NULL;
+    DWORD dwLen = 0;
+    ULONGLONG ullRid = 0;
+
+    // The group SID is the domain SID of the entry followed by the RID, this needs 'objectSid' in the same request
+    if (pObjectSid == NULL || pObjectSid->dwValuesCount == 0 || FormatParseUnsignedA(pRid, &ullRid) == FALSE || ullRid > MAXDWORD) {
+        return;
+    }
+    dwLen = DirCrawlerSdFormatSid(pObjectSid->ppValues[0]->pbData, pObjectSid->ppValues[0]->dwSize, acSid);
+    pLastDash = strrchr(acSid, '-');
+    if (dwLen <= 1 || pLastDash == NULL) {
+        return;
+    }
+
+    dwLen = (DWORD)(pLastDash - acSid) + 1;
+    dwLen += FormatDecimalA(ullRid, acSid + dwLen);
+    DirCrawlerEdgesAdd(pOutput, dwSource, DirCrawlerEdgesGetNodeId(acSid, dwLen), DirCrawlerEdgePrimaryGroup, 0, NULL, DIR_CRAWLER_EDGES_NO_NODE);
+}
+
+static void DirCrawlerEdgesAddSd(
+    _In_ const PDIR_CRAWLER_EDGES_OUTPUT pOutput,
+    _In_ const DWORD dwSource,
+    _In_ const PLDAP_VALUE pLdapValue,
+    _In_ const DIR_CRAWLER_EDGE_RELATION eRelation
+    ) {
+    CHAR acGuid[DIR_CRAWLER_SD_GUID_LEN] = { 0 };
+    DIR_CRAWLER_SD sSd = { 0 };
+    DIR_CRAWLER_ACE sAce = { 0 };
+    DWORD dwOffset = 0;
+    DWORD dwTarget = DIR_CRAWLER_EDGES_NO_NODE;
+    DWORD dwObjectType = DIR_CRAWLER_EDGES_NO_NODE;
+
+    if (DirCrawlerSdParse(pLdapValue->pbData, pLdapValue->dwSize, &sSd) == FALSE) {
+        REQ_LOG(pOutput->pReqDescr, Warn, _T("Invalid security descriptor (%u bytes), no edge extracted"), pLdapValue->dwSize);
+        return;
+    }
+
+    // Only the owner of the object itself is a control relation
+    if (eRelation == DirCrawlerEdgeAce && sSd.pbOwner != NULL) {
+        dwTarget = DirCrawlerEdgesSidNode(sSd.pbOwner, sSd.dwOwnerSize);
+        if (dwTarget != DIR_CRAWLER_EDGES_NO_NODE) {
+            DirCrawlerEdgesAdd(pOutput, dwSource, dwTarget, DirCrawlerEdgeOwner, 0, NULL, DIR_CRAWLER_EDGES_NO_NODE);
+        }
+    }
+
+    while (DirCrawlerSdNextAce(&sSd, &dwOffset, &sAce) == TRUE) {
+        if (sAce.pbTrustee == NULL) {
+            continue;
+        }
+        dwTarget = DirCrawlerEdgesSidNode(sAce.pbTrustee, sAce.dwTrusteeSize);
+        if (dwTarget == DIR_CRAWLER_EDGES_NO_NODE) {
+            continue;
+        }
+        dwObjectType = DIR_CRAWLER_EDGES_NO_NODE;
+        if (sAce.pbObjectType != NULL && DirCrawlerSdFormatGuid(sAce.pbObjectType, DIR_CRAWLER_SD_GUID_SIZE, acGuid) > 1) {
+            dwObjectType = DirCrawlerEdgesGetNodeId(acGuid, DIR_CRAWLER_SD_GUID_LEN - 1);
+        }
+        DirCrawlerEdgesAdd(pOutput, dwSource, dwTarget, eRelation, sAce.dwMask, &sAce, dwObjectType);
+    }
+}
+
+static DWORD DirCrawlerEdgesEntryNode(
+    _In_ const PDIR_CRAWLER_EDGES_OUTPUT pOutput,
+    _In_ const PTCHAR ptDn
+    ) {
+#ifdef UNICODE
+    DWORD dwLen = WideCharToMultiByte(CP_UTF8, 0, ptDn, -1, NULL, 0, NULL, NULL);
+
+    if (dwLen == 0) {
+        REQ_LOG(pOutput->pReqDescr, Warn, _T("Failed to convert DN <%s> to UTF-8, no edge extracted: <gle:%#08x>"), ptDn, GLE());
+        return DIR_CRAWLER_EDGES_NO_NODE;
+    }
+    if (dwLen > pOutput->dwDnBufferSize) {
+        pOutput->pDnBuffer = UtilsHeapAllocOrReallocHelper(g_pDirCrawlerHeap, pOutput->pDnBuffer, dwLen);
+        pOutput->dwDnBufferSize = dwLen;
+    }
+    WideCharToMultiByte(CP_UTF8, 0, ptDn, -1, pOutput->pDnBuffer, dwLen, NULL, NULL);
+    return DirCrawlerEdgesGetNodeId(pOutput->pDnBuffer, dwLen - 1);
+#else
+    UNREFERENCED_PARAMETER(pOutput);
+    return DirCrawlerEdgesGetNodeId(ptDn, (DWORD)strlen(ptDn));
+#endif
+}
+
+/* --- PUBLIC FUNCTIONS ----------------------------------------------------- */
+void DirCrawlerEdgesInit(
+    _In_ const BOOL bKeepMemberships
+    ) {
+    DWORD i = 0;
+
+    gs_bKeepMemberships = bKeepMemberships;
+    InitializeCriticalSection(&gs_sKeptLock);
+
+    gs_ppNodeBuckets = UtilsHeapAllocArrayHelper(g_pDirCrawlerHeap, PDIR_CRAWLER_EDGE_NODE, DIR_CRAWLER_EDGES_BUCKETS);
+    ZeroMemory(gs_ppNodeBuckets, SIZEOF_ARRAY(PDIR_CRAWLER_EDGE_NODE, DIR_CRAWLER_EDGES_BUCKETS));
+    for (i = 0; i < DIR_CRAWLER_EDGES_STRIPES; i++) {
+        InitializeCriticalSection(&gs_asNodeLocks[i]);
+    }
+    gs_lNodeCount = 0;
+}
+
+void DirCrawlerEdgesCleanup(
+    ) {
+    PDIR_CRAWLER_EDGE_NODE pNode = NULL;
+    PDIR_CRAWLER_EDGE_NODE pNext = NULL;
+    DWORD i = 0;
+
+    if (gs_ppNodeBuckets == NULL) {
+        return;
+    }
+
+    for (i = 0; i < DIR_CRAWLER_EDGES_BUCKETS; i++) {
+        for (pNode = gs_ppNodeBuckets[i]; pNode != NULL; pNode = pNext) {
+            pNext = pNode->pNext;
+            UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, pNode);
+        }
+    }
+    for (i = 0; i < DIR_CRAWLER_EDGES_STRIPES; i++) {
+        DeleteCriticalSection(&gs_asNodeLocks[i]);
+    }
+    UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, gs_ppNodeBuckets);
+
+    if (gs_pKeptEdges != NULL) {
+        UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, gs_pKeptEdges);
+    }
+    gs_ullKeptCount = 0;
+    DeleteCriticalSection(&gs_sKeptLock);
+}
+
+DWORD DirCrawlerEdgesGetNodeId(
+    _In_ const LPCSTR pKey,
+    _In_ const DWORD dwKeySize
+    ) {
+    DWORD dwHash = DirCrawlerEdgesHashKey(pKey, dwKeySize);
+    DWORD dwBucket = dwHash & (DIR_CRAWLER_EDGES_BUCKETS - 1);
+    PCRITICAL_SECTION pLock = &gs_asNodeLocks[dwBucket % DIR_CRAWLER_EDGES_STRIPES];
+    PDIR_CRAWLER_EDGE_NODE pNode = NULL;
+    DWORD dwId = DIR_CRAWLER_EDGES_NO_NODE;
+
+    EnterCriticalSection(pLock);
+    for (pNode = gs_ppNodeBuckets[dwBucket]; pNode != NULL; pNode = pNode->pNext) {
+        if (pNode->dwHash == dwHash && pNode->dwKeySize == dwKeySize && _strnicmp(pNode->acKey, pKey, dwKeySize) == 0) {
+            dwId = pNode->dwId;
+            break;
+        }
+    }
+    if (pNode == NULL) {
+        pNode = UtilsHeapAllocHelper(g_pDirCrawlerHeap, FIELD_OFFSET(DIR_CRAWLER_EDGE_NODE, acKey) + dwKeySize + 1);
+        pNode->dwHash = dwHash;
+        pNode->dwKeySize = dwKeySize;
+        CopyMemory(pNode->acKey, pKey, dwKeySize);
+        pNode->acKey[dwKeySize] = '\0';
+        pNode->dwId = (DWORD)InterlockedIncrement(&gs_lNodeCount);
+        pNode->pNext = gs_ppNodeBuckets[dwBucket];
+        gs_ppNodeBuckets[dwBucket] = pNode;
+        dwId = pNode->dwId;
+    }
+    LeaveCriticalSection(pLock);
+
+    return dwId;
+}
+
+BOOL DirCrawlerEdgesHasEdgeAttribute(
+    _In_ const PDIR_CRAWLER_REQ_DESCR pReqDescr
+    ) {
+    DWORD i = 0;
+
+    for (i = 0; i < pReqDescr->ldap.attributes.dwAttrCount; i++) {
+        if (DirCrawlerEdgesFindAttribute(pReqDescr->ldap.attributes.pAttrArray[i].ptName) != DIR_CRAWLER_EDGES_NO_ATTRIBUTE) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+PDIR_CRAWLER_EDGES_OUTPUT DirCrawlerEdgesStartRequest(
+    _In_ const PDIR_CRAWLER_REQ_DESCR pReqDescr,
+    _In_ const PTCHAR ptEdgesOutfile
+    ) {
+    PDIR_CRAWLER_EDGES_OUTPUT pOutput = NULL;
+    DIR_CRAWLER_EDGES_FILE_HEADER sFileHeader = { .dwMagic = DIR_CRAWLER_EDGES_FILE_MAGIC, .dwVersion = DIR_CRAWLER_EDGES_VERSION, .dwCount = sizeof(DIR_CRAWLER_EDGE_RECORD) };
+    BOOL bResult = FALSE;
+    DWORD dwWritten = 0;
+    DWORD i = 0;
+
+    pOutput = UtilsHeapAllocStructHelper(g_pDirCrawlerHeap, DIR_CRAWLER_EDGES_OUTPUT);
+    pOutput->pReqDescr = pReqDescr;
+    pOutput->dwUsed = 0;
+    pOutput->ullEdgeCount = 0;
+    pOutput->pDnBuffer = NULL;
+    pOutput->dwDnBufferSize = 0;
+    pOutput->dwObjectSidIndex = DIR_CRAWLER_EDGES_NO_ATTRIBUTE;
+    pOutput->pKeptEdges = NULL;
+    pOutput->dwKeptCount = 0;
+    pOutput->dwKeptCapacity = 0;
+
+    // Attribute names are matched once per request, not once per entry
+    pOutput->pdwEdgeAttributes = UtilsHeapAllocArrayHelper(g_pDirCrawlerHeap, DWORD, max(pReqDescr->ldap.attributes.dwAttrCount, 1));
+    for (i = 0; i < pReqDescr->ldap.attributes.dwAttrCount; i++) {
+        pOutput->pdwEdgeAttributes[i] = DirCrawlerEdgesFindAttribute(pReqDescr->ldap.attributes.pAttrArray[i].ptName);
+        if (pOutput->pdwEdgeAttributes[i] != DIR_CRAWLER_EDGES_NO_ATTRIBUTE && gsc_asEdgeAttributes[pOutput->pdwEdgeAttributes[i]].eRelation == DirCrawlerEdgeSid) {
+            pOutput->dwObjectSidIndex = i;
+        }
+    }
+
+    pOutput->hFile = CreateFile(ptEdgesOutfile, GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (pOutput->hFile == INVALID_HANDLE_VALUE) {
+        REQ_FATAL(pReqDescr, _T("Failed to create edges outfile <%s>: <gle:%#08x>"), ptEdgesOutfile, GLE());
+    }
+    bResult = WriteFile(pOutput->hFile, &sFileHeader, sizeof(sFileHeader), &dwWritten, NULL);
+    if (bResult == FALSE || dwWritten != sizeof(sFileHeader)) {
+        REQ_FATAL(pReqDescr, _T("Failed to write edges outfile header <%s>: <gle:%#08x>"), ptEdgesOutfile, GLE());
+    }
+
+    return pOutput;
+}
+
+void DirCrawlerEdgesWriteEntry(
+    _In_ const PDIR_CRAWLER_EDGES_OUTPUT pOutput,
+    _In_ const PTCHAR ptDn,
+    _In_ const PLDAP_ATTRIBUTE ppLdapAttributes[]
+    ) {
+    PDIR_CRAWLER_REQ_DESCR pReqDescr = pOutput->pReqDescr;
+    const DIR_CRAWLER_EDGE_ATTRIBUTE *pEdgeAttr = NULL;
+    PLDAP_ATTRIBUTE pObjectSid = NULL;
+    PLDAP_VALUE pLdapValue = NULL;
+    DWORD dwSource = DIR_CRAWLER_EDGES_NO_NODE;
+    DWORD dwTarget = DIR_CRAWLER_EDGES_NO_NODE;
+    DWORD i = 0, j = 0;
+
+    for (i = 0; i < pReqDescr->ldap.attributes.dwAttrCount; i++) {
+        if (pOutput->pdwEdgeAttributes[i] == DIR_CRAWLER_EDGES_NO_ATTRIBUTE || ppLdapAttributes[i] == NULL) {
+            continue;
+        }
+        pEdgeAttr = &gsc_asEdgeAttributes[pOutput->pdwEdgeAttributes[i]];
+
+        // The DN of the entry is only converted and looked up if it has at least one edge
+        if (dwSource == DIR_CRAWLER_EDGES_NO_NODE) {
+            dwSource = DirCrawlerEdgesEntryNode(pOutput, ptDn);
+            if (dwSource == DIR_CRAWLER_EDGES_NO_NODE) {
+                return;
+            }
+            pObjectSid = (pOutput->dwObjectSidIndex != DIR_CRAWLER_EDGES_NO_ATTRIBUTE) ? ppLdapAttributes[pOutput->dwObjectSidIndex] : NULL;
+        }
+
+        for (j = 0; j < ppLdapAttributes[i]->dwValuesCount; j++) {
+            pLdapValue = ppLdapAttributes[i]->ppValues[j];
+
+            switch (pEdgeAttr->eKind) {
+            case DirCrawlerEdgeValueDn:
+                dwTarget = DirCrawlerEdgesGetNodeId((LPCSTR)pLdapValue->pbData, (DWORD)strnlen((LPCSTR)pLdapValue->pbData, pLdapValue->dwSize));
+                DirCrawlerEdgesAdd(pOutput, dwSource, dwTarget, pEdgeAttr->eRelation, 0, NULL, DIR_CRAWLER_EDGES_NO_NODE);
+                break;
+            case DirCrawlerEdgeValueSid:
+                dwTarget = DirCrawlerEdgesSidNode(pLdapValue->pbData, pLdapValue->dwSize);
+                if (dwTarget != DIR_CRAWLER_EDGES_NO_NODE) {
+                    DirCrawlerEdgesAdd(pOutput, dwSource, dwTarget, pEdgeAttr->eRelation, 0, NULL, DIR_CRAWLER_EDGES_NO_NODE);
+                }
+                break;
+            case DirCrawlerEdgeValueGpLink:
+                DirCrawlerEdgesAddGpLinks(pOutput, dwSource, (LPSTR)pLdapValue->pbData);
+                break;
+            case DirCrawlerEdgeValuePrimaryGroup:
+                DirCrawlerEdgesAddPrimaryGroup(pOutput, dwSource, (LPSTR)pLdapValue->pbData, pObjectSid);
+                break;
+            case DirCrawlerEdgeValueSd:
+                DirCrawlerEdgesAddSd(pOutput, dwSource, pLdapValue, pEdgeAttr->eRelation);
+                break;
+            }
+        }
+    }
+}
+
+void DirCrawlerEdgesEndRequest(
+    _Inout_ PDIR_CRAWLER_EDGES_OUTPUT *ppOutput
+    ) {
+    PDIR_CRAWLER_EDGES_OUTPUT pOutput = *ppOutput;
+
+    if (pOutput == NULL) {
+        return;
+    }
+
+    DirCrawlerEdgesFlush(pOutput);
+    CloseHandle(pOutput->hFile);
+    REQ_LOG(pOutput->pReqDescr, Info, _T("Edges extracted: <%llu>"), pOutput->ullEdgeCount);
+
+    if (pOutput->pKeptEdges != NULL) {
+        EnterCriticalSection(&gs_sKeptLock);
+        gs_pKeptEdges = UtilsHeapAllocOrReallocHelper(g_pDirCrawlerHeap, gs_pKeptEdges, SIZEOF_ARRAY(DIR_CRAWLER_EDGE_RECORD, gs_ullKeptCount + pOutput->dwKeptCount));
+        CopyMemory(gs_pKeptEdges + gs_ullKeptCount, pOutput->pKeptEdges, SIZEOF_ARRAY(DIR_CRAWLER_EDGE_RECORD, pOutput->dwKeptCount));
+        gs_ullKeptCount += pOutput->dwKeptCount;
+        LeaveCriticalSection(&gs_sKeptLock);
+        UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, pOutput->pKeptEdges);
+    }
+
+    UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, pOutput->pdwEdgeAttributes);
+    if (pOutput->pDnBuffer != NULL) {
+        UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, pOutput->pDnBuffer);
+    }
+    UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, pOutput);
+    *ppOutput = NULL;
+}
+
+void DirCrawlerEdgesWriteNodes(
+    _In_ const PTCHAR ptNodesOutfile
+    ) {
+    DIR_CRAWLER_EDGES_FILE_HEADER sFileHeader = { .dwMagic = DIR_CRAWLER_EDGES_NODES_MAGIC, .dwVersion = DIR_CRAWLER_EDGES_VERSION, .dwCount = (DWORD)gs_lNodeCount };
+    PDIR_CRAWLER_EDGE_NODE pNode = NULL;
+    HANDLE hFile = INVALID_HANDLE_VALUE;
+    PBYTE pbBuffer = NULL;
+    DWORD dwUsed = 0;
+    DWORD dwRecordSize = 0;
+    DWORD dwWritten = 0;
+    BOOL bResult = FALSE;
+    DWORD i = 0;
+
+    hFile = CreateFile(ptNodesOutfile, GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        FATAL(_T("Failed to create edges nodes outfile <%s>: <gle:%#08x>"), ptNodesOutfile, GLE());
+    }
+
+    // Called once the workers are done, the table is not locked
+    pbBuffer = UtilsHeapAllocHelper(g_pDirCrawlerHeap, DIR_CRAWLER_EDGES_BUFFER_SIZE);
+    CopyMemory(pbBuffer, &sFileHeader, sizeof(sFileHeader));
+    dwUsed = sizeof(sFileHeader);
+
+    for (i = 0; i < DIR_CRAWLER_EDGES_BUCKETS; i++) {
+        for (pNode = gs_ppNodeBuckets[i]; pNode != NULL; pNode = pNode->pNext) {
+            dwRecordSize = DIR_CRAWLER_EDGES_ALIGN(2 * sizeof(DWORD) + pNode->dwKeySize);
+            if (dwUsed + dwRecordSize > DIR_CRAWLER_EDGES_BUFFER_SIZE) {
+                bResult = WriteFile(hFile, pbBuffer, dwUsed, &dwWritten, NULL);
+                if (bResult == FALSE || dwWritten != dwUsed) {
+                    FATAL(_T("Failed to write edges nodes outfile <%s>: <gle:%#08x>"), ptNodesOutfile, GLE());
+                }
+                dwUsed = 0;
+            }
+            if (dwRecordSize > DIR_CRAWLER_EDGES_BUFFER_SIZE) {
+                // Keys longer than the buffer are not expected (DNs are limited well below), skip rather than overflow
+                LOG(Warn, _T("Edges node <%u> key too long <%u>, not written"), pNode->dwId, pNode->dwKeySize);
+                continue;
+            }
+
+            ZeroMemory(pbBuffer + dwUsed, dwRecordSize);
+            ((PDWORD)(pbBuffer + dwUsed))[0] = pNode->dwId;
+            ((PDWORD)(pbBuffer + dwUsed))[1] = pNode->dwKeySize;
+            CopyMemory(pbBuffer + dwUsed + 2 * sizeof(DWORD), pNode->acKey, pNode->dwKeySize);
+            dwUsed += dwRecordSize;
+        }
+    }
+
+    bResult = WriteFile(hFile, pbBuffer, dwUsed, &dwWritten, NULL);
+    if (bResult == FALSE || dwWritten != dwUsed) {
+        FATAL(_T("Failed to write edges nodes outfile <%s>: <gle:%#08x>"), ptNodesOutfile, GLE());
+    }
+    CloseHandle(hFile);
+    UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, pbBuffer);
+
+    LOG(Info, SUB_LOG(_T("Edges nodes written to <%s>: <nodes:%u>")), ptNodesOutfile, sFileHeader.dwCount);
+}
+
+DWORD DirCrawlerEdgesNodeCount(
+    ) {
+    return (DWORD)gs_lNodeCount;
+}
+
+PDIR_CRAWLER_EDGE_RECORD DirCrawlerEdgesKeptMemberships(
+    _Out_ PULONGLONG pullCount
+    ) {
+    // Only valid once all the requests have ended
+    *pullCount = gs_ullKeptCount;
+    return gs_pKeptEdges;
+}
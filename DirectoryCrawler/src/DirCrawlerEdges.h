@@ -0,0 +1,151 @@
+#ifndef __DIR_CRAWLER_EDGES_H__
+#define __DIR_CRAWLER_EDGES_H__
+
+/* --- INCLUDES ------------------------------------------------------------- */
+#include "DirectoryCrawler.h"
+#include "DirCrawlerSd.h"
+
+/* --- DEFINES -------------------------------------------------------------- */
+//
+// Control-path edges extracted while crawling (all integers are little-endian, records are 4-bytes aligned):
+//  - <prefix>_LDAP_<request>_edges.bin: file header (magic, version, record size), then fixed-size edge records
+//  - <prefix>_LDAP_edges_nodes.bin    : file header (magic, version, node count), then node records (id, key size, UTF-8 key, aligned)
+// Every edge reads "<source> <relation> <target>", the source being the entry holding the attribute. Node ids are shared by
+// all the requests of a run: node keys are DNs, string SIDs (ACE trustees, objectSid...) and GUIDs (ACE object types).
+//
+#define DIR_CRAWLER_EDGES_OUTFILES_SUFFIX   _T("edges")
+#define DIR_CRAWLER_EDGES_NODES_OUTFILE     _T("edges_nodes")
+#define DIR_CRAWLER_EDGES_OUTFILES_EXT      _T("bin")
+
+#define DIR_CRAWLER_EDGES_FILE_MAGIC        0x45474445  // 'EDGE'
+#define DIR_CRAWLER_EDGES_NODES_MAGIC       0x45444F4E  // 'NODE'
+#define DIR_CRAWLER_EDGES_VERSION           1
+#define DIR_CRAWLER_EDGES_BUFFER_SIZE       (256 * 1024)
+#define DIR_CRAWLER_EDGES_ALIGN(x)          (((x) + 3) & ~((DWORD)3))
+
+#define DIR_CRAWLER_EDGES_NO_NODE           0           // node ids start at 1
+#define DIR_CRAWLER_EDGES_NO_ATTRIBUTE      ((DWORD)-1)
+#define DIR_CRAWLER_EDGES_BUCKETS           (1 << 20)   // power of 2, chained
+#define DIR_CRAWLER_EDGES_STRIPES           64          // locks shared by the buckets
+#define DIR_CRAWLER_EDGES_KEY_MAX_LEN       (DIR_CRAWLER_SD_SID_MAX_LEN + 11)   // SID or GUID keys, primary group SIDs get one more sub-authority
+
+#define DIR_CRAWLER_EDGES_GPLINK_PREFIX     "LDAP://"
+#define DIR_CRAWLER_EDGES_KEPT_MIN_SIZE     1024
+
+/* --- TYPES ---------------------------------------------------------------- */
+typedef enum _DIR_CRAWLER_EDGE_RELATION {
+    DirCrawlerEdgeMember = 1,
+    DirCrawlerEdgeManagedBy,
+    DirCrawlerEdgeRevealOnDemand,   // msDS-RevealOnDemandGroup
+    DirCrawlerEdgeNeverReveal,      // msDS-NeverRevealGroup
+    DirCrawlerEdgeHomeMdb,
+    DirCrawlerEdgeExchUserLink,
+    DirCrawlerEdgeExchRoleLink,
+    DirCrawlerEdgeGpLink,           // value: gPLink options
+    DirCrawlerEdgePrimaryGroup,     // target: SID of the group (domain SID of the entry + primaryGroupID)
+    DirCrawlerEdgeSid,              // objectSid, target: string SID
+    DirCrawlerEdgeSidHistory,
+    DirCrawlerEdgeOwner,            // nTSecurityDescriptor owner
+    DirCrawlerEdgeAce,              // nTSecurityDescriptor ACE, target: trustee, value: access mask
+    DirCrawlerEdgeMailboxAce,       // msExchMailboxSecurityDescriptor ACE
+    DirCrawlerEdgeAllowedToActAce,  // msDS-AllowedToActOnBehalfOfOtherIdentity ACE
+} DIR_CRAWLER_EDGE_RELATION;
+
+typedef enum _DIR_CRAWLER_EDGE_VALUE_KIND {
+    DirCrawlerEdgeValueDn,
+    DirCrawlerEdgeValueSid,
+    DirCrawlerEdgeValueGpLink,
+    DirCrawlerEdgeValuePrimaryGroup,
+    DirCrawlerEdgeValueSd,
+} DIR_CRAWLER_EDGE_VALUE_KIND;
+
+typedef struct _DIR_CRAWLER_EDGE_ATTRIBUTE {
+    PTCHAR ptName;
+    DIR_CRAWLER_EDGE_VALUE_KIND eKind;
+    DIR_CRAWLER_EDGE_RELATION eRelation;
+} DIR_CRAWLER_EDGE_ATTRIBUTE, *PDIR_CRAWLER_EDGE_ATTRIBUTE;
+
+typedef struct _DIR_CRAWLER_EDGES_FILE_HEADER {
+    DWORD dwMagic;
+    DWORD dwVersion;
+    DWORD dwCount;          // record size for edge files, node count for the nodes file
+} DIR_CRAWLER_EDGES_FILE_HEADER, *PDIR_CRAWLER_EDGES_FILE_HEADER;
+
+typedef struct _DIR_CRAWLER_EDGE_RECORD {
+    DWORD dwSource;
+    DWORD dwTarget;
+    WORD wRelation;         // DIR_CRAWLER_EDGE_RELATION
+    BYTE bAceType;          // ACE relations only
+    BYTE bAceFlags;         // ACE relations only
+    DWORD dwValue;          // access mask for ACE relations, options for gPLink, 0 otherwise
+    DWORD dwObjectType;     // node of the ACE object type GUID, DIR_CRAWLER_EDGES_NO_NODE if none
+} DIR_CRAWLER_EDGE_RECORD, *PDIR_CRAWLER_EDGE_RECORD;
+
+typedef struct _DIR_CRAWLER_EDGE_NODE {
+    struct _DIR_CRAWLER_EDGE_NODE *pNext;
+    DWORD dwHash;
+    DWORD dwId;
+    DWORD dwKeySize;        // in bytes, without NULL terminator
+    CHAR acKey[ANYSIZE_ARRAY];
+} DIR_CRAWLER_EDGE_NODE, *PDIR_CRAWLER_EDGE_NODE;
+
+typedef struct _DIR_CRAWLER_EDGES_OUTPUT {
+    PDIR_CRAWLER_REQ_DESCR pReqDescr;
+    HANDLE hFile;
+    PDWORD pdwEdgeAttributes;   // one per requested attribute: index in the edge attributes table, or DIR_CRAWLER_EDGES_NO_ATTRIBUTE
+    DWORD dwObjectSidIndex;     // requested attribute index of 'objectSid', needed by primary group edges
+    LPSTR pDnBuffer;            // UTF-8 DN of the current entry, reused from one entry to another
+    DWORD dwDnBufferSize;
+    ULONGLONG ullEdgeCount;
+    PDIR_CRAWLER_EDGE_RECORD pKeptEdges;    // membership edges of the request, merged in the run list when it ends
+    DWORD dwKeptCount;
+    DWORD dwKeptCapacity;
+    DWORD dwUsed;
+    BYTE abBuffer[DIR_CRAWLER_EDGES_BUFFER_SIZE];
+} DIR_CRAWLER_EDGES_OUTPUT, *PDIR_CRAWLER_EDGES_OUTPUT;
+
+/* --- VARIABLES ------------------------------------------------------------ */
+/* --- PROTOTYPES ----------------------------------------------------------- */
+void DirCrawlerEdgesInit(
+    _In_ const BOOL bKeepMemberships
+    );
+
+void DirCrawlerEdgesCleanup(
+    );
+
+DWORD DirCrawlerEdgesGetNodeId(
+    _In_ const LPCSTR pKey,
+    _In_ const DWORD dwKeySize
+    );
+
+BOOL DirCrawlerEdgesHasEdgeAttribute(
+    _In_ const PDIR_CRAWLER_REQ_DESCR pReqDescr
+    );
+
+PDIR_CRAWLER_EDGES_OUTPUT DirCrawlerEdgesStartRequest(
+    _In_ const PDIR_CRAWLER_REQ_DESCR pReqDescr,
+    _In_ const PTCHAR ptEdgesOutfile
+    );
+
+void DirCrawlerEdgesWriteEntry(
+    _In_ const PDIR_CRAWLER_EDGES_OUTPUT pOutput,
+    _In_ const PTCHAR ptDn,
+    _In_ const PLDAP_ATTRIBUTE ppLdapAttributes[]
+    );
+
+void DirCrawlerEdgesEndRequest(
+    _Inout_ PDIR_CRAWLER_EDGES_OUTPUT *ppOutput
+    );
+
+void DirCrawlerEdgesWriteNodes(
+    _In_ const PTCHAR ptNodesOutfile
+    );
+
+DWORD DirCrawlerEdgesNodeCount(
+    );
+
+PDIR_CRAWLER_EDGE_RECORD DirCrawlerEdgesKeptMemberships(
+    _Out_ PULONGLONG pullCount
+    );
+
+#endif // __DIR_CRAWLER_EDGES_H__
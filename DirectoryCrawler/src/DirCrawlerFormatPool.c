@@ -0,0 +1,420 @@
+/* --- INCLUDES ------------------------------------------------------------- */
+#include "DirCrawlerFormatPool.h"
+#include "DirCrawlerHeap.h"
+#include "DirCrawlerStats.h"
+
+/* --- PRIVATE VARIABLES ---------------------------------------------------- */
+static PFN_DIR_CRAWLER_FORMAT_FIELD gs_pfnFormatField = NULL;
+static PFN_DIR_CRAWLER_FORMAT_SIDE gs_pfnFormatSide = NULL;
+static PHANDLE gs_phFormatThreads = NULL;
+
+// Protects the queue, the 'bFormatted' flags of the batches and the stats
+static SRWLOCK gs_sFormatLock = SRWLOCK_INIT;
+static CONDITION_VARIABLE gs_sBatchQueued = CONDITION_VARIABLE_INIT;
+static CONDITION_VARIABLE gs_sBatchFormatted = CONDITION_VARIABLE_INIT;
+static PDIR_CRAWLER_FORMAT_BATCH gs_pQueueHead = NULL;
+static PDIR_CRAWLER_FORMAT_BATCH gs_pQueueTail = NULL;
+static BOOL gs_bFormatStopping = FALSE;
+static DIR_CRAWLER_FORMAT_STATS gs_sFormatStats = { 0 };
+
+static __declspec(thread) PDIR_CRAWLER_FORMAT_STREAM gs_pThreadStream = NULL;    // stream of the request run by the current thread
+
+/* --- PUBLIC VARIABLES ----------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS ---------------------------------------------------- */
+static PDIR_CRAWLER_FORMAT_ENTRY DirCrawlerFormatCopyEntry(
+    _In_ const PDIR_CRAWLER_FORMAT_STREAM pStream,
+    _In_ const PTCHAR ptDn,
+    _In_ const PLDAP_ATTRIBUTE ppLdapAttributes[],
+    _In_ const DWORD adwLens[]
+    ) {
+    PDIR_CRAWLER_FORMAT_ENTRY pEntry = NULL;
+    PLDAP_ATTRIBUTE pAttributes = NULL;
+    PLDAP_VALUE *ppValues = NULL;
+    PLDAP_VALUE pValues = NULL;
+    PTCHAR ptChars = NULL;
+    PBYTE pbData = NULL;
+    DWORD dwPresentCount = 0;
+    DWORD dwValueCount = 0;
+    DWORD dwFieldsLen = 0;
+    DWORD dwDnLen = (DWORD)_tcslen(ptDn) + 1;
+    SIZE_T sizeData = 0;
+    SIZE_T sizeEntry = 0;
+    DWORD i = 0, j = 0;
+
+    for (i = 0; i < pStream->dwAttrCount; i++) {
+        if (ppLdapAttributes[i] != NULL) {
+            dwPresentCount += 1;
+            dwValueCount += ppLdapAttributes[i]->dwValuesCount;
+            for (j = 0; j < ppLdapAttributes[i]->dwValuesCount; j++) {
+                sizeData += ppLdapAttributes[i]->ppValues[j]->dwSize;
+            }
+        }
+        dwFieldsLen += adwLens[i];
+    }
+    sizeData += dwValueCount;    // the formatters read values up to a terminator, like the ones of LdapLib and of captures
+
+    // One allocation per entry, pointer-aligned parts first: attributes, record, values, lens, DN and fields, raw values (each followed by a terminator)
+    sizeEntry = sizeof(DIR_CRAWLER_FORMAT_ENTRY)
+        + SIZEOF_ARRAY(PLDAP_ATTRIBUTE, pStream->dwAttrCount)
+        + SIZEOF_ARRAY(PTCHAR, pStream->dwAttrCount + 1)
+        + SIZEOF_ARRAY(LDAP_ATTRIBUTE, dwPresentCount)
+        + SIZEOF_ARRAY(PLDAP_VALUE, dwValueCount)
+        + SIZEOF_ARRAY(LDAP_VALUE, dwValueCount)
+        + SIZEOF_ARRAY(DWORD, pStream->dwAttrCount)
+        + SIZEOF_ARRAY(TCHAR, dwDnLen + dwFieldsLen)
+        + sizeData;
+    pEntry = DIR_CRAWLER_STATS_ALLOC(sizeEntry, UtilsHeapAllocHelper(DIR_CRAWLER_THREAD_HEAP, sizeEntry));
+    pEntry->ppAttributes = (PLDAP_ATTRIBUTE *)(pEntry + 1);
+    pEntry->pptRecord = (PTCHAR *)(pEntry->ppAttributes + pStream->dwAttrCount);
+    pAttributes = (PLDAP_ATTRIBUTE)(pEntry->pptRecord + pStream->dwAttrCount + 1);
+    ppValues = (PLDAP_VALUE *)(pAttributes + dwPresentCount);
+    pValues = (PLDAP_VALUE)(ppValues + dwValueCount);
+    pEntry->pdwLens = (PDWORD)(pValues + dwValueCount);
+    ptChars = (PTCHAR)(pEntry->pdwLens + pStream->dwAttrCount);
+    pbData = (PBYTE)(ptChars + dwDnLen + dwFieldsLen);
+    pEntry->pvSide = NULL;
+    pEntry->llFormattedBytes = 0;
+
+    pEntry->ptDn = ptChars;
+    CopyMemory(pEntry->ptDn, ptDn, SIZEOF_ARRAY(TCHAR, dwDnLen));
+    pEntry->pptRecord[0] = pEntry->ptDn;
+    ptChars += dwDnLen;
+
+    for (i = 0; i < pStream->dwAttrCount; i++) {
+        pEntry->pdwLens[i] = adwLens[i];
+        pEntry->pptRecord[i + 1] = ptChars;
+        ptChars += adwLens[i];
+
+        if (ppLdapAttributes[i] == NULL) {
+            pEntry->ppAttributes[i] = NULL;
+            continue;
+        }
+        ZeroMemory(pAttributes, sizeof(LDAP_ATTRIBUTE));
+        pAttributes->dwValuesCount = ppLdapAttributes[i]->dwValuesCount;
+        pAttributes->ppValues = ppValues;
+        for (j = 0; j < ppLdapAttributes[i]->dwValuesCount; j++) {
+            pValues->dwSize = ppLdapAttributes[i]->ppValues[j]->dwSize;
+            pValues->pbData = pbData;
+            CopyMemory(pbData, ppLdapAttributes[i]->ppValues[j]->pbData, pValues->dwSize);
+            pbData[pValues->dwSize] = '\0';
+            pbData += pValues->dwSize + 1;
+            *ppValues++ = pValues++;
+        }
+        pEntry->ppAttributes[i] = pAttributes++;
+    }
+
+    return pEntry;
+}
+
+static void DirCrawlerFormatBatch(
+    _In_ const PDIR_CRAWLER_FORMAT_BATCH pBatch
+    ) {
+    PDIR_CRAWLER_REQ_DESCR pReqDescr = pBatch->pStream->pReqDescr;
+    PDIR_CRAWLER_FORMAT_ENTRY pEntry = NULL;
+    PVOID apvSides[DIR_CRAWLER_FORMAT_BATCH_ENTRIES] = { 0 };
+    DWORD i = 0, j = 0;
+
+    for (i = 0; i < pBatch->dwEntryCount; i++) {
+        pEntry = pBatch->apEntries[i];
+        for (j = 0; j < pBatch->pStream->dwAttrCount; j++) {
+            gs_pfnFormatField(pEntry->ppAttributes[j], &pReqDescr->ldap.attributes.pAttrArray[j], pEntry->pptRecord[j + 1], pEntry->pdwLens[j]);
+            pEntry->llFormattedBytes += _tcslen(pEntry->pptRecord[j + 1]) * sizeof(TCHAR);
+        }
+        pEntry->pvSide = gs_pfnFormatSide(pReqDescr, pEntry->ppAttributes, apvSides, i);
+        apvSides[i] = pEntry->pvSide;
+    }
+}
+
+static DWORD WINAPI DirCrawlerFormatWorker(
+    _In_ PVOID pvParam
+    ) {
+    PDIR_CRAWLER_FORMAT_BATCH pBatch = NULL;
+    LONGLONG llStart = 0;
+
+    UNREFERENCED_PARAMETER(pvParam);
+    // Only the scratch buffers of long values are allocated here: the fields are in the entries of the search thread, and
+    // the side data, freed by the search thread, in g_pDirCrawlerHeap
+    DirCrawlerHeapThreadStart();
+
+    AcquireSRWLockExclusive(&gs_sFormatLock);
+    for (;;) {
+        while (gs_pQueueHead == NULL && gs_bFormatStopping == FALSE) {
+            SleepConditionVariableSRW(&gs_sBatchQueued, &gs_sFormatLock, INFINITE, 0);
+        }
+        if (gs_pQueueHead == NULL) {
+            break;
+        }
+        pBatch = gs_pQueueHead;
+        gs_pQueueHead = pBatch->pNextQueued;
+        if (gs_pQueueHead == NULL) {
+            gs_pQueueTail = NULL;
+        }
+        ReleaseSRWLockExclusive(&gs_sFormatLock);
+
+        llStart = DirCrawlerStatsNow();
+        DirCrawlerFormatBatch(pBatch);
+
+        AcquireSRWLockExclusive(&gs_sFormatLock);
+        pBatch->llFormatTicks = DirCrawlerStatsNow() - llStart;
+        pBatch->bFormatted = TRUE;
+        gs_sFormatStats.llFormatTicks += pBatch->llFormatTicks;
+        WakeAllConditionVariable(&gs_sBatchFormatted);
+    }
+    ReleaseSRWLockExclusive(&gs_sFormatLock);
+
+    DirCrawlerHeapThreadEnd();
+    return EXIT_SUCCESS;
+}
+
+static PDIR_CRAWLER_FORMAT_BATCH DirCrawlerFormatFillingBatch(
+    _In_ const PDIR_CRAWLER_FORMAT_STREAM pStream
+    ) {
+    // NULL when all the batches are in flight
+    if (pStream->dwInFlight == pStream->dwBatchCount) {
+        return NULL;
+    }
+    return &pStream->pBatches[(pStream->dwOldest + pStream->dwInFlight) % pStream->dwBatchCount];
+}
+
+static void DirCrawlerFormatQueueBatch(
+    _In_ const PDIR_CRAWLER_FORMAT_STREAM pStream
+    ) {
+    PDIR_CRAWLER_FORMAT_BATCH pBatch = DirCrawlerFormatFillingBatch(pStream);
+
+    pBatch->bFormatted = FALSE;
+    pBatch->llFormatTicks = 0;
+    pBatch->pNextQueued = NULL;
+
+    AcquireSRWLockExclusive(&gs_sFormatLock);
+    if (gs_pQueueTail == NULL) {
+        gs_pQueueHead = pBatch;
+    }
+    else {
+        gs_pQueueTail->pNextQueued = pBatch;
+    }
+    gs_pQueueTail = pBatch;
+    gs_sFormatStats.llBatches += 1;
+    gs_sFormatStats.llEntries += pBatch->dwEntryCount;
+    ReleaseSRWLockExclusive(&gs_sFormatLock);
+    WakeConditionVariable(&gs_sBatchQueued);
+
+    pStream->dwInFlight += 1;
+}
+
+static void DirCrawlerFormatWaitBatch(
+    _In_ const PDIR_CRAWLER_FORMAT_BATCH pBatch
+    ) {
+    LONGLONG llStart = DirCrawlerStatsNow();
+
+    AcquireSRWLockExclusive(&gs_sFormatLock);
+    while (pBatch->bFormatted == FALSE) {
+        SleepConditionVariableSRW(&gs_sBatchFormatted, &gs_sFormatLock, INFINITE, 0);
+    }
+    gs_sFormatStats.llWaitTicks += DirCrawlerStatsNow() - llStart;
+    ReleaseSRWLockExclusive(&gs_sFormatLock);
+}
+
+static void DirCrawlerFormatWriteOldest(
+    _In_ const PDIR_CRAWLER_FORMAT_STREAM pStream
+    ) {
+    PDIR_CRAWLER_FORMAT_BATCH pBatch = &pStream->pBatches[pStream->dwOldest];
+    PDIR_CRAWLER_FORMAT_ENTRY pEntry = NULL;
+    DWORD i = 0;
+
+    DirCrawlerFormatWaitBatch(pBatch);
+    DirCrawlerStatsStageAdd(pStream->pReqContext->pStats, DirCrawlerStageFormat, pBatch->llFormatTicks);
+
+    for (i = 0; i < pBatch->dwEntryCount; i++) {
+        pEntry = pBatch->apEntries[i];
+        pStream->pfnWrite(pStream->pReqContext, pEntry->ptDn, pEntry->ppAttributes, pEntry->pptRecord, pEntry->pvSide, pEntry->llFormattedBytes);
+        if (pEntry->pvSide != NULL) {
+            UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, pEntry->pvSide);
+        }
+        // Entries already written are not freed again when the request is aborted by the next ones
+        UtilsHeapFreeAndNullHelper(DIR_CRAWLER_THREAD_HEAP, pBatch->apEntries[i]);
+    }
+
+    pBatch->dwEntryCount = 0;
+    pStream->dwOldest = (pStream->dwOldest + 1) % pStream->dwBatchCount;
+    pStream->dwInFlight -= 1;
+}
+
+static void DirCrawlerFormatFreeStream(
+    _Inout_ PDIR_CRAWLER_FORMAT_STREAM *ppStream
+    ) {
+    PDIR_CRAWLER_FORMAT_STREAM pStream = *ppStream;
+    DWORD i = 0, j = 0;
+
+    for (i = 0; i < pStream->dwBatchCount; i++) {
+        for (j = 0; j < pStream->pBatches[i].dwEntryCount; j++) {
+            if (pStream->pBatches[i].apEntries[j] != NULL) {
+                if (pStream->pBatches[i].apEntries[j]->pvSide != NULL) {
+                    UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, pStream->pBatches[i].apEntries[j]->pvSide);
+                }
+                UtilsHeapFreeAndNullHelper(DIR_CRAWLER_THREAD_HEAP, pStream->pBatches[i].apEntries[j]);
+            }
+        }
+    }
+    UtilsHeapFreeAndNullHelper(DIR_CRAWLER_THREAD_HEAP, pStream->pBatches);
+    UtilsHeapFreeAndNullHelper(DIR_CRAWLER_THREAD_HEAP, pStream);
+    gs_pThreadStream = NULL;
+    *ppStream = NULL;
+}
+
+/* --- PUBLIC FUNCTIONS ----------------------------------------------------- */
+void DirCrawlerFormatPoolInit(
+    _In_ const DWORD dwThreads,
+    _In_ const PFN_DIR_CRAWLER_FORMAT_FIELD pfnFormatField,
+    _In_ const PFN_DIR_CRAWLER_FORMAT_SIDE pfnFormatSide
+    ) {
+    DWORD i = 0;
+
+    if (dwThreads > DIR_CRAWLER_FORMAT_THREADS_MAX) {
+        FATAL(_T("Too many formatting threads <%u>, the maximum is <%u>"), dwThreads, DIR_CRAWLER_FORMAT_THREADS_MAX);
+    }
+
+    gs_pfnFormatField = pfnFormatField;
+    gs_pfnFormatSide = pfnFormatSide;
+    gs_sFormatStats.dwThreads = dwThreads;
+    gs_phFormatThreads = UtilsHeapAllocArrayHelper(g_pDirCrawlerHeap, HANDLE, dwThreads);
+    for (i = 0; i < dwThreads; i++) {
+        gs_phFormatThreads[i] = CreateThread(NULL, 0, DirCrawlerFormatWorker, NULL, 0, NULL);
+        if (gs_phFormatThreads[i] == NULL) {
+            FATAL(_T("Failed to create formatting thread <%u/%u>: <gle:%#08x>"), i + 1, dwThreads, GLE());
+        }
+    }
+
+    LOG(Info, SUB_LOG(_T("Entries formatted by a pool of <%u> threads, in batches of <%u>")), dwThreads, DIR_CRAWLER_FORMAT_BATCH_ENTRIES);
+}
+
+void DirCrawlerFormatPoolCleanup(
+    ) {
+    DWORD dwResult = 0;
+    DWORD i = 0;
+
+    if (gs_phFormatThreads == NULL) {
+        return;
+    }
+
+    // The requests are over: the queue is empty
+    AcquireSRWLockExclusive(&gs_sFormatLock);
+    gs_bFormatStopping = TRUE;
+    ReleaseSRWLockExclusive(&gs_sFormatLock);
+    WakeAllConditionVariable(&gs_sBatchQueued);
+
+    dwResult = WaitForMultipleObjects(gs_sFormatStats.dwThreads, gs_phFormatThreads, TRUE, INFINITE);
+    if (dwResult != WAIT_OBJECT_0) {
+        LOG(Err, _T("Failed to wait on formatting threads: <%#08x>"), GLE());
+    }
+    for (i = 0; i < gs_sFormatStats.dwThreads; i++) {
+        CloseHandle(gs_phFormatThreads[i]);
+    }
+    UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, gs_phFormatThreads);
+}
+
+BOOL DirCrawlerFormatPoolIsEnabled(
+    ) {
+    return (BOOL)(gs_phFormatThreads != NULL);
+}
+
+PDIR_CRAWLER_FORMAT_STREAM DirCrawlerFormatStreamStart(
+    _In_ const PDIR_CRAWLER_REQ_CONTEXT pReqContext,
+    _In_ const PFN_DIR_CRAWLER_FORMAT_WRITE pfnWrite
+    ) {
+    PDIR_CRAWLER_FORMAT_STREAM pStream = NULL;
+    DWORD i = 0;
+
+    pStream = UtilsHeapAllocStructHelper(DIR_CRAWLER_THREAD_HEAP, DIR_CRAWLER_FORMAT_STREAM);
+    ZeroMemory(pStream, sizeof(DIR_CRAWLER_FORMAT_STREAM));
+    pStream->pReqContext = pReqContext;
+    pStream->pReqDescr = pReqContext->pReqDescr;
+    pStream->pfnWrite = pfnWrite;
+    pStream->dwAttrCount = pReqContext->pReqDescr->ldap.attributes.dwAttrCount;
+    pStream->dwBatchCount = gs_sFormatStats.dwThreads * DIR_CRAWLER_FORMAT_BATCHES_PER_THREAD;
+    pStream->pBatches = UtilsHeapAllocArrayHelper(DIR_CRAWLER_THREAD_HEAP, DIR_CRAWLER_FORMAT_BATCH, pStream->dwBatchCount);
+    ZeroMemory(pStream->pBatches, SIZEOF_ARRAY(DIR_CRAWLER_FORMAT_BATCH, pStream->dwBatchCount));
+    for (i = 0; i < pStream->dwBatchCount; i++) {
+        pStream->pBatches[i].pStream = pStream;
+    }
+
+    gs_pThreadStream = pStream;
+    return pStream;
+}
+
+void DirCrawlerFormatStreamAdd(
+    _In_ const PDIR_CRAWLER_FORMAT_STREAM pStream,
+    _In_ const PTCHAR ptDn,
+    _In_ const PLDAP_ATTRIBUTE ppLdapAttributes[],
+    _In_ const DWORD adwLens[]
+    ) {
+    PDIR_CRAWLER_FORMAT_BATCH pBatch = NULL;
+
+    if (pStream->dwInFlight == pStream->dwBatchCount) {
+        DirCrawlerFormatWriteOldest(pStream);
+    }
+    pBatch = DirCrawlerFormatFillingBatch(pStream);
+    pBatch->apEntries[pBatch->dwEntryCount] = DirCrawlerFormatCopyEntry(pStream, ptDn, ppLdapAttributes, adwLens);
+    pBatch->dwEntryCount += 1;
+
+    if (pBatch->dwEntryCount == DIR_CRAWLER_FORMAT_BATCH_ENTRIES) {
+        DirCrawlerFormatQueueBatch(pStream);
+    }
+}
+
+void DirCrawlerFormatStreamFlush(
+    _In_ const PDIR_CRAWLER_FORMAT_STREAM pStream
+    ) {
+    PDIR_CRAWLER_FORMAT_BATCH pBatch = DirCrawlerFormatFillingBatch(pStream);
+
+    if (pBatch != NULL && pBatch->dwEntryCount > 0) {
+        DirCrawlerFormatQueueBatch(pStream);
+    }
+    while (pStream->dwInFlight > 0) {
+        DirCrawlerFormatWriteOldest(pStream);
+    }
+}
+
+void DirCrawlerFormatStreamBypass(
+    _In_ const PDIR_CRAWLER_FORMAT_STREAM pStream
+    ) {
+    DirCrawlerFormatStreamFlush(pStream);
+
+    AcquireSRWLockExclusive(&gs_sFormatLock);
+    gs_sFormatStats.llBypassed += 1;
+    ReleaseSRWLockExclusive(&gs_sFormatLock);
+}
+
+void DirCrawlerFormatStreamEnd(
+    _Inout_ PDIR_CRAWLER_FORMAT_STREAM *ppStream
+    ) {
+    if ((*ppStream) == NULL) {
+        return;
+    }
+
+    DirCrawlerFormatStreamFlush(*ppStream);
+    DirCrawlerFormatFreeStream(ppStream);
+}
+
+void DirCrawlerFormatPoolAbortRequest(
+    ) {
+    PDIR_CRAWLER_FORMAT_STREAM pStream = gs_pThreadStream;
+    DWORD i = 0;
+
+    if (pStream == NULL) {
+        return;
+    }
+
+    // The pool threads may still be formatting into the entries: they are freed once their batch is done
+    for (i = 0; i < pStream->dwInFlight; i++) {
+        DirCrawlerFormatWaitBatch(&pStream->pBatches[(pStream->dwOldest + i) % pStream->dwBatchCount]);
+    }
+    DirCrawlerFormatFreeStream(&pStream);
+}
+
+void DirCrawlerFormatPoolGetStats(
+    _Out_ PDIR_CRAWLER_FORMAT_STATS pStats
+    ) {
+    AcquireSRWLockShared(&gs_sFormatLock);
+    *pStats = gs_sFormatStats;
+    ReleaseSRWLockShared(&gs_sFormatLock);
+}
@@ -0,0 +1,137 @@
+#ifndef __DIR_CRAWLER_FORMAT_POOL_H__
+#define __DIR_CRAWLER_FORMAT_POOL_H__
+
+/* --- INCLUDES ------------------------------------------------------------- */
+#include "DirectoryCrawler.h"
+
+/* --- DEFINES -------------------------------------------------------------- */
+//
+// With '--format-threads <num>', the attributes of the entries are formatted by a pool of <num> threads shared by all
+// the requests, instead of by the thread running the search. The search thread copies every entry (DN and raw values,
+// so that LdapLib, capture and synthetic buffers are released or reused at once) into a batch, and hands full batches
+// to the pool. It then writes the formatted batches in the order it queued them: records, and their 'sd', 'ace', edges
+// and snapshot side outputs, keep the order in which the server returned the entries. The 'sd' values are parsed and
+// their ACE rows formatted by the pool too: the search thread only keeps the DACL deduplication, which depends on the
+// entries written before, and the writes.
+// A request has at most DIR_CRAWLER_FORMAT_BATCHES_PER_THREAD batches per pool thread in flight: beyond, the search
+// thread waits for its oldest one. Entries whose record is measured over DIR_CRAWLER_BUDGET_MIN_BYTES bypass the pool,
+// and are formatted by the search thread once the batches in flight are written (memory budget reservations are taken
+// and released by the same thread).
+//
+#define DIR_CRAWLER_FORMAT_BATCH_ENTRIES        64
+#define DIR_CRAWLER_FORMAT_BATCHES_PER_THREAD   2
+#define DIR_CRAWLER_FORMAT_THREADS_MAX          MAXIMUM_WAIT_OBJECTS
+
+/* --- TYPES ---------------------------------------------------------------- */
+// Copy of an entry, in a single allocation of the search thread heap: attributes, values, DN, value bytes and fields follow it
+typedef struct _DIR_CRAWLER_FORMAT_ENTRY {
+    PTCHAR ptDn;
+    PLDAP_ATTRIBUTE *ppAttributes;      // one per requested attribute, NULL if missing
+    PDWORD pdwLens;                     // of the fields, from DirCrawlerMeasureAttribute
+    PTCHAR *pptRecord;                  // DN then one field per attribute, formatted by the pool
+    PVOID pvSide;                       // from the side formatter, NULL if none
+    LONGLONG llFormattedBytes;
+} DIR_CRAWLER_FORMAT_ENTRY, *PDIR_CRAWLER_FORMAT_ENTRY;
+
+typedef struct _DIR_CRAWLER_FORMAT_BATCH {
+    struct _DIR_CRAWLER_FORMAT_STREAM *pStream;
+    DWORD dwEntryCount;
+    BOOL bFormatted;                    // set by the pool thread, under the pool lock
+    LONGLONG llFormatTicks;             // spent by the pool thread (QueryPerformanceCounter ticks)
+    PDIR_CRAWLER_FORMAT_ENTRY apEntries[DIR_CRAWLER_FORMAT_BATCH_ENTRIES];
+    struct _DIR_CRAWLER_FORMAT_BATCH *pNextQueued;
+} DIR_CRAWLER_FORMAT_BATCH, *PDIR_CRAWLER_FORMAT_BATCH;
+
+typedef void (FN_DIR_CRAWLER_FORMAT_FIELD)(     // called by the pool threads: must not raise
+    _In_opt_ const PLDAP_ATTRIBUTE pLdapAttribute,
+    _In_ const PDIR_CRAWLER_LDAP_ATTRIBUTE_DESCRIPTION pAttrDesc,
+    _Out_ PTCHAR ptOutBuff,
+    _In_ const DWORD dwLen
+    );
+typedef FN_DIR_CRAWLER_FORMAT_FIELD *PFN_DIR_CRAWLER_FORMAT_FIELD;
+
+typedef PVOID (FN_DIR_CRAWLER_FORMAT_SIDE)(     // called by the pool threads: must not raise. NULL or a single allocation of g_pDirCrawlerHeap
+    _In_ const PDIR_CRAWLER_REQ_DESCR pReqDescr,
+    _In_ const PLDAP_ATTRIBUTE ppLdapAttributes[],
+    _In_ const PVOID apvPrevious[],     // side data of the entries before it in its batch
+    _In_ const DWORD dwPreviousCount
+    );
+typedef FN_DIR_CRAWLER_FORMAT_SIDE *PFN_DIR_CRAWLER_FORMAT_SIDE;
+
+typedef void (FN_DIR_CRAWLER_FORMAT_WRITE)(     // called by the search thread, in the order of the entries
+    _In_ const PDIR_CRAWLER_REQ_CONTEXT pReqContext,
+    _In_ const PTCHAR ptDn,
+    _In_ const PLDAP_ATTRIBUTE ppLdapAttributes[],
+    _In_ const PTCHAR pptCsvRecord[],
+    _In_opt_ const PVOID pvSide,        // freed by the pool once written
+    _In_ const LONGLONG llFormattedBytes
+    );
+typedef FN_DIR_CRAWLER_FORMAT_WRITE *PFN_DIR_CRAWLER_FORMAT_WRITE;
+
+// The batches of one request, in a ring: the oldest in flight is the next one to be written
+typedef struct _DIR_CRAWLER_FORMAT_STREAM {
+    PDIR_CRAWLER_REQ_CONTEXT pReqContext;
+    PDIR_CRAWLER_REQ_DESCR pReqDescr;   // read by the pool threads, also while the request is being aborted
+    PFN_DIR_CRAWLER_FORMAT_WRITE pfnWrite;
+    DWORD dwAttrCount;
+    DWORD dwBatchCount;
+    DWORD dwOldest;
+    DWORD dwInFlight;                   // queued or formatted, not written yet: the batch being filled comes after them
+    PDIR_CRAWLER_FORMAT_BATCH pBatches;
+} DIR_CRAWLER_FORMAT_STREAM, *PDIR_CRAWLER_FORMAT_STREAM;
+
+typedef struct _DIR_CRAWLER_FORMAT_STATS {
+    DWORD dwThreads;
+    LONGLONG llBatches;
+    LONGLONG llEntries;
+    LONGLONG llBypassed;                // formatted by their search thread
+    LONGLONG llFormatTicks;             // summed over the pool threads
+    LONGLONG llWaitTicks;               // search threads waiting for their oldest batch
+} DIR_CRAWLER_FORMAT_STATS, *PDIR_CRAWLER_FORMAT_STATS;
+
+/* --- VARIABLES ------------------------------------------------------------ */
+/* --- PROTOTYPES ----------------------------------------------------------- */
+void DirCrawlerFormatPoolInit(
+    _In_ const DWORD dwThreads,
+    _In_ const PFN_DIR_CRAWLER_FORMAT_FIELD pfnFormatField,
+    _In_ const PFN_DIR_CRAWLER_FORMAT_SIDE pfnFormatSide
+    );
+
+void DirCrawlerFormatPoolCleanup(
+    );
+
+BOOL DirCrawlerFormatPoolIsEnabled(
+    );
+
+PDIR_CRAWLER_FORMAT_STREAM DirCrawlerFormatStreamStart(
+    _In_ const PDIR_CRAWLER_REQ_CONTEXT pReqContext,
+    _In_ const PFN_DIR_CRAWLER_FORMAT_WRITE pfnWrite
+    );
+
+void DirCrawlerFormatStreamAdd(
+    _In_ const PDIR_CRAWLER_FORMAT_STREAM pStream,
+    _In_ const PTCHAR ptDn,
+    _In_ const PLDAP_ATTRIBUTE ppLdapAttributes[],
+    _In_ const DWORD adwLens[]          // one per attribute
+    );
+
+void DirCrawlerFormatStreamFlush(       // writes the batches in flight, at the end of every search
+    _In_ const PDIR_CRAWLER_FORMAT_STREAM pStream
+    );
+
+void DirCrawlerFormatStreamBypass(      // flush before an entry formatted by the search thread itself
+    _In_ const PDIR_CRAWLER_FORMAT_STREAM pStream
+    );
+
+void DirCrawlerFormatStreamEnd(
+    _Inout_ PDIR_CRAWLER_FORMAT_STREAM *ppStream
+    );
+
+void DirCrawlerFormatPoolAbortRequest(  // waits for the batches of the aborted request of the current thread, and drops them
+    );
+
+void DirCrawlerFormatPoolGetStats(
+    _Out_ PDIR_CRAWLER_FORMAT_STATS pStats
+    );
+
+#endif // __DIR_CRAWLER_FORMAT_POOL_H__
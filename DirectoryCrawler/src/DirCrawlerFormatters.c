@@ -1,15 +1,105 @@
 /* --- INCLUDES ------------------------------------------------------------- */
 #include "DirCrawlerFormatters.h"
+#include "DirCrawlerSd.h"
+#include "DirCrawlerJson.h"
 
 /* --- PRIVATE VARIABLES ---------------------------------------------------- */
+// Longest output of the formatters, on top of their fallbacks (hexadecimal or escaped string, at most 2 chars per byte)
+static const DWORD gsc_adwFormattersMaxLen[] = {
+    [DirCrawlerTypeStr] = 1,
+    [DirCrawlerTypeInt] = 1,
+    [DirCrawlerTypeBin] = 1,
+    [DirCrawlerTypeSd] = DIR_CRAWLER_SD_DACL_ID_LEN,
+    [DirCrawlerTypeSid] = DIR_CRAWLER_SD_SID_MAX_LEN,
+    [DirCrawlerTypeGuid] = DIR_CRAWLER_SD_GUID_LEN,
+    [DirCrawlerTypeFiletime] = DIR_CRAWLER_EPOCH_MAX_LEN,
+    [DirCrawlerTypeGentime] = DIR_CRAWLER_EPOCH_MAX_LEN,
+    [DirCrawlerTypeAuto] = 1,
+    [DirCrawlerTypeRaw] = 1,
+};
+
 /* --- PUBLIC VARIABLES ----------------------------------------------------- */
 const PFN_LDAP_ATTR_VALUE_FORMATTER gc_ppfnFormatters[] = {
     [DirCrawlerTypeStr] = FormatLdapAttrStr,
     [DirCrawlerTypeInt] = FormatLdapAttrInt,
     [DirCrawlerTypeBin] = FormatLdapAttrBin,
+    [DirCrawlerTypeSd] = FormatLdapAttrSd,
+    [DirCrawlerTypeSid] = FormatLdapAttrSid,
+    [DirCrawlerTypeGuid] = FormatLdapAttrGuid,
+    [DirCrawlerTypeFiletime] = FormatLdapAttrFiletime,
+    [DirCrawlerTypeGentime] = FormatLdapAttrGentime,
+    [DirCrawlerTypeAuto] = FormatLdapAttrStr,   // resolved before the requests are started, kept as a safety net
+    [DirCrawlerTypeRaw] = FormatLdapAttrRaw,
 };
 
 /* --- PRIVATE FUNCTIONS ---------------------------------------------------- */
+static BOOL FormatParseDigitsA(
+    _In_ const LPSTR pStr,
+    _In_ const DWORD dwCount,
+    _Out_ PDWORD pdwValue
+    ) {
+    DWORD i = 0;
+
+    *pdwValue = 0;
+    for (i = 0; i < dwCount; i++) {
+        if (pStr[i] < '0' || pStr[i] > '9') {
+            return FALSE;
+        }
+        *pdwValue = (*pdwValue * 10) + (pStr[i] - '0');
+    }
+    return TRUE;
+}
+
+static LONGLONG FormatDaysFromCivil(
+    _In_ const DWORD dwYear,
+    _In_ const DWORD dwMonth,
+    _In_ const DWORD dwDay
+    ) {
+    // Days since 1970-01-01 in the proleptic Gregorian calendar, with years starting in March so that leap days come last
+    LONGLONG llYear = (LONGLONG)dwYear - (dwMonth <= 2 ? 1 : 0);
+    LONGLONG llEra = (llYear >= 0 ? llYear : llYear - 399) / 400;
+    LONGLONG llYearOfEra = llYear - llEra * 400;
+    LONGLONG llDayOfYear = (153 * (dwMonth > 2 ? dwMonth - 3 : dwMonth + 9) + 2) / 5 + dwDay - 1;
+    LONGLONG llDayOfEra = llYearOfEra * 365 + llYearOfEra / 4 - llYearOfEra / 100 + llDayOfYear;
+
+    return llEra * 146097 + llDayOfEra - 719468;
+}
+
+static DWORD FormatLdapEpoch(
+    _In_ const LONGLONG llEpoch,
+    _In_opt_ LPSTR ptOutBuff
+    ) {
+    CHAR aEpoch[DIR_CRAWLER_EPOCH_MAX_LEN] = { 0 };
+    DWORD dwLen = 0;
+
+    if (llEpoch < 0) {
+        aEpoch[dwLen++] = '-';
+        dwLen += FormatDecimalA((ULONGLONG)-llEpoch, aEpoch + dwLen);
+    }
+    else {
+        dwLen += FormatDecimalA((ULONGLONG)llEpoch, aEpoch + dwLen);
+    }
+
+    if (ptOutBuff != NULL) {
+        CopyMemory(ptOutBuff, aEpoch, dwLen);
+        ptOutBuff[dwLen] = '\0';
+    }
+    return dwLen + 1;
+}
+
+static DWORD FormatLdapAttrFallback(
+    _In_ PLDAP_VALUE pLdapValue,
+    _In_opt_ LPSTR ptOutBuff,
+    _In_ const PTCHAR ptExpected
+    ) {
+    // Unexpected values are kept as they were received so that nothing is lost (reported once, on the formatting pass,
+    // without making the formatting threads wait for the log)
+    if (ptOutBuff != NULL) {
+        ASYNC_LOG(Warn, _T("Value is not a valid <%s>, writing it as is: <len:%u> <val:%.*hs>"), ptExpected, pLdapValue->dwSize, pLdapValue->dwSize, pLdapValue->pbData);
+    }
+    return FormatLdapAttrStr(pLdapValue, ptOutBuff);
+}
+
 /* --- PUBLIC FUNCTIONS ----------------------------------------------------- */
 DWORD FormatLdapAttrStr(
     _In_ PLDAP_VALUE pLdapValue,
@@ -45,15 +135,25 @@ DWORD FormatLdapAttrInt(
     _In_opt_ LPSTR ptOutBuff
     ) {
     // Numeric values are actually received as strings from the LDAP server
-    // We just verify here that the value is *actually* numeric
-    if (IsNumericA((PCHAR)pLdapValue->pbData)) {
-        return FormatLdapAttrStr(pLdapValue, ptOutBuff);
+    // We just verify here that the value is *actually* numeric, it then has no separator to escape and is copied as is
+    LPSTR pStr = (LPSTR)pLdapValue->pbData;
+    DWORD i = (pStr[0] == '-') ? 1 : 0;
+
+    while (pStr[i] >= '0' && pStr[i] <= '9') {
+        i += 1;
+    }
+
+    if (pStr[i] == '\0' && (i > 1 || (i == 1 && pStr[0] != '-'))) {
+        if (ptOutBuff != NULL) {
+            CopyMemory(ptOutBuff, pStr, i + 1);
+        }
+        return i + 1;
     }
     else {
 #ifdef _DEBUG
         DebugBreak();
 #endif
-        LOG(Warn, _T("Non-numeric value when exepecting one: <len:%u> <ptr:%p> <val:%*s>"), pLdapValue->dwSize, pLdapValue->pbData, pLdapValue->dwSize, pLdapValue->pbData);
+        ASYNC_LOG(Warn, _T("Non-numeric value when exepecting one: <len:%u> <ptr:%p> <val:%.*hs>"), pLdapValue->dwSize, pLdapValue->pbData, pLdapValue->dwSize, pLdapValue->pbData);
         if (ptOutBuff != NULL) {
             ptOutBuff[0] = '\0';
         }
@@ -61,6 +161,20 @@ DWORD FormatLdapAttrInt(
     }
 }
 
+DWORD FormatLdapAttrRaw(
+    _In_ PLDAP_VALUE pLdapValue,
+    _In_opt_ LPSTR ptOutBuff
+    ) {
+    // Only used for attributes whose schema syntax guarantees values without separator (integers, booleans): no check, no escaping
+    DWORD dwLen = (DWORD)strnlen((LPSTR)pLdapValue->pbData, pLdapValue->dwSize);
+
+    if (ptOutBuff != NULL) {
+        CopyMemory(ptOutBuff, pLdapValue->pbData, dwLen);
+        ptOutBuff[dwLen] = '\0';
+    }
+    return dwLen + 1;
+}
+
 DWORD FormatLdapAttrBin(
     _In_ PLDAP_VALUE pLdapValue,
     _In_opt_ LPSTR ptOutBuff
@@ -73,3 +187,163 @@ DWORD FormatLdapAttrBin(
 
     return dwLen;
 }
+
+DWORD FormatLdapAttrSd(
+    _In_ PLDAP_VALUE pLdapValue,
+    _In_opt_ LPSTR ptOutBuff
+    ) {
+    // The outfile only gets the DACL id, the descriptor itself goes to the '_sd' and '_ace' side outfiles
+    // Unparsable values are kept in hexadecimal so that nothing is lost
+    DIR_CRAWLER_SD sSd = { 0 };
+    ULONGLONG ullDaclId = 0;
+
+    if (DirCrawlerSdParse(pLdapValue->pbData, pLdapValue->dwSize, &sSd) == FALSE) {
+        return FormatLdapAttrBin(pLdapValue, ptOutBuff);
+    }
+
+    ullDaclId = DirCrawlerSdDaclId(&sSd);
+    if (ullDaclId == DIR_CRAWLER_SD_NO_DACL_ID) {
+        if (ptOutBuff != NULL) {
+            ptOutBuff[0] = '\0';
+        }
+        return 1;
+    }
+
+    if (ptOutBuff != NULL) {
+        _snprintf_s(ptOutBuff, DIR_CRAWLER_SD_DACL_ID_LEN, _TRUNCATE, "%016llx", ullDaclId);
+    }
+    return DIR_CRAWLER_SD_DACL_ID_LEN;
+}
+
+DWORD FormatLdapAttrSid(
+    _In_ PLDAP_VALUE pLdapValue,
+    _In_opt_ LPSTR ptOutBuff
+    ) {
+    DWORD dwLen = DirCrawlerSdFormatSid(pLdapValue->pbData, pLdapValue->dwSize, ptOutBuff);
+
+    // Malformed SIDs are kept in hexadecimal
+    if (dwLen == 1 && pLdapValue->dwSize > 0) {
+        return FormatLdapAttrBin(pLdapValue, ptOutBuff);
+    }
+    return dwLen;
+}
+
+DWORD FormatLdapAttrGuid(
+    _In_ PLDAP_VALUE pLdapValue,
+    _In_opt_ LPSTR ptOutBuff
+    ) {
+    if (pLdapValue->dwSize != DIR_CRAWLER_SD_GUID_SIZE) {
+        return FormatLdapAttrBin(pLdapValue, ptOutBuff);
+    }
+    return DirCrawlerSdFormatGuid(pLdapValue->pbData, pLdapValue->dwSize, ptOutBuff);
+}
+
+DWORD FormatLdapAttrFiletime(
+    _In_ PLDAP_VALUE pLdapValue,
+    _In_opt_ LPSTR ptOutBuff
+    ) {
+    // FILETIME values are received as decimal strings of 100ns intervals since 1601-01-01 UTC
+    // 0 and 0x7FFFFFFFFFFFFFFF both mean 'never' (accountExpires, lockoutTime...) and are written as empty values
+    ULONGLONG ullFiletime = 0;
+
+    if (FormatParseUnsignedA((LPSTR)pLdapValue->pbData, &ullFiletime) == FALSE) {
+        return FormatLdapAttrFallback(pLdapValue, ptOutBuff, JSON_TYPE_FILETIME);
+    }
+
+    if (ullFiletime == 0 || ullFiletime >= DIR_CRAWLER_FILETIME_NEVER) {
+        if (ptOutBuff != NULL) {
+            ptOutBuff[0] = '\0';
+        }
+        return 1;
+    }
+
+    return FormatLdapEpoch((LONGLONG)(ullFiletime / DIR_CRAWLER_FILETIME_TICKS_PER_SEC) - DIR_CRAWLER_FILETIME_EPOCH_DELTA, ptOutBuff);
+}
+
+DWORD FormatLdapAttrGentime(
+    _In_ PLDAP_VALUE pLdapValue,
+    _In_opt_ LPSTR ptOutBuff
+    ) {
+    // Generalized time as returned by AD: 'YYYYMMDDHHMMSS.0Z', the fraction is optional and ignored
+    LPSTR pStr = (LPSTR)pLdapValue->pbData;
+    DWORD dwYear = 0, dwMonth = 0, dwDay = 0, dwHour = 0, dwMinute = 0, dwSecond = 0;
+    DWORD i = 14;
+
+    if (FormatParseDigitsA(pStr, 4, &dwYear) == FALSE
+        || FormatParseDigitsA(pStr + 4, 2, &dwMonth) == FALSE || dwMonth < 1 || dwMonth > 12
+        || FormatParseDigitsA(pStr + 6, 2, &dwDay) == FALSE || dwDay < 1 || dwDay > 31
+        || FormatParseDigitsA(pStr + 8, 2, &dwHour) == FALSE || dwHour > 23
+        || FormatParseDigitsA(pStr + 10, 2, &dwMinute) == FALSE || dwMinute > 59
+        || FormatParseDigitsA(pStr + 12, 2, &dwSecond) == FALSE || dwSecond > 60) {
+        return FormatLdapAttrFallback(pLdapValue, ptOutBuff, JSON_TYPE_GENTIME);
+    }
+
+    if (pStr[i] == '.' || pStr[i] == ',') {
+        for (i += 1; pStr[i] >= '0' && pStr[i] <= '9'; i++);
+    }
+    if (pStr[i] != 'Z' || pStr[i + 1] != '\0') {
+        return FormatLdapAttrFallback(pLdapValue, ptOutBuff, JSON_TYPE_GENTIME);
+    }
+
+    return FormatLdapEpoch(FormatDaysFromCivil(dwYear, dwMonth, dwDay) * 86400 + dwHour * 3600 + dwMinute * 60 + dwSecond, ptOutBuff);
+}
+
+DWORD FormatLdapAttrMaxLen(
+    _In_ const DIR_CRAWLER_LDAP_ATTR_TYPE eType,
+    _In_ const PLDAP_VALUE pLdapValue
+    ) {
+    return max(gsc_adwFormattersMaxLen[eType], (pLdapValue->dwSize * 2) + 1);
+}
+
+BOOL FormatParseUnsignedA(
+    _In_ const LPSTR pStr,
+    _Out_ PULONGLONG pullValue
+    ) {
+    DWORD i = 0;
+
+    *pullValue = 0;
+    for (i = 0; pStr[i] != '\0'; i++) {
+        if (pStr[i] < '0' || pStr[i] > '9' || i >= DIR_CRAWLER_FILETIME_MAX_DIGITS) {
+            return FALSE;
+        }
+        *pullValue = (*pullValue * 10) + (pStr[i] - '0');
+    }
+    return i > 0;
+}
+
+DWORD FormatDecimalA(
+    _In_ ULONGLONG ullValue,
+    _Out_ LPSTR pOut
+    ) {
+    CHAR aDigits[DIR_CRAWLER_EPOCH_MAX_LEN] = { 0 };
+    DWORD dwCount = 0;
+    DWORD i = 0;
+
+    do {
+        aDigits[dwCount++] = (CHAR)('0' + (ullValue % 10));
+        ullValue /= 10;
+    } while (ullValue != 0);
+
+    for (i = 0; i < dwCount; i++) {
+        pOut[i] = aDigits[dwCount - 1 - i];
+    }
+    return dwCount;
+}
+
+DWORD FormatHexA(
+    _In_ ULONGLONG ullValue,
+    _In_ const DWORD dwDigits,
+    _In_ const BOOL bUpperCase,
+    _Out_ LPSTR pOut
+    ) {
+    static const CHAR sc_acLowerDigits[] = "0123456789abcdef";
+    static const CHAR sc_acUpperDigits[] = "0123456789ABCDEF";
+    const CHAR *pcDigits = bUpperCase ? sc_acUpperDigits : sc_acLowerDigits;
+    DWORD i = 0;
+
+    for (i = dwDigits; i > 0; i--) {
+        pOut[i - 1] = pcDigits[ullValue & 0xF];
+        ullValue >>= 4;
+    }
+    return dwDigits;
+}
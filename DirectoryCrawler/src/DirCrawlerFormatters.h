@@ -5,6 +5,11 @@
 #include "DirectoryCrawler.h"
 
 /* --- DEFINES -------------------------------------------------------------- */
+#define DIR_CRAWLER_EPOCH_MAX_LEN               21                  // sign + 19 digits + NULL terminator, also the max len of a 64 bits unsigned integer
+#define DIR_CRAWLER_FILETIME_TICKS_PER_SEC      10000000ULL         // FILETIME unit is 100ns
+#define DIR_CRAWLER_FILETIME_EPOCH_DELTA        11644473600LL       // seconds between 1601-01-01 and 1970-01-01
+#define DIR_CRAWLER_FILETIME_NEVER              0x7FFFFFFFFFFFFFFFULL
+#define DIR_CRAWLER_FILETIME_MAX_DIGITS         19                  // more would not fit in a ULONGLONG
 /* --- TYPES ---------------------------------------------------------------- */
 // Data formaters
 //  - if pOutBuff == return the len only
@@ -23,5 +28,36 @@ extern const PFN_LDAP_ATTR_VALUE_FORMATTER gc_ppfnFormatters[];
 FN_LDAP_ATTR_VALUE_FORMATTER FormatLdapAttrStr;
 FN_LDAP_ATTR_VALUE_FORMATTER FormatLdapAttrInt;
 FN_LDAP_ATTR_VALUE_FORMATTER FormatLdapAttrBin;
+FN_LDAP_ATTR_VALUE_FORMATTER FormatLdapAttrSd;
+FN_LDAP_ATTR_VALUE_FORMATTER FormatLdapAttrSid;
+FN_LDAP_ATTR_VALUE_FORMATTER FormatLdapAttrGuid;
+FN_LDAP_ATTR_VALUE_FORMATTER FormatLdapAttrFiletime;
+FN_LDAP_ATTR_VALUE_FORMATTER FormatLdapAttrGentime;
+FN_LDAP_ATTR_VALUE_FORMATTER FormatLdapAttrRaw;
+
+// Upper bound of the len returned by the formatter of this type, without formatting the value
+DWORD FormatLdapAttrMaxLen(
+    _In_ const DIR_CRAWLER_LDAP_ATTR_TYPE eType,
+    _In_ const PLDAP_VALUE pLdapValue
+    );
+
+// Decimal digits only, at most DIR_CRAWLER_FILETIME_MAX_DIGITS of them
+BOOL FormatParseUnsignedA(
+    _In_ const LPSTR pStr,
+    _Out_ PULONGLONG pullValue
+    );
+
+// Allocation-free integer rendering, no NULL terminator is written and the number of chars is returned
+DWORD FormatDecimalA(
+    _In_ ULONGLONG ullValue,
+    _Out_ LPSTR pOut
+    );
+
+DWORD FormatHexA(
+    _In_ ULONGLONG ullValue,
+    _In_ const DWORD dwDigits,
+    _In_ const BOOL bUpperCase,
+    _Out_ LPSTR pOut
+    );
 
 #endif // __DIR_CRAWLER_FORMATTERS_H__
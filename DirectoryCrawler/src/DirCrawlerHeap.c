@@ -0,0 +1,52 @@
+/* --- INCLUDES ------------------------------------------------------------- */
+#include "DirCrawlerHeap.h"
+
+/* --- PRIVATE VARIABLES ---------------------------------------------------- */
+static BOOL gs_bSharedHeap = FALSE;
+static __declspec(thread) PUTILS_HEAP gs_pThreadHeap = NULL;
+
+/* --- PUBLIC VARIABLES ----------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS ---------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS ----------------------------------------------------- */
+void DirCrawlerHeapInit(
+    _In_ const BOOL bShared
+    ) {
+    gs_bSharedHeap = bShared;
+    if (bShared == TRUE) {
+        LOG(Info, SUB_LOG(_T("Worker threads share the process heap")));
+    }
+}
+
+void DirCrawlerHeapThreadStart(
+    ) {
+    BOOL bResult = FALSE;
+
+    if (gs_bSharedHeap == TRUE || gs_pThreadHeap != NULL) {
+        return;
+    }
+
+    bResult = UtilsHeapCreate(&gs_pThreadHeap, DIR_CRAWLER_THREAD_HEAP_NAME, NULL);
+    if (!bResult) {
+        // Not fatal: the thread falls back to the shared heap
+        LOG(Err, _T("Failed to create heap of <thread:%#08x>: <err:%#08x>"), GetCurrentThreadId(), UtilsGetLastError());
+        gs_pThreadHeap = NULL;
+    }
+}
+
+void DirCrawlerHeapThreadEnd(
+    ) {
+    if (gs_pThreadHeap != NULL) {
+        UtilsHeapDestroy(&gs_pThreadHeap);
+        gs_pThreadHeap = NULL;
+    }
+}
+
+PUTILS_HEAP DirCrawlerHeapGet(
+    ) {
+    return gs_pThreadHeap != NULL ? gs_pThreadHeap : g_pDirCrawlerHeap;
+}
+
+BOOL DirCrawlerHeapIsShared(
+    ) {
+    return gs_bSharedHeap;
+}
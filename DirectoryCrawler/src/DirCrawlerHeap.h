@@ -0,0 +1,36 @@
+#ifndef __DIR_CRAWLER_HEAP_H__
+#define __DIR_CRAWLER_HEAP_H__
+
+/* --- INCLUDES ------------------------------------------------------------- */
+#include "DirectoryCrawler.h"
+
+/* --- DEFINES -------------------------------------------------------------- */
+//
+// Heap of the per-request path (controls and attributes arrays, CSV records, formatted values and conversion buffers).
+// Each worker thread owns one, so that the threads do not serialize on the lock of g_pDirCrawlerHeap. A buffer taken from
+// it must be freed by the same thread: what an aborted request leaves behind is released with the heap when the thread
+// exits. Threads without their own heap, and '--shared-heap' runs (to compare both), use g_pDirCrawlerHeap.
+//
+#define DIR_CRAWLER_THREAD_HEAP             (DirCrawlerHeapGet())
+#define DIR_CRAWLER_THREAD_HEAP_NAME        DIR_CRAWLER_TOOL_NAME _T("-thread")
+
+/* --- TYPES ---------------------------------------------------------------- */
+/* --- VARIABLES ------------------------------------------------------------ */
+/* --- PROTOTYPES ----------------------------------------------------------- */
+void DirCrawlerHeapInit(
+    _In_ const BOOL bShared
+    );
+
+void DirCrawlerHeapThreadStart(
+    );
+
+void DirCrawlerHeapThreadEnd(
+    );
+
+PUTILS_HEAP DirCrawlerHeapGet(
+    );
+
+BOOL DirCrawlerHeapIsShared(
+    );
+
+#endif // __DIR_CRAWLER_HEAP_H__
@@ -131,11 +131,11 @@ static BOOL DirCrawlerEntryExtractLdapCtrlsArr(
 }
 
 static BOOL DirCrawlerEntryExtractLdapSingleAttrTypeStr(
-    _In_ const PJSON_OBJECT pJsonElement,   // type str, type of an ldap attribute of a request, ("type": "str|int|bin")
+    _In_ const PJSON_OBJECT pJsonElement,   // type str, type of an ldap attribute of a request, ("type": "str|int|bin|sd|sid|guid|filetime|gentime|auto")
     _In_ const PVOID pvContext              // never null, type PDIR_CRAWLER_LDAP_ATTRIBUTE_DESCRIPTION
     ) {
-    static const PTCHAR sc_aptAttrTypes[] = { JSON_TYPE_STR, JSON_TYPE_INT, JSON_TYPE_BIN };
-    static const LDAP_REQ_SCOPE sc_aeAttrTypes[] = { DirCrawlerTypeStr, DirCrawlerTypeInt, DirCrawlerTypeBin };
+    static const PTCHAR sc_aptAttrTypes[] = { JSON_TYPE_STR, JSON_TYPE_INT, JSON_TYPE_BIN, JSON_TYPE_SD, JSON_TYPE_SID, JSON_TYPE_GUID, JSON_TYPE_FILETIME, JSON_TYPE_GENTIME, JSON_TYPE_AUTO };
+    static const LDAP_REQ_SCOPE sc_aeAttrTypes[] = { DirCrawlerTypeStr, DirCrawlerTypeInt, DirCrawlerTypeBin, DirCrawlerTypeSd, DirCrawlerTypeSid, DirCrawlerTypeGuid, DirCrawlerTypeFiletime, DirCrawlerTypeGentime, DirCrawlerTypeAuto };
     static_assert(_countof(sc_aptAttrTypes) == _countof(sc_aeAttrTypes), "Invalid array count");
 
     DWORD dwIndex = 0;
@@ -159,7 +159,7 @@ static BOOL DirCrawlerEntryExtractLdapSingleAttrNameStr(
 }
 
 static BOOL DirCrawlerEntryExtractLdapSingleAttr(
-    _In_ const PJSON_OBJECT pJsonElement,   // type ? must be obj, represents an ldap attribute of a request, ({"type":..., "name":...})
+    _In_ const PJSON_OBJECT pJsonElement,   // type ? must be obj, represents an ldap attribute of a request, ({"type":..., "name":...}), or the "*" wildcard
     _In_ const PVOID pvContext              // never null, type PDIR_CRAWLER_REQ_DESCR
     ) {
     static const JSON_REQUESTED_ELEMENT sc_asJsonLdapAttrElements[] = {
@@ -167,6 +167,16 @@ static BOOL DirCrawlerEntryExtractLdapSingleAttr(
         { .ptKey = JSON_TOKEN_NAME, .eExpectedType = JsonResultTypeString, .pfnCallback = DirCrawlerEntryExtractLdapSingleAttrNameStr, .bMustBePresent = TRUE },
     };
     PDIR_CRAWLER_REQ_DESCR pReqDescr = pvContext;
+    PDIR_CRAWLER_LDAP_ATTRIBUTE_DESCRIPTION pAttrDescr = NULL;
+
+    if (pJsonElement->eObjectType == JsonResultTypeString && STR_EQ(JSON_ATTR_WILDCARD, JSON_STRVAL(pJsonElement))) {
+        // Expanded from the schema catalog once it is loaded
+        pReqDescr->ldap.attributes.pAttrArray = UtilsHeapAllocOrReallocHelper(g_pDirCrawlerHeap, pReqDescr->ldap.attributes.pAttrArray, SIZEOF_ARRAY(DIR_CRAWLER_LDAP_ATTRIBUTE_DESCRIPTION, pReqDescr->ldap.attributes.dwAttrCount + 1));
+        pAttrDescr = &pReqDescr->ldap.attributes.pAttrArray[pReqDescr->ldap.attributes.dwAttrCount];
+        pAttrDescr->ptName = UtilsHeapStrDupHelper(g_pDirCrawlerHeap, JSON_ATTR_WILDCARD);
+        pAttrDescr->eType = DirCrawlerTypeAuto;
+        return TRUE;
+    }
 
     if (pJsonElement->eObjectType != JsonResultTypeObject) {
         FATAL(_T("JSON error: attribute <%u> of sub-element <%s> is not an object"), pReqDescr->ldap.attributes.dwAttrCount, pReqDescr->infos.ptName);
@@ -272,6 +282,26 @@ static BOOL DirCrawlerEntryExtractDescrStr(
     return TRUE;
 }
 
+static BOOL DirCrawlerEntryExtractTimeoutStr(
+    _In_ const PJSON_OBJECT pJsonElement,   // type str, seconds the request can run, ("timeout": "...")
+    _In_ const PVOID pvContext              // never null, type PDIR_CRAWLER_REQ_DESCR
+    ) {
+    PDIR_CRAWLER_REQ_DESCR pReqDescr = pvContext;
+    pReqDescr->limits.dwTimeout = _tstoi(JSON_STRVAL(pJsonElement));
+    LOG(Info, SUB_LOG(SUB_LOG(_T("Timeout   : <%us>"))), pReqDescr->limits.dwTimeout);
+    return TRUE;
+}
+
+static BOOL DirCrawlerEntryExtractMaxEntriesStr(
+    _In_ const PJSON_OBJECT pJsonElement,   // type str, entries the request can write, ("maxentries": "...")
+    _In_ const PVOID pvContext              // never null, type PDIR_CRAWLER_REQ_DESCR
+    ) {
+    PDIR_CRAWLER_REQ_DESCR pReqDescr = pvContext;
+    pReqDescr->limits.dwMaxEntries = _tstoi(JSON_STRVAL(pJsonElement));
+    LOG(Info, SUB_LOG(SUB_LOG(_T("MaxEntries: <%u>"))), pReqDescr->limits.dwMaxEntries);
+    return TRUE;
+}
+
 static BOOL DirCrawlerEntryExtractRequest(
     _In_ const PJSON_OBJECT pJsonElement,   // must have type str, describes a request, ("name": {"descr":..., "ldap":...} )
     _In_ const PVOID pvContext              // never null, type PDIR_CRAWLER_REQ_DESCR_ARRAY
@@ -279,6 +309,8 @@ static BOOL DirCrawlerEntryExtractRequest(
     static const JSON_REQUESTED_ELEMENT sc_asJsonMainElements[] = {
         { .ptKey = JSON_TOKEN_DESCR, .eExpectedType = JsonResultTypeString, .pfnCallback = DirCrawlerEntryExtractDescrStr, .bMustBePresent = TRUE },
         { .ptKey = JSON_TOKEN_LDAP, .eExpectedType = JsonResultTypeObject, .pfnCallback = DirCrawlerEntryExtractLdapObj, .bMustBePresent = TRUE },
+        { .ptKey = JSON_TOKEN_TIMEOUT, .eExpectedType = JsonResultTypeString, .pfnCallback = DirCrawlerEntryExtractTimeoutStr, .bMustBePresent = FALSE },
+        { .ptKey = JSON_TOKEN_MAX_ENTRIES, .eExpectedType = JsonResultTypeString, .pfnCallback = DirCrawlerEntryExtractMaxEntriesStr, .bMustBePresent = FALSE },
     };
     BOOL bResult = FALSE;
     PDIR_CRAWLER_REQ_DESCR_ARRAY pReqDescr = pvContext;
@@ -289,6 +321,8 @@ static BOOL DirCrawlerEntryExtractRequest(
 
     pReqDescr->pRequestsDescriptions = UtilsHeapAllocOrReallocHelper(g_pDirCrawlerHeap, pReqDescr->pRequestsDescriptions, SIZEOF_ARRAY(DIR_CRAWLER_REQ_DESCR, pReqDescr->dwRequestCount + 1));
     pReqDescr->pRequestsDescriptions[pReqDescr->dwRequestCount].infos.ptName = UtilsHeapStrDupHelper(g_pDirCrawlerHeap, pJsonElement->ptKey);
+    pReqDescr->pRequestsDescriptions[pReqDescr->dwRequestCount].limits.dwTimeout = 0;
+    pReqDescr->pRequestsDescriptions[pReqDescr->dwRequestCount].limits.dwMaxEntries = 0;
     LOG(Info, SUB_LOG(_T("Request <%u:%s>")), pReqDescr->dwRequestCount, pJsonElement->ptKey);
 
     bResult = JsonObjectForeachRequestedElement(pJsonElement, FALSE, sc_asJsonMainElements, _countof(sc_asJsonMainElements), &(pReqDescr->pRequestsDescriptions[pReqDescr->dwRequestCount]), NULL);
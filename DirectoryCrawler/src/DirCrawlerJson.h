@@ -11,6 +11,8 @@
 //
 #define JSON_TOKEN_DESCR                _T("descr")
 #define JSON_TOKEN_LDAP                 _T("ldap")
+#define JSON_TOKEN_TIMEOUT              _T("timeout")
+#define JSON_TOKEN_MAX_ENTRIES          _T("maxentries")
 #define JSON_TOKEN_BASE                 _T("base")
 #define JSON_TOKEN_SCOPE                _T("scope")
 #define JSON_TOKEN_FILTER               _T("filter")
@@ -33,11 +35,18 @@
 #define JSON_BASE_WELLKNOW_NC_DOMDNS    _T("domainDns")
 #define JSON_BASE_WELLKNOW_NC_FORDNS    _T("forestDns")
 #define JSON_BASE_WILDCARD_NC           _T("*")
+#define JSON_ATTR_WILDCARD              _T("*")     // "attrs": ["*", {...}], every non-constructed attribute of the schema catalog
 
 #define JSON_TYPE_NONE                  _T("none")
 #define JSON_TYPE_STR                   _T("str")
 #define JSON_TYPE_INT                   _T("int")
 #define JSON_TYPE_BIN                   _T("bin")
+#define JSON_TYPE_SD                    _T("sd")
+#define JSON_TYPE_SID                   _T("sid")
+#define JSON_TYPE_GUID                  _T("guid")
+#define JSON_TYPE_FILETIME              _T("filetime")
+#define JSON_TYPE_GENTIME               _T("gentime")
+#define JSON_TYPE_AUTO                  _T("auto")
 
 #define JSON_CONTROL_TYPE_CLIENT        _T("client")
 #define JSON_CONTROL_TYPE_SERVER        _T("server")
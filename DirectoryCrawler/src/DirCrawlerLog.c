@@ -0,0 +1,260 @@
+/* --- INCLUDES ------------------------------------------------------------- */
+#include "DirCrawlerLog.h"
+#include <stdarg.h>
+
+/* --- PRIVATE VARIABLES ---------------------------------------------------- */
+static volatile LONG gs_lStarted = FALSE;
+static HANDLE gs_hFlusherThread = NULL;
+static HANDLE gs_hStopEvent = NULL;
+static CRITICAL_SECTION gs_sFlushLock = { 0 };     // taken by the consumers only
+static PDIR_CRAWLER_LOG_RING volatile gs_pRingsHead = NULL;   // rings are only added to the list until the log is stopped
+static __declspec(thread) PDIR_CRAWLER_LOG_RING gs_pThreadRing = NULL;
+static DIR_CRAWLER_LOG_LEVEL gs_eMinLevel = DirCrawlerLogAll;
+static DWORD gs_dwBurst = DIR_CRAWLER_LOG_DEFAULT_BURST;
+static DIR_CRAWLER_LOG_SITE gs_aSites[DIR_CRAWLER_LOG_SITES] = { 0 };
+static volatile LONG gs_lDropped = 0;
+static LONGLONG gs_llTotalSuppressed = 0;          // protected by the flush lock
+
+static const PTCHAR gsc_aptLevelNames[] = {        // in DIR_CRAWLER_LOG_LEVEL order, as accepted by '-v' and '-w'
+    _T("ALL"), _T("DBG"), _T("INFO"), _T("WARN"), _T("ERR"), _T("SUCC"), _T("NONE")
+};
+
+/* --- PUBLIC VARIABLES ----------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS ---------------------------------------------------- */
+static DIR_CRAWLER_LOG_LEVEL DirCrawlerLogParseLevel(
+    _In_opt_ const PTCHAR ptLevel
+    ) {
+    DWORD i = 0;
+
+    for (i = 0; ptLevel != NULL && i < _countof(gsc_aptLevelNames); i++) {
+        if (_tcsicmp(ptLevel, gsc_aptLevelNames[i]) == 0) {
+            return (DIR_CRAWLER_LOG_LEVEL)i;
+        }
+    }
+    return DirCrawlerLogAll;    // unknown here: LogLib decides
+}
+
+static void DirCrawlerLogWrite(
+    _In_ const DIR_CRAWLER_LOG_LEVEL eLevel,
+    _In_ const PTCHAR ptMsg
+    ) {
+    // LOG only takes a level name
+    switch (eLevel) {
+    case DirCrawlerLogDbg: LOG(Dbg, _T("%s"), ptMsg); break;
+    case DirCrawlerLogInfo: LOG(Info, _T("%s"), ptMsg); break;
+    case DirCrawlerLogWarn: LOG(Warn, _T("%s"), ptMsg); break;
+    case DirCrawlerLogSucc: LOG(Succ, _T("%s"), ptMsg); break;
+    default: LOG(Err, _T("%s"), ptMsg); break;
+    }
+}
+
+static BOOL DirCrawlerLogIsMuted(
+    _In_ const PVOID pvFormat
+    ) {
+    DWORD dwIndex = (DWORD)(((ULONG_PTR)pvFormat >> 3) & (DIR_CRAWLER_LOG_SITES - 1));
+    PVOID pvCurrent = NULL;
+    DWORD i = 0;
+
+    // Open addressing, sites are never removed
+    for (i = 0; i < DIR_CRAWLER_LOG_SITES; i++) {
+        pvCurrent = InterlockedCompareExchangePointer(&gs_aSites[dwIndex].pvFormat, pvFormat, NULL);
+        if (pvCurrent == NULL || pvCurrent == pvFormat) {
+            if ((DWORD)InterlockedIncrement(&gs_aSites[dwIndex].lCount) > gs_dwBurst) {
+                InterlockedIncrement(&gs_aSites[dwIndex].lSuppressed);
+                return TRUE;
+            }
+            return FALSE;
+        }
+        dwIndex = (dwIndex + 1) & (DIR_CRAWLER_LOG_SITES - 1);
+    }
+    return FALSE;
+}
+
+static PDIR_CRAWLER_LOG_RING DirCrawlerLogGetRing(
+    ) {
+    if (gs_pThreadRing == NULL) {
+        // Rings live until the log is stopped, after every worker thread has exited
+        gs_pThreadRing = UtilsHeapAllocStructHelper(g_pDirCrawlerHeap, DIR_CRAWLER_LOG_RING);
+        gs_pThreadRing->lHead = 0;
+        gs_pThreadRing->lTail = 0;
+        do {
+            gs_pThreadRing->pNext = gs_pRingsHead;
+        } while (InterlockedCompareExchangePointer((PVOID volatile *)&gs_pRingsHead, gs_pThreadRing, gs_pThreadRing->pNext) != gs_pThreadRing->pNext);
+    }
+    return gs_pThreadRing;
+}
+
+static void DirCrawlerLogDrain(
+    ) {
+    PDIR_CRAWLER_LOG_RING pRing = NULL;
+    ULONG ulHead = 0;
+    ULONG ulTail = 0;
+
+    // Indexes wrap around: they are only compared for equality or subtracted
+    for (pRing = (PDIR_CRAWLER_LOG_RING)InterlockedCompareExchangePointer((PVOID volatile *)&gs_pRingsHead, NULL, NULL); pRing != NULL; pRing = pRing->pNext) {
+        ulTail = (ULONG)InterlockedCompareExchange(&pRing->lTail, 0, 0);
+        for (ulHead = (ULONG)pRing->lHead; ulHead != ulTail; ulHead++) {
+            DirCrawlerLogWrite(pRing->aSlots[ulHead & (DIR_CRAWLER_LOG_RING_SLOTS - 1)].eLevel, pRing->aSlots[ulHead & (DIR_CRAWLER_LOG_RING_SLOTS - 1)].atMsg);
+        }
+        InterlockedExchange(&pRing->lHead, (LONG)ulTail);
+    }
+}
+
+static void DirCrawlerLogReportSuppressed(
+    ) {
+    LONG lSuppressed = 0;
+    DWORD i = 0;
+
+    for (i = 0; i < DIR_CRAWLER_LOG_SITES; i++) {
+        if (gs_aSites[i].pvFormat == NULL) {
+            continue;
+        }
+        lSuppressed = InterlockedExchange(&gs_aSites[i].lSuppressed, 0);
+        InterlockedExchange(&gs_aSites[i].lCount, 0);
+        if (lSuppressed > 0) {
+            gs_llTotalSuppressed += lSuppressed;
+            LOG(Warn, _T("<%d> more messages suppressed like: %s"), lSuppressed, (PTCHAR)gs_aSites[i].pvFormat);
+        }
+    }
+}
+
+static DWORD WINAPI DirCrawlerLogFlusher(
+    LPVOID lpThreadParameter
+    ) {
+    UNREFERENCED_PARAMETER(lpThreadParameter);
+
+    ULONGLONG ullLastInterval = GetTickCount64();
+
+    while (WaitForSingleObject(gs_hStopEvent, DIR_CRAWLER_LOG_FLUSH_DELAY) == WAIT_TIMEOUT) {
+        EnterCriticalSection(&gs_sFlushLock);
+        DirCrawlerLogDrain();
+        if (GetTickCount64() - ullLastInterval >= DIR_CRAWLER_LOG_FLUSH_INTERVAL) {
+            DirCrawlerLogReportSuppressed();
+            ullLastInterval = GetTickCount64();
+        }
+        LeaveCriticalSection(&gs_sFlushLock);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/* --- PUBLIC FUNCTIONS ----------------------------------------------------- */
+void DirCrawlerLogAsync(
+    _In_ const DIR_CRAWLER_LOG_LEVEL eLevel,
+    _In_ const PTCHAR ptFormat,
+    ...
+    ) {
+    PDIR_CRAWLER_LOG_RING pRing = NULL;
+    PDIR_CRAWLER_LOG_SLOT pSlot = NULL;
+    TCHAR atMsg[DIR_CRAWLER_LOG_MSG_MAX_LEN] = { 0 };
+    ULONG ulTail = 0;
+    va_list vaArgs;
+
+    if (eLevel < gs_eMinLevel) {
+        return;
+    }
+
+    va_start(vaArgs, ptFormat);
+    if (InterlockedCompareExchange(&gs_lStarted, FALSE, FALSE) == FALSE) {
+        // Before the flusher starts and after it stops, including for the main thread
+        _vsntprintf_s(atMsg, _countof(atMsg), _TRUNCATE, ptFormat, vaArgs);
+        DirCrawlerLogWrite(eLevel, atMsg);
+        va_end(vaArgs);
+        return;
+    }
+
+    if (eLevel < DirCrawlerLogErr && gs_dwBurst > 0 && DirCrawlerLogIsMuted(ptFormat) == TRUE) {
+        va_end(vaArgs);
+        return;
+    }
+
+    pRing = DirCrawlerLogGetRing();
+    ulTail = (ULONG)pRing->lTail;
+    while (ulTail - (ULONG)InterlockedCompareExchange(&pRing->lHead, 0, 0) >= DIR_CRAWLER_LOG_RING_SLOTS) {
+        if (eLevel < DirCrawlerLogErr) {
+            InterlockedIncrement(&gs_lDropped);
+            va_end(vaArgs);
+            return;
+        }
+        Sleep(DIR_CRAWLER_LOG_FLUSH_DELAY);
+    }
+
+    pSlot = &pRing->aSlots[ulTail & (DIR_CRAWLER_LOG_RING_SLOTS - 1)];
+    pSlot->eLevel = eLevel;
+    if (_vsntprintf_s(pSlot->atMsg, _countof(pSlot->atMsg), _TRUNCATE, ptFormat, vaArgs) == -1) {
+        _tcscpy_s(&pSlot->atMsg[_countof(pSlot->atMsg) - _countof(DIR_CRAWLER_LOG_TRUNCATED_SUFFIX)], _countof(DIR_CRAWLER_LOG_TRUNCATED_SUFFIX), DIR_CRAWLER_LOG_TRUNCATED_SUFFIX);
+    }
+    va_end(vaArgs);
+
+    // Publishes the slot to the consumer
+    InterlockedExchange(&pRing->lTail, (LONG)(ulTail + 1));
+}
+
+void DirCrawlerLogFlush(
+    ) {
+    if (InterlockedCompareExchange(&gs_lStarted, FALSE, FALSE) == TRUE) {
+        EnterCriticalSection(&gs_sFlushLock);
+        DirCrawlerLogDrain();
+        LeaveCriticalSection(&gs_sFlushLock);
+    }
+}
+
+void DirCrawlerLogStart(
+    _In_ const PTCHAR ptConsoleLevel,
+    _In_opt_ const PTCHAR ptLogfileLevel,
+    _In_ const DWORD dwBurst
+    ) {
+    gs_eMinLevel = DirCrawlerLogParseLevel(ptConsoleLevel);
+    if (ptLogfileLevel != NULL) {
+        gs_eMinLevel = min(gs_eMinLevel, DirCrawlerLogParseLevel(ptLogfileLevel));
+    }
+    gs_dwBurst = dwBurst;
+
+    InitializeCriticalSection(&gs_sFlushLock);
+
+    gs_hStopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (gs_hStopEvent == NULL) {
+        FATAL(_T("Failed to create log flusher stop event: <gle:%#08x>"), GLE());
+    }
+
+    gs_hFlusherThread = CreateThread(NULL, 0, DirCrawlerLogFlusher, NULL, 0, NULL);
+    if (gs_hFlusherThread == NULL) {
+        FATAL(_T("Failed to create log flusher thread: <gle:%#08x>"), GLE());
+    }
+
+    InterlockedExchange(&gs_lStarted, TRUE);
+}
+
+void DirCrawlerLogStop(
+    ) {
+    PDIR_CRAWLER_LOG_RING pRing = NULL;
+    LONG lDropped = 0;
+
+    if (gs_hFlusherThread == NULL) {
+        return;
+    }
+
+    SetEvent(gs_hStopEvent);
+    WaitForSingleObject(gs_hFlusherThread, INFINITE);
+    CloseHandle(gs_hFlusherThread);
+    CloseHandle(gs_hStopEvent);
+    gs_hFlusherThread = NULL;
+    gs_hStopEvent = NULL;
+
+    // Worker threads have exited: the last messages are written synchronously from now on
+    InterlockedExchange(&gs_lStarted, FALSE);
+    DirCrawlerLogDrain();
+    DirCrawlerLogReportSuppressed();
+
+    lDropped = InterlockedExchange(&gs_lDropped, 0);
+    if (lDropped > 0 || gs_llTotalSuppressed > 0) {
+        LOG(Warn, _T("Asynchronous log: <%d> messages dropped (full ring), <%lld> suppressed (rate limit)"), lDropped, gs_llTotalSuppressed);
+    }
+
+    while (gs_pRingsHead != NULL) {
+        pRing = gs_pRingsHead;
+        gs_pRingsHead = pRing->pNext;
+        UtilsHeapFreeHelper(g_pDirCrawlerHeap, pRing);
+    }
+    DeleteCriticalSection(&gs_sFlushLock);
+}
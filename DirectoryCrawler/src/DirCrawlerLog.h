@@ -0,0 +1,55 @@
+#ifndef __DIR_CRAWLER_LOG_H__
+#define __DIR_CRAWLER_LOG_H__
+
+/* --- INCLUDES ------------------------------------------------------------- */
+#include "DirectoryCrawler.h"
+
+/* --- DEFINES -------------------------------------------------------------- */
+//
+// Asynchronous log of the worker threads (ASYNC_LOG, REQ_LOG). A message below the console and logfile levels is
+// dropped before being formatted. Otherwise it is formatted into a ring owned by the calling thread, without any lock,
+// and the flusher thread writes it through LogLib (the console, the logfile and their lock). The arguments are formatted
+// right away because most of them point to per-entry buffers freed just after the call.
+// Below 'Err', a call site logging more than '--log-burst' messages in a flush interval is muted until the next one:
+// the flusher then writes how many messages it suppressed. A full ring drops these messages and waits for the others.
+//
+#define DIR_CRAWLER_LOG_RING_SLOTS          128         // per thread, power of 2
+#define DIR_CRAWLER_LOG_MSG_MAX_LEN         512         // longer messages are truncated
+#define DIR_CRAWLER_LOG_FLUSH_INTERVAL      1000        // ms, also the rate-limiting window
+#define DIR_CRAWLER_LOG_FLUSH_DELAY         20          // ms between two drains of the rings
+#define DIR_CRAWLER_LOG_DEFAULT_BURST       20          // messages per call site and interval, 0 for no limit
+#define DIR_CRAWLER_LOG_SITES               256         // rate-limited call sites, power of 2 (beyond: not limited)
+#define DIR_CRAWLER_LOG_TRUNCATED_SUFFIX    _T("[...]")
+
+/* --- TYPES ---------------------------------------------------------------- */
+typedef struct _DIR_CRAWLER_LOG_SLOT {
+    DIR_CRAWLER_LOG_LEVEL eLevel;
+    TCHAR atMsg[DIR_CRAWLER_LOG_MSG_MAX_LEN];
+} DIR_CRAWLER_LOG_SLOT, *PDIR_CRAWLER_LOG_SLOT;
+
+// Single producer (its thread), single consumer (whoever holds the flush lock)
+typedef struct _DIR_CRAWLER_LOG_RING {
+    struct _DIR_CRAWLER_LOG_RING *pNext;
+    volatile LONG lHead;            // next slot to write out, advanced by the consumer
+    volatile LONG lTail;            // next slot to fill, advanced by the producer
+    DIR_CRAWLER_LOG_SLOT aSlots[DIR_CRAWLER_LOG_RING_SLOTS];
+} DIR_CRAWLER_LOG_RING, *PDIR_CRAWLER_LOG_RING;
+
+typedef struct _DIR_CRAWLER_LOG_SITE {
+    PVOID volatile pvFormat;        // call site key: its format string
+    volatile LONG lCount;           // messages in the current interval
+    volatile LONG lSuppressed;
+} DIR_CRAWLER_LOG_SITE, *PDIR_CRAWLER_LOG_SITE;
+
+/* --- VARIABLES ------------------------------------------------------------ */
+/* --- PROTOTYPES ----------------------------------------------------------- */
+void DirCrawlerLogStart(
+    _In_ const PTCHAR ptConsoleLevel,
+    _In_opt_ const PTCHAR ptLogfileLevel,
+    _In_ const DWORD dwBurst
+    );
+
+void DirCrawlerLogStop(
+    );
+
+#endif // __DIR_CRAWLER_LOG_H__
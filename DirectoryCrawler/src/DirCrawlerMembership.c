@@ -0,0 +1,202 @@
+/* --- INCLUDES ------------------------------------------------------------- */
+#include "DirCrawlerMembership.h"
+
+/* --- PRIVATE VARIABLES ---------------------------------------------------- */
+/* --- PUBLIC VARIABLES ----------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS ---------------------------------------------------- */
+static void DirCrawlerMembershipBuildGraph(
+    _In_ const PDIR_CRAWLER_EDGE_RECORD pEdges,
+    _In_ const ULONGLONG ullEdgeCount,
+    _In_ const DWORD dwNodeCount,
+    _Out_ PDIR_CRAWLER_MEMBERSHIP_GRAPH pGraph
+    ) {
+    PDWORD pdwSidOwner = NULL;
+    PDWORD pdwCursor = NULL;
+    DWORD dwMember = 0;
+    DWORD dwGroup = 0;
+    ULONGLONG i = 0;
+    DWORD n = 0;
+
+    pGraph->dwNodeCount = dwNodeCount;
+    pGraph->dwEdgeCount = 0;
+    pGraph->pdwOffsets = UtilsHeapAllocArrayHelper(g_pDirCrawlerHeap, DWORD, dwNodeCount + 2);
+    ZeroMemory(pGraph->pdwOffsets, SIZEOF_ARRAY(DWORD, dwNodeCount + 2));
+
+    // Primary groups are found by SID, the objectSid edges give the DN node owning each SID node
+    pdwSidOwner = UtilsHeapAllocArrayHelper(g_pDirCrawlerHeap, DWORD, dwNodeCount + 1);
+    ZeroMemory(pdwSidOwner, SIZEOF_ARRAY(DWORD, dwNodeCount + 1));
+    for (i = 0; i < ullEdgeCount; i++) {
+        if (pEdges[i].wRelation == DirCrawlerEdgeSid) {
+            pdwSidOwner[pEdges[i].dwTarget] = pEdges[i].dwSource;
+        }
+    }
+
+    // Two passes over the edges: out-degrees, then targets at their final place
+    for (i = 0; i < ullEdgeCount; i++) {
+        if (pEdges[i].wRelation == DirCrawlerEdgeMember || pEdges[i].wRelation == DirCrawlerEdgePrimaryGroup) {
+            dwMember = (pEdges[i].wRelation == DirCrawlerEdgeMember) ? pEdges[i].dwTarget : pEdges[i].dwSource;
+            pGraph->pdwOffsets[dwMember + 1] += 1;
+            pGraph->dwEdgeCount += 1;
+        }
+    }
+    for (n = 1; n <= dwNodeCount + 1; n++) {
+        pGraph->pdwOffsets[n] += pGraph->pdwOffsets[n - 1];
+    }
+
+    pGraph->pdwTargets = UtilsHeapAllocArrayHelper(g_pDirCrawlerHeap, DWORD, max(pGraph->dwEdgeCount, 1));
+    pdwCursor = UtilsHeapAllocArrayHelper(g_pDirCrawlerHeap, DWORD, dwNodeCount + 1);
+    CopyMemory(pdwCursor, pGraph->pdwOffsets, SIZEOF_ARRAY(DWORD, dwNodeCount + 1));
+    for (i = 0; i < ullEdgeCount; i++) {
+        if (pEdges[i].wRelation == DirCrawlerEdgeMember) {
+            dwMember = pEdges[i].dwTarget;
+            dwGroup = pEdges[i].dwSource;
+        }
+        else if (pEdges[i].wRelation == DirCrawlerEdgePrimaryGroup) {
+            dwMember = pEdges[i].dwSource;
+            dwGroup = pdwSidOwner[pEdges[i].dwTarget] != DIR_CRAWLER_EDGES_NO_NODE ? pdwSidOwner[pEdges[i].dwTarget] : pEdges[i].dwTarget;
+        }
+        else {
+            continue;
+        }
+        pGraph->pdwTargets[pdwCursor[dwMember]++] = dwGroup;
+    }
+
+    UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, pdwCursor);
+    UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, pdwSidOwner);
+}
+
+static void DirCrawlerMembershipPush(
+    _Inout_ PDIR_CRAWLER_MEMBERSHIP_WORKER pWorker,
+    _In_ const DWORD dwValue
+    ) {
+    if (pWorker->dwOutputCount == pWorker->dwOutputCapacity) {
+        pWorker->dwOutputCapacity = max(pWorker->dwOutputCapacity * 2, DIR_CRAWLER_MEMBERSHIP_MIN_SIZE);
+        pWorker->pdwOutput = UtilsHeapAllocOrReallocHelper(g_pDirCrawlerHeap, pWorker->pdwOutput, SIZEOF_ARRAY(DWORD, pWorker->dwOutputCapacity));
+    }
+    pWorker->pdwOutput[pWorker->dwOutputCount++] = dwValue;
+}
+
+static DWORD WINAPI DirCrawlerMembershipWorker(
+    _In_ PVOID pvParameter
+    ) {
+    PDIR_CRAWLER_MEMBERSHIP_WORKER pWorker = pvParameter;
+    PDIR_CRAWLER_MEMBERSHIP_GRAPH pGraph = pWorker->pGraph;
+    DWORD dwPrincipal = 0;
+    DWORD dwStackSize = 0;
+    DWORD dwCountIndex = 0;
+    DWORD dwNode = 0;
+    DWORD e = 0;
+
+    for (dwPrincipal = pWorker->dwFirstNode; dwPrincipal < pWorker->dwEndNode; dwPrincipal++) {
+        if (pGraph->pdwOffsets[dwPrincipal] == pGraph->pdwOffsets[dwPrincipal + 1]) {
+            continue;
+        }
+
+        DirCrawlerMembershipPush(pWorker, dwPrincipal);
+        dwCountIndex = pWorker->dwOutputCount;
+        DirCrawlerMembershipPush(pWorker, 0);
+
+        // Depth-first walk of the 'is member of' edges, stamps avoid clearing the visited set between principals
+        pWorker->pdwVisited[dwPrincipal] = dwPrincipal;
+        dwStackSize = 0;
+        pWorker->pdwStack[dwStackSize++] = dwPrincipal;
+        while (dwStackSize > 0) {
+            dwNode = pWorker->pdwStack[--dwStackSize];
+            for (e = pGraph->pdwOffsets[dwNode]; e < pGraph->pdwOffsets[dwNode + 1]; e++) {
+                if (pWorker->pdwVisited[pGraph->pdwTargets[e]] != dwPrincipal) {
+                    pWorker->pdwVisited[pGraph->pdwTargets[e]] = dwPrincipal;
+                    pWorker->pdwStack[dwStackSize++] = pGraph->pdwTargets[e];
+                    DirCrawlerMembershipPush(pWorker, pGraph->pdwTargets[e]);
+                }
+            }
+        }
+
+        pWorker->pdwOutput[dwCountIndex] = pWorker->dwOutputCount - dwCountIndex - 1;
+        pWorker->dwPrincipalCount += 1;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/* --- PUBLIC FUNCTIONS ----------------------------------------------------- */
+void DirCrawlerMembershipCompute(
+    _In_ const PTCHAR ptOutfile,
+    _In_ const DWORD dwThreadCount
+    ) {
+    DIR_CRAWLER_MEMBERSHIP_GRAPH sGraph = { 0 };
+    DIR_CRAWLER_EDGES_FILE_HEADER sFileHeader = { .dwMagic = DIR_CRAWLER_MEMBERSHIP_FILE_MAGIC, .dwVersion = DIR_CRAWLER_MEMBERSHIP_VERSION, .dwCount = 0 };
+    PDIR_CRAWLER_MEMBERSHIP_WORKER pWorkers = NULL;
+    PHANDLE phThreads = NULL;
+    PDIR_CRAWLER_EDGE_RECORD pEdges = NULL;
+    ULONGLONG ullEdgeCount = 0;
+    ULONGLONG ullTimeStart = GetTickCount64();
+    DWORD dwWorkers = max(dwThreadCount, 1);
+    DWORD dwNodeCount = DirCrawlerEdgesNodeCount();
+    DWORD dwRange = 0;
+    HANDLE hFile = INVALID_HANDLE_VALUE;
+    DWORD dwWritten = 0;
+    DWORD dwResult = 0;
+    BOOL bResult = FALSE;
+    DWORD i = 0;
+
+    pEdges = DirCrawlerEdgesKeptMemberships(&ullEdgeCount);
+    DirCrawlerMembershipBuildGraph(pEdges, ullEdgeCount, dwNodeCount, &sGraph);
+    LOG(Info, SUB_LOG(_T("Membership graph: <nodes:%u> <edges:%u>")), sGraph.dwNodeCount, sGraph.dwEdgeCount);
+
+    // Contiguous node ranges, so that the outfile is in node order whatever the number of workers
+    pWorkers = UtilsHeapAllocArrayHelper(g_pDirCrawlerHeap, DIR_CRAWLER_MEMBERSHIP_WORKER, dwWorkers);
+    phThreads = UtilsHeapAllocArrayHelper(g_pDirCrawlerHeap, HANDLE, dwWorkers);
+    dwRange = (dwNodeCount / dwWorkers) + 1;
+    for (i = 0; i < dwWorkers; i++) {
+        ZeroMemory(&pWorkers[i], sizeof(DIR_CRAWLER_MEMBERSHIP_WORKER));
+        pWorkers[i].pGraph = &sGraph;
+        pWorkers[i].dwFirstNode = min(1 + i * dwRange, dwNodeCount + 1);
+        pWorkers[i].dwEndNode = min(1 + (i + 1) * dwRange, dwNodeCount + 1);
+        pWorkers[i].pdwVisited = UtilsHeapAllocArrayHelper(g_pDirCrawlerHeap, DWORD, dwNodeCount + 1);
+        ZeroMemory(pWorkers[i].pdwVisited, SIZEOF_ARRAY(DWORD, dwNodeCount + 1));
+        pWorkers[i].pdwStack = UtilsHeapAllocArrayHelper(g_pDirCrawlerHeap, DWORD, sGraph.dwEdgeCount + 1);
+
+        phThreads[i] = CreateThread(NULL, 0, DirCrawlerMembershipWorker, &pWorkers[i], 0, NULL);
+        if (phThreads[i] == NULL) {
+            FATAL(_T("Failed to create membership thread <%u/%u>: <gle:%#08x>"), i + 1, dwWorkers, GLE());
+        }
+    }
+
+    dwResult = WaitForMultipleObjects(dwWorkers, phThreads, TRUE, INFINITE);
+    if (dwResult != WAIT_OBJECT_0) {
+        FATAL(_T("Failed to wait on membership threads: <%#08x>"), GLE());
+    }
+
+    hFile = CreateFile(ptOutfile, GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        FATAL(_T("Failed to create memberships outfile <%s>: <gle:%#08x>"), ptOutfile, GLE());
+    }
+    for (i = 0; i < dwWorkers; i++) {
+        sFileHeader.dwCount += pWorkers[i].dwPrincipalCount;
+    }
+    bResult = WriteFile(hFile, &sFileHeader, sizeof(sFileHeader), &dwWritten, NULL);
+    if (bResult == FALSE || dwWritten != sizeof(sFileHeader)) {
+        FATAL(_T("Failed to write memberships outfile header <%s>: <gle:%#08x>"), ptOutfile, GLE());
+    }
+
+    for (i = 0; i < dwWorkers; i++) {
+        CloseHandle(phThreads[i]);
+        if (pWorkers[i].dwOutputCount > 0) {
+            bResult = WriteFile(hFile, pWorkers[i].pdwOutput, pWorkers[i].dwOutputCount * sizeof(DWORD), &dwWritten, NULL);
+            if (bResult == FALSE || dwWritten != pWorkers[i].dwOutputCount * sizeof(DWORD)) {
+                FATAL(_T("Failed to write memberships outfile <%s>: <gle:%#08x>"), ptOutfile, GLE());
+            }
+            UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, pWorkers[i].pdwOutput);
+        }
+        UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, pWorkers[i].pdwVisited);
+        UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, pWorkers[i].pdwStack);
+    }
+    CloseHandle(hFile);
+
+    LOG(Info, SUB_LOG(_T("Memberships written to <%s>: <principals:%u> <threads:%u> <time:%.3fs>")), ptOutfile, sFileHeader.dwCount, dwWorkers, TIME_DIFF_SEC(ullTimeStart, GetTickCount64()));
+
+    UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, phThreads);
+    UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, pWorkers);
+    UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, sGraph.pdwTargets);
+    UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, sGraph.pdwOffsets);
+}
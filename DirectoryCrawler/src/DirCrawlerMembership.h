@@ -0,0 +1,49 @@
+#ifndef __DIR_CRAWLER_MEMBERSHIP_H__
+#define __DIR_CRAWLER_MEMBERSHIP_H__
+
+/* --- INCLUDES ------------------------------------------------------------- */
+#include "DirectoryCrawler.h"
+#include "DirCrawlerEdges.h"
+
+/* --- DEFINES -------------------------------------------------------------- */
+//
+// Transitive group memberships, computed at exit from the 'member', 'primaryGroupID' and 'objectSid' edges of the run.
+// <prefix>_LDAP_memberships.bin (little-endian DWORDs): file header (magic, version, principal count), then for every
+// principal: node id, group count, group node ids. Node ids are the ones of the '_edges_nodes' outfile.
+//
+#define DIR_CRAWLER_MEMBERSHIP_OUTFILE      _T("memberships")
+#define DIR_CRAWLER_MEMBERSHIP_FILE_MAGIC   0x5352424D  // 'MBRS'
+#define DIR_CRAWLER_MEMBERSHIP_VERSION      1
+#define DIR_CRAWLER_MEMBERSHIP_MIN_SIZE     4096        // DWORDs, initial size of the per-thread output buffers
+
+/* --- TYPES ---------------------------------------------------------------- */
+// Compressed sparse row 'is member of' graph: groups of node <n> are pdwTargets[pdwOffsets[n] .. pdwOffsets[n + 1]]
+typedef struct _DIR_CRAWLER_MEMBERSHIP_GRAPH {
+    DWORD dwNodeCount;          // node ids are 1..dwNodeCount
+    PDWORD pdwOffsets;          // dwNodeCount + 2 entries
+    PDWORD pdwTargets;
+    DWORD dwEdgeCount;
+} DIR_CRAWLER_MEMBERSHIP_GRAPH, *PDIR_CRAWLER_MEMBERSHIP_GRAPH;
+
+typedef struct _DIR_CRAWLER_MEMBERSHIP_WORKER {
+    PDIR_CRAWLER_MEMBERSHIP_GRAPH pGraph;
+    DWORD dwFirstNode;
+    DWORD dwEndNode;            // excluded
+    PDWORD pdwVisited;          // one stamp per node, the id of the last principal that reached it
+    PDWORD pdwStack;            // at most one entry per edge
+
+    // Output records of the range, written in node order once all the workers are done
+    PDWORD pdwOutput;
+    DWORD dwOutputCount;
+    DWORD dwOutputCapacity;
+    DWORD dwPrincipalCount;
+} DIR_CRAWLER_MEMBERSHIP_WORKER, *PDIR_CRAWLER_MEMBERSHIP_WORKER;
+
+/* --- VARIABLES ------------------------------------------------------------ */
+/* --- PROTOTYPES ----------------------------------------------------------- */
+void DirCrawlerMembershipCompute(
+    _In_ const PTCHAR ptOutfile,
+    _In_ const DWORD dwThreadCount
+    );
+
+#endif // __DIR_CRAWLER_MEMBERSHIP_H__
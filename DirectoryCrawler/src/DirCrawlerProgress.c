@@ -0,0 +1,381 @@
+/* --- INCLUDES ------------------------------------------------------------- */
+#include "DirCrawlerProgress.h"
+#include "DirCrawlerStats.h"
+#include <stdarg.h>
+
+/* --- PRIVATE VARIABLES ---------------------------------------------------- */
+static HANDLE gs_hMonitorThread = NULL;
+static HANDLE gs_hStopEvent = NULL;
+static DWORD gs_dwInterval = DIR_CRAWLER_PROGRESS_DEFAULT_INTERVAL;
+static PSLIST_HEADER gs_pReqListHead = NULL;
+static TCHAR gs_atOutFile[MAX_PATH] = { 0 };
+static TCHAR gs_atTmpFile[MAX_PATH] = { 0 };
+static LONGLONG gs_llStartTicks = 0;
+
+// Only touched by the thread writing the metrics file (monitor thread, then main thread once the monitor is stopped)
+static LONGLONG gs_llLastSampleTicks = 0;
+static LONGLONG gs_llLastSampleEntries = 0;
+
+// Entries count of every request of the previous run, read from the metrics file it left behind
+static PDIR_CRAWLER_PROGRESS_PREVIOUS gs_pPrevious = NULL;
+static DWORD gs_dwPreviousCount = 0;
+
+/* --- PUBLIC VARIABLES ----------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS ---------------------------------------------------- */
+static void DirCrawlerProgressFlush(
+    _In_ const PDIR_CRAWLER_PROGRESS_WRITER pWriter
+    ) {
+    DWORD dwWritten = 0;
+
+    if (pWriter->bFailed == FALSE && pWriter->dwLen > 0) {
+        if (WriteFile(pWriter->hFile, pWriter->acBuffer, pWriter->dwLen, &dwWritten, NULL) == FALSE || dwWritten != pWriter->dwLen) {
+            pWriter->bFailed = TRUE;
+        }
+    }
+    pWriter->dwLen = 0;
+}
+
+static void DirCrawlerProgressPrintf(
+    _In_ const PDIR_CRAWLER_PROGRESS_WRITER pWriter,
+    _In_ const char *pcFormat,
+    ...
+    ) {
+    va_list vaArgs;
+    int iLen = 0;
+
+    va_start(vaArgs, pcFormat);
+    iLen = _vsnprintf_s(pWriter->acBuffer + pWriter->dwLen, DIR_CRAWLER_PROGRESS_BUFFER_SIZE - pWriter->dwLen, _TRUNCATE, pcFormat, vaArgs);
+    va_end(vaArgs);
+
+    if (iLen < 0) {
+        // Does not fit: flush what is already formatted and retry on an empty buffer (lines are way shorter than the buffer)
+        pWriter->acBuffer[pWriter->dwLen] = 0;
+        DirCrawlerProgressFlush(pWriter);
+        va_start(vaArgs, pcFormat);
+        iLen = _vsnprintf_s(pWriter->acBuffer, DIR_CRAWLER_PROGRESS_BUFFER_SIZE, _TRUNCATE, pcFormat, vaArgs);
+        va_end(vaArgs);
+    }
+    if (iLen > 0) {
+        pWriter->dwLen += (DWORD)iLen;
+    }
+}
+
+static void DirCrawlerProgressHeader(
+    _In_ const PDIR_CRAWLER_PROGRESS_WRITER pWriter,
+    _In_ const char *pcName,
+    _In_ const char *pcType,
+    _In_ const char *pcHelp
+    ) {
+    DirCrawlerProgressPrintf(pWriter, "# HELP " DIR_CRAWLER_PROGRESS_METRIC_PREFIX "%s %s\n", pcName, pcHelp);
+    DirCrawlerProgressPrintf(pWriter, "# TYPE " DIR_CRAWLER_PROGRESS_METRIC_PREFIX "%s %s\n", pcName, pcType);
+}
+
+static void DirCrawlerProgressLabel(
+    _In_ const PTCHAR ptValue,
+    _Out_ char *pcOut,
+    _In_ const DWORD dwSize
+    ) {
+    char acUtf8[MAX_LINE] = { 0 };
+    char *pcCurrent = NULL;
+    DWORD dwLen = 0;
+
+#ifdef UNICODE
+    if (WideCharToMultiByte(CP_UTF8, 0, ptValue, -1, acUtf8, sizeof(acUtf8), NULL, NULL) == 0) {
+        acUtf8[0] = 0;
+    }
+#else
+    strncpy_s(acUtf8, sizeof(acUtf8), ptValue, _TRUNCATE);
+#endif
+
+    // Label values escaping of the text exposition format: backslash, double-quote and line feed
+    for (pcCurrent = acUtf8; *pcCurrent != 0 && dwLen + 2 < dwSize; pcCurrent++) {
+        switch (*pcCurrent) {
+        case '\\': pcOut[dwLen++] = '\\'; pcOut[dwLen++] = '\\'; break;
+        case '"': pcOut[dwLen++] = '\\'; pcOut[dwLen++] = '"'; break;
+        case '\n': pcOut[dwLen++] = '\\'; pcOut[dwLen++] = 'n'; break;
+        default: pcOut[dwLen++] = *pcCurrent; break;
+        }
+    }
+    pcOut[dwLen] = 0;
+}
+
+static PDIR_CRAWLER_PROGRESS_PREVIOUS DirCrawlerProgressFindPrevious(
+    _In_ const PTCHAR ptRequestName
+    ) {
+    DWORD i = 0;
+
+    for (i = 0; i < gs_dwPreviousCount; i++) {
+        if (STR_EQ(gs_pPrevious[i].ptRequestName, ptRequestName)) {
+            return &gs_pPrevious[i];
+        }
+    }
+    return NULL;
+}
+
+static void DirCrawlerProgressLoadPrevious(
+    ) {
+    static const char sc_acPrefix[] = DIR_CRAWLER_PROGRESS_METRIC_PREFIX "request_entries_total{request=\"";
+    FILE *pFile = NULL;
+    char acLine[MAX_LINE] = { 0 };
+    char acName[MAX_LINE] = { 0 };
+    char *pcCurrent = NULL;
+    DWORD dwLen = 0;
+    LONGLONG llEntries = 0;
+    PTCHAR ptName = NULL;
+
+    if (_tfopen_s(&pFile, gs_atOutFile, _T("rb")) != 0 || pFile == NULL) {
+        LOG(Info, SUB_LOG(_T("No previous metrics file <%s>, no ETA will be computed")), gs_atOutFile);
+        return;
+    }
+
+    while (fgets(acLine, sizeof(acLine), pFile) != NULL) {
+        if (strncmp(acLine, sc_acPrefix, sizeof(sc_acPrefix) - 1) != 0) {
+            continue;
+        }
+
+        // Unescape the label value, then read the sample value after the closing brace
+        dwLen = 0;
+        for (pcCurrent = acLine + sizeof(sc_acPrefix) - 1; *pcCurrent != 0 && *pcCurrent != '"' && dwLen + 1 < sizeof(acName); pcCurrent++) {
+            if (*pcCurrent == '\\' && *(pcCurrent + 1) != 0) {
+                pcCurrent++;
+                acName[dwLen++] = (*pcCurrent == 'n' ? '\n' : *pcCurrent);
+            }
+            else {
+                acName[dwLen++] = *pcCurrent;
+            }
+        }
+        acName[dwLen] = 0;
+        pcCurrent = strstr(pcCurrent, "} ");
+        if (pcCurrent == NULL || sscanf_s(pcCurrent + 2, "%lld", &llEntries) != 1) {
+            continue;
+        }
+
+#ifdef UNICODE
+        dwLen = MultiByteToWideChar(CP_UTF8, 0, acName, -1, NULL, 0);
+        if (dwLen == 0) {
+            continue;
+        }
+        ptName = UtilsHeapAllocStrHelper(g_pDirCrawlerHeap, dwLen * sizeof(TCHAR));
+        MultiByteToWideChar(CP_UTF8, 0, acName, -1, ptName, dwLen);
+#else
+        ptName = UtilsHeapStrDupHelper(g_pDirCrawlerHeap, acName);
+#endif
+        gs_dwPreviousCount += 1;
+        gs_pPrevious = UtilsHeapAllocOrReallocHelper(g_pDirCrawlerHeap, gs_pPrevious, SIZEOF_ARRAY(DIR_CRAWLER_PROGRESS_PREVIOUS, gs_dwPreviousCount));
+        gs_pPrevious[gs_dwPreviousCount - 1].ptRequestName = ptName;
+        gs_pPrevious[gs_dwPreviousCount - 1].llEntries = llEntries;
+    }
+    fclose(pFile);
+
+    LOG(Info, SUB_LOG(_T("Read entries count of <%u> requests from previous metrics file <%s>")), gs_dwPreviousCount, gs_atOutFile);
+}
+
+static void DirCrawlerProgressCountRequest(
+    _In_ const PDIR_CRAWLER_REQ_STATS pStats,
+    _In_opt_ PVOID pvContext
+    ) {
+    PDIR_CRAWLER_PROGRESS_SAMPLE pSample = (PDIR_CRAWLER_PROGRESS_SAMPLE)pvContext;
+    PDIR_CRAWLER_PROGRESS_PREVIOUS pPrevious = DirCrawlerProgressFindPrevious(pStats->pReqDescr->infos.ptName);
+    BOOL bEnded = (pStats->llEndTicks != 0);
+
+    if (bEnded == FALSE) {
+        pSample->dwRunning += 1;
+        pSample->dwInFlight += (pStats->lSearching != FALSE);
+    }
+    else if (pStats->bSucceeded == TRUE) {
+        pSample->dwSucceeded += 1;
+    }
+    else {
+        pSample->dwFailed += 1;
+    }
+
+    if (pPrevious != NULL) {
+        pSample->llConsumedExpected += (bEnded == TRUE ? pPrevious->llEntries : min(pStats->llEntries, pPrevious->llEntries));
+    }
+}
+
+static void DirCrawlerProgressWriteRequest(
+    _In_ const PDIR_CRAWLER_REQ_STATS pStats,
+    _In_opt_ PVOID pvContext
+    ) {
+    PDIR_CRAWLER_PROGRESS_SAMPLE pSample = (PDIR_CRAWLER_PROGRESS_SAMPLE)pvContext;
+    PDIR_CRAWLER_PROGRESS_PREVIOUS pPrevious = NULL;
+    LONGLONG llEntries = pStats->llEntries;
+    LONGLONG llEndTicks = pStats->llEndTicks != 0 ? pStats->llEndTicks : pSample->llNow;
+    LONGLONG llLastEntryTicks = pStats->llLastEntryTicks != 0 ? pStats->llLastEntryTicks : pStats->llStartTicks;
+    char acName[MAX_LINE] = { 0 };
+
+    DirCrawlerProgressLabel(pStats->pReqDescr->infos.ptName, acName, sizeof(acName));
+
+    switch (pSample->eMetric) {
+    case ProgressReqMetricEntries:
+        DirCrawlerProgressPrintf(pSample->pWriter, DIR_CRAWLER_PROGRESS_METRIC_PREFIX "request_entries_total{request=\"%s\"} %lld\n", acName, llEntries);
+        break;
+    case ProgressReqMetricRate:
+        DirCrawlerProgressPrintf(pSample->pWriter, DIR_CRAWLER_PROGRESS_METRIC_PREFIX "request_entries_per_second{request=\"%s\"} %.1f\n", acName,
+            llEndTicks > pStats->llStartTicks ? (double)llEntries / DirCrawlerStatsTicksToSec(llEndTicks - pStats->llStartTicks) : 0);
+        break;
+    case ProgressReqMetricIdle:
+        if (pStats->llEndTicks == 0) {
+            DirCrawlerProgressPrintf(pSample->pWriter, DIR_CRAWLER_PROGRESS_METRIC_PREFIX "request_idle_seconds{request=\"%s\"} %.3f\n", acName, DirCrawlerStatsTicksToSec(pSample->llNow - llLastEntryTicks));
+        }
+        break;
+    case ProgressReqMetricExpected:
+        pPrevious = DirCrawlerProgressFindPrevious(pStats->pReqDescr->infos.ptName);
+        if (pPrevious != NULL) {
+            DirCrawlerProgressPrintf(pSample->pWriter, DIR_CRAWLER_PROGRESS_METRIC_PREFIX "request_expected_entries{request=\"%s\"} %lld\n", acName, pPrevious->llEntries);
+        }
+        break;
+    }
+}
+
+static void DirCrawlerProgressWriteMetrics(
+    ) {
+    static DIR_CRAWLER_PROGRESS_WRITER s_sWriter = { 0 }; // too large for the monitor thread stack, and never used concurrently
+    DIR_CRAWLER_PROGRESS_SAMPLE sSample = { 0 };
+    LONGLONG llEntries = 0;
+    LONGLONG llFormattedBytes = 0;
+    LONGLONG llExpected = 0;
+    double dElapsed = 0;
+    double dSampleRate = 0;
+    DWORD i = 0;
+
+    sSample.llNow = DirCrawlerStatsNow();
+    sSample.pWriter = &s_sWriter;
+    DirCrawlerStatsGetTotals(&llEntries, &llFormattedBytes);
+    DirCrawlerStatsForEach(DirCrawlerProgressCountRequest, &sSample);
+
+    dElapsed = DirCrawlerStatsTicksToSec(sSample.llNow - gs_llStartTicks);
+    if (sSample.llNow > gs_llLastSampleTicks) {
+        dSampleRate = (double)(llEntries - gs_llLastSampleEntries) / DirCrawlerStatsTicksToSec(sSample.llNow - gs_llLastSampleTicks);
+    }
+    gs_llLastSampleTicks = sSample.llNow;
+    gs_llLastSampleEntries = llEntries;
+
+    s_sWriter.hFile = CreateFile(gs_atTmpFile, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (s_sWriter.hFile == INVALID_HANDLE_VALUE) {
+        LOG(Warn, _T("Failed to create metrics file <%s>: <gle:%#08x>"), gs_atTmpFile, GLE());
+        return;
+    }
+    s_sWriter.bFailed = FALSE;
+    s_sWriter.dwLen = 0;
+
+    DirCrawlerProgressHeader(&s_sWriter, "entries_total", "counter", "Entries written to the outfiles by all requests");
+    DirCrawlerProgressPrintf(&s_sWriter, DIR_CRAWLER_PROGRESS_METRIC_PREFIX "entries_total %lld\n", llEntries);
+    DirCrawlerProgressHeader(&s_sWriter, "formatted_bytes_total", "counter", "Bytes of formatted attribute values handed to the CSV writer");
+    DirCrawlerProgressPrintf(&s_sWriter, DIR_CRAWLER_PROGRESS_METRIC_PREFIX "formatted_bytes_total %lld\n", llFormattedBytes);
+    DirCrawlerProgressHeader(&s_sWriter, "entries_per_second", "gauge", "Entries written per second since the previous sample");
+    DirCrawlerProgressPrintf(&s_sWriter, DIR_CRAWLER_PROGRESS_METRIC_PREFIX "entries_per_second %.1f\n", dSampleRate);
+    DirCrawlerProgressHeader(&s_sWriter, "elapsed_seconds", "gauge", "Time elapsed since the requests started");
+    DirCrawlerProgressPrintf(&s_sWriter, DIR_CRAWLER_PROGRESS_METRIC_PREFIX "elapsed_seconds %.3f\n", dElapsed);
+    DirCrawlerProgressHeader(&s_sWriter, "inflight_searches", "gauge", "LDAP searches currently waiting for or processing entries");
+    DirCrawlerProgressPrintf(&s_sWriter, DIR_CRAWLER_PROGRESS_METRIC_PREFIX "inflight_searches %u\n", sSample.dwInFlight);
+    DirCrawlerProgressHeader(&s_sWriter, "queued_requests", "gauge", "Requests not yet picked by a worker thread");
+    DirCrawlerProgressPrintf(&s_sWriter, DIR_CRAWLER_PROGRESS_METRIC_PREFIX "queued_requests %u\n", (DWORD)QueryDepthSList(gs_pReqListHead));
+    DirCrawlerProgressHeader(&s_sWriter, "requests", "gauge", "Requests picked by a worker thread, by state");
+    DirCrawlerProgressPrintf(&s_sWriter, DIR_CRAWLER_PROGRESS_METRIC_PREFIX "requests{state=\"running\"} %u\n", sSample.dwRunning);
+    DirCrawlerProgressPrintf(&s_sWriter, DIR_CRAWLER_PROGRESS_METRIC_PREFIX "requests{state=\"succeeded\"} %u\n", sSample.dwSucceeded);
+    DirCrawlerProgressPrintf(&s_sWriter, DIR_CRAWLER_PROGRESS_METRIC_PREFIX "requests{state=\"failed\"} %u\n", sSample.dwFailed);
+
+    // ETA: entries the previous run had and this one has not produced yet, at the average rate of this run
+    if (gs_dwPreviousCount > 0 && llEntries > 0 && dElapsed > 0) {
+        for (i = 0; i < gs_dwPreviousCount; i++) {
+            llExpected += gs_pPrevious[i].llEntries;
+        }
+        DirCrawlerProgressHeader(&s_sWriter, "eta_seconds", "gauge", "Estimated remaining time, based on the entries count of the previous run");
+        DirCrawlerProgressPrintf(&s_sWriter, DIR_CRAWLER_PROGRESS_METRIC_PREFIX "eta_seconds %.0f\n", (double)max(llExpected - sSample.llConsumedExpected, 0) / ((double)llEntries / dElapsed));
+    }
+
+    DirCrawlerProgressHeader(&s_sWriter, "request_entries_total", "counter", "Entries written to the outfile of the request");
+    sSample.eMetric = ProgressReqMetricEntries;
+    DirCrawlerStatsForEach(DirCrawlerProgressWriteRequest, &sSample);
+    DirCrawlerProgressHeader(&s_sWriter, "request_entries_per_second", "gauge", "Average entries written per second by the request");
+    sSample.eMetric = ProgressReqMetricRate;
+    DirCrawlerStatsForEach(DirCrawlerProgressWriteRequest, &sSample);
+    DirCrawlerProgressHeader(&s_sWriter, "request_idle_seconds", "gauge", "Time since the running request wrote its last entry");
+    sSample.eMetric = ProgressReqMetricIdle;
+    DirCrawlerStatsForEach(DirCrawlerProgressWriteRequest, &sSample);
+    if (gs_dwPreviousCount > 0) {
+        DirCrawlerProgressHeader(&s_sWriter, "request_expected_entries", "gauge", "Entries written by the request during the previous run");
+        sSample.eMetric = ProgressReqMetricExpected;
+        DirCrawlerStatsForEach(DirCrawlerProgressWriteRequest, &sSample);
+    }
+
+    DirCrawlerProgressFlush(&s_sWriter);
+    CloseHandle(s_sWriter.hFile);
+    s_sWriter.hFile = INVALID_HANDLE_VALUE;
+
+    // Replace the metrics file in one step, so that a collector never reads a partial file
+    if (s_sWriter.bFailed == TRUE) {
+        LOG(Warn, _T("Failed to write metrics file <%s>: <gle:%#08x>"), gs_atTmpFile, GLE());
+    }
+    else if (MoveFileEx(gs_atTmpFile, gs_atOutFile, MOVEFILE_REPLACE_EXISTING) == FALSE) {
+        LOG(Warn, _T("Failed to replace metrics file <%s>: <gle:%#08x>"), gs_atOutFile, GLE());
+    }
+}
+
+static DWORD WINAPI DirCrawlerProgressMonitor(
+    LPVOID lpThreadParameter
+    ) {
+    UNREFERENCED_PARAMETER(lpThreadParameter);
+
+    while (WaitForSingleObject(gs_hStopEvent, gs_dwInterval * 1000) == WAIT_TIMEOUT) {
+        DirCrawlerProgressWriteMetrics();
+    }
+
+    LOG(Dbg, _T("Exiting progress monitor <thread:%#08x>"), GetCurrentThreadId());
+    return EXIT_SUCCESS;
+}
+
+/* --- PUBLIC FUNCTIONS ----------------------------------------------------- */
+void DirCrawlerProgressStart(
+    _In_ const PTCHAR ptOutFile,
+    _In_ const DWORD dwInterval,
+    _In_ const PSLIST_HEADER pReqListHead
+    ) {
+    _tcscpy_s(gs_atOutFile, MAX_PATH, ptOutFile);
+    _stprintf_s(gs_atTmpFile, MAX_PATH, _T("%s%s"), ptOutFile, DIR_CRAWLER_PROGRESS_TMP_SUFFIX);
+    gs_dwInterval = dwInterval > 0 ? dwInterval : DIR_CRAWLER_PROGRESS_DEFAULT_INTERVAL;
+    gs_pReqListHead = pReqListHead;
+    gs_llStartTicks = DirCrawlerStatsNow();
+    gs_llLastSampleTicks = gs_llStartTicks;
+
+    DirCrawlerProgressLoadPrevious();
+
+    gs_hStopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (gs_hStopEvent == NULL) {
+        FATAL(_T("Failed to create progress monitor stop event: <gle:%#08x>"), GLE());
+    }
+
+    gs_hMonitorThread = CreateThread(NULL, 0, DirCrawlerProgressMonitor, NULL, 0, NULL);
+    if (gs_hMonitorThread == NULL) {
+        FATAL(_T("Failed to create progress monitor thread: <gle:%#08x>"), GLE());
+    }
+
+    LOG(Info, SUB_LOG(_T("Writing live metrics to <%s> every <%u> seconds")), gs_atOutFile, gs_dwInterval);
+}
+
+void DirCrawlerProgressStop(
+    ) {
+    DWORD i = 0;
+
+    if (gs_hMonitorThread == NULL) {
+        return;
+    }
+
+    SetEvent(gs_hStopEvent);
+    WaitForSingleObject(gs_hMonitorThread, INFINITE);
+    CloseHandle(gs_hMonitorThread);
+    CloseHandle(gs_hStopEvent);
+    gs_hMonitorThread = NULL;
+    gs_hStopEvent = NULL;
+
+    // Final sample: it is also the reference of the next run for its ETA
+    DirCrawlerProgressWriteMetrics();
+
+    for (i = 0; i < gs_dwPreviousCount; i++) {
+        UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, gs_pPrevious[i].ptRequestName);
+    }
+    UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, gs_pPrevious);
+    gs_dwPreviousCount = 0;
+}
@@ -0,0 +1,55 @@
+#ifndef __DIR_CRAWLER_PROGRESS_H__
+#define __DIR_CRAWLER_PROGRESS_H__
+
+/* --- INCLUDES ------------------------------------------------------------- */
+#include "DirectoryCrawler.h"
+
+/* --- DEFINES -------------------------------------------------------------- */
+#define DIR_CRAWLER_PROGRESS_DEFAULT_INTERVAL   10      // seconds between two rewrites of the metrics file
+#define DIR_CRAWLER_PROGRESS_TMP_SUFFIX         _T(".tmp")
+#define DIR_CRAWLER_PROGRESS_METRIC_PREFIX      "dircrawler_"
+#define DIR_CRAWLER_PROGRESS_BUFFER_SIZE        0x10000
+
+/* --- TYPES ---------------------------------------------------------------- */
+typedef struct _DIR_CRAWLER_PROGRESS_PREVIOUS {
+    PTCHAR ptRequestName;
+    LONGLONG llEntries;
+} DIR_CRAWLER_PROGRESS_PREVIOUS, *PDIR_CRAWLER_PROGRESS_PREVIOUS;
+
+typedef struct _DIR_CRAWLER_PROGRESS_WRITER {
+    HANDLE hFile;
+    BOOL bFailed;
+    DWORD dwLen;
+    CHAR acBuffer[DIR_CRAWLER_PROGRESS_BUFFER_SIZE];
+} DIR_CRAWLER_PROGRESS_WRITER, *PDIR_CRAWLER_PROGRESS_WRITER;
+
+typedef enum _DIR_CRAWLER_PROGRESS_REQ_METRIC {
+    ProgressReqMetricEntries,
+    ProgressReqMetricRate,
+    ProgressReqMetricIdle,
+    ProgressReqMetricExpected,
+} DIR_CRAWLER_PROGRESS_REQ_METRIC;
+
+typedef struct _DIR_CRAWLER_PROGRESS_SAMPLE {
+    PDIR_CRAWLER_PROGRESS_WRITER pWriter;
+    DIR_CRAWLER_PROGRESS_REQ_METRIC eMetric;
+    LONGLONG llNow;
+    DWORD dwRunning;
+    DWORD dwSucceeded;
+    DWORD dwFailed;
+    DWORD dwInFlight;
+    LONGLONG llConsumedExpected;    // part of the previous run entries already covered by this run
+} DIR_CRAWLER_PROGRESS_SAMPLE, *PDIR_CRAWLER_PROGRESS_SAMPLE;
+
+/* --- VARIABLES ------------------------------------------------------------ */
+/* --- PROTOTYPES ----------------------------------------------------------- */
+void DirCrawlerProgressStart(
+    _In_ const PTCHAR ptOutFile,
+    _In_ const DWORD dwInterval,
+    _In_ const PSLIST_HEADER pReqListHead
+    );
+
+void DirCrawlerProgressStop(
+    );
+
+#endif // __DIR_CRAWLER_PROGRESS_H__
@@ -0,0 +1,392 @@
+/* --- INCLUDES ------------------------------------------------------------- */
+#include "DirCrawlerReplicas.h"
+#include "DirCrawlerStats.h"
+#include "DirCrawlerTls.h"
+
+/* --- PRIVATE VARIABLES ---------------------------------------------------- */
+static PDIR_CRAWLER_REPLICA gs_pReplicas = NULL;
+static DWORD gs_dwReplicaCount = 0;
+static CRITICAL_SECTION gs_sReplicasLock = { 0 };
+static BOOL gs_bReplicasInit = FALSE;
+
+static const PTCHAR gsc_aptUsnAttributes[] = { DIR_CRAWLER_REPLICAS_ATTR_USN, NULL };
+static const PTCHAR gsc_aptServerAttributes[] = { DIR_CRAWLER_REPLICAS_ATTR_DNS_NAME, NULL };
+static const PTCHAR gsc_aptDsaAttributes[] = { DIR_CRAWLER_REPLICAS_ATTR_CATEGORY, NULL };  // only the DN is used
+
+/* --- PUBLIC VARIABLES ----------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS ---------------------------------------------------- */
+static PTCHAR DirCrawlerReplicasWiden(
+    _In_ const LPSTR pValue
+    ) {
+#ifdef UNICODE
+    DWORD dwLen = MultiByteToWideChar(CP_UTF8, 0, pValue, -1, NULL, 0);
+    PTCHAR ptValue = UtilsHeapAllocStrHelper(g_pDirCrawlerHeap, max(dwLen, 1) * sizeof(TCHAR));
+
+    if (dwLen == 0 || MultiByteToWideChar(CP_UTF8, 0, pValue, -1, ptValue, dwLen) == 0) {
+        ptValue[0] = NULL_CHAR;
+    }
+    return ptValue;
+#else
+    return UtilsHeapStrDupHelper(g_pDirCrawlerHeap, pValue);
+#endif
+}
+
+static PTCHAR DirCrawlerReplicasGetString(
+    _In_ const PLDAP_CONNECT pLdapConnect,
+    _In_ const PLDAP_ENTRY pLdapEntry,
+    _In_ const PTCHAR ptAttrName
+    ) {
+    PLDAP_ATTRIBUTE pLdapAttribute = NULL;
+    PTCHAR ptValue = NULL;
+
+    if (LdapDupNamedAttr(pLdapConnect, pLdapEntry, ptAttrName, &pLdapAttribute) == TRUE && pLdapAttribute != NULL && pLdapAttribute->dwValuesCount > 0) {
+        ptValue = DirCrawlerReplicasWiden((LPSTR)pLdapAttribute->ppValues[0]->pbData);
+    }
+    if (pLdapAttribute != NULL) {
+        LdapReleaseAttribute(pLdapConnect, &pLdapAttribute);
+    }
+    return ptValue;
+}
+
+static BOOL DirCrawlerReplicasReadUsn(
+    _In_ const PLDAP_CONNECT pLdapConnect,
+    _Out_ PULONGLONG pullUsn
+    ) {
+    PLDAP_REQUEST pLdapRequest = NULL;
+    PLDAP_ENTRY pLdapEntry = NULL;
+    PTCHAR ptUsn = NULL;
+    BOOL bResult = FALSE;
+
+    *pullUsn = 0;
+    bResult = LdapInitRequestEx(pLdapConnect, EMPTY_STR, DIR_CRAWLER_REPLICAS_ROOT_DSE_FILTER, LdapScopeBase, (PTCHAR *)gsc_aptUsnAttributes, NULL, NULL, &pLdapRequest);
+    if (API_FAILED(bResult)) {
+        return FALSE;
+    }
+
+    bResult = LdapGetNextEntry(pLdapConnect, pLdapRequest, &pLdapEntry);
+    if (bResult == TRUE && pLdapEntry != NULL) {
+        ptUsn = DirCrawlerReplicasGetString(pLdapConnect, pLdapEntry, DIR_CRAWLER_REPLICAS_ATTR_USN);
+        if (ptUsn != NULL) {
+            *pullUsn = _tcstoui64(ptUsn, NULL, 10);
+            UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, ptUsn);
+        }
+        LdapReleaseEntry(pLdapConnect, &pLdapEntry);
+    }
+    LdapReleaseRequest(pLdapConnect, &pLdapRequest);
+
+    return (BOOL)(*pullUsn != 0);
+}
+
+static void DirCrawlerReplicasAdd(
+    _In_ const PTCHAR ptServer,
+    _In_ const PLDAP_OPTIONS pLdapOptions,
+    _In_ const PTCHAR ptDomainNc,
+    _In_ const DWORD dwMaxRequests
+    ) {
+    PDIR_CRAWLER_REPLICA pReplica = NULL;
+    DWORD i = 0;
+
+    for (i = 0; i < gs_dwReplicaCount; i++) {
+        if (_tcsicmp(gs_pReplicas[i].ptServer, ptServer) == 0) {
+            return;
+        }
+    }
+    // Every DC needs its own semaphore in DirCrawlerReplicasAcquire's wait
+    if (gs_dwReplicaCount == MAXIMUM_WAIT_OBJECTS) {
+        LOG(Warn, SUB_LOG(_T("Ignoring DC <%s>: no more than <%u> DCs can be used")), ptServer, MAXIMUM_WAIT_OBJECTS);
+        return;
+    }
+
+    gs_pReplicas = UtilsHeapAllocOrReallocHelper(g_pDirCrawlerHeap, gs_pReplicas, SIZEOF_ARRAY(DIR_CRAWLER_REPLICA, gs_dwReplicaCount + 1));
+    pReplica = &gs_pReplicas[gs_dwReplicaCount];
+    ZeroMemory(pReplica, sizeof(DIR_CRAWLER_REPLICA));
+    pReplica->ptServer = UtilsHeapStrDupHelper(g_pDirCrawlerHeap, ptServer);
+    pReplica->hSlots = CreateSemaphore(NULL, dwMaxRequests, dwMaxRequests, NULL);
+    if (pReplica->hSlots == NULL) {
+        FATAL(_T("Failed to create semaphore of DC <%s>: <gle:%#08x>"), ptServer, GLE());
+    }
+    gs_dwReplicaCount += 1;
+
+    // Startup check: the DC must answer, hold the same domain, and accept the credentials. The connection is kept to read the USN at exit
+    if (DirCrawlerTlsConnect(ptServer, pLdapOptions->dwLdapPort, &pReplica->pConnection, &pReplica->pRootDse) == FALSE) {
+        LOG(Warn, SUB_LOG(_T("DC <%s> is unreachable, not using it: <err:%#08x>")), ptServer, LdapLastError());
+        pReplica->pConnection = NULL;
+        return;
+    }
+    if (pReplica->pRootDse->extracted.ptDefaultNamingContext == NULL || _tcsicmp(pReplica->pRootDse->extracted.ptDefaultNamingContext, ptDomainNc) != 0) {
+        LOG(Warn, SUB_LOG(_T("DC <%s> does not hold <%s>, not using it")), ptServer, ptDomainNc);
+    }
+    else if (LdapBind(pReplica->pConnection, ptDomainNc, pLdapOptions->ptLogin, pLdapOptions->ptPassword, pLdapOptions->ptExplicitDomain) == FALSE) {
+        LOG(Warn, SUB_LOG(_T("Failed to bind to DC <%s>, not using it: <err:%#08x>")), ptServer, LdapLastError());
+    }
+    else {
+        DirCrawlerReplicasReadUsn(pReplica->pConnection, &pReplica->ullStartUsn);
+        pReplica->bHealthy = TRUE;
+        LOG(Info, SUB_LOG(_T("DC <%s>: <usn:%llu>")), ptServer, pReplica->ullStartUsn);
+    }
+}
+
+static void DirCrawlerReplicasDiscover(
+    _In_ const PLDAP_CONNECT pLdapConnect,
+    _In_ const PLDAP_ROOT_DSE pRootDse,
+    _In_ const PLDAP_OPTIONS pLdapOptions,
+    _In_ const DWORD dwMaxRequests
+    ) {
+    PTCHAR ptConfigNc = pRootDse->extracted.ptConfigurationNamingContext;
+    PTCHAR ptDomainNc = pRootDse->extracted.ptDefaultNamingContext;
+    PLDAP_REQUEST pLdapRequest = NULL;
+    PLDAP_ENTRY pLdapEntry = NULL;
+    PTCHAR *pptServerDns = NULL;
+    DWORD dwServerCount = 0;
+    PTCHAR ptParent = NULL;
+    PTCHAR ptDnsName = NULL;
+    TCHAR atFilter[MAX_LINE] = { 0 };
+    BOOL bResult = FALSE;
+    DWORD i = 0;
+
+    bResult = LdapBind(pLdapConnect, ptConfigNc, pLdapOptions->ptLogin, pLdapOptions->ptPassword, pLdapOptions->ptExplicitDomain);
+    if (!bResult) {
+        FATAL(_T("Failed to bind to the configuration naming context to discover the DCs: <err:%#08x>"), LdapLastError());
+    }
+
+    // nTDSDSA objects holding the domain NC, their parent being the server object of the DC
+    _stprintf_s(atFilter, _countof(atFilter), DIR_CRAWLER_REPLICAS_DSA_FILTER, ptDomainNc, ptDomainNc);
+    bResult = LdapInitRequestEx(pLdapConnect, ptConfigNc, atFilter, LdapScopeSubtree, (PTCHAR *)gsc_aptDsaAttributes, NULL, NULL, &pLdapRequest);
+    if (API_FAILED(bResult)) {
+        FATAL(_T("Failed to init DC discovery request <%s> on <%s>: <err:%#08x>"), atFilter, ptConfigNc, LdapLastError());
+    }
+    for (;;) {
+        bResult = LdapGetNextEntry(pLdapConnect, pLdapRequest, &pLdapEntry);
+        if (API_FAILED(bResult)) {
+            FATAL(_T("Unable to get next nTDSDSA entry <%u>: <err:%#08x>"), dwServerCount, LdapLastError());
+        }
+        if (pLdapEntry == NULL) {
+            break;
+        }
+        ptParent = _tcschr(pLdapEntry->ptDn, _T(','));
+        if (ptParent != NULL) {
+            dwServerCount += 1;
+            pptServerDns = UtilsHeapAllocOrReallocHelper(g_pDirCrawlerHeap, pptServerDns, SIZEOF_ARRAY(PTCHAR, dwServerCount));
+            pptServerDns[dwServerCount - 1] = UtilsHeapStrDupHelper(g_pDirCrawlerHeap, ptParent + 1);
+        }
+        LdapReleaseEntry(pLdapConnect, &pLdapEntry);
+    }
+    LdapReleaseRequest(pLdapConnect, &pLdapRequest);
+
+    // Then their DNS names
+    bResult = LdapInitRequestEx(pLdapConnect, ptConfigNc, DIR_CRAWLER_REPLICAS_SERVER_FILTER, LdapScopeSubtree, (PTCHAR *)gsc_aptServerAttributes, NULL, NULL, &pLdapRequest);
+    if (API_FAILED(bResult)) {
+        FATAL(_T("Failed to init DC discovery request <%s> on <%s>: <err:%#08x>"), DIR_CRAWLER_REPLICAS_SERVER_FILTER, ptConfigNc, LdapLastError());
+    }
+    for (;;) {
+        bResult = LdapGetNextEntry(pLdapConnect, pLdapRequest, &pLdapEntry);
+        if (API_FAILED(bResult)) {
+            FATAL(_T("Unable to get next server entry: <err:%#08x>"), LdapLastError());
+        }
+        if (pLdapEntry == NULL) {
+            break;
+        }
+        if (IsInSetOfStrings(pLdapEntry->ptDn, pptServerDns, dwServerCount, NULL) == TRUE) {
+            ptDnsName = DirCrawlerReplicasGetString(pLdapConnect, pLdapEntry, DIR_CRAWLER_REPLICAS_ATTR_DNS_NAME);
+            if (ptDnsName != NULL) {
+                DirCrawlerReplicasAdd(ptDnsName, pLdapOptions, ptDomainNc, dwMaxRequests);
+                UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, ptDnsName);
+            }
+        }
+        LdapReleaseEntry(pLdapConnect, &pLdapEntry);
+    }
+    LdapReleaseRequest(pLdapConnect, &pLdapRequest);
+
+    if (pptServerDns != NULL) {
+        UtilsHeapFreeAndNullArrayHelper(g_pDirCrawlerHeap, pptServerDns, dwServerCount, i);
+    }
+}
+
+/* --- PUBLIC FUNCTIONS ----------------------------------------------------- */
+void DirCrawlerReplicasInit(
+    _In_ const PTCHAR ptReplicaList,
+    _In_ const PLDAP_CONNECT pLdapConnect,
+    _In_ const PLDAP_ROOT_DSE pRootDse,
+    _In_ const PLDAP_OPTIONS pLdapOptions,
+    _In_ const DWORD dwMaxRequests
+    ) {
+    PTCHAR ptCtx = NULL;
+    PTCHAR ptServer = NULL;
+    DWORD dwHealthyCount = 0;
+    DWORD i = 0;
+
+    InitializeCriticalSection(&gs_sReplicasLock);
+    gs_bReplicasInit = TRUE;
+
+    if (pRootDse->extracted.ptDefaultNamingContext == NULL) {
+        FATAL(_T("No default naming context in the RootDSE, cannot spread requests over its DCs"));
+    }
+
+    if (_tcsicmp(ptReplicaList, DIR_CRAWLER_REPLICAS_AUTO) == 0) {
+        LOG(Info, SUB_LOG(_T("Discovering the DCs of <%s>")), pRootDse->extracted.ptDefaultNamingContext);
+        DirCrawlerReplicasDiscover(pLdapConnect, pRootDse, pLdapOptions, dwMaxRequests);
+    }
+    else {
+        while (StrNextToken(ptReplicaList, _T(","), &ptCtx, &ptServer)) {
+            DirCrawlerReplicasAdd(ptServer, pLdapOptions, pRootDse->extracted.ptDefaultNamingContext, dwMaxRequests);
+        }
+    }
+
+    for (i = 0; i < gs_dwReplicaCount; i++) {
+        dwHealthyCount += gs_pReplicas[i].bHealthy ? 1 : 0;
+    }
+    if (dwHealthyCount == 0) {
+        FATAL(_T("No usable DC to spread the requests over"));
+    }
+    LOG(Info, SUB_LOG(_T("Spreading requests over <%u/%u> DCs, <%u> requests at most per DC")), dwHealthyCount, gs_dwReplicaCount, dwMaxRequests);
+}
+
+void DirCrawlerReplicasCleanup(
+    ) {
+    DWORD i = 0;
+
+    if (gs_bReplicasInit == FALSE) {
+        return;
+    }
+
+    for (i = 0; i < gs_dwReplicaCount; i++) {
+        if (gs_pReplicas[i].pConnection != NULL) {
+            LdapCloseConnection(&gs_pReplicas[i].pConnection, &gs_pReplicas[i].pRootDse);
+        }
+        CloseHandle(gs_pReplicas[i].hSlots);
+        UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, gs_pReplicas[i].ptServer);
+        if (gs_pReplicas[i].pptRequests != NULL) {
+            UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, gs_pReplicas[i].pptRequests);
+        }
+    }
+    if (gs_pReplicas != NULL) {
+        UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, gs_pReplicas);
+    }
+    gs_dwReplicaCount = 0;
+    DeleteCriticalSection(&gs_sReplicasLock);
+    gs_bReplicasInit = FALSE;
+}
+
+PDIR_CRAWLER_REPLICA DirCrawlerReplicasAcquire(
+    _In_ const PDIR_CRAWLER_REQ_DESCR pReqDescr
+    ) {
+    PDIR_CRAWLER_REPLICA apCandidates[MAXIMUM_WAIT_OBJECTS] = { 0 };
+    HANDLE ahSlots[MAXIMUM_WAIT_OBJECTS] = { 0 };
+    PDIR_CRAWLER_REPLICA pReplica = NULL;
+    DWORD dwCount = 0;
+    DWORD dwResult = 0;
+    DWORD i = 0;
+    DWORD j = 0;
+
+    for (;;) {
+        // Healthy DCs, least busy first
+        dwCount = 0;
+        for (i = 0; i < gs_dwReplicaCount; i++) {
+            if (gs_pReplicas[i].bHealthy == TRUE) {
+                for (j = dwCount; j > 0 && apCandidates[j - 1]->lActive > gs_pReplicas[i].lActive; j--) {
+                    apCandidates[j] = apCandidates[j - 1];
+                }
+                apCandidates[j] = &gs_pReplicas[i];
+                dwCount += 1;
+            }
+        }
+        if (dwCount == 0) {
+            REQ_LOG(pReqDescr, Warn, _T("No healthy DC left"));
+            return NULL;
+        }
+
+        pReplica = NULL;
+        for (i = 0; i < dwCount && pReplica == NULL; i++) {
+            ahSlots[i] = apCandidates[i]->hSlots;
+            if (WaitForSingleObject(ahSlots[i], 0) == WAIT_OBJECT_0) {
+                pReplica = apCandidates[i];
+            }
+        }
+        // All of them are busy: take the first slot released
+        if (pReplica == NULL) {
+            dwResult = WaitForMultipleObjects(dwCount, ahSlots, FALSE, INFINITE);
+            if (dwResult >= WAIT_OBJECT_0 + dwCount) {
+                // Called before the request exception handler: the request falls back to the '-s' server
+                REQ_LOG(pReqDescr, Err, _T("Failed to wait for a DC: <gle:%#08x>"), GLE());
+                return NULL;
+            }
+            pReplica = apCandidates[dwResult - WAIT_OBJECT_0];
+        }
+
+        // The DC may have been put aside while waiting
+        if (pReplica->bHealthy == TRUE) {
+            InterlockedIncrement(&pReplica->lActive);
+            return pReplica;
+        }
+        ReleaseSemaphore(pReplica->hSlots, 1, NULL);
+    }
+}
+
+void DirCrawlerReplicasRelease(
+    _In_ const PDIR_CRAWLER_REPLICA pReplica,
+    _In_ const PDIR_CRAWLER_REQ_DESCR pReqDescr,
+    _In_ const BOOL bSucceeded
+    ) {
+    EnterCriticalSection(&gs_sReplicasLock);
+    pReplica->dwRequestCount += 1;
+    pReplica->pptRequests = UtilsHeapAllocOrReallocHelper(g_pDirCrawlerHeap, pReplica->pptRequests, SIZEOF_ARRAY(PTCHAR, pReplica->dwRequestCount));
+    pReplica->pptRequests[pReplica->dwRequestCount - 1] = pReqDescr->infos.ptName;
+    if (bSucceeded == TRUE) {
+        pReplica->dwSucceededCount += 1;
+        pReplica->lFailures = 0;
+    }
+    else {
+        pReplica->lFailures += 1;
+        if (pReplica->lFailures >= DIR_CRAWLER_REPLICAS_MAX_FAILURES && pReplica->bHealthy == TRUE) {
+            LOG(Warn, _T("DC <%s> failed <%u> requests in a row, not using it anymore"), pReplica->ptServer, pReplica->lFailures);
+            pReplica->bHealthy = FALSE;
+        }
+    }
+    LeaveCriticalSection(&gs_sReplicasLock);
+
+    InterlockedDecrement(&pReplica->lActive);
+    ReleaseSemaphore(pReplica->hSlots, 1, NULL);
+}
+
+void DirCrawlerReplicasWriteJson(
+    _In_ const PTCHAR ptOutFile
+    ) {
+    FILE *pFile = NULL;
+    errno_t err = 0;
+    PDIR_CRAWLER_REPLICA pReplica = NULL;
+    DWORD i = 0;
+    DWORD j = 0;
+
+    err = DirCrawlerStatsOpenJson(&pFile, ptOutFile);
+    if (err != 0) {
+        LOG(Err, _T("Failed to open replicas file <%s>: <errno:%#08x>"), ptOutFile, err);
+        return;
+    }
+
+    // Entries of a request are as of the time its DC served it, between the start and end USNs of this DC
+    _ftprintf(pFile, _T("{\n  \"replicas\": ["));
+    for (i = 0; i < gs_dwReplicaCount; i++) {
+        pReplica = &gs_pReplicas[i];
+        if (pReplica->pConnection != NULL) {
+            DirCrawlerReplicasReadUsn(pReplica->pConnection, &pReplica->ullEndUsn);
+        }
+
+        _ftprintf(pFile, _T("%s\n    {\n      \"server\": "), i == 0 ? EMPTY_STR : _T(","));
+        DirCrawlerStatsWriteJsonString(pFile, pReplica->ptServer);
+        _ftprintf(pFile, _T(",\n      \"healthy\": %s,\n      \"startUsn\": %llu,\n      \"endUsn\": %llu,\n      \"succeeded\": %u,\n      \"failed\": %u,\n      \"requests\": ["),
+            pReplica->bHealthy ? _T("true") : _T("false"),
+            pReplica->ullStartUsn,
+            pReplica->ullEndUsn,
+            pReplica->dwSucceededCount,
+            pReplica->dwRequestCount - pReplica->dwSucceededCount);
+        for (j = 0; j < pReplica->dwRequestCount; j++) {
+            _ftprintf(pFile, _T("%s"), j == 0 ? EMPTY_STR : _T(", "));
+            DirCrawlerStatsWriteJsonString(pFile, pReplica->pptRequests[j]);
+        }
+        _ftprintf(pFile, _T("]\n    }"));
+    }
+    _ftprintf(pFile, _T("\n  ]\n}\n"));
+
+    fclose(pFile);
+    LOG(Info, SUB_LOG(_T("Replicas written to <%s>")), ptOutFile);
+}
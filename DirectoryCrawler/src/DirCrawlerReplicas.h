@@ -0,0 +1,70 @@
+#ifndef __DIR_CRAWLER_REPLICAS_H__
+#define __DIR_CRAWLER_REPLICAS_H__
+
+/* --- INCLUDES ------------------------------------------------------------- */
+#include "DirectoryCrawler.h"
+
+/* --- DEFINES -------------------------------------------------------------- */
+//
+// Requests spread over the writable DCs of the domain ('--replicas <server,...>', or 'auto' to read them from the
+// nTDSDSA objects of the configuration NC). Each request runs on a single DC, picked when a worker starts it: the
+// healthy DC with the most free slots ('--replica-requests' concurrent requests per DC). A DC failing too many requests
+// in a row is no longer used. The highestCommittedUSN of each DC is read before and after the crawl and written
+// with the requests it served to <prefix>_LDAP_replicas.json, in the stats folder.
+//
+#define DIR_CRAWLER_REPLICAS_AUTO           _T("auto")
+#define DIR_CRAWLER_REPLICAS_OUTFILE        _T("replicas")
+#define DIR_CRAWLER_REPLICAS_MAX_FAILURES   3           // consecutive failed requests before a DC is put aside
+#define DIR_CRAWLER_REPLICAS_DSA_FILTER     _T("(&(objectCategory=nTDSDSA)(|(msDS-hasMasterNCs=%s)(hasMasterNCs=%s)))") // writable DCs only (RODCs are 'nTDSDSARO')
+#define DIR_CRAWLER_REPLICAS_SERVER_FILTER  _T("(&(objectClass=server)(dNSHostName=*))")
+#define DIR_CRAWLER_REPLICAS_ATTR_DNS_NAME  _T("dNSHostName")
+#define DIR_CRAWLER_REPLICAS_ATTR_USN       _T("highestCommittedUSN")
+#define DIR_CRAWLER_REPLICAS_ATTR_CATEGORY  _T("objectCategory")
+#define DIR_CRAWLER_REPLICAS_ROOT_DSE_FILTER _T("(objectClass=*)")
+
+/* --- TYPES ---------------------------------------------------------------- */
+typedef struct _DIR_CRAWLER_REPLICA {
+    PTCHAR ptServer;
+    PLDAP_CONNECT pConnection;  // kept from the startup check to read the USNs, NULL if the DC could not be reached
+    PLDAP_ROOT_DSE pRootDse;
+    HANDLE hSlots;              // semaphore: requests the DC can still take
+    LONG lActive;
+    LONG lFailures;             // consecutive failed requests
+    BOOL bHealthy;
+    ULONGLONG ullStartUsn;
+    ULONGLONG ullEndUsn;
+
+    // Requests served by the DC, protected by the replicas lock
+    PTCHAR *pptRequests;
+    DWORD dwRequestCount;
+    DWORD dwSucceededCount;
+} DIR_CRAWLER_REPLICA, *PDIR_CRAWLER_REPLICA;
+
+/* --- VARIABLES ------------------------------------------------------------ */
+/* --- PROTOTYPES ----------------------------------------------------------- */
+void DirCrawlerReplicasInit(
+    _In_ const PTCHAR ptReplicaList,
+    _In_ const PLDAP_CONNECT pLdapConnect,
+    _In_ const PLDAP_ROOT_DSE pRootDse,
+    _In_ const PLDAP_OPTIONS pLdapOptions,
+    _In_ const DWORD dwMaxRequests  // per DC
+    );
+
+void DirCrawlerReplicasCleanup(
+    );
+
+PDIR_CRAWLER_REPLICA DirCrawlerReplicasAcquire(    // NULL if no DC can be used, the request then uses the '-s' server
+    _In_ const PDIR_CRAWLER_REQ_DESCR pReqDescr
+    );
+
+void DirCrawlerReplicasRelease(
+    _In_ const PDIR_CRAWLER_REPLICA pReplica,
+    _In_ const PDIR_CRAWLER_REQ_DESCR pReqDescr,
+    _In_ const BOOL bSucceeded
+    );
+
+void DirCrawlerReplicasWriteJson(
+    _In_ const PTCHAR ptOutFile
+    );
+
+#endif // __DIR_CRAWLER_REPLICAS_H__
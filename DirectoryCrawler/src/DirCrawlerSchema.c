@@ -0,0 +1,468 @@
+/* --- INCLUDES ------------------------------------------------------------- */
+#include "DirCrawlerSchema.h"
+
+/* --- PRIVATE VARIABLES ---------------------------------------------------- */
+static DIR_CRAWLER_SCHEMA_CATALOG gs_sCatalog = { 0 };
+
+static const PTCHAR gsc_aptSchemaAttributes[] = {
+    DIR_CRAWLER_SCHEMA_ATTR_NAME, DIR_CRAWLER_SCHEMA_ATTR_SYNTAX, DIR_CRAWLER_SCHEMA_ATTR_OM_SYNTAX, DIR_CRAWLER_SCHEMA_ATTR_SINGLE,
+    DIR_CRAWLER_SCHEMA_ATTR_RANGE_LOWER, DIR_CRAWLER_SCHEMA_ATTR_RANGE_UPPER, DIR_CRAWLER_SCHEMA_ATTR_FLAGS, DIR_CRAWLER_SCHEMA_ATTR_USN, NULL
+};
+
+// Large integers are either counters or FILETIMEs, the syntax does not tell them apart
+static const PTCHAR gsc_aptFiletimeAttributes[] = {
+    _T("accountExpires"), _T("badPasswordTime"), _T("creationTime"), _T("lastLogoff"), _T("lastLogon"), _T("lastLogonTimestamp"), _T("lockoutTime"),
+    _T("pwdLastSet"), _T("msDS-LastFailedInteractiveLogonTime"), _T("msDS-LastSuccessfulInteractiveLogonTime"), _T("msDS-UserPasswordExpiryTimeComputed"),
+    _T("ms-Mcs-AdmPwdExpirationTime"), _T("msLAPS-PasswordExpirationTime")
+};
+
+/* --- PUBLIC VARIABLES ----------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS ---------------------------------------------------- */
+static int DirCrawlerSchemaCompareAttributes(
+    _In_ const void *pvFirst,
+    _In_ const void *pvSecond
+    ) {
+    return _tcsicmp(((PDIR_CRAWLER_SCHEMA_ATTRIBUTE)pvFirst)->ptName, ((PDIR_CRAWLER_SCHEMA_ATTRIBUTE)pvSecond)->ptName);
+}
+
+static int DirCrawlerSchemaCompareName(
+    _In_ const void *pvName,
+    _In_ const void *pvAttribute
+    ) {
+    return _tcsicmp((PTCHAR)pvName, ((PDIR_CRAWLER_SCHEMA_ATTRIBUTE)pvAttribute)->ptName);
+}
+
+static BOOL DirCrawlerSchemaIsInSet(
+    _In_ const PTCHAR ptName,
+    _In_ const PTCHAR aptSet[],
+    _In_ const DWORD dwCount
+    ) {
+    DWORD i = 0;
+
+    // LDAP display names are case insensitive
+    for (i = 0; i < dwCount; i++) {
+        if (_tcsicmp(ptName, aptSet[i]) == 0) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+static DIR_CRAWLER_LDAP_ATTR_TYPE DirCrawlerSchemaBestType(
+    _In_ const PDIR_CRAWLER_SCHEMA_ATTRIBUTE pAttr
+    ) {
+    switch (pAttr->dwSyntax) {
+    case DIR_CRAWLER_SCHEMA_SYNTAX_SID:
+        return DirCrawlerTypeSid;
+    case DIR_CRAWLER_SCHEMA_SYNTAX_SD:
+        return DirCrawlerTypeSd;
+    case DIR_CRAWLER_SCHEMA_SYNTAX_TIME:
+        return pAttr->dwOmSyntax == DIR_CRAWLER_SCHEMA_OM_GENERALIZED ? DirCrawlerTypeGentime : DirCrawlerTypeStr;
+    case DIR_CRAWLER_SCHEMA_SYNTAX_LARGE_INT:
+        return DirCrawlerSchemaIsInSet(pAttr->ptName, gsc_aptFiletimeAttributes, _countof(gsc_aptFiletimeAttributes)) ? DirCrawlerTypeFiletime : DirCrawlerTypeRaw;
+    case DIR_CRAWLER_SCHEMA_SYNTAX_INTEGER:
+    case DIR_CRAWLER_SCHEMA_SYNTAX_BOOLEAN:
+        return DirCrawlerTypeRaw;
+    case DIR_CRAWLER_SCHEMA_SYNTAX_OCTETS:
+        return (pAttr->llRangeLower == DIR_CRAWLER_SCHEMA_GUID_RANGE && pAttr->llRangeUpper == DIR_CRAWLER_SCHEMA_GUID_RANGE) ? DirCrawlerTypeGuid : DirCrawlerTypeBin;
+    default:
+        return DirCrawlerTypeStr;
+    }
+}
+
+static PTCHAR DirCrawlerSchemaWiden(
+    _In_ const LPSTR pValue
+    ) {
+#ifdef UNICODE
+    DWORD dwLen = MultiByteToWideChar(CP_UTF8, 0, pValue, -1, NULL, 0);
+    PTCHAR ptValue = UtilsHeapAllocStrHelper(g_pDirCrawlerHeap, max(dwLen, 1) * sizeof(TCHAR));
+
+    if (dwLen == 0 || MultiByteToWideChar(CP_UTF8, 0, pValue, -1, ptValue, dwLen) == 0) {
+        ptValue[0] = NULL_CHAR;
+    }
+    return ptValue;
+#else
+    return UtilsHeapStrDupHelper(g_pDirCrawlerHeap, pValue);
+#endif
+}
+
+static LPSTR DirCrawlerSchemaGetValue(
+    _In_ const PLDAP_CONNECT pLdapConnect,
+    _In_ const PLDAP_ENTRY pLdapEntry,
+    _In_ const PTCHAR ptAttrName,
+    _Out_ PLDAP_ATTRIBUTE *ppLdapAttribute
+    ) {
+    // The attribute must be released by the caller if it is not NULL
+    *ppLdapAttribute = NULL;
+    if (LdapDupNamedAttr(pLdapConnect, pLdapEntry, ptAttrName, ppLdapAttribute) == FALSE || *ppLdapAttribute == NULL || (*ppLdapAttribute)->dwValuesCount == 0) {
+        return NULL;
+    }
+    return (LPSTR)(*ppLdapAttribute)->ppValues[0]->pbData;
+}
+
+static LONGLONG DirCrawlerSchemaGetInteger(
+    _In_ const PLDAP_CONNECT pLdapConnect,
+    _In_ const PLDAP_ENTRY pLdapEntry,
+    _In_ const PTCHAR ptAttrName,
+    _In_ const LONGLONG llDefault
+    ) {
+    PLDAP_ATTRIBUTE pLdapAttribute = NULL;
+    LPSTR pValue = DirCrawlerSchemaGetValue(pLdapConnect, pLdapEntry, ptAttrName, &pLdapAttribute);
+    LONGLONG llValue = (pValue != NULL) ? _atoi64(pValue) : llDefault;
+
+    if (pLdapAttribute != NULL) {
+        LdapReleaseAttribute(pLdapConnect, &pLdapAttribute);
+    }
+    return llValue;
+}
+
+static BOOL DirCrawlerSchemaAddEntry(
+    _In_ const PLDAP_CONNECT pLdapConnect,
+    _In_ const PLDAP_ENTRY pLdapEntry
+    ) {
+    PDIR_CRAWLER_SCHEMA_ATTRIBUTE pAttr = NULL;
+    PLDAP_ATTRIBUTE pLdapAttribute = NULL;
+    LPSTR pValue = NULL;
+    ULONGLONG ullUsn = 0;
+
+    pValue = DirCrawlerSchemaGetValue(pLdapConnect, pLdapEntry, DIR_CRAWLER_SCHEMA_ATTR_NAME, &pLdapAttribute);
+    if (pValue == NULL) {
+        LOG(Warn, SUB_LOG(_T("attributeSchema <%s> has no <%s>, ignoring it")), pLdapEntry->ptDn, DIR_CRAWLER_SCHEMA_ATTR_NAME);
+        if (pLdapAttribute != NULL) {
+            LdapReleaseAttribute(pLdapConnect, &pLdapAttribute);
+        }
+        return FALSE;
+    }
+
+    gs_sCatalog.pAttrArray = UtilsHeapAllocOrReallocHelper(g_pDirCrawlerHeap, gs_sCatalog.pAttrArray, SIZEOF_ARRAY(DIR_CRAWLER_SCHEMA_ATTRIBUTE, gs_sCatalog.dwAttrCount + 1));
+    pAttr = &gs_sCatalog.pAttrArray[gs_sCatalog.dwAttrCount];
+    ZeroMemory(pAttr, sizeof(DIR_CRAWLER_SCHEMA_ATTRIBUTE));
+    pAttr->ptName = DirCrawlerSchemaWiden(pValue);
+    LdapReleaseAttribute(pLdapConnect, &pLdapAttribute);
+
+    pValue = DirCrawlerSchemaGetValue(pLdapConnect, pLdapEntry, DIR_CRAWLER_SCHEMA_ATTR_SYNTAX, &pLdapAttribute);
+    if (pValue != NULL && strncmp(pValue, DIR_CRAWLER_SCHEMA_SYNTAX_PREFIX, sizeof(DIR_CRAWLER_SCHEMA_SYNTAX_PREFIX) - 1) == 0) {
+        pAttr->dwSyntax = atoi(pValue + sizeof(DIR_CRAWLER_SCHEMA_SYNTAX_PREFIX) - 1);
+    }
+    if (pLdapAttribute != NULL) {
+        LdapReleaseAttribute(pLdapConnect, &pLdapAttribute);
+    }
+
+    pValue = DirCrawlerSchemaGetValue(pLdapConnect, pLdapEntry, DIR_CRAWLER_SCHEMA_ATTR_SINGLE, &pLdapAttribute);
+    pAttr->bSingleValued = (pValue != NULL && _stricmp(pValue, "TRUE") == 0);
+    if (pLdapAttribute != NULL) {
+        LdapReleaseAttribute(pLdapConnect, &pLdapAttribute);
+    }
+
+    pAttr->dwOmSyntax = (DWORD)DirCrawlerSchemaGetInteger(pLdapConnect, pLdapEntry, DIR_CRAWLER_SCHEMA_ATTR_OM_SYNTAX, 0);
+    pAttr->llRangeLower = DirCrawlerSchemaGetInteger(pLdapConnect, pLdapEntry, DIR_CRAWLER_SCHEMA_ATTR_RANGE_LOWER, DIR_CRAWLER_SCHEMA_NO_RANGE);
+    pAttr->llRangeUpper = DirCrawlerSchemaGetInteger(pLdapConnect, pLdapEntry, DIR_CRAWLER_SCHEMA_ATTR_RANGE_UPPER, DIR_CRAWLER_SCHEMA_NO_RANGE);
+    pAttr->dwSystemFlags = (DWORD)DirCrawlerSchemaGetInteger(pLdapConnect, pLdapEntry, DIR_CRAWLER_SCHEMA_ATTR_FLAGS, 0);
+    pAttr->eType = DirCrawlerSchemaBestType(pAttr);
+
+    ullUsn = (ULONGLONG)DirCrawlerSchemaGetInteger(pLdapConnect, pLdapEntry, DIR_CRAWLER_SCHEMA_ATTR_USN, 0);
+    gs_sCatalog.ullUsn = max(gs_sCatalog.ullUsn, ullUsn);
+    gs_sCatalog.dwAttrCount += 1;
+    return TRUE;
+}
+
+static DWORD DirCrawlerSchemaSearch(
+    _In_ const PLDAP_CONNECT pLdapConnect,
+    _In_ const PTCHAR ptSchemaNc,
+    _In_ const PTCHAR ptFilter,
+    _In_ const BOOL bAddEntries
+    ) {
+    PLDAP_REQUEST pLdapRequest = NULL;
+    PLDAP_ENTRY pLdapEntry = NULL;
+    DWORD dwEntryCount = 0;
+    BOOL bResult = FALSE;
+
+    bResult = LdapInitRequestEx(pLdapConnect, ptSchemaNc, ptFilter, LdapScopeOneLevel, (PTCHAR *)gsc_aptSchemaAttributes, NULL, NULL, &pLdapRequest);
+    if (API_FAILED(bResult)) {
+        FATAL(_T("Failed to init schema request <%s> on <%s>: <err:%#08x>"), ptFilter, ptSchemaNc, LdapLastError());
+    }
+
+    for (;;) {
+        bResult = LdapGetNextEntry(pLdapConnect, pLdapRequest, &pLdapEntry);
+        if (API_FAILED(bResult)) {
+            FATAL(_T("Unable to get next schema entry <%u>: <err:%#08x>"), dwEntryCount, LdapLastError());
+        }
+        if (pLdapEntry == NULL) {
+            break;
+        }
+
+        dwEntryCount += 1;
+        if (bAddEntries == TRUE) {
+            DirCrawlerSchemaAddEntry(pLdapConnect, pLdapEntry);
+        }
+        LdapReleaseEntry(pLdapConnect, &pLdapEntry);
+    }
+
+    LdapReleaseRequest(pLdapConnect, &pLdapRequest);
+    return dwEntryCount;
+}
+
+static void DirCrawlerSchemaWriteCache(
+    _In_ const PTCHAR ptCacheFile
+    ) {
+    FILE *pFile = NULL;
+    errno_t err = 0;
+    DWORD i = 0;
+
+    err = _tfopen_s(&pFile, ptCacheFile, _T("w, ccs=UTF-8"));
+    if (err != 0 || pFile == NULL) {
+        LOG(Warn, SUB_LOG(_T("Failed to write schema cache <%s>: <errno:%#08x>")), ptCacheFile, err);
+        return;
+    }
+
+    _ftprintf(pFile, _T("%s\n%s\n%llu\n"), DIR_CRAWLER_SCHEMA_CACHE_MAGIC, gs_sCatalog.ptServer, gs_sCatalog.ullUsn);
+    for (i = 0; i < gs_sCatalog.dwAttrCount; i++) {
+        _ftprintf(pFile, _T("%s\t%u\t%u\t%u\t%lld\t%lld\t%u\n"),
+            gs_sCatalog.pAttrArray[i].ptName, gs_sCatalog.pAttrArray[i].dwSyntax, gs_sCatalog.pAttrArray[i].dwOmSyntax, gs_sCatalog.pAttrArray[i].bSingleValued,
+            gs_sCatalog.pAttrArray[i].llRangeLower, gs_sCatalog.pAttrArray[i].llRangeUpper, gs_sCatalog.pAttrArray[i].dwSystemFlags);
+    }
+    fclose(pFile);
+
+    LOG(Info, SUB_LOG(_T("Schema catalog written to cache <%s>")), ptCacheFile);
+}
+
+static void DirCrawlerSchemaRelease(
+    ) {
+    DWORD i = 0;
+
+    for (i = 0; i < gs_sCatalog.dwAttrCount; i++) {
+        UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, gs_sCatalog.pAttrArray[i].ptName);
+    }
+    UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, gs_sCatalog.pAttrArray);
+    UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, gs_sCatalog.ptServer);
+    ZeroMemory(&gs_sCatalog, sizeof(gs_sCatalog));
+}
+
+static void DirCrawlerSchemaExpandWildcard(
+    _Inout_ PDIR_CRAWLER_REQ_DESCR pReqDescr
+    ) {
+    PDIR_CRAWLER_LDAP_ATTRIBUTE_DESCRIPTION pOldArray = pReqDescr->ldap.attributes.pAttrArray;
+    DWORD dwOldCount = pReqDescr->ldap.attributes.dwAttrCount;
+    PDIR_CRAWLER_LDAP_ATTRIBUTE_DESCRIPTION pNewArray = NULL;
+    DWORD dwNewCount = 0;
+    BOOL bExplicit = FALSE;
+    DWORD i = 0, j = 0, k = 0;
+
+    // Explicitly listed attributes keep their position and type, the wildcard is replaced by all the other catalog attributes
+    pNewArray = UtilsHeapAllocArrayHelper(g_pDirCrawlerHeap, DIR_CRAWLER_LDAP_ATTRIBUTE_DESCRIPTION, dwOldCount + gs_sCatalog.dwAttrCount);
+    for (i = 0; i < dwOldCount; i++) {
+        if (STR_EQ(pOldArray[i].ptName, JSON_ATTR_WILDCARD) == FALSE) {
+            pNewArray[dwNewCount++] = pOldArray[i];
+            continue;
+        }
+
+        for (j = 0; j < gs_sCatalog.dwAttrCount; j++) {
+            if (gs_sCatalog.pAttrArray[j].dwSystemFlags & DIR_CRAWLER_SCHEMA_FLAG_CONSTRUCTED) {
+                continue;
+            }
+            bExplicit = FALSE;
+            for (k = 0; k < dwOldCount && bExplicit == FALSE; k++) {
+                bExplicit = (_tcsicmp(pOldArray[k].ptName, gs_sCatalog.pAttrArray[j].ptName) == 0);
+            }
+            if (bExplicit == FALSE) {
+                pNewArray[dwNewCount].ptName = UtilsHeapStrDupHelper(g_pDirCrawlerHeap, gs_sCatalog.pAttrArray[j].ptName);
+                pNewArray[dwNewCount].eType = gs_sCatalog.pAttrArray[j].eType;
+                dwNewCount += 1;
+            }
+        }
+        UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, pOldArray[i].ptName);
+    }
+
+    pReqDescr->ldap.attributes.pAttrArray = pNewArray;
+    pReqDescr->ldap.attributes.dwAttrCount = dwNewCount;
+    UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, pOldArray);
+
+    REQ_LOG(pReqDescr, Info, _T("Wildcard expanded to <%u> attributes"), dwNewCount);
+}
+
+static void DirCrawlerSchemaResolveAttribute(
+    _In_ const PDIR_CRAWLER_REQ_DESCR pReqDescr,
+    _Inout_ PDIR_CRAWLER_LDAP_ATTRIBUTE_DESCRIPTION pAttrDescr
+    ) {
+    PDIR_CRAWLER_SCHEMA_ATTRIBUTE pSchemaAttr = DirCrawlerSchemaLookup(pAttrDescr->ptName);
+
+    switch (pAttrDescr->eType) {
+    case DirCrawlerTypeAuto:
+        if (pSchemaAttr != NULL) {
+            pAttrDescr->eType = pSchemaAttr->eType;
+        }
+        else {
+            REQ_LOG(pReqDescr, Warn, _T("Attribute <%s> of type 'auto' is not in the schema catalog, it is written as 'str'"), pAttrDescr->ptName);
+            pAttrDescr->eType = DirCrawlerTypeStr;
+        }
+        break;
+
+    case DirCrawlerTypeInt:
+        // A wrong 'int' would otherwise be checked (and rejected) value by value
+        if (pSchemaAttr == NULL) {
+            break;
+        }
+        if (pSchemaAttr->dwSyntax == DIR_CRAWLER_SCHEMA_SYNTAX_INTEGER || pSchemaAttr->dwSyntax == DIR_CRAWLER_SCHEMA_SYNTAX_LARGE_INT) {
+            pAttrDescr->eType = DirCrawlerTypeRaw;
+        }
+        else {
+            REQ_LOG(pReqDescr, Warn, _T("Attribute <%s> is declared as 'int' but has syntax <2.5.5.%u> in the schema, it is written as 'str'"), pAttrDescr->ptName, pSchemaAttr->dwSyntax);
+            pAttrDescr->eType = DirCrawlerTypeStr;
+        }
+        break;
+
+    default:
+        break;
+    }
+}
+
+/* --- PUBLIC FUNCTIONS ----------------------------------------------------- */
+BOOL DirCrawlerSchemaLoad(
+    _In_ const PLDAP_CONNECT pLdapConnect,
+    _In_ const PLDAP_ROOT_DSE pRootDse,
+    _In_ const PLDAP_OPTIONS pLdapOptions,
+    _In_opt_ const PTCHAR ptCacheFile
+    ) {
+    TCHAR atFilter[MAX_LINE] = { 0 };
+    PTCHAR ptSchemaNc = pRootDse->extracted.ptSchemaNamingContext;
+    PTCHAR ptServer = pRootDse->extracted.ptLdapServiceName;
+    BOOL bResult = FALSE;
+
+    if (ptSchemaNc == NULL || ptServer == NULL) {
+        LOG(Warn, SUB_LOG(_T("No schema naming context or LDAP service name in the RootDSE, no schema catalog")));
+        return FALSE;
+    }
+
+    bResult = LdapBind(pLdapConnect, ptSchemaNc, pLdapOptions->ptLogin, pLdapOptions->ptPassword, pLdapOptions->ptExplicitDomain);
+    if (!bResult) {
+        LOG(Warn, SUB_LOG(_T("Failed to bind to the schema naming context, no schema catalog: <err:%#08x>")), LdapLastError());
+        return FALSE;
+    }
+
+    // The cached catalog is still valid if no attributeSchema object changed on this DC since it was written
+    if (ptCacheFile != NULL && DirCrawlerSchemaLoadCache(ptCacheFile) == TRUE) {
+        if (STR_EQ(gs_sCatalog.ptServer, ptServer)) {
+            _stprintf_s(atFilter, _countof(atFilter), DIR_CRAWLER_SCHEMA_CHANGED_FILTER, gs_sCatalog.ullUsn + 1);
+            if (DirCrawlerSchemaSearch(pLdapConnect, ptSchemaNc, atFilter, FALSE) == 0) {
+                LOG(Info, SUB_LOG(_T("Schema catalog cache <%s> is up to date <usn:%llu>")), ptCacheFile, gs_sCatalog.ullUsn);
+                return TRUE;
+            }
+            LOG(Info, SUB_LOG(_T("Schema changed since <usn:%llu>, reloading it")), gs_sCatalog.ullUsn);
+        }
+        else {
+            LOG(Info, SUB_LOG(_T("Schema catalog cache was written from <%s>, reloading it from <%s>")), gs_sCatalog.ptServer, ptServer);
+        }
+        DirCrawlerSchemaRelease();
+    }
+
+    gs_sCatalog.ptServer = UtilsHeapStrDupHelper(g_pDirCrawlerHeap, ptServer);
+    DirCrawlerSchemaSearch(pLdapConnect, ptSchemaNc, DIR_CRAWLER_SCHEMA_FILTER, TRUE);
+    if (gs_sCatalog.dwAttrCount == 0) {
+        LOG(Warn, SUB_LOG(_T("No attributeSchema object found in <%s>, no schema catalog")), ptSchemaNc);
+        DirCrawlerSchemaRelease();
+        return FALSE;
+    }
+    qsort(gs_sCatalog.pAttrArray, gs_sCatalog.dwAttrCount, sizeof(DIR_CRAWLER_SCHEMA_ATTRIBUTE), DirCrawlerSchemaCompareAttributes);
+    LOG(Info, SUB_LOG(_T("Schema catalog loaded from <%s>: <attributes:%u> <usn:%llu>")), ptSchemaNc, gs_sCatalog.dwAttrCount, gs_sCatalog.ullUsn);
+
+    if (ptCacheFile != NULL) {
+        DirCrawlerSchemaWriteCache(ptCacheFile);
+    }
+    return TRUE;
+}
+
+BOOL DirCrawlerSchemaLoadCache(
+    _In_ const PTCHAR ptCacheFile
+    ) {
+    FILE *pFile = NULL;
+    TCHAR atLine[MAX_LINE] = { 0 };
+    TCHAR atName[MAX_LINE] = { 0 };
+    PDIR_CRAWLER_SCHEMA_ATTRIBUTE pAttr = NULL;
+    DWORD dwLine = 0;
+
+    if (_tfopen_s(&pFile, ptCacheFile, _T("r, ccs=UTF-8")) != 0 || pFile == NULL) {
+        LOG(Info, SUB_LOG(_T("No schema catalog cache <%s>")), ptCacheFile);
+        return FALSE;
+    }
+
+    while (_fgetts(atLine, _countof(atLine), pFile) != NULL) {
+        atLine[_tcscspn(atLine, _T("\r\n"))] = NULL_CHAR;
+        dwLine += 1;
+
+        if (dwLine == 1) {
+            if (STR_EQ(atLine, DIR_CRAWLER_SCHEMA_CACHE_MAGIC) == FALSE) {
+                break;
+            }
+        }
+        else if (dwLine == 2) {
+            gs_sCatalog.ptServer = UtilsHeapStrDupHelper(g_pDirCrawlerHeap, atLine);
+        }
+        else if (dwLine == 3) {
+            gs_sCatalog.ullUsn = _tcstoui64(atLine, NULL, 10);
+        }
+        else {
+            gs_sCatalog.pAttrArray = UtilsHeapAllocOrReallocHelper(g_pDirCrawlerHeap, gs_sCatalog.pAttrArray, SIZEOF_ARRAY(DIR_CRAWLER_SCHEMA_ATTRIBUTE, gs_sCatalog.dwAttrCount + 1));
+            pAttr = &gs_sCatalog.pAttrArray[gs_sCatalog.dwAttrCount];
+            ZeroMemory(pAttr, sizeof(DIR_CRAWLER_SCHEMA_ATTRIBUTE));
+            if (_stscanf_s(atLine, _T("%[^\t]\t%u\t%u\t%u\t%lld\t%lld\t%u"), atName, (unsigned)_countof(atName), &pAttr->dwSyntax, &pAttr->dwOmSyntax, &pAttr->bSingleValued, &pAttr->llRangeLower, &pAttr->llRangeUpper, &pAttr->dwSystemFlags) != 7) {
+                LOG(Warn, SUB_LOG(_T("Invalid line <%u> in schema catalog cache <%s>")), dwLine, ptCacheFile);
+                break;
+            }
+            pAttr->ptName = UtilsHeapStrDupHelper(g_pDirCrawlerHeap, atName);
+            pAttr->eType = DirCrawlerSchemaBestType(pAttr);
+            gs_sCatalog.dwAttrCount += 1;
+        }
+    }
+    fclose(pFile);
+
+    if (gs_sCatalog.ptServer == NULL || gs_sCatalog.dwAttrCount == 0 || dwLine != gs_sCatalog.dwAttrCount + 3) {
+        LOG(Warn, SUB_LOG(_T("Ignoring invalid schema catalog cache <%s>")), ptCacheFile);
+        DirCrawlerSchemaRelease();
+        return FALSE;
+    }
+
+    // Written sorted, but it costs nothing to make sure the lookups will work
+    qsort(gs_sCatalog.pAttrArray, gs_sCatalog.dwAttrCount, sizeof(DIR_CRAWLER_SCHEMA_ATTRIBUTE), DirCrawlerSchemaCompareAttributes);
+    LOG(Info, SUB_LOG(_T("Schema catalog read from cache <%s>: <server:%s> <attributes:%u> <usn:%llu>")), ptCacheFile, gs_sCatalog.ptServer, gs_sCatalog.dwAttrCount, gs_sCatalog.ullUsn);
+    return TRUE;
+}
+
+PDIR_CRAWLER_SCHEMA_ATTRIBUTE DirCrawlerSchemaLookup(
+    _In_ const PTCHAR ptName
+    ) {
+    if (gs_sCatalog.dwAttrCount == 0) {
+        return NULL;
+    }
+    return bsearch(ptName, gs_sCatalog.pAttrArray, gs_sCatalog.dwAttrCount, sizeof(DIR_CRAWLER_SCHEMA_ATTRIBUTE), DirCrawlerSchemaCompareName);
+}
+
+void DirCrawlerSchemaResolveRequests(
+    _Inout_ PDIR_CRAWLER_REQ_DESCR_ARRAY pRequests
+    ) {
+    PDIR_CRAWLER_REQ_DESCR pReqDescr = NULL;
+    DWORD i = 0, j = 0;
+
+    for (i = 0; i < pRequests->dwRequestCount; i++) {
+        pReqDescr = &pRequests->pRequestsDescriptions[i];
+
+        for (j = 0; j < pReqDescr->ldap.attributes.dwAttrCount; j++) {
+            if (STR_EQ(pReqDescr->ldap.attributes.pAttrArray[j].ptName, JSON_ATTR_WILDCARD)) {
+                if (gs_sCatalog.dwAttrCount == 0) {
+                    // Called from _tmain before any request runs: there is no request exception handler yet
+                    FATAL(_T("Attribute wildcard '*' of request <%s> needs the schema catalog (LDAP server or '--schema-cache')"), pReqDescr->infos.ptName);
+                }
+                DirCrawlerSchemaExpandWildcard(pReqDescr);
+                break;
+            }
+        }
+
+        for (j = 0; j < pReqDescr->ldap.attributes.dwAttrCount; j++) {
+            DirCrawlerSchemaResolveAttribute(pReqDescr, &pReqDescr->ldap.attributes.pAttrArray[j]);
+        }
+    }
+}
+
+void DirCrawlerSchemaCleanup(
+    ) {
+    DirCrawlerSchemaRelease();
+}
@@ -0,0 +1,87 @@
+#ifndef __DIR_CRAWLER_SCHEMA_H__
+#define __DIR_CRAWLER_SCHEMA_H__
+
+/* --- INCLUDES ------------------------------------------------------------- */
+#include "DirectoryCrawler.h"
+#include "DirCrawlerJson.h"
+
+/* --- DEFINES -------------------------------------------------------------- */
+//
+// Attribute catalog, loaded once per run from the 'attributeSchema' objects of the schema NC.
+// The cache file is a UTF-8 text file:
+//  - header lines : magic, server the catalog was read from, highest 'uSNChanged' of the attributeSchema objects
+//  - then one line: lDAPDisplayName, attributeSyntax, oMSyntax, isSingleValued, rangeLower, rangeUpper, systemFlags (tab separated)
+// USNs are local to a DC, so the cache is only reused as is when it comes from the same server and no attributeSchema object changed since.
+//
+#define DIR_CRAWLER_SCHEMA_CACHE_MAGIC      _T("DirectoryCrawler schema catalog v1")
+#define DIR_CRAWLER_SCHEMA_FILTER           _T("(objectClass=attributeSchema)")
+#define DIR_CRAWLER_SCHEMA_CHANGED_FILTER   _T("(&(objectClass=attributeSchema)(uSNChanged>=%llu))")
+
+#define DIR_CRAWLER_SCHEMA_ATTR_NAME        _T("lDAPDisplayName")
+#define DIR_CRAWLER_SCHEMA_ATTR_SYNTAX      _T("attributeSyntax")
+#define DIR_CRAWLER_SCHEMA_ATTR_OM_SYNTAX   _T("oMSyntax")
+#define DIR_CRAWLER_SCHEMA_ATTR_SINGLE      _T("isSingleValued")
+#define DIR_CRAWLER_SCHEMA_ATTR_RANGE_LOWER _T("rangeLower")
+#define DIR_CRAWLER_SCHEMA_ATTR_RANGE_UPPER _T("rangeUpper")
+#define DIR_CRAWLER_SCHEMA_ATTR_FLAGS       _T("systemFlags")
+#define DIR_CRAWLER_SCHEMA_ATTR_USN         _T("uSNChanged")
+
+#define DIR_CRAWLER_SCHEMA_SYNTAX_PREFIX    "2.5.5."    // attributeSyntax values are 2.5.5.<n>, only <n> is kept
+#define DIR_CRAWLER_SCHEMA_NO_RANGE         (-1)
+#define DIR_CRAWLER_SCHEMA_FLAG_CONSTRUCTED 0x00000004  // FLAG_ATTR_IS_CONSTRUCTED, computed by the DC and not returned for '*'
+
+// attributeSyntax (2.5.5.<n>) and oMSyntax values driving the formatter choice
+#define DIR_CRAWLER_SCHEMA_SYNTAX_BOOLEAN   8
+#define DIR_CRAWLER_SCHEMA_SYNTAX_INTEGER   9
+#define DIR_CRAWLER_SCHEMA_SYNTAX_OCTETS    10
+#define DIR_CRAWLER_SCHEMA_SYNTAX_TIME      11
+#define DIR_CRAWLER_SCHEMA_SYNTAX_SD        15
+#define DIR_CRAWLER_SCHEMA_SYNTAX_LARGE_INT 16
+#define DIR_CRAWLER_SCHEMA_SYNTAX_SID       17
+#define DIR_CRAWLER_SCHEMA_OM_GENERALIZED   24
+#define DIR_CRAWLER_SCHEMA_GUID_RANGE       16
+
+/* --- TYPES ---------------------------------------------------------------- */
+typedef struct _DIR_CRAWLER_SCHEMA_ATTRIBUTE {
+    PTCHAR ptName;
+    DWORD dwSyntax;             // <n> of attributeSyntax 2.5.5.<n>
+    DWORD dwOmSyntax;
+    BOOL bSingleValued;
+    LONGLONG llRangeLower;      // DIR_CRAWLER_SCHEMA_NO_RANGE if absent
+    LONGLONG llRangeUpper;      // DIR_CRAWLER_SCHEMA_NO_RANGE if absent
+    DWORD dwSystemFlags;
+    DIR_CRAWLER_LDAP_ATTR_TYPE eType;   // best formatter for this syntax
+} DIR_CRAWLER_SCHEMA_ATTRIBUTE, *PDIR_CRAWLER_SCHEMA_ATTRIBUTE;
+
+typedef struct _DIR_CRAWLER_SCHEMA_CATALOG {
+    PTCHAR ptServer;
+    ULONGLONG ullUsn;
+    DWORD dwAttrCount;
+    PDIR_CRAWLER_SCHEMA_ATTRIBUTE pAttrArray;  // sorted by name (case insensitive)
+} DIR_CRAWLER_SCHEMA_CATALOG, *PDIR_CRAWLER_SCHEMA_CATALOG;
+
+/* --- VARIABLES ------------------------------------------------------------ */
+/* --- PROTOTYPES ----------------------------------------------------------- */
+BOOL DirCrawlerSchemaLoad(
+    _In_ const PLDAP_CONNECT pLdapConnect,
+    _In_ const PLDAP_ROOT_DSE pRootDse,
+    _In_ const PLDAP_OPTIONS pLdapOptions,
+    _In_opt_ const PTCHAR ptCacheFile
+    );
+
+BOOL DirCrawlerSchemaLoadCache(
+    _In_ const PTCHAR ptCacheFile
+    );
+
+PDIR_CRAWLER_SCHEMA_ATTRIBUTE DirCrawlerSchemaLookup(
+    _In_ const PTCHAR ptName
+    );
+
+void DirCrawlerSchemaResolveRequests(
+    _Inout_ PDIR_CRAWLER_REQ_DESCR_ARRAY pRequests
+    );
+
+void DirCrawlerSchemaCleanup(
+    );
+
+#endif // __DIR_CRAWLER_SCHEMA_H__
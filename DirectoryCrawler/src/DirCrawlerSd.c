@@ -0,0 +1,564 @@
+/* --- INCLUDES ------------------------------------------------------------- */
+#include "DirCrawlerSd.h"
+#include "DirCrawlerFormatters.h"
+#include "DirCrawlerSink.h"
+#include "DirCrawlerStats.h"
+
+/* --- PRIVATE VARIABLES ---------------------------------------------------- */
+static const PTCHAR gsc_aptSdOutfileHeader[] = { _T("dn"), _T("attribute"), _T("owner"), _T("group"), _T("control"), _T("daclId") };
+static const PTCHAR gsc_aptAceOutfileHeader[] = { _T("daclId"), _T("index"), _T("type"), _T("flags"), _T("trustee"), _T("accessMask"), _T("objectType"), _T("inheritedObjectType") };
+
+/* --- PUBLIC VARIABLES ----------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS ---------------------------------------------------- */
+static WORD DirCrawlerSdGetWord(
+    _In_ const PBYTE pbData
+    ) {
+    return *(UNALIGNED WORD *)pbData;
+}
+
+static DWORD DirCrawlerSdGetDword(
+    _In_ const PBYTE pbData
+    ) {
+    return *(UNALIGNED DWORD *)pbData;
+}
+
+static DWORD DirCrawlerSdSidSize(
+    _In_ const PBYTE pbSid,
+    _In_ const DWORD dwMaxSize
+    ) {
+    DWORD dwSize = 0;
+
+    if (dwMaxSize < DIR_CRAWLER_SD_SID_HEADER_SIZE || pbSid[0] != SID_REVISION || pbSid[1] > SID_MAX_SUB_AUTHORITIES) {
+        return 0;
+    }
+    dwSize = DIR_CRAWLER_SD_SID_HEADER_SIZE + pbSid[1] * sizeof(DWORD);
+    return dwSize <= dwMaxSize ? dwSize : 0;
+}
+
+static PBYTE DirCrawlerSdGetSid(
+    _In_ const PBYTE pbData,
+    _In_ const DWORD dwSize,
+    _In_ const DWORD dwOffset,
+    _Out_ PDWORD pdwSidSize
+    ) {
+    *pdwSidSize = 0;
+    if (dwOffset == 0 || dwOffset >= dwSize) {
+        return NULL;
+    }
+    *pdwSidSize = DirCrawlerSdSidSize(pbData + dwOffset, dwSize - dwOffset);
+    return *pdwSidSize != 0 ? pbData + dwOffset : NULL;
+}
+
+static BOOL DirCrawlerSdIsObjectAce(
+    _In_ const BYTE bType
+    ) {
+    switch (bType) {
+    case ACCESS_ALLOWED_OBJECT_ACE_TYPE:
+    case ACCESS_DENIED_OBJECT_ACE_TYPE:
+    case SYSTEM_AUDIT_OBJECT_ACE_TYPE:
+    case SYSTEM_ALARM_OBJECT_ACE_TYPE:
+    case ACCESS_ALLOWED_CALLBACK_OBJECT_ACE_TYPE:
+    case ACCESS_DENIED_CALLBACK_OBJECT_ACE_TYPE:
+    case SYSTEM_AUDIT_CALLBACK_OBJECT_ACE_TYPE:
+    case SYSTEM_ALARM_CALLBACK_OBJECT_ACE_TYPE:
+        return TRUE;
+    default:
+        return FALSE;
+    }
+}
+
+static void DirCrawlerSdWiden(
+    _In_ const LPSTR pIn,
+    _Out_ PTCHAR ptOut,
+    _In_ const DWORD dwOutSize
+    ) {
+    DWORD i = 0;
+
+    // Only used on SID, GUID and hexadecimal strings, which are pure ASCII
+    for (i = 0; pIn[i] != '\0' && i + 1 < dwOutSize; i++) {
+        ptOut[i] = (TCHAR)pIn[i];
+    }
+    ptOut[i] = NULL_CHAR;
+}
+
+static void DirCrawlerSdFormatSidT(
+    _In_opt_ const PBYTE pbSid,
+    _In_ const DWORD dwSize,
+    _Out_ PTCHAR ptOut
+    ) {
+    CHAR aSid[DIR_CRAWLER_SD_SID_MAX_LEN] = { 0 };
+
+    if (pbSid != NULL) {
+        DirCrawlerSdFormatSid(pbSid, dwSize, aSid);
+    }
+    DirCrawlerSdWiden(aSid, ptOut, DIR_CRAWLER_SD_SID_MAX_LEN);
+}
+
+static void DirCrawlerSdFormatGuidT(
+    _In_opt_ const PBYTE pbGuid,
+    _Out_ PTCHAR ptOut
+    ) {
+    CHAR aGuid[DIR_CRAWLER_SD_GUID_LEN] = { 0 };
+
+    if (pbGuid != NULL) {
+        DirCrawlerSdFormatGuid(pbGuid, DIR_CRAWLER_SD_GUID_SIZE, aGuid);
+    }
+    DirCrawlerSdWiden(aGuid, ptOut, DIR_CRAWLER_SD_GUID_LEN);
+}
+
+static BOOL DirCrawlerSdAddDaclId(
+    _In_ const PDIR_CRAWLER_SD_OUTPUT pOutput,
+    _In_ const ULONGLONG ullDaclId
+    ) {
+    ULONGLONG *pullOldIds = NULL;
+    DWORD dwOldSize = 0;
+    DWORD dwSlot = 0;
+    DWORD i = 0;
+
+    for (dwSlot = (DWORD)ullDaclId & (pOutput->dwDaclSetSize - 1); pOutput->pullDaclIds[dwSlot] != DIR_CRAWLER_SD_NO_DACL_ID; dwSlot = (dwSlot + 1) & (pOutput->dwDaclSetSize - 1)) {
+        if (pOutput->pullDaclIds[dwSlot] == ullDaclId) {
+            return FALSE;
+        }
+    }
+    pOutput->pullDaclIds[dwSlot] = ullDaclId;
+    pOutput->dwDaclCount += 1;
+
+    // Keep the load factor under 1/2
+    if (pOutput->dwDaclCount * 2 >= pOutput->dwDaclSetSize) {
+        pullOldIds = pOutput->pullDaclIds;
+        dwOldSize = pOutput->dwDaclSetSize;
+        pOutput->dwDaclSetSize *= 2;
+        pOutput->pullDaclIds = UtilsHeapAllocArrayHelper(g_pDirCrawlerHeap, ULONGLONG, pOutput->dwDaclSetSize);
+        ZeroMemory(pOutput->pullDaclIds, SIZEOF_ARRAY(ULONGLONG, pOutput->dwDaclSetSize));
+        for (i = 0; i < dwOldSize; i++) {
+            if (pullOldIds[i] != DIR_CRAWLER_SD_NO_DACL_ID) {
+                for (dwSlot = (DWORD)pullOldIds[i] & (pOutput->dwDaclSetSize - 1); pOutput->pullDaclIds[dwSlot] != DIR_CRAWLER_SD_NO_DACL_ID; dwSlot = (dwSlot + 1) & (pOutput->dwDaclSetSize - 1));
+                pOutput->pullDaclIds[dwSlot] = pullOldIds[i];
+            }
+        }
+        UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, pullOldIds);
+    }
+
+    return TRUE;
+}
+
+static void DirCrawlerSdFormatAce(
+    _In_ const PDIR_CRAWLER_ACE pAce,
+    _In_ const DWORD dwIndex,
+    _Out_ PDIR_CRAWLER_SD_ACE_FIELDS pAceFields
+    ) {
+    _stprintf_s(pAceFields->atIndex, _countof(pAceFields->atIndex), _T("%u"), dwIndex);
+    _stprintf_s(pAceFields->atType, _countof(pAceFields->atType), _T("%u"), pAce->bType);
+    _stprintf_s(pAceFields->atFlags, _countof(pAceFields->atFlags), _T("0x%02x"), pAce->bFlags);
+    _stprintf_s(pAceFields->atMask, _countof(pAceFields->atMask), _T("0x%08x"), pAce->dwMask);
+    DirCrawlerSdFormatSidT(pAce->pbTrustee, pAce->dwTrusteeSize, pAceFields->atTrustee);
+    DirCrawlerSdFormatGuidT(pAce->pbObjectType, pAceFields->atObjectType);
+    DirCrawlerSdFormatGuidT(pAce->pbInheritedObjectType, pAceFields->atInheritedObjectType);
+}
+
+static BOOL DirCrawlerSdIsDaclFormatted(
+    _In_ const ULONGLONG ullDaclId,
+    _In_ const PDIR_CRAWLER_SD_ENTRY apPrevious[],
+    _In_ const DWORD dwPreviousCount,
+    _In_opt_ const PDIR_CRAWLER_SD_FIELDS pFields,  // earlier values of the entry being formatted
+    _In_ const DWORD dwFieldsCount
+    ) {
+    DWORD i = 0, j = 0;
+
+    for (i = 0; i < dwPreviousCount; i++) {
+        if (apPrevious[i] != NULL) {
+            for (j = 0; j < apPrevious[i]->dwValueCount; j++) {
+                if (apPrevious[i]->pValues[j].ullDaclId == ullDaclId) {
+                    return TRUE;
+                }
+            }
+        }
+    }
+    for (j = 0; j < dwFieldsCount; j++) {
+        if (pFields[j].ullDaclId == ullDaclId) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+static void DirCrawlerSdWriteDacl(
+    _In_ const PDIR_CRAWLER_SD_OUTPUT pOutput,
+    _In_ const PDIR_CRAWLER_REQ_DESCR pReqDescr,
+    _In_ const PDIR_CRAWLER_SD_FIELDS pFields
+    ) {
+    BOOL bResult = FALSE;
+    DWORD i = 0;
+
+    for (i = 0; i < pFields->dwAceFieldsCount; i++) {
+        PDIR_CRAWLER_SD_ACE_FIELDS pAceFields = &pFields->pAceFields[i];
+        PTCHAR aptRecord[] = { pFields->atDaclId, pAceFields->atIndex, pAceFields->atType, pAceFields->atFlags, pAceFields->atTrustee, pAceFields->atMask, pAceFields->atObjectType, pAceFields->atInheritedObjectType };
+        static_assert(_countof(aptRecord) == _countof(gsc_aptAceOutfileHeader), "Invalid array count");
+
+        bResult = DirCrawlerSinkWriteRecord(pOutput->pAceSink, aptRecord);
+        if (API_FAILED(bResult)) {
+            REQ_FATAL(pReqDescr, _T("Failed to write ACE record of DACL <%s>: <err:%#08x>"), pFields->atDaclId, DirCrawlerSinkGetLastError(pOutput->pAceSink));
+        }
+    }
+
+    if (pFields->dwAceFieldsCount != pFields->wAceCount) {
+        REQ_LOG(pReqDescr, Warn, _T("Malformed DACL <%s>: only <%u/%u> ACEs could be parsed"), pFields->atDaclId, pFields->dwAceFieldsCount, pFields->wAceCount);
+    }
+}
+
+/* --- PUBLIC FUNCTIONS ----------------------------------------------------- */
+DWORD DirCrawlerSdFormatSid(
+    _In_ const PBYTE pbSid,
+    _In_ const DWORD dwSize,
+    _Out_opt_ LPSTR pOutBuff
+    ) {
+    CHAR aSid[DIR_CRAWLER_SD_SID_MAX_LEN] = { 'S', '-' };
+    ULONGLONG ullAuthority = 0;
+    DWORD dwLen = 2;
+    DWORD i = 0;
+
+    if (DirCrawlerSdSidSize(pbSid, dwSize) == 0) {
+        if (pOutBuff != NULL) {
+            pOutBuff[0] = '\0';
+        }
+        return 1;
+    }
+
+    // Identifier authority is big-endian, and printed in hexadecimal when it does not fit in 32 bits (like ConvertSidToStringSid)
+    for (i = 0; i < 6; i++) {
+        ullAuthority = (ullAuthority << 8) | pbSid[2 + i];
+    }
+    // No CRT formatting here, this is called for every SID and trustee value
+    dwLen += FormatDecimalA(pbSid[0], aSid + dwLen);
+    aSid[dwLen++] = '-';
+    if (ullAuthority >> 32) {
+        aSid[dwLen++] = '0';
+        aSid[dwLen++] = 'x';
+        dwLen += FormatHexA(ullAuthority, 12, TRUE, aSid + dwLen);
+    }
+    else {
+        dwLen += FormatDecimalA(ullAuthority, aSid + dwLen);
+    }
+    for (i = 0; i < pbSid[1]; i++) {
+        aSid[dwLen++] = '-';
+        dwLen += FormatDecimalA(DirCrawlerSdGetDword(pbSid + DIR_CRAWLER_SD_SID_HEADER_SIZE + i * sizeof(DWORD)), aSid + dwLen);
+    }
+    aSid[dwLen] = '\0';
+
+    if (pOutBuff != NULL) {
+        CopyMemory(pOutBuff, aSid, dwLen + 1);
+    }
+    return dwLen + 1;
+}
+
+DWORD DirCrawlerSdFormatGuid(
+    _In_ const PBYTE pbGuid,
+    _In_ const DWORD dwSize,
+    _Out_opt_ LPSTR pOutBuff
+    ) {
+    if (dwSize != DIR_CRAWLER_SD_GUID_SIZE) {
+        if (pOutBuff != NULL) {
+            pOutBuff[0] = '\0';
+        }
+        return 1;
+    }
+
+    // Mixed-endian layout of GUID structures: Data1, Data2 and Data3 are little-endian, Data4 is a byte array
+    if (pOutBuff != NULL) {
+        FormatHexA(DirCrawlerSdGetDword(pbGuid), 8, FALSE, pOutBuff);
+        pOutBuff[8] = '-';
+        FormatHexA(DirCrawlerSdGetWord(pbGuid + 4), 4, FALSE, pOutBuff + 9);
+        pOutBuff[13] = '-';
+        FormatHexA(DirCrawlerSdGetWord(pbGuid + 6), 4, FALSE, pOutBuff + 14);
+        pOutBuff[18] = '-';
+        FormatHexA(((ULONGLONG)pbGuid[8] << 8) | pbGuid[9], 4, FALSE, pOutBuff + 19);
+        pOutBuff[23] = '-';
+        FormatHexA(_byteswap_uint64(*(UNALIGNED ULONGLONG *)(pbGuid + 8)) & 0xFFFFFFFFFFFF, 12, FALSE, pOutBuff + 24);
+        pOutBuff[36] = '\0';
+    }
+    return DIR_CRAWLER_SD_GUID_LEN;
+}
+
+BOOL DirCrawlerSdParse(
+    _In_ const PBYTE pbData,
+    _In_ const DWORD dwSize,
+    _Out_ PDIR_CRAWLER_SD pSd
+    ) {
+    DWORD dwDaclOffset = 0;
+
+    ZeroMemory(pSd, sizeof(DIR_CRAWLER_SD));
+
+    // Values come from the server: every offset and size is checked against the value size
+    if (dwSize < sizeof(SECURITY_DESCRIPTOR_RELATIVE) || pbData[0] != SECURITY_DESCRIPTOR_REVISION) {
+        return FALSE;
+    }
+    pSd->wControl = DirCrawlerSdGetWord(pbData + FIELD_OFFSET(SECURITY_DESCRIPTOR_RELATIVE, Control));
+    if ((pSd->wControl & SE_SELF_RELATIVE) == 0) {
+        return FALSE;
+    }
+
+    pSd->pbOwner = DirCrawlerSdGetSid(pbData, dwSize, DirCrawlerSdGetDword(pbData + FIELD_OFFSET(SECURITY_DESCRIPTOR_RELATIVE, Owner)), &pSd->dwOwnerSize);
+    pSd->pbGroup = DirCrawlerSdGetSid(pbData, dwSize, DirCrawlerSdGetDword(pbData + FIELD_OFFSET(SECURITY_DESCRIPTOR_RELATIVE, Group)), &pSd->dwGroupSize);
+
+    dwDaclOffset = DirCrawlerSdGetDword(pbData + FIELD_OFFSET(SECURITY_DESCRIPTOR_RELATIVE, Dacl));
+    if ((pSd->wControl & SE_DACL_PRESENT) != 0 && dwDaclOffset != 0) {
+        if (dwDaclOffset > dwSize - sizeof(ACL)) {
+            return FALSE;
+        }
+        pSd->pbDacl = pbData + dwDaclOffset;
+        pSd->dwDaclSize = DirCrawlerSdGetWord(pSd->pbDacl + FIELD_OFFSET(ACL, AclSize));
+        pSd->wAceCount = DirCrawlerSdGetWord(pSd->pbDacl + FIELD_OFFSET(ACL, AceCount));
+        if (pSd->dwDaclSize < sizeof(ACL) || pSd->dwDaclSize > dwSize - dwDaclOffset) {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+BOOL DirCrawlerSdNextAce(
+    _In_ const PDIR_CRAWLER_SD pSd,
+    _Inout_ PDWORD pdwOffset,           // 0 for the first ACE
+    _Out_ PDIR_CRAWLER_ACE pAce
+    ) {
+    PBYTE pbAce = NULL;
+    DWORD dwAceSize = 0;
+    DWORD dwBodyOffset = sizeof(ACE_HEADER) + sizeof(DWORD); // header and access mask
+    DWORD dwObjectFlags = 0;
+
+    ZeroMemory(pAce, sizeof(DIR_CRAWLER_ACE));
+
+    if (pSd->pbDacl == NULL) {
+        return FALSE;
+    }
+    if (*pdwOffset == 0) {
+        *pdwOffset = sizeof(ACL);
+    }
+    if (*pdwOffset + sizeof(ACE_HEADER) > pSd->dwDaclSize) {
+        return FALSE;
+    }
+
+    pbAce = pSd->pbDacl + *pdwOffset;
+    dwAceSize = DirCrawlerSdGetWord(pbAce + FIELD_OFFSET(ACE_HEADER, AceSize));
+    if (dwAceSize < dwBodyOffset || *pdwOffset + dwAceSize > pSd->dwDaclSize) {
+        return FALSE;
+    }
+    *pdwOffset += dwAceSize;
+
+    pAce->bType = pbAce[FIELD_OFFSET(ACE_HEADER, AceType)];
+    pAce->bFlags = pbAce[FIELD_OFFSET(ACE_HEADER, AceFlags)];
+    pAce->dwMask = DirCrawlerSdGetDword(pbAce + sizeof(ACE_HEADER));
+
+    if (DirCrawlerSdIsObjectAce(pAce->bType) == TRUE) {
+        if (dwAceSize < dwBodyOffset + sizeof(DWORD)) {
+            return TRUE;
+        }
+        dwObjectFlags = DirCrawlerSdGetDword(pbAce + dwBodyOffset);
+        dwBodyOffset += sizeof(DWORD);
+        if ((dwObjectFlags & ACE_OBJECT_TYPE_PRESENT) != 0 && dwBodyOffset + DIR_CRAWLER_SD_GUID_SIZE <= dwAceSize) {
+            pAce->pbObjectType = pbAce + dwBodyOffset;
+            dwBodyOffset += DIR_CRAWLER_SD_GUID_SIZE;
+        }
+        if ((dwObjectFlags & ACE_INHERITED_OBJECT_TYPE_PRESENT) != 0 && dwBodyOffset + DIR_CRAWLER_SD_GUID_SIZE <= dwAceSize) {
+            pAce->pbInheritedObjectType = pbAce + dwBodyOffset;
+            dwBodyOffset += DIR_CRAWLER_SD_GUID_SIZE;
+        }
+    }
+    else if (pAce->bType == ACCESS_ALLOWED_COMPOUND_ACE_TYPE) {
+        return TRUE; // obsolete, no single trustee
+    }
+
+    pAce->dwTrusteeSize = DirCrawlerSdSidSize(pbAce + dwBodyOffset, dwAceSize - dwBodyOffset);
+    pAce->pbTrustee = pAce->dwTrusteeSize != 0 ? pbAce + dwBodyOffset : NULL;
+    return TRUE;
+}
+
+ULONGLONG DirCrawlerSdDaclId(
+    _In_ const PDIR_CRAWLER_SD pSd
+    ) {
+    ULONGLONG ullHash = 0xcbf29ce484222325ULL; // FNV-1a
+    DWORD i = 0;
+
+    if (pSd->pbDacl == NULL) {
+        return DIR_CRAWLER_SD_NO_DACL_ID;
+    }
+    for (i = 0; i < pSd->dwDaclSize; i++) {
+        ullHash = (ullHash ^ pSd->pbDacl[i]) * 0x100000001b3ULL;
+    }
+    return ullHash != DIR_CRAWLER_SD_NO_DACL_ID ? ullHash : 1;
+}
+
+BOOL DirCrawlerSdHasSdAttribute(
+    _In_ const PDIR_CRAWLER_REQ_DESCR pReqDescr
+    ) {
+    DWORD i = 0;
+
+    for (i = 0; i < pReqDescr->ldap.attributes.dwAttrCount; i++) {
+        if (pReqDescr->ldap.attributes.pAttrArray[i].eType == DirCrawlerTypeSd) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+PDIR_CRAWLER_SD_OUTPUT DirCrawlerSdStartRequest(
+    _In_ const PDIR_CRAWLER_REQ_DESCR pReqDescr,
+    _In_ const PTCHAR ptSdOutfile,
+    _In_ const PTCHAR ptAceOutfile
+    ) {
+    PDIR_CRAWLER_SD_OUTPUT pOutput = NULL;
+
+    pOutput = UtilsHeapAllocStructHelper(g_pDirCrawlerHeap, DIR_CRAWLER_SD_OUTPUT);
+    pOutput->dwDaclSetSize = DIR_CRAWLER_SD_DACL_SET_MIN_SIZE;
+    pOutput->dwDaclCount = 0;
+    pOutput->pullDaclIds = UtilsHeapAllocArrayHelper(g_pDirCrawlerHeap, ULONGLONG, pOutput->dwDaclSetSize);
+    ZeroMemory(pOutput->pullDaclIds, SIZEOF_ARRAY(ULONGLONG, pOutput->dwDaclSetSize));
+
+    pOutput->pSdSink = DirCrawlerSinkOpen(pReqDescr, ptSdOutfile, _countof(gsc_aptSdOutfileHeader), (PTCHAR *)gsc_aptSdOutfileHeader);
+    pOutput->pAceSink = DirCrawlerSinkOpen(pReqDescr, ptAceOutfile, _countof(gsc_aptAceOutfileHeader), (PTCHAR *)gsc_aptAceOutfileHeader);
+
+    return pOutput;
+}
+
+PDIR_CRAWLER_SD_ENTRY DirCrawlerSdFormatEntry(
+    _In_ const PDIR_CRAWLER_REQ_DESCR pReqDescr,
+    _In_ const PLDAP_ATTRIBUTE ppLdapAttributes[],
+    _In_ const PDIR_CRAWLER_SD_ENTRY apPrevious[],
+    _In_ const DWORD dwPreviousCount
+    ) {
+    PDIR_CRAWLER_SD_ENTRY pEntry = NULL;
+    PDIR_CRAWLER_SD_FIELDS pFields = NULL;
+    PDIR_CRAWLER_SD_ACE_FIELDS pAceFields = NULL;
+    PLDAP_VALUE pValue = NULL;
+    DIR_CRAWLER_SD sSd = { 0 };
+    DIR_CRAWLER_ACE sAce = { 0 };
+    DWORD dwValueCount = 0;
+    DWORD dwAceCount = 0;
+    DWORD dwOffset = 0;
+    SIZE_T sizeEntry = 0;
+    DWORD i = 0, j = 0;
+
+    // Sized first: ACEs are only formatted for the first value of the batch referencing their DACL, the writer
+    // adds its id before it reaches the next ones. Duplicated values within the entry may leave unused ACE fields.
+    for (i = 0; i < pReqDescr->ldap.attributes.dwAttrCount; i++) {
+        if (ppLdapAttributes[i] == NULL || pReqDescr->ldap.attributes.pAttrArray[i].eType != DirCrawlerTypeSd) {
+            continue;
+        }
+        dwValueCount += ppLdapAttributes[i]->dwValuesCount;
+        for (j = 0; j < ppLdapAttributes[i]->dwValuesCount; j++) {
+            pValue = ppLdapAttributes[i]->ppValues[j];
+            if (DirCrawlerSdParse(pValue->pbData, pValue->dwSize, &sSd) == TRUE && sSd.pbDacl != NULL
+                && DirCrawlerSdIsDaclFormatted(DirCrawlerSdDaclId(&sSd), apPrevious, dwPreviousCount, NULL, 0) == FALSE) {
+                dwAceCount += sSd.wAceCount;
+            }
+        }
+    }
+    if (dwValueCount == 0) {
+        return NULL;
+    }
+
+    sizeEntry = sizeof(DIR_CRAWLER_SD_ENTRY) + SIZEOF_ARRAY(DIR_CRAWLER_SD_FIELDS, dwValueCount) + SIZEOF_ARRAY(DIR_CRAWLER_SD_ACE_FIELDS, dwAceCount);
+    pEntry = DIR_CRAWLER_STATS_ALLOC(sizeEntry, UtilsHeapAllocHelper(g_pDirCrawlerHeap, sizeEntry));
+    pEntry->dwValueCount = 0;
+    pEntry->pValues = (PDIR_CRAWLER_SD_FIELDS)(pEntry + 1);
+    pAceFields = (PDIR_CRAWLER_SD_ACE_FIELDS)(pEntry->pValues + dwValueCount);
+
+    for (i = 0; i < pReqDescr->ldap.attributes.dwAttrCount; i++) {
+        if (ppLdapAttributes[i] == NULL || pReqDescr->ldap.attributes.pAttrArray[i].eType != DirCrawlerTypeSd) {
+            continue;
+        }
+        for (j = 0; j < ppLdapAttributes[i]->dwValuesCount; j++) {
+            pValue = ppLdapAttributes[i]->ppValues[j];
+            pFields = &pEntry->pValues[pEntry->dwValueCount];
+            ZeroMemory(pFields, sizeof(DIR_CRAWLER_SD_FIELDS));
+            pFields->dwAttr = i;
+            pFields->dwSize = pValue->dwSize;
+            pFields->bValid = DirCrawlerSdParse(pValue->pbData, pValue->dwSize, &sSd);
+            if (pFields->bValid == FALSE) {
+                pEntry->dwValueCount += 1;
+                continue;
+            }
+
+            pFields->ullDaclId = DirCrawlerSdDaclId(&sSd);
+            pFields->wAceCount = sSd.wAceCount;
+            DirCrawlerSdFormatSidT(sSd.pbOwner, sSd.dwOwnerSize, pFields->atOwner);
+            DirCrawlerSdFormatSidT(sSd.pbGroup, sSd.dwGroupSize, pFields->atGroup);
+            _stprintf_s(pFields->atControl, _countof(pFields->atControl), _T("0x%04x"), sSd.wControl);
+            if (pFields->ullDaclId != DIR_CRAWLER_SD_NO_DACL_ID) {
+                _stprintf_s(pFields->atDaclId, _countof(pFields->atDaclId), _T("%016llx"), pFields->ullDaclId);
+            }
+
+            // The ACEs of the DACL are formatted here, and only written by the search thread if the DACL is new to the request
+            if (pFields->ullDaclId != DIR_CRAWLER_SD_NO_DACL_ID
+                && DirCrawlerSdIsDaclFormatted(pFields->ullDaclId, apPrevious, dwPreviousCount, pEntry->pValues, pEntry->dwValueCount) == FALSE) {
+                pFields->pAceFields = pAceFields;
+                dwOffset = 0;
+                while (pFields->dwAceFieldsCount < pFields->wAceCount && DirCrawlerSdNextAce(&sSd, &dwOffset, &sAce) == TRUE) {
+                    DirCrawlerSdFormatAce(&sAce, pFields->dwAceFieldsCount, &pAceFields[pFields->dwAceFieldsCount]);
+                    pFields->dwAceFieldsCount += 1;
+                }
+                pAceFields += pFields->wAceCount;
+            }
+            pEntry->dwValueCount += 1;
+        }
+    }
+
+    return pEntry;
+}
+
+void DirCrawlerSdWriteEntry(
+    _In_ const PDIR_CRAWLER_SD_OUTPUT pOutput,
+    _In_ const PDIR_CRAWLER_REQ_DESCR pReqDescr,
+    _In_ const PTCHAR ptDn,
+    _In_ const PDIR_CRAWLER_SD_ENTRY pEntry
+    ) {
+    BOOL bResult = FALSE;
+    DWORD i = 0;
+
+    for (i = 0; i < pEntry->dwValueCount; i++) {
+        PDIR_CRAWLER_SD_FIELDS pFields = &pEntry->pValues[i];
+        PTCHAR ptAttrName = pReqDescr->ldap.attributes.pAttrArray[pFields->dwAttr].ptName;
+        PTCHAR aptRecord[] = { ptDn, ptAttrName, pFields->atOwner, pFields->atGroup, pFields->atControl, pFields->atDaclId };
+        static_assert(_countof(aptRecord) == _countof(gsc_aptSdOutfileHeader), "Invalid array count");
+
+        if (pFields->bValid == FALSE) {
+            REQ_LOG(pReqDescr, Warn, _T("Invalid security descriptor in <%s> of <%s> (%u bytes)"), ptAttrName, ptDn, pFields->dwSize);
+            continue;
+        }
+        bResult = DirCrawlerSinkWriteRecord(pOutput->pSdSink, aptRecord);
+        if (API_FAILED(bResult)) {
+            REQ_FATAL(pReqDescr, _T("Failed to write security descriptor record for entry <%s>: <err:%#08x>"), ptDn, DirCrawlerSinkGetLastError(pOutput->pSdSink));
+        }
+
+        // ACEs are written once per distinct DACL of the request, objects reference them through their DACL id
+        if (pFields->ullDaclId != DIR_CRAWLER_SD_NO_DACL_ID && DirCrawlerSdAddDaclId(pOutput, pFields->ullDaclId) == TRUE) {
+            DirCrawlerSdWriteDacl(pOutput, pReqDescr, pFields);
+        }
+    }
+}
+
+void DirCrawlerSdFreeEntry(
+    _Inout_ PDIR_CRAWLER_SD_ENTRY *ppEntry
+    ) {
+    if (*ppEntry == NULL) {
+        return;
+    }
+    UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, *ppEntry);
+    *ppEntry = NULL;
+}
+
+void DirCrawlerSdEndRequest(
+    _Inout_ PDIR_CRAWLER_SD_OUTPUT *ppOutput
+    ) {
+    PDIR_CRAWLER_SD_OUTPUT pOutput = *ppOutput;
+
+    if (pOutput == NULL) {
+        return;
+    }
+
+    DirCrawlerSinkClose(&pOutput->pSdSink);
+    DirCrawlerSinkClose(&pOutput->pAceSink);
+    UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, pOutput->pullDaclIds);
+    UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, pOutput);
+    *ppOutput = NULL;
+}
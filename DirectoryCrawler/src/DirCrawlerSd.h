@@ -0,0 +1,149 @@
+#ifndef __DIR_CRAWLER_SD_H__
+#define __DIR_CRAWLER_SD_H__
+
+/* --- INCLUDES ------------------------------------------------------------- */
+#include "DirectoryCrawler.h"
+
+/* --- DEFINES -------------------------------------------------------------- */
+//
+// Side outfiles of requests having 'sd' attributes: <prefix>_LDAP_<request>_sd.csv and <prefix>_LDAP_<request>_ace.csv
+//
+#define DIR_CRAWLER_SD_OUTFILES_SUFFIX      _T("sd")
+#define DIR_CRAWLER_ACE_OUTFILES_SUFFIX     _T("ace")
+
+#define DIR_CRAWLER_SD_SID_MAX_LEN          (sizeof("S-255-0x000000000000") - 1 + SID_MAX_SUB_AUTHORITIES * (sizeof("-4294967295") - 1) + 1)
+#define DIR_CRAWLER_SD_GUID_LEN             37      // 8-4-4-4-12 + NULL terminator
+#define DIR_CRAWLER_SD_DACL_ID_LEN          17      // 64 bits hash in hexadecimal + NULL terminator
+#define DIR_CRAWLER_SD_NO_DACL_ID           0       // also marks empty slots of the DACL ids set
+#define DIR_CRAWLER_SD_DACL_SET_MIN_SIZE    1024    // power of 2
+
+#define DIR_CRAWLER_SD_GUID_SIZE            16
+#define DIR_CRAWLER_SD_SID_HEADER_SIZE      8       // revision, sub-authorities count, identifier authority
+
+/* --- TYPES ---------------------------------------------------------------- */
+// Parsed self-relative security descriptor, pointers reference the original value
+typedef struct _DIR_CRAWLER_SD {
+    WORD wControl;
+    PBYTE pbOwner;          // NULL if absent
+    DWORD dwOwnerSize;
+    PBYTE pbGroup;          // NULL if absent
+    DWORD dwGroupSize;
+    PBYTE pbDacl;           // NULL if absent (no DACL or NULL DACL)
+    DWORD dwDaclSize;
+    WORD wAceCount;
+} DIR_CRAWLER_SD, *PDIR_CRAWLER_SD;
+
+typedef struct _DIR_CRAWLER_ACE {
+    BYTE bType;
+    BYTE bFlags;
+    DWORD dwMask;
+    PBYTE pbObjectType;             // NULL if absent
+    PBYTE pbInheritedObjectType;    // NULL if absent
+    PBYTE pbTrustee;                // NULL for ACE types without a SID
+    DWORD dwTrusteeSize;
+} DIR_CRAWLER_ACE, *PDIR_CRAWLER_ACE;
+
+// Fields of the 'sd' and 'ace' records, formatted by DirCrawlerSdFormatEntry
+typedef struct _DIR_CRAWLER_SD_ACE_FIELDS {
+    TCHAR atIndex[DIR_CRAWLER_SD_DACL_ID_LEN];
+    TCHAR atType[DIR_CRAWLER_SD_DACL_ID_LEN];
+    TCHAR atFlags[DIR_CRAWLER_SD_DACL_ID_LEN];
+    TCHAR atMask[DIR_CRAWLER_SD_DACL_ID_LEN];
+    TCHAR atTrustee[DIR_CRAWLER_SD_SID_MAX_LEN];
+    TCHAR atObjectType[DIR_CRAWLER_SD_GUID_LEN];
+    TCHAR atInheritedObjectType[DIR_CRAWLER_SD_GUID_LEN];
+} DIR_CRAWLER_SD_ACE_FIELDS, *PDIR_CRAWLER_SD_ACE_FIELDS;
+
+typedef struct _DIR_CRAWLER_SD_FIELDS {
+    DWORD dwAttr;                   // index of the 'sd' attribute in the request
+    DWORD dwSize;                   // of the value
+    BOOL bValid;                    // FALSE if the value could not be parsed, the other fields are then empty
+    ULONGLONG ullDaclId;
+    WORD wAceCount;                 // in the DACL header
+    DWORD dwAceFieldsCount;         // 0 when an earlier value of the batch references the same DACL
+    PDIR_CRAWLER_SD_ACE_FIELDS pAceFields;
+    TCHAR atOwner[DIR_CRAWLER_SD_SID_MAX_LEN];
+    TCHAR atGroup[DIR_CRAWLER_SD_SID_MAX_LEN];
+    TCHAR atControl[DIR_CRAWLER_SD_DACL_ID_LEN];
+    TCHAR atDaclId[DIR_CRAWLER_SD_DACL_ID_LEN];
+} DIR_CRAWLER_SD_FIELDS, *PDIR_CRAWLER_SD_FIELDS;
+
+// 'sd' values of an entry, in a single allocation of g_pDirCrawlerHeap (made by a pool thread, freed by the search thread): values and ACEs follow it
+typedef struct _DIR_CRAWLER_SD_ENTRY {
+    DWORD dwValueCount;
+    PDIR_CRAWLER_SD_FIELDS pValues;
+} DIR_CRAWLER_SD_ENTRY, *PDIR_CRAWLER_SD_ENTRY;
+
+typedef struct _DIR_CRAWLER_SD_OUTPUT {
+    struct _DIR_CRAWLER_SINK *pSdSink;
+    struct _DIR_CRAWLER_SINK *pAceSink;
+
+    // Ids of the DACLs already written in the ACE outfile of the request (open addressing)
+    ULONGLONG *pullDaclIds;
+    DWORD dwDaclSetSize;
+    DWORD dwDaclCount;
+} DIR_CRAWLER_SD_OUTPUT, *PDIR_CRAWLER_SD_OUTPUT;
+
+/* --- VARIABLES ------------------------------------------------------------ */
+/* --- PROTOTYPES ----------------------------------------------------------- */
+DWORD DirCrawlerSdFormatSid(
+    _In_ const PBYTE pbSid,
+    _In_ const DWORD dwSize,
+    _Out_opt_ LPSTR pOutBuff
+    );
+
+DWORD DirCrawlerSdFormatGuid(
+    _In_ const PBYTE pbGuid,
+    _In_ const DWORD dwSize,
+    _Out_opt_ LPSTR pOutBuff
+    );
+
+BOOL DirCrawlerSdParse(
+    _In_ const PBYTE pbData,
+    _In_ const DWORD dwSize,
+    _Out_ PDIR_CRAWLER_SD pSd
+    );
+
+BOOL DirCrawlerSdNextAce(
+    _In_ const PDIR_CRAWLER_SD pSd,
+    _Inout_ PDWORD pdwOffset,
+    _Out_ PDIR_CRAWLER_ACE pAce
+    );
+
+ULONGLONG DirCrawlerSdDaclId(
+    _In_ const PDIR_CRAWLER_SD pSd
+    );
+
+BOOL DirCrawlerSdHasSdAttribute(
+    _In_ const PDIR_CRAWLER_REQ_DESCR pReqDescr
+    );
+
+PDIR_CRAWLER_SD_OUTPUT DirCrawlerSdStartRequest(
+    _In_ const PDIR_CRAWLER_REQ_DESCR pReqDescr,
+    _In_ const PTCHAR ptSdOutfile,
+    _In_ const PTCHAR ptAceOutfile
+    );
+
+PDIR_CRAWLER_SD_ENTRY DirCrawlerSdFormatEntry(  // also called by the pool threads: must not raise. NULL if the entry has no 'sd' value
+    _In_ const PDIR_CRAWLER_REQ_DESCR pReqDescr,
+    _In_ const PLDAP_ATTRIBUTE ppLdapAttributes[],
+    _In_ const PDIR_CRAWLER_SD_ENTRY apPrevious[],    // of the entries before it in its batch, whose ACEs are not formatted again
+    _In_ const DWORD dwPreviousCount
+    );
+
+void DirCrawlerSdWriteEntry(                    // called by the search thread, in the order of the entries
+    _In_ const PDIR_CRAWLER_SD_OUTPUT pOutput,
+    _In_ const PDIR_CRAWLER_REQ_DESCR pReqDescr,
+    _In_ const PTCHAR ptDn,
+    _In_ const PDIR_CRAWLER_SD_ENTRY pEntry
+    );
+
+void DirCrawlerSdFreeEntry(
+    _Inout_ PDIR_CRAWLER_SD_ENTRY *ppEntry
+    );
+
+void DirCrawlerSdEndRequest(
+    _Inout_ PDIR_CRAWLER_SD_OUTPUT *ppOutput
+    );
+
+#endif // __DIR_CRAWLER_SD_H__
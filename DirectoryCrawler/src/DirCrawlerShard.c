@@ -0,0 +1,430 @@
+/* --- INCLUDES ------------------------------------------------------------- */
+#include "DirCrawlerShard.h"
+#include "DirCrawlerStats.h"
+#include <bcrypt.h>
+
+/* --- PRIVATE VARIABLES ---------------------------------------------------- */
+static BOOL gs_bShardEnabled = FALSE;
+static ULONGLONG gs_ullShardMaxRows = 0;
+static ULONGLONG gs_ullShardMaxBytes = 0;
+static TCHAR gs_atShardManifestFile[MAX_PATH] = { 0 };
+static TCHAR gs_atShardManifestTmpFile[MAX_PATH] = { 0 };
+static BCRYPT_ALG_HANDLE gs_hShardHashAlg = NULL;
+
+// Protects the sets and their shards, the pending hashes count and the manifest file
+static SRWLOCK gs_sShardLock = SRWLOCK_INIT;
+static CONDITION_VARIABLE gs_sShardHashed = CONDITION_VARIABLE_INIT;
+static DWORD gs_dwShardPendingHashes = 0;
+static PDIR_CRAWLER_SHARD_SET gs_pShardSetsHead = NULL;
+static PDIR_CRAWLER_SHARD_SET gs_pShardSetsTail = NULL;
+
+/* --- PUBLIC VARIABLES ----------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS ---------------------------------------------------- */
+static PTCHAR DirCrawlerShardFileName(
+    _In_ const PTCHAR ptPath
+    ) {
+    PTCHAR ptSlash = _tcsrchr(ptPath, _T('\\'));
+    return ptSlash != NULL ? ptSlash + 1 : ptPath;
+}
+
+static void DirCrawlerShardFormatPaths(
+    _In_ const PDIR_CRAWLER_SHARD_OUTPUT pOutput
+    ) {
+    PTCHAR ptExt = _tcsrchr(pOutput->pSet->ptOutfile, _T('.'));
+    DWORD dwBaseLen = (ptExt != NULL && ptExt > DirCrawlerShardFileName(pOutput->pSet->ptOutfile)) ? (DWORD)(ptExt - pOutput->pSet->ptOutfile) : (DWORD)_tcslen(pOutput->pSet->ptOutfile);
+
+    // <outfile without extension>.<index>.<extension>
+    if (_stprintf_s(pOutput->atFile, _countof(pOutput->atFile), _T("%.*s.%03u%s"), dwBaseLen, pOutput->pSet->ptOutfile, pOutput->dwIndex, ptExt != NULL && dwBaseLen != _tcslen(pOutput->pSet->ptOutfile) ? ptExt : EMPTY_STR) == -1
+        || _stprintf_s(pOutput->atPartFile, _countof(pOutput->atPartFile), _T("%s.%s"), pOutput->atFile, DIR_CRAWLER_SHARD_PART_EXT) == -1) {
+        REQ_FATAL(pOutput->pReqDescr, _T("Failed to format shard path of <%s>"), pOutput->pSet->ptOutfile);
+    }
+}
+
+static void DirCrawlerShardOpenPart(
+    _In_ const PDIR_CRAWLER_SHARD_OUTPUT pOutput,
+    _Out_ CSV_HANDLE *phCsvOutfile
+    ) {
+    BOOL bResult = FALSE;
+
+    DirCrawlerShardFormatPaths(pOutput);
+    bResult = CsvOpenWrite(pOutput->atPartFile, pOutput->pSet->dwColumns, pOutput->pSet->pptColumns, phCsvOutfile);
+    if (API_FAILED(bResult)) {
+        REQ_FATAL(pOutput->pReqDescr, _T("Failed to open CSV outfile <%s>: <err:%#08x>"), pOutput->atPartFile, CsvGetLastError(*phCsvOutfile));
+    }
+    pOutput->ullRows = 0;
+    pOutput->ullBytes = 0;
+}
+
+static BOOL DirCrawlerShardHashFile(
+    _In_ const PDIR_CRAWLER_SHARD pShard
+    ) {
+    HANDLE hFile = INVALID_HANDLE_VALUE;
+    BCRYPT_HASH_HANDLE hHash = NULL;
+    PBYTE pbChunk = NULL;
+    BYTE abDigest[DIR_CRAWLER_SHARD_SHA256_SIZE] = { 0 };
+    DWORD dwRead = 0;
+    DWORD i = 0;
+    BOOL bResult = FALSE;
+
+    hFile = CreateFile(pShard->atFile, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        return FALSE;
+    }
+    pbChunk = UtilsHeapAllocHelper(g_pDirCrawlerHeap, DIR_CRAWLER_SHARD_HASH_CHUNK);
+
+    if (BCRYPT_SUCCESS(BCryptCreateHash(gs_hShardHashAlg, &hHash, NULL, 0, NULL, 0, 0))) {
+        for (;;) {
+            bResult = ReadFile(hFile, pbChunk, DIR_CRAWLER_SHARD_HASH_CHUNK, &dwRead, NULL);
+            if (bResult == FALSE || dwRead == 0) {
+                break;
+            }
+            pShard->ullBytes += dwRead;
+            if (!BCRYPT_SUCCESS(BCryptHashData(hHash, pbChunk, dwRead, 0))) {
+                bResult = FALSE;
+                break;
+            }
+        }
+        if (bResult == TRUE && BCRYPT_SUCCESS(BCryptFinishHash(hHash, abDigest, sizeof(abDigest), 0))) {
+            for (i = 0; i < sizeof(abDigest); i++) {
+                _stprintf_s(&pShard->atSha256[i * 2], _countof(pShard->atSha256) - i * 2, _T("%02x"), abDigest[i]);
+            }
+        }
+        else {
+            bResult = FALSE;
+        }
+        BCryptDestroyHash(hHash);
+    }
+
+    UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, pbChunk);
+    CloseHandle(hFile);
+    return bResult;
+}
+
+static void DirCrawlerShardWriteManifest(
+    _In_ const BOOL bComplete
+    ) {
+    FILE *pFile = NULL;
+    errno_t err = 0;
+    PDIR_CRAWLER_SHARD_SET pSet = NULL;
+    PDIR_CRAWLER_SHARD pShard = NULL;
+    BOOL bFirst = TRUE;
+    DWORD i = 0;
+
+    // Called with the shard lock held
+    err = DirCrawlerStatsOpenJson(&pFile, gs_atShardManifestTmpFile);
+    if (err != 0) {
+        LOG(Err, _T("Failed to open shards manifest <%s>: <errno:%#08x>"), gs_atShardManifestTmpFile, err);
+        return;
+    }
+
+    // Shards are next to their outfile: file names are relative to its folder
+    _ftprintf(pFile, _T("{\n  \"complete\": %s,\n  \"maxRows\": %llu,\n  \"maxBytes\": %llu,\n  \"outfiles\": ["),
+        bComplete ? _T("true") : _T("false"), gs_ullShardMaxRows, gs_ullShardMaxBytes);
+    for (pSet = gs_pShardSetsHead; pSet != NULL; pSet = pSet->pNext) {
+        if (pSet->bSuperseded == TRUE) {
+            continue;
+        }
+        _ftprintf(pFile, _T("%s\n    {\n      \"request\": "), bFirst == TRUE ? EMPTY_STR : _T(","));
+        bFirst = FALSE;
+        DirCrawlerStatsWriteJsonString(pFile, pSet->ptRequest);
+        _ftprintf(pFile, _T(",\n      \"outfile\": "));
+        DirCrawlerStatsWriteJsonString(pFile, pSet->ptOutfile);
+        _ftprintf(pFile, _T(",\n      \"complete\": %s,\n      \"partial\": "), pSet->bComplete ? _T("true") : _T("false"));
+        DirCrawlerStatsWriteJsonString(pFile, pSet->ptPartial);
+        _ftprintf(pFile, _T(",\n      \"columns\": ["));
+        for (i = 0; i < pSet->dwColumns; i++) {
+            _ftprintf(pFile, i == 0 ? EMPTY_STR : _T(", "));
+            DirCrawlerStatsWriteJsonString(pFile, pSet->pptColumns[i]);
+        }
+        _ftprintf(pFile, _T("],\n      \"shards\": ["));
+        for (pShard = pSet->pShards; pShard != NULL; pShard = pShard->pNext) {
+            _ftprintf(pFile, _T("%s\n        { \"file\": "), pShard == pSet->pShards ? EMPTY_STR : _T(","));
+            DirCrawlerStatsWriteJsonString(pFile, DirCrawlerShardFileName(pShard->atFile));
+            _ftprintf(pFile, _T(", \"index\": %u, \"rows\": %llu, \"bytes\": %llu, \"sha256\": "), pShard->dwIndex, pShard->ullRows, pShard->ullBytes);
+            DirCrawlerStatsWriteJsonString(pFile, pShard->atSha256[0] != NULL_CHAR ? pShard->atSha256 : NULL);
+            _ftprintf(pFile, _T(" }"));
+        }
+        _ftprintf(pFile, _T("%s]\n    }"), pSet->pShards != NULL ? _T("\n      ") : EMPTY_STR);
+    }
+    _ftprintf(pFile, _T("\n  ]\n}\n"));
+    fclose(pFile);
+
+    // Replace the manifest in one step, so that a loader never reads a partial file
+    if (MoveFileEx(gs_atShardManifestTmpFile, gs_atShardManifestFile, MOVEFILE_REPLACE_EXISTING) == FALSE) {
+        LOG(Warn, _T("Failed to replace shards manifest <%s>: <gle:%#08x>"), gs_atShardManifestFile, GLE());
+    }
+}
+
+static void DirCrawlerShardAdd(
+    _In_ const PDIR_CRAWLER_SHARD pShard
+    ) {
+    PDIR_CRAWLER_SHARD *ppCurrent = NULL;
+    DWORD dwListed = 0;
+
+    // Hashes end in any order: the shards of an outfile are kept sorted
+    AcquireSRWLockExclusive(&gs_sShardLock);
+    for (ppCurrent = &pShard->pSet->pShards; *ppCurrent != NULL && (*ppCurrent)->dwIndex < pShard->dwIndex; ppCurrent = &(*ppCurrent)->pNext) {
+        dwListed += 1;
+    }
+    pShard->pNext = *ppCurrent;
+    *ppCurrent = pShard;
+    for (; *ppCurrent != NULL; ppCurrent = &(*ppCurrent)->pNext) {
+        dwListed += 1;
+    }
+    pShard->pSet->bComplete = (pShard->pSet->dwShardCount > 0 && dwListed == pShard->pSet->dwShardCount);
+
+    DirCrawlerShardWriteManifest(FALSE);
+    gs_dwShardPendingHashes -= 1;
+    WakeAllConditionVariable(&gs_sShardHashed);
+    ReleaseSRWLockExclusive(&gs_sShardLock);
+}
+
+static void CALLBACK DirCrawlerShardHash(
+    _Inout_ PTP_CALLBACK_INSTANCE pInstance,
+    _Inout_opt_ PVOID pvContext
+    ) {
+    PDIR_CRAWLER_SHARD pShard = (PDIR_CRAWLER_SHARD)pvContext;
+    UNREFERENCED_PARAMETER(pInstance);
+
+    if (DirCrawlerShardHashFile(pShard) == FALSE) {
+        LOG(Warn, _T("Failed to hash shard <%s>: <gle:%#08x>"), pShard->atFile, GLE());
+        pShard->atSha256[0] = NULL_CHAR;
+    }
+    DirCrawlerShardAdd(pShard);
+}
+
+static void DirCrawlerShardClosePart(
+    _In_ const PDIR_CRAWLER_SHARD_OUTPUT pOutput,
+    _Inout_ CSV_HANDLE *phCsvOutfile
+    ) {
+    PDIR_CRAWLER_SHARD pShard = NULL;
+    WIN32_FILE_ATTRIBUTE_DATA sFileAttributes = { 0 };
+
+    CsvClose(phCsvOutfile);
+    if (MoveFileEx(pOutput->atPartFile, pOutput->atFile, MOVEFILE_REPLACE_EXISTING) == FALSE) {
+        REQ_FATAL(pOutput->pReqDescr, _T("Failed to rename shard <%s>: <gle:%#08x>"), pOutput->atPartFile, GLE());
+    }
+    if (GetFileAttributesEx(pOutput->atFile, GetFileExInfoStandard, &sFileAttributes) == TRUE) {
+        pOutput->ullClosedBytes += ((ULONGLONG)sFileAttributes.nFileSizeHigh << 32) | sFileAttributes.nFileSizeLow;
+    }
+
+    pShard = UtilsHeapAllocStructHelper(g_pDirCrawlerHeap, DIR_CRAWLER_SHARD);
+    ZeroMemory(pShard, sizeof(DIR_CRAWLER_SHARD));
+    pShard->pSet = pOutput->pSet;
+    pShard->dwIndex = pOutput->dwIndex;
+    pShard->ullRows = pOutput->ullRows;
+    _tcscpy_s(pShard->atFile, _countof(pShard->atFile), pOutput->atFile);
+
+    // The request goes on with its next shard while this one is hashed by the thread pool
+    AcquireSRWLockExclusive(&gs_sShardLock);
+    gs_dwShardPendingHashes += 1;
+    ReleaseSRWLockExclusive(&gs_sShardLock);
+    if (TrySubmitThreadpoolCallback(DirCrawlerShardHash, pShard, NULL) == FALSE) {
+        DirCrawlerShardHash(NULL, pShard);
+    }
+}
+
+/* --- PUBLIC FUNCTIONS ----------------------------------------------------- */
+void DirCrawlerShardInit(
+    _In_ const ULONGLONG ullMaxRows,
+    _In_ const ULONGLONG ullMaxBytes,
+    _In_ const PTCHAR ptManifestFile
+    ) {
+    NTSTATUS status = 0;
+
+    if (ullMaxRows == 0 && ullMaxBytes == 0) {
+        return;
+    }
+
+    status = BCryptOpenAlgorithmProvider(&gs_hShardHashAlg, BCRYPT_SHA256_ALGORITHM, NULL, 0);
+    if (!BCRYPT_SUCCESS(status)) {
+        FATAL(_T("Failed to open SHA-256 provider: <status:%#08x>"), status);
+    }
+    gs_ullShardMaxRows = ullMaxRows;
+    gs_ullShardMaxBytes = ullMaxBytes;
+    _tcscpy_s(gs_atShardManifestFile, _countof(gs_atShardManifestFile), ptManifestFile);
+    _stprintf_s(gs_atShardManifestTmpFile, _countof(gs_atShardManifestTmpFile), _T("%s.%s"), ptManifestFile, DIR_CRAWLER_SHARD_TMP_EXT);
+    gs_bShardEnabled = TRUE;
+
+    LOG(Info, SUB_LOG(_T("Outfiles split into shards of <rows:%llu> <MB:%llu> (0: unlimited), manifest in <%s>")), ullMaxRows, ullMaxBytes / DIR_CRAWLER_SHARD_MB, ptManifestFile);
+}
+
+void DirCrawlerShardCleanup(
+    ) {
+    PDIR_CRAWLER_SHARD_SET pSet = NULL;
+    PDIR_CRAWLER_SHARD pShard = NULL;
+    DWORD i = 0;
+
+    if (gs_bShardEnabled == FALSE) {
+        return;
+    }
+
+    AcquireSRWLockExclusive(&gs_sShardLock);
+    while (gs_dwShardPendingHashes > 0) {
+        SleepConditionVariableSRW(&gs_sShardHashed, &gs_sShardLock, INFINITE, 0);
+    }
+    DirCrawlerShardWriteManifest(TRUE);
+    ReleaseSRWLockExclusive(&gs_sShardLock);
+    LOG(Info, SUB_LOG(_T("Shards manifest written to <%s>")), gs_atShardManifestFile);
+
+    while (gs_pShardSetsHead != NULL) {
+        pSet = gs_pShardSetsHead;
+        gs_pShardSetsHead = pSet->pNext;
+        while (pSet->pShards != NULL) {
+            pShard = pSet->pShards;
+            pSet->pShards = pShard->pNext;
+            UtilsHeapFreeHelper(g_pDirCrawlerHeap, pShard);
+        }
+        UtilsHeapFreeAndNullArrayHelper(g_pDirCrawlerHeap, pSet->pptColumns, pSet->dwColumns, i);
+        UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, pSet->ptOutfile);
+        UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, pSet->ptRequest);
+        UtilsHeapFreeHelper(g_pDirCrawlerHeap, pSet);
+    }
+    gs_pShardSetsTail = NULL;
+    BCryptCloseAlgorithmProvider(gs_hShardHashAlg, 0);
+    gs_bShardEnabled = FALSE;
+}
+
+PDIR_CRAWLER_SHARD_OUTPUT DirCrawlerShardOpen(
+    _In_ const PDIR_CRAWLER_REQ_DESCR pReqDescr,
+    _In_ const PTCHAR ptOutfile,
+    _In_ const DWORD dwColumns,
+    _In_ const PTCHAR pptColumns[],
+    _Out_ CSV_HANDLE *phCsvOutfile
+    ) {
+    PDIR_CRAWLER_SHARD_OUTPUT pOutput = NULL;
+    PDIR_CRAWLER_SHARD_SET pSet = NULL;
+    PDIR_CRAWLER_SHARD_SET pPrevious = NULL;
+    BOOL bResult = FALSE;
+    DWORD i = 0;
+
+    if (gs_bShardEnabled == FALSE) {
+        bResult = CsvOpenWrite(ptOutfile, dwColumns, (PTCHAR *)pptColumns, phCsvOutfile);
+        if (API_FAILED(bResult)) {
+            REQ_FATAL(pReqDescr, _T("Failed to open CSV outfile <%s>: <err:%#08x>"), ptOutfile, CsvGetLastError(*phCsvOutfile));
+        }
+        return NULL;
+    }
+
+    // The set outlives the request: columns are copied to the process heap
+    pSet = UtilsHeapAllocStructHelper(g_pDirCrawlerHeap, DIR_CRAWLER_SHARD_SET);
+    ZeroMemory(pSet, sizeof(DIR_CRAWLER_SHARD_SET));
+    pSet->ptRequest = UtilsHeapStrDupHelper(g_pDirCrawlerHeap, pReqDescr->infos.ptName);
+    pSet->ptOutfile = UtilsHeapStrDupHelper(g_pDirCrawlerHeap, ptOutfile);
+    pSet->dwColumns = dwColumns;
+    pSet->pptColumns = UtilsHeapAllocArrayHelper(g_pDirCrawlerHeap, PTCHAR, dwColumns);
+    for (i = 0; i < dwColumns; i++) {
+        pSet->pptColumns[i] = UtilsHeapStrDupHelper(g_pDirCrawlerHeap, pptColumns[i]);
+    }
+
+    AcquireSRWLockExclusive(&gs_sShardLock);
+    for (pPrevious = gs_pShardSetsHead; pPrevious != NULL; pPrevious = pPrevious->pNext) {
+        if (_tcscmp(pPrevious->ptOutfile, ptOutfile) == 0) {
+            // The shards of this attempt overwrite the ones of the previous attempt
+            pPrevious->bSuperseded = TRUE;
+        }
+    }
+    if (gs_pShardSetsTail == NULL) {
+        gs_pShardSetsHead = pSet;
+    }
+    else {
+        gs_pShardSetsTail->pNext = pSet;
+    }
+    gs_pShardSetsTail = pSet;
+    ReleaseSRWLockExclusive(&gs_sShardLock);
+
+    pOutput = UtilsHeapAllocStructHelper(g_pDirCrawlerHeap, DIR_CRAWLER_SHARD_OUTPUT);
+    ZeroMemory(pOutput, sizeof(DIR_CRAWLER_SHARD_OUTPUT));
+    pOutput->pReqDescr = pReqDescr;
+    pOutput->pSet = pSet;
+    DirCrawlerShardOpenPart(pOutput, phCsvOutfile);
+    return pOutput;
+}
+
+void DirCrawlerShardNextRecord(
+    _In_opt_ const PDIR_CRAWLER_SHARD_OUTPUT pOutput,
+    _Inout_ CSV_HANDLE *phCsvOutfile,
+    _In_ const PTCHAR pptRecord[]
+    ) {
+    ULONGLONG ullRecordBytes = 0;
+    DWORD i = 0;
+
+    if (pOutput == NULL) {
+        return;
+    }
+
+    // The outfile encoding is up to CsvLib: the size of a record is estimated from its characters and separators
+    if (gs_ullShardMaxBytes > 0) {
+        for (i = 0; i < pOutput->pSet->dwColumns; i++) {
+            ullRecordBytes += _tcslen(pptRecord[i]) + 1;
+        }
+    }
+
+    // A shard holds at least one record, even larger than the size limit
+    if (pOutput->ullRows > 0 && ((gs_ullShardMaxRows > 0 && pOutput->ullRows >= gs_ullShardMaxRows) || (gs_ullShardMaxBytes > 0 && pOutput->ullBytes + ullRecordBytes > gs_ullShardMaxBytes))) {
+        DirCrawlerShardClosePart(pOutput, phCsvOutfile);
+        pOutput->dwIndex += 1;
+        DirCrawlerShardOpenPart(pOutput, phCsvOutfile);
+    }
+    pOutput->ullRows += 1;
+    pOutput->ullBytes += ullRecordBytes;
+}
+
+void DirCrawlerShardMarkPartial(
+    _In_opt_ const PDIR_CRAWLER_SHARD_OUTPUT pOutput,
+    _In_ const PTCHAR ptReason
+    ) {
+    if (pOutput == NULL) {
+        return;
+    }
+
+    // Written in the manifest with the last shard of the outfile
+    AcquireSRWLockExclusive(&gs_sShardLock);
+    pOutput->pSet->ptPartial = ptReason;
+    ReleaseSRWLockExclusive(&gs_sShardLock);
+}
+
+ULONGLONG DirCrawlerShardClose(
+    _Inout_ PDIR_CRAWLER_SHARD_OUTPUT *ppOutput,
+    _Inout_ CSV_HANDLE *phCsvOutfile
+    ) {
+    PDIR_CRAWLER_SHARD_OUTPUT pOutput = *ppOutput;
+    ULONGLONG ullBytes = 0;
+
+    if (pOutput == NULL) {
+        if (*phCsvOutfile != CSV_INVALID_HANDLE_VALUE) {
+            CsvClose(phCsvOutfile);
+        }
+        return 0;
+    }
+
+    // Known before the last hash ends: the manifest marks the outfile complete once all its shards are listed
+    AcquireSRWLockExclusive(&gs_sShardLock);
+    pOutput->pSet->dwShardCount = pOutput->dwIndex + 1;
+    ReleaseSRWLockExclusive(&gs_sShardLock);
+    DirCrawlerShardClosePart(pOutput, phCsvOutfile);
+
+    ullBytes = pOutput->ullClosedBytes;
+    UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, *ppOutput);
+    return ullBytes;
+}
+
+void DirCrawlerShardAbort(
+    _Inout_ PDIR_CRAWLER_SHARD_OUTPUT *ppOutput,
+    _Inout_ CSV_HANDLE *phCsvOutfile
+    ) {
+    PDIR_CRAWLER_SHARD_OUTPUT pOutput = *ppOutput;
+
+    if (*phCsvOutfile != CSV_INVALID_HANDLE_VALUE) {
+        CsvClose(phCsvOutfile);
+    }
+    if (pOutput == NULL) {
+        return;
+    }
+
+    // The shard being written is dropped, the closed ones stay listed in an incomplete set until an attempt supersedes it
+    if (DeleteFile(pOutput->atPartFile) == FALSE && GLE() != ERROR_FILE_NOT_FOUND) {
+        LOG(Warn, _T("Failed to delete aborted shard <%s>: <gle:%#08x>"), pOutput->atPartFile, GLE());
+    }
+    UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, *ppOutput);
+}
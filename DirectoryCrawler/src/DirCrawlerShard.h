@@ -0,0 +1,99 @@
+#ifndef __DIR_CRAWLER_SHARD_H__
+#define __DIR_CRAWLER_SHARD_H__
+
+/* --- INCLUDES ------------------------------------------------------------- */
+#include "DirectoryCrawler.h"
+
+/* --- DEFINES -------------------------------------------------------------- */
+//
+// With '--shard-rows' or '--shard-size', the CSV outfiles of the requests (and their 'sd' and 'ace' side outfiles) are
+// split into shards: <prefix>_LDAP_<request>.000.csv, .001.csv... each one with the CSV header. A shard is written as
+// <shard>.part and renamed once closed, then hashed in the background, and added to <prefix>_LDAP_shards.json in the
+// stats folder. The manifest is replaced in one step after every shard, so loaders can ingest the shards it lists while
+// the crawl goes on.
+//
+#define DIR_CRAWLER_SHARD_MANIFEST_OUTFILE  _T("shards")
+#define DIR_CRAWLER_SHARD_PART_EXT          _T("part")
+#define DIR_CRAWLER_SHARD_TMP_EXT           _T("tmp")
+#define DIR_CRAWLER_SHARD_MB                (1024 * 1024)
+#define DIR_CRAWLER_SHARD_HASH_CHUNK        (1024 * 1024)
+#define DIR_CRAWLER_SHARD_SHA256_SIZE       32
+#define DIR_CRAWLER_SHARD_SHA256_LEN        (DIR_CRAWLER_SHARD_SHA256_SIZE * 2 + 1)
+
+/* --- TYPES ---------------------------------------------------------------- */
+typedef struct _DIR_CRAWLER_SHARD {
+    struct _DIR_CRAWLER_SHARD_SET *pSet;
+    DWORD dwIndex;
+    ULONGLONG ullRows;
+    ULONGLONG ullBytes;                 // size of the closed file
+    TCHAR atFile[MAX_PATH];
+    TCHAR atSha256[DIR_CRAWLER_SHARD_SHA256_LEN];   // empty when the file could not be hashed
+    struct _DIR_CRAWLER_SHARD *pNext;
+} DIR_CRAWLER_SHARD, *PDIR_CRAWLER_SHARD;
+
+// One per sharded outfile, kept until exit for the manifest
+typedef struct _DIR_CRAWLER_SHARD_SET {
+    PTCHAR ptRequest;
+    PTCHAR ptOutfile;                   // the path of the outfile without sharding
+    DWORD dwColumns;
+    PTCHAR *pptColumns;
+    DWORD dwShardCount;                 // closed shards, set once the outfile is complete
+    BOOL bComplete;
+    PTCHAR ptPartial;                   // why the request stopped before its last entry, NULL when it did not
+    BOOL bSuperseded;                   // the outfile was written again by a rescheduled request: left out of the manifest
+    PDIR_CRAWLER_SHARD pShards;         // hashed shards, sorted by index
+    struct _DIR_CRAWLER_SHARD_SET *pNext;
+} DIR_CRAWLER_SHARD_SET, *PDIR_CRAWLER_SHARD_SET;
+
+typedef struct _DIR_CRAWLER_SHARD_OUTPUT {
+    PDIR_CRAWLER_REQ_DESCR pReqDescr;
+    PDIR_CRAWLER_SHARD_SET pSet;
+    DWORD dwIndex;                      // of the shard being written
+    ULONGLONG ullRows;
+    ULONGLONG ullBytes;                 // estimated from the length of the fields
+    ULONGLONG ullClosedBytes;           // size of the closed shards
+    TCHAR atFile[MAX_PATH];
+    TCHAR atPartFile[MAX_PATH];
+} DIR_CRAWLER_SHARD_OUTPUT, *PDIR_CRAWLER_SHARD_OUTPUT;
+
+/* --- VARIABLES ------------------------------------------------------------ */
+/* --- PROTOTYPES ----------------------------------------------------------- */
+void DirCrawlerShardInit(
+    _In_ const ULONGLONG ullMaxRows,    // 0 for unlimited
+    _In_ const ULONGLONG ullMaxBytes,   // 0 for unlimited
+    _In_ const PTCHAR ptManifestFile
+    );
+
+void DirCrawlerShardCleanup(
+    );
+
+PDIR_CRAWLER_SHARD_OUTPUT DirCrawlerShardOpen(  // CsvOpenWrite of the first shard, or of the outfile itself (returns NULL) without sharding
+    _In_ const PDIR_CRAWLER_REQ_DESCR pReqDescr,
+    _In_ const PTCHAR ptOutfile,
+    _In_ const DWORD dwColumns,
+    _In_ const PTCHAR pptColumns[],
+    _Out_ CSV_HANDLE *phCsvOutfile
+    );
+
+void DirCrawlerShardNextRecord(                 // before every CsvWriteNextRecord: moves to the next shard when the current one is full
+    _In_opt_ const PDIR_CRAWLER_SHARD_OUTPUT pOutput,
+    _Inout_ CSV_HANDLE *phCsvOutfile,
+    _In_ const PTCHAR pptRecord[]
+    );
+
+void DirCrawlerShardMarkPartial(                // before DirCrawlerShardClose, for requests stopped by their limits
+    _In_opt_ const PDIR_CRAWLER_SHARD_OUTPUT pOutput,
+    _In_ const PTCHAR ptReason
+    );
+
+ULONGLONG DirCrawlerShardClose(                 // returns the size of all the shards, 0 without sharding
+    _Inout_ PDIR_CRAWLER_SHARD_OUTPUT *ppOutput,
+    _Inout_ CSV_HANDLE *phCsvOutfile
+    );
+
+void DirCrawlerShardAbort(                      // for requests ending with an exception: the '.part' shard is deleted
+    _Inout_ PDIR_CRAWLER_SHARD_OUTPUT *ppOutput,
+    _Inout_ CSV_HANDLE *phCsvOutfile
+    );
+
+#endif // __DIR_CRAWLER_SHARD_H__
@@ -0,0 +1,500 @@
+/* --- INCLUDES ------------------------------------------------------------- */
+#include <WinSock2.h>   // before the Windows headers pulled by DirectoryCrawler.h
+#include <WS2tcpip.h>
+#include <afunix.h>
+#include "DirCrawlerSink.h"
+#include "DirCrawlerShard.h"
+#include "DirCrawlerStats.h"
+
+/* --- PRIVATE VARIABLES ---------------------------------------------------- */
+typedef struct _DIR_CRAWLER_SINK {
+    PDIR_CRAWLER_REQ_DESCR pReqDescr;
+    DWORD dwColumns;
+    DWORD dwLastError;
+
+    // DirCrawlerSinkFile
+    CSV_HANDLE hCsvOutfile;
+    PDIR_CRAWLER_SHARD_OUTPUT pShardOutput;     // NULL when outfiles are not sharded
+
+    // Streams
+    HANDLE hPipe;
+    SOCKET hSocket;
+    PBYTE pbBatch;
+    DWORD dwBatchSize;
+    DWORD dwBatchLen;
+    ULONGLONG ullRecords;
+    ULONGLONG ullSentBytes;
+    PTCHAR ptPartial;
+
+    struct _DIR_CRAWLER_SINK *pNext;
+} DIR_CRAWLER_SINK;
+
+static DIR_CRAWLER_SINK_TYPE gs_eSinkType = DirCrawlerSinkFile;
+static TCHAR gs_atSinkPipe[MAX_PATH] = { 0 };
+static SOCKADDR_UN gs_sSinkUnixAddress = { 0 };
+static PADDRINFOT gs_pSinkAddrInfo = NULL;
+static DIR_CRAWLER_SINK_STATS gs_sSinkStats = { 0 };
+static __declspec(thread) PDIR_CRAWLER_SINK gs_pThreadSinks = NULL;    // open sinks of the request run by the current thread
+
+/* --- PUBLIC VARIABLES ----------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS ---------------------------------------------------- */
+static BOOL DirCrawlerSinkConnect(
+    _In_ const PDIR_CRAWLER_SINK pSink
+    ) {
+    PADDRINFOT pCurrent = NULL;
+    DWORD dwTry = 0;
+
+    for (dwTry = 0; dwTry < DIR_CRAWLER_SINK_CONNECT_RETRIES; dwTry++) {
+        if (dwTry > 0) {
+            Sleep(DIR_CRAWLER_SINK_RETRY_DELAY);
+        }
+
+        switch (gs_eSinkType) {
+        case DirCrawlerSinkPipe:
+            // All the instances are busy until the consumer creates a new one: the first one available is taken as soon
+            // as it is, the retries are only for a consumer not started yet
+            for (;;) {
+                pSink->hPipe = CreateFile(gs_atSinkPipe, GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
+                if (pSink->hPipe != INVALID_HANDLE_VALUE) {
+                    return TRUE;
+                }
+                pSink->dwLastError = GLE();
+                if (pSink->dwLastError != ERROR_PIPE_BUSY) {
+                    break;
+                }
+                if (WaitNamedPipe(gs_atSinkPipe, DIR_CRAWLER_SINK_PIPE_WAIT) == FALSE) {
+                    pSink->dwLastError = GLE();
+                    return FALSE;
+                }
+            }
+            break;
+
+        case DirCrawlerSinkUnix:
+            pSink->hSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+            if (pSink->hSocket != INVALID_SOCKET && connect(pSink->hSocket, (PSOCKADDR)&gs_sSinkUnixAddress, sizeof(gs_sSinkUnixAddress)) != SOCKET_ERROR) {
+                return TRUE;
+            }
+            break;
+
+        case DirCrawlerSinkTcp:
+            for (pCurrent = gs_pSinkAddrInfo; pCurrent != NULL; pCurrent = pCurrent->ai_next) {
+                pSink->hSocket = socket(pCurrent->ai_family, pCurrent->ai_socktype, pCurrent->ai_protocol);
+                if (pSink->hSocket != INVALID_SOCKET && connect(pSink->hSocket, pCurrent->ai_addr, (int)pCurrent->ai_addrlen) != SOCKET_ERROR) {
+                    return TRUE;
+                }
+                if (pSink->hSocket != INVALID_SOCKET) {
+                    closesocket(pSink->hSocket);
+                    pSink->hSocket = INVALID_SOCKET;
+                }
+            }
+            break;
+
+        default:
+            return FALSE;
+        }
+
+        if (pSink->hSocket != INVALID_SOCKET) {
+            closesocket(pSink->hSocket);
+            pSink->hSocket = INVALID_SOCKET;
+        }
+        if (gs_eSinkType != DirCrawlerSinkPipe) {
+            pSink->dwLastError = WSAGetLastError();
+        }
+    }
+    return FALSE;
+}
+
+static void DirCrawlerSinkDisconnect(
+    _In_ const PDIR_CRAWLER_SINK pSink
+    ) {
+    if (pSink->hPipe != INVALID_HANDLE_VALUE) {
+        CloseHandle(pSink->hPipe);
+        pSink->hPipe = INVALID_HANDLE_VALUE;
+    }
+    if (pSink->hSocket != INVALID_SOCKET) {
+        shutdown(pSink->hSocket, SD_BOTH);
+        closesocket(pSink->hSocket);
+        pSink->hSocket = INVALID_SOCKET;
+    }
+}
+
+static BOOL DirCrawlerSinkFlush(
+    _In_ const PDIR_CRAWLER_SINK pSink
+    ) {
+    LONGLONG llStart = DirCrawlerStatsNow();
+    DWORD dwSent = 0;
+    DWORD dwWritten = 0;
+    int iResult = 0;
+
+    // Blocks while the pipe or socket buffers are full: the consumer sets the pace of the worker threads
+    while (dwSent < pSink->dwBatchLen) {
+        if (pSink->hPipe != INVALID_HANDLE_VALUE) {
+            if (WriteFile(pSink->hPipe, pSink->pbBatch + dwSent, pSink->dwBatchLen - dwSent, &dwWritten, NULL) == FALSE) {
+                pSink->dwLastError = GLE();
+                return FALSE;
+            }
+        }
+        else {
+            iResult = send(pSink->hSocket, (const char *)pSink->pbBatch + dwSent, (int)(pSink->dwBatchLen - dwSent), 0);
+            if (iResult == SOCKET_ERROR) {
+                pSink->dwLastError = WSAGetLastError();
+                return FALSE;
+            }
+            dwWritten = (DWORD)iResult;
+        }
+        dwSent += dwWritten;
+    }
+
+    InterlockedAdd64(&gs_sSinkStats.llSendTicks, DirCrawlerStatsNow() - llStart);
+    InterlockedAdd64(&gs_sSinkStats.llBytes, dwSent);
+    InterlockedIncrement64(&gs_sSinkStats.llBatches);
+    pSink->ullSentBytes += dwSent;
+    pSink->dwBatchLen = 0;
+    return TRUE;
+}
+
+static DWORD DirCrawlerSinkStringMaxBytes(
+    _In_opt_ const PTCHAR ptStr
+    ) {
+    return (DWORD)sizeof(DWORD) + ((ptStr != NULL) ? (DWORD)_tcslen(ptStr) * DIR_CRAWLER_SINK_UTF8_MAX : 0);
+}
+
+static BOOL DirCrawlerSinkBeginFrame(
+    _In_ const PDIR_CRAWLER_SINK pSink,
+    _In_ const BYTE bType,
+    _In_ const DWORD dwMaxBytes,            // of the frame content
+    _Out_ PDWORD pdwFrameStart
+    ) {
+    DWORD dwFrameBytes = (DWORD)sizeof(DWORD) + sizeof(BYTE) + dwMaxBytes;
+
+    if (pSink->dwBatchLen + dwFrameBytes > pSink->dwBatchSize) {
+        if (DirCrawlerSinkFlush(pSink) == FALSE) {
+            return FALSE;
+        }
+        // Frames larger than a batch are sent alone
+        if (dwFrameBytes > pSink->dwBatchSize) {
+            pSink->pbBatch = UtilsHeapAllocOrReallocHelper(g_pDirCrawlerHeap, pSink->pbBatch, dwFrameBytes);
+            pSink->dwBatchSize = dwFrameBytes;
+        }
+    }
+
+    *pdwFrameStart = pSink->dwBatchLen;
+    pSink->dwBatchLen += sizeof(DWORD);     // size, known at the end of the frame
+    pSink->pbBatch[pSink->dwBatchLen] = bType;
+    pSink->dwBatchLen += sizeof(BYTE);
+    return TRUE;
+}
+
+static void DirCrawlerSinkEndFrame(
+    _In_ const PDIR_CRAWLER_SINK pSink,
+    _In_ const DWORD dwFrameStart
+    ) {
+    DWORD dwSize = pSink->dwBatchLen - dwFrameStart - sizeof(DWORD);
+    CopyMemory(pSink->pbBatch + dwFrameStart, &dwSize, sizeof(DWORD));
+}
+
+static void DirCrawlerSinkPutDword(
+    _In_ const PDIR_CRAWLER_SINK pSink,
+    _In_ const DWORD dwValue
+    ) {
+    CopyMemory(pSink->pbBatch + pSink->dwBatchLen, &dwValue, sizeof(DWORD));
+    pSink->dwBatchLen += sizeof(DWORD);
+}
+
+static void DirCrawlerSinkPutString(
+    _In_ const PDIR_CRAWLER_SINK pSink,
+    _In_opt_ const PTCHAR ptStr
+    ) {
+    DWORD dwChars = (ptStr != NULL) ? (DWORD)_tcslen(ptStr) : 0;
+    DWORD dwBytes = 0;
+
+    // Room for the worst case was taken by DirCrawlerSinkBeginFrame
+    if (dwChars > 0) {
+        dwBytes = (DWORD)WideCharToMultiByte(CP_UTF8, 0, ptStr, (int)dwChars, (LPSTR)(pSink->pbBatch + pSink->dwBatchLen + sizeof(DWORD)), (int)(pSink->dwBatchSize - pSink->dwBatchLen - sizeof(DWORD)), NULL, NULL);
+    }
+    DirCrawlerSinkPutDword(pSink, dwBytes);
+    pSink->dwBatchLen += dwBytes;
+}
+
+static BOOL DirCrawlerSinkWriteHeader(
+    _In_ const PDIR_CRAWLER_SINK pSink,
+    _In_ const PTCHAR ptOutfile,
+    _In_ const PTCHAR pptColumns[]
+    ) {
+    DWORD dwMaxBytes = DirCrawlerSinkStringMaxBytes(ptOutfile) + DirCrawlerSinkStringMaxBytes(pSink->pReqDescr->infos.ptName) + sizeof(DWORD);
+    DWORD dwFrameStart = 0;
+    DWORD i = 0;
+
+    for (i = 0; i < pSink->dwColumns; i++) {
+        dwMaxBytes += DirCrawlerSinkStringMaxBytes(pptColumns[i]);
+    }
+    if (DirCrawlerSinkBeginFrame(pSink, DIR_CRAWLER_SINK_FRAME_HEADER, dwMaxBytes, &dwFrameStart) == FALSE) {
+        return FALSE;
+    }
+    DirCrawlerSinkPutString(pSink, ptOutfile);
+    DirCrawlerSinkPutString(pSink, pSink->pReqDescr->infos.ptName);
+    DirCrawlerSinkPutDword(pSink, pSink->dwColumns);
+    for (i = 0; i < pSink->dwColumns; i++) {
+        DirCrawlerSinkPutString(pSink, pptColumns[i]);
+    }
+    DirCrawlerSinkEndFrame(pSink, dwFrameStart);
+    return TRUE;
+}
+
+static BOOL DirCrawlerSinkWriteEnd(
+    _In_ const PDIR_CRAWLER_SINK pSink
+    ) {
+    DWORD dwFrameStart = 0;
+
+    if (DirCrawlerSinkBeginFrame(pSink, DIR_CRAWLER_SINK_FRAME_END, sizeof(ULONGLONG) + DirCrawlerSinkStringMaxBytes(pSink->ptPartial), &dwFrameStart) == FALSE) {
+        return FALSE;
+    }
+    CopyMemory(pSink->pbBatch + pSink->dwBatchLen, &pSink->ullRecords, sizeof(ULONGLONG));
+    pSink->dwBatchLen += sizeof(ULONGLONG);
+    DirCrawlerSinkPutString(pSink, pSink->ptPartial);
+    DirCrawlerSinkEndFrame(pSink, dwFrameStart);
+    return DirCrawlerSinkFlush(pSink);
+}
+
+static void DirCrawlerSinkUnlink(
+    _In_ const PDIR_CRAWLER_SINK pSink
+    ) {
+    PDIR_CRAWLER_SINK *ppCurrent = NULL;
+
+    for (ppCurrent = &gs_pThreadSinks; *ppCurrent != NULL; ppCurrent = &(*ppCurrent)->pNext) {
+        if (*ppCurrent == pSink) {
+            *ppCurrent = pSink->pNext;
+            return;
+        }
+    }
+}
+
+static void DirCrawlerSinkFree(
+    _Inout_ PDIR_CRAWLER_SINK *ppSink
+    ) {
+    DirCrawlerSinkUnlink(*ppSink);
+    if ((*ppSink)->pbBatch != NULL) {
+        UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, (*ppSink)->pbBatch);
+    }
+    UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, *ppSink);
+}
+
+/* --- PUBLIC FUNCTIONS ----------------------------------------------------- */
+void DirCrawlerSinkInit(
+    _In_opt_ const PTCHAR ptSpec
+    ) {
+    WSADATA sWsaData = { 0 };
+    ADDRINFOT sHints = { 0 };
+    TCHAR atHost[MAX_LINE] = { 0 };
+    PTCHAR ptPort = NULL;
+    PTCHAR ptTarget = NULL;
+    int iResult = 0;
+
+    if (ptSpec == NULL) {
+        gs_eSinkType = DirCrawlerSinkFile;
+        return;
+    }
+
+    if (_tcsnicmp(ptSpec, DIR_CRAWLER_SINK_PIPE, _tcslen(DIR_CRAWLER_SINK_PIPE)) == 0) {
+        gs_eSinkType = DirCrawlerSinkPipe;
+        ptTarget = ptSpec + _tcslen(DIR_CRAWLER_SINK_PIPE);
+        _stprintf_s(gs_atSinkPipe, _countof(gs_atSinkPipe), _T("%s%s"), (_tcsncmp(ptTarget, _T("\\\\"), 2) == 0) ? EMPTY_STR : DIR_CRAWLER_SINK_PIPE_PREFIX, ptTarget);
+        LOG(Info, SUB_LOG(_T("Streaming outfiles to pipe <%s>")), gs_atSinkPipe);
+        return;
+    }
+
+    if (_tcsnicmp(ptSpec, DIR_CRAWLER_SINK_UNIX, _tcslen(DIR_CRAWLER_SINK_UNIX)) == 0) {
+        gs_eSinkType = DirCrawlerSinkUnix;
+        ptTarget = ptSpec + _tcslen(DIR_CRAWLER_SINK_UNIX);
+        gs_sSinkUnixAddress.sun_family = AF_UNIX;
+        if (WideCharToMultiByte(CP_UTF8, 0, ptTarget, -1, gs_sSinkUnixAddress.sun_path, sizeof(gs_sSinkUnixAddress.sun_path), NULL, NULL) == 0) {
+            FATAL(_T("Invalid unix socket path <%s>: <gle:%#08x>"), ptTarget, GLE());
+        }
+    }
+    else if (_tcsnicmp(ptSpec, DIR_CRAWLER_SINK_TCP, _tcslen(DIR_CRAWLER_SINK_TCP)) == 0) {
+        gs_eSinkType = DirCrawlerSinkTcp;
+        ptTarget = ptSpec + _tcslen(DIR_CRAWLER_SINK_TCP);
+        _tcscpy_s(atHost, _countof(atHost), ptTarget);
+        ptPort = _tcsrchr(atHost, DIR_CRAWLER_SINK_PORT_SEPARATOR);
+        if (ptPort == NULL) {
+            FATAL(_T("Invalid sink <%s>: expecting %s<host>:<port>"), ptSpec, DIR_CRAWLER_SINK_TCP);
+        }
+        *ptPort = NULL_CHAR;
+        ptPort += 1;
+    }
+    else {
+        FATAL(_T("Invalid sink <%s>, expecting %s<name>, %s<path> or %s<host>:<port>"), ptSpec, DIR_CRAWLER_SINK_PIPE, DIR_CRAWLER_SINK_UNIX, DIR_CRAWLER_SINK_TCP);
+    }
+
+    iResult = WSAStartup(MAKEWORD(2, 2), &sWsaData);
+    if (iResult != 0) {
+        FATAL(_T("Failed to initialize Winsock: <err:%#08x>"), iResult);
+    }
+
+    // Resolved once, every stream connects to the same consumer
+    if (gs_eSinkType == DirCrawlerSinkTcp) {
+        sHints.ai_family = AF_UNSPEC;
+        sHints.ai_socktype = SOCK_STREAM;
+        sHints.ai_protocol = IPPROTO_TCP;
+        iResult = GetAddrInfo(atHost, ptPort, &sHints, &gs_pSinkAddrInfo);
+        if (iResult != 0) {
+            FATAL(_T("Failed to resolve sink <%s>: <err:%#08x>"), ptSpec, iResult);
+        }
+    }
+    LOG(Info, SUB_LOG(_T("Streaming outfiles to <%s>")), ptTarget);
+}
+
+void DirCrawlerSinkCleanup(
+    ) {
+    if (gs_eSinkType == DirCrawlerSinkUnix || gs_eSinkType == DirCrawlerSinkTcp) {
+        if (gs_pSinkAddrInfo != NULL) {
+            FreeAddrInfo(gs_pSinkAddrInfo);
+            gs_pSinkAddrInfo = NULL;
+        }
+        WSACleanup();
+    }
+    gs_eSinkType = DirCrawlerSinkFile;
+}
+
+PDIR_CRAWLER_SINK DirCrawlerSinkOpen(
+    _In_ const PDIR_CRAWLER_REQ_DESCR pReqDescr,
+    _In_ const PTCHAR ptOutfile,
+    _In_ const DWORD dwColumns,
+    _In_ const PTCHAR pptColumns[]
+    ) {
+    PDIR_CRAWLER_SINK pSink = NULL;
+
+    pSink = UtilsHeapAllocStructHelper(g_pDirCrawlerHeap, DIR_CRAWLER_SINK);
+    ZeroMemory(pSink, sizeof(DIR_CRAWLER_SINK));
+    pSink->pReqDescr = pReqDescr;
+    pSink->dwColumns = dwColumns;
+    pSink->hCsvOutfile = CSV_INVALID_HANDLE_VALUE;
+    pSink->hPipe = INVALID_HANDLE_VALUE;
+    pSink->hSocket = INVALID_SOCKET;
+    pSink->pNext = gs_pThreadSinks;
+    gs_pThreadSinks = pSink;
+
+    if (gs_eSinkType == DirCrawlerSinkFile) {
+        pSink->pShardOutput = DirCrawlerShardOpen(pReqDescr, ptOutfile, dwColumns, pptColumns, &pSink->hCsvOutfile);
+        return pSink;
+    }
+
+    pSink->dwBatchSize = DIR_CRAWLER_SINK_BATCH_SIZE;
+    pSink->pbBatch = UtilsHeapAllocHelper(g_pDirCrawlerHeap, pSink->dwBatchSize);
+    if (DirCrawlerSinkConnect(pSink) == FALSE) {
+        REQ_FATAL(pReqDescr, _T("Failed to open stream of <%s>: <err:%#08x>"), ptOutfile, pSink->dwLastError);
+    }
+    InterlockedIncrement64(&gs_sSinkStats.llStreams);
+
+    // The header goes out with the first batch of records
+    if (DirCrawlerSinkWriteHeader(pSink, ptOutfile, pptColumns) == FALSE) {
+        REQ_FATAL(pReqDescr, _T("Failed to write stream header of <%s>: <err:%#08x>"), ptOutfile, pSink->dwLastError);
+    }
+    return pSink;
+}
+
+BOOL DirCrawlerSinkWriteRecord(
+    _In_ const PDIR_CRAWLER_SINK pSink,
+    _In_ const PTCHAR pptRecord[]
+    ) {
+    DWORD dwMaxBytes = sizeof(DWORD);
+    DWORD dwFrameStart = 0;
+    DWORD i = 0;
+
+    if (gs_eSinkType == DirCrawlerSinkFile) {
+        DirCrawlerShardNextRecord(pSink->pShardOutput, &pSink->hCsvOutfile, pptRecord);
+        return CsvWriteNextRecord(pSink->hCsvOutfile, (PTCHAR *)pptRecord, NULL);
+    }
+
+    for (i = 0; i < pSink->dwColumns; i++) {
+        dwMaxBytes += DirCrawlerSinkStringMaxBytes(pptRecord[i]);
+    }
+    if (DirCrawlerSinkBeginFrame(pSink, DIR_CRAWLER_SINK_FRAME_RECORD, dwMaxBytes, &dwFrameStart) == FALSE) {
+        return FALSE;
+    }
+    DirCrawlerSinkPutDword(pSink, pSink->dwColumns);
+    for (i = 0; i < pSink->dwColumns; i++) {
+        DirCrawlerSinkPutString(pSink, pptRecord[i]);
+    }
+    DirCrawlerSinkEndFrame(pSink, dwFrameStart);
+
+    pSink->ullRecords += 1;
+    InterlockedIncrement64(&gs_sSinkStats.llRecords);
+    return TRUE;
+}
+
+DWORD DirCrawlerSinkGetColumnCount(
+    _In_ const PDIR_CRAWLER_SINK pSink
+    ) {
+    return pSink->dwColumns;
+}
+
+DWORD DirCrawlerSinkGetLastError(
+    _In_ const PDIR_CRAWLER_SINK pSink
+    ) {
+    return (gs_eSinkType == DirCrawlerSinkFile) ? CsvGetLastError(pSink->hCsvOutfile) : pSink->dwLastError;
+}
+
+void DirCrawlerSinkMarkPartial(
+    _In_ const PDIR_CRAWLER_SINK pSink,
+    _In_ const PTCHAR ptReason
+    ) {
+    // Files: in the shards manifest (and the '.partial' marker of the request), streams: in their end frame
+    if (gs_eSinkType == DirCrawlerSinkFile) {
+        DirCrawlerShardMarkPartial(pSink->pShardOutput, ptReason);
+    }
+    pSink->ptPartial = ptReason;
+}
+
+ULONGLONG DirCrawlerSinkClose(
+    _Inout_ PDIR_CRAWLER_SINK *ppSink
+    ) {
+    PDIR_CRAWLER_SINK pSink = *ppSink;
+    ULONGLONG ullBytes = 0;
+
+    if (pSink == NULL) {
+        return 0;
+    }
+
+    if (gs_eSinkType == DirCrawlerSinkFile) {
+        ullBytes = DirCrawlerShardClose(&pSink->pShardOutput, &pSink->hCsvOutfile);
+        DirCrawlerSinkFree(ppSink);
+        return ullBytes;
+    }
+
+    if (DirCrawlerSinkWriteEnd(pSink) == FALSE) {
+        // Still in the list of the thread: cut by DirCrawlerSinkAbortRequest
+        REQ_FATAL(pSink->pReqDescr, _T("Failed to end stream: <err:%#08x>"), pSink->dwLastError);
+    }
+    DirCrawlerSinkDisconnect(pSink);
+    ullBytes = pSink->ullSentBytes;
+    DirCrawlerSinkFree(ppSink);
+    return ullBytes;
+}
+
+void DirCrawlerSinkAbortRequest(
+    ) {
+    PDIR_CRAWLER_SINK pSink = NULL;
+
+    // The consumer sees the end of the stream without its end frame, and drops the records of the request
+    while (gs_pThreadSinks != NULL) {
+        pSink = gs_pThreadSinks;
+        DirCrawlerShardAbort(&pSink->pShardOutput, &pSink->hCsvOutfile);
+        if (pSink->hPipe != INVALID_HANDLE_VALUE || pSink->hSocket != INVALID_SOCKET) {
+            InterlockedIncrement64(&gs_sSinkStats.llAborted);
+        }
+        DirCrawlerSinkDisconnect(pSink);
+        DirCrawlerSinkFree(&pSink);
+    }
+}
+
+BOOL DirCrawlerSinkIsStream(
+    ) {
+    return (BOOL)(gs_eSinkType != DirCrawlerSinkFile);
+}
+
+void DirCrawlerSinkGetStats(
+    _Out_ PDIR_CRAWLER_SINK_STATS pStats
+    ) {
+    CopyMemory(pStats, &gs_sSinkStats, sizeof(DIR_CRAWLER_SINK_STATS));
+}
@@ -0,0 +1,107 @@
+#ifndef __DIR_CRAWLER_SINK_H__
+#define __DIR_CRAWLER_SINK_H__
+
+/* --- INCLUDES ------------------------------------------------------------- */
+#include "DirectoryCrawler.h"
+
+/* --- DEFINES -------------------------------------------------------------- */
+//
+// Outfiles of the requests (and their 'sd' and 'ace' side outfiles) are written through a sink: CSV files (sharded or
+// not) by default, or with '--sink <spec>' a stream per outfile to an ingestion service, so that nothing is written to
+// disk and the service ingests the rows while the crawl goes on. <spec> is:
+//   pipe:<name>        a named pipe (\\.\pipe\<name>, or <name> when it is a full pipe path), one instance per stream
+//   unix:<path>        an AF_UNIX socket, one connection per stream
+//   tcp:<host>:<port>  a TCP endpoint, one connection per stream
+//
+// A stream is a sequence of frames: DWORD size of the frame after this field, BYTE type, then:
+//   'H' header: string outfile path, string request name, DWORD column count, one string per column
+//   'R' record: DWORD field count, one string per field (the values of the CSV outfile, unescaped)
+//   'E' end   : ULONGLONG record count, string partial reason (empty when the request wrote all its entries)
+// Integers are little-endian, strings are a DWORD byte count followed by UTF-8 bytes (no terminator). A stream closed
+// without its 'E' frame belongs to an aborted request, and a later stream of the same outfile (rescheduled request)
+// replaces a partial one.
+// Frames are batched, and a batch is sent when the next frame does not fit or the outfile is closed. Sends are
+// blocking: a consumer that does not keep up makes the worker threads wait (back-pressure), which '--bench' reports.
+//
+#define DIR_CRAWLER_SINK_PIPE               _T("pipe:")
+#define DIR_CRAWLER_SINK_UNIX               _T("unix:")
+#define DIR_CRAWLER_SINK_TCP                _T("tcp:")
+#define DIR_CRAWLER_SINK_PIPE_PREFIX        _T("\\\\.\\pipe\\")
+#define DIR_CRAWLER_SINK_PORT_SEPARATOR     _T(':')
+#define DIR_CRAWLER_SINK_BATCH_SIZE         (64 * 1024)
+#define DIR_CRAWLER_SINK_UTF8_MAX           3           // UTF-8 bytes per UTF-16 code unit
+#define DIR_CRAWLER_SINK_CONNECT_RETRIES    30          // the consumer may be busy accepting other streams
+#define DIR_CRAWLER_SINK_RETRY_DELAY        1000        // ms
+#define DIR_CRAWLER_SINK_PIPE_WAIT          (DIR_CRAWLER_SINK_CONNECT_RETRIES * DIR_CRAWLER_SINK_RETRY_DELAY)  // ms, for a free pipe instance
+#define DIR_CRAWLER_SINK_FRAME_HEADER       'H'
+#define DIR_CRAWLER_SINK_FRAME_RECORD       'R'
+#define DIR_CRAWLER_SINK_FRAME_END          'E'
+
+/* --- TYPES ---------------------------------------------------------------- */
+typedef enum _DIR_CRAWLER_SINK_TYPE {
+    DirCrawlerSinkFile,             // CSV outfiles, sharded with '--shard-rows' and '--shard-size'
+    DirCrawlerSinkPipe,
+    DirCrawlerSinkUnix,
+    DirCrawlerSinkTcp,
+} DIR_CRAWLER_SINK_TYPE;
+
+typedef struct _DIR_CRAWLER_SINK *PDIR_CRAWLER_SINK;  // an open outfile or stream, Winsock types stay in DirCrawlerSink.c
+
+typedef struct _DIR_CRAWLER_SINK_STATS {
+    LONGLONG llStreams;
+    LONGLONG llAborted;             // closed without their end frame
+    LONGLONG llRecords;
+    LONGLONG llBytes;
+    LONGLONG llBatches;
+    LONGLONG llSendTicks;           // time spent in blocking sends, waiting for the consumer when it lags (QueryPerformanceCounter ticks)
+} DIR_CRAWLER_SINK_STATS, *PDIR_CRAWLER_SINK_STATS;
+
+/* --- VARIABLES ------------------------------------------------------------ */
+/* --- PROTOTYPES ----------------------------------------------------------- */
+void DirCrawlerSinkInit(
+    _In_opt_ const PTCHAR ptSpec    // NULL for CSV outfiles
+    );
+
+void DirCrawlerSinkCleanup(
+    );
+
+PDIR_CRAWLER_SINK DirCrawlerSinkOpen(
+    _In_ const PDIR_CRAWLER_REQ_DESCR pReqDescr,
+    _In_ const PTCHAR ptOutfile,
+    _In_ const DWORD dwColumns,
+    _In_ const PTCHAR pptColumns[]
+    );
+
+BOOL DirCrawlerSinkWriteRecord(
+    _In_ const PDIR_CRAWLER_SINK pSink,
+    _In_ const PTCHAR pptRecord[]   // one field per column
+    );
+
+DWORD DirCrawlerSinkGetColumnCount(
+    _In_ const PDIR_CRAWLER_SINK pSink
+    );
+
+DWORD DirCrawlerSinkGetLastError(   // CsvLib error for CSV outfiles, Win32 or Winsock error for streams
+    _In_ const PDIR_CRAWLER_SINK pSink
+    );
+
+void DirCrawlerSinkMarkPartial(     // before DirCrawlerSinkClose, for requests stopped by their limits
+    _In_ const PDIR_CRAWLER_SINK pSink,
+    _In_ const PTCHAR ptReason
+    );
+
+ULONGLONG DirCrawlerSinkClose(      // returns the bytes written to the shards or the stream, 0 for a CSV outfile
+    _Inout_ PDIR_CRAWLER_SINK *ppSink
+    );
+
+void DirCrawlerSinkAbortRequest(    // cuts the streams left open by the aborted request of the current thread
+    );
+
+BOOL DirCrawlerSinkIsStream(
+    );
+
+void DirCrawlerSinkGetStats(
+    _Out_ PDIR_CRAWLER_SINK_STATS pStats
+    );
+
+#endif // __DIR_CRAWLER_SINK_H__
@@ -0,0 +1,565 @@
+/* --- INCLUDES ------------------------------------------------------------- */
+#include "DirCrawlerSnapshot.h"
+#include "DirCrawlerStats.h"
+
+/* --- PRIVATE VARIABLES ---------------------------------------------------- */
+static const PTCHAR gsc_aptIndexNames[DirCrawlerSnapshotIndexCount] = { _T("dn"), _T("objectSid"), _T("objectGUID") };
+
+static HANDLE gs_hSnapshotFile = INVALID_HANDLE_VALUE;
+static PTCHAR gs_ptSnapshotFile = NULL;
+static CRITICAL_SECTION gs_sSnapshotLock = { 0 };
+static ULONGLONG gs_ullFileEnd = 0;
+
+// Requests in the order they started, entries of the requests already ended
+static PDIR_CRAWLER_SNAPSHOT_REQUEST gs_pRequests = NULL;
+static DWORD gs_dwRequestCount = 0;
+static PDIR_CRAWLER_SNAPSHOT_ENTRY gs_pEntries = NULL;
+static DWORD gs_dwEntryCount = 0;
+
+// qsort has no context parameter, indexes are sorted one after the other once the workers are done
+static PBYTE gs_pbSortBase = NULL;
+static DIR_CRAWLER_SNAPSHOT_INDEX gs_eSortIndex = DirCrawlerSnapshotIndexDn;
+
+/* --- PUBLIC VARIABLES ----------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS ---------------------------------------------------- */
+static ULONGLONG DirCrawlerSnapshotAppend(
+    _In_ const PVOID pvData,
+    _In_ const DWORD dwSize
+    ) {
+    ULONGLONG ullOffset = gs_ullFileEnd;
+    BOOL bResult = FALSE;
+    DWORD dwWritten = 0;
+
+    // Callers hold the snapshot lock while crawling
+    if (dwSize > 0) {
+        bResult = WriteFile(gs_hSnapshotFile, pvData, dwSize, &dwWritten, NULL);
+        if (bResult == FALSE || dwWritten != dwSize) {
+            FATAL(_T("Failed to write snapshot <%s> <size:%u>: <gle:%#08x>"), gs_ptSnapshotFile, dwSize, GLE());
+        }
+        gs_ullFileEnd += dwSize;
+    }
+    return ullOffset;
+}
+
+static ULONGLONG DirCrawlerSnapshotAppendString(
+    _In_ const PTCHAR ptString
+    ) {
+    return DirCrawlerSnapshotAppend(ptString, (DWORD)((_tcslen(ptString) + 1) * sizeof(TCHAR)));
+}
+
+static ULONGLONG DirCrawlerSnapshotBufferString(
+    _In_ const PDIR_CRAWLER_SNAPSHOT_OUTPUT pOutput,
+    _In_ const PTCHAR ptString
+    ) {
+    DWORD dwSize = (DWORD)((_tcslen(ptString) + 1) * sizeof(TCHAR));
+    DWORD dwOffset = pOutput->dwUsed;
+
+    // The buffer is flushed between entries, it only grows for entries larger than its initial size
+    if (pOutput->dwUsed + dwSize > pOutput->dwSize) {
+        pOutput->dwSize = max(pOutput->dwSize * 2, pOutput->dwUsed + dwSize);
+        pOutput->pbBuffer = UtilsHeapAllocOrReallocHelper(g_pDirCrawlerHeap, pOutput->pbBuffer, pOutput->dwSize);
+    }
+    CopyMemory(pOutput->pbBuffer + pOutput->dwUsed, ptString, dwSize);
+    pOutput->dwUsed += dwSize;
+
+    return dwOffset;
+}
+
+static void DirCrawlerSnapshotFlush(
+    _In_ const PDIR_CRAWLER_SNAPSHOT_OUTPUT pOutput
+    ) {
+    ULONGLONG ullBase = 0;
+    DWORD i = 0, k = 0;
+
+    if (pOutput->dwUsed == 0) {
+        return;
+    }
+
+    EnterCriticalSection(&gs_sSnapshotLock);
+    ullBase = DirCrawlerSnapshotAppend(pOutput->pbBuffer, pOutput->dwUsed);
+    LeaveCriticalSection(&gs_sSnapshotLock);
+
+    // Keys of the buffered entries become file offsets
+    for (i = pOutput->dwFlushedCount; i < pOutput->dwEntryCount; i++) {
+        for (k = 0; k < DirCrawlerSnapshotIndexCount; k++) {
+            pOutput->pEntries[i].aullKeys[k] = (pOutput->pEntries[i].aullKeys[k] == DIR_CRAWLER_SNAPSHOT_BUFFERED_NONE) ? DIR_CRAWLER_SNAPSHOT_NO_STRING : ullBase + pOutput->pEntries[i].aullKeys[k];
+        }
+    }
+    pOutput->dwFlushedCount = pOutput->dwEntryCount;
+    pOutput->dwUsed = 0;
+}
+
+static int DirCrawlerSnapshotCompareEntries(
+    _In_ const void *pvA,
+    _In_ const void *pvB
+    ) {
+    DWORD dwA = *(const DWORD *)pvA;
+    DWORD dwB = *(const DWORD *)pvB;
+
+    return _tcsicmp(DIR_CRAWLER_SNAPSHOT_STRING(gs_pbSortBase, gs_pEntries[dwA].aullKeys[gs_eSortIndex]), DIR_CRAWLER_SNAPSHOT_STRING(gs_pbSortBase, gs_pEntries[dwB].aullKeys[gs_eSortIndex]));
+}
+
+static BOOL DirCrawlerSnapshotCheckTable(
+    _In_ const PDIR_CRAWLER_SNAPSHOT pSnapshot,
+    _In_ const ULONGLONG ullOffset,
+    _In_ const ULONGLONG ullSize
+    ) {
+    // Tables are 8-bytes aligned after the header, the subtraction cannot wrap on a corrupt offset
+    return ullOffset >= sizeof(DIR_CRAWLER_SNAPSHOT_HEADER) && (ullOffset % sizeof(ULONGLONG)) == 0
+        && ullOffset <= pSnapshot->ullSize && ullSize <= pSnapshot->ullSize - ullOffset;
+}
+
+static BOOL DirCrawlerSnapshotCheckString(
+    _In_ const ULONGLONG ullPoolEnd,
+    _In_ const ULONGLONG ullOffset
+    ) {
+    return ullOffset >= sizeof(DIR_CRAWLER_SNAPSHOT_HEADER) && ullOffset < ullPoolEnd && (ullOffset % sizeof(TCHAR)) == 0;
+}
+
+static BOOL DirCrawlerSnapshotCheckTables(
+    _In_ const PDIR_CRAWLER_SNAPSHOT pSnapshot
+    ) {
+    PDIR_CRAWLER_SNAPSHOT_HEADER pHeader = pSnapshot->pHeader;
+    PDIR_CRAWLER_SNAPSHOT_ENTRY pEntry = NULL;
+    ULONGLONG ullPoolEnd = pHeader->ullRequests;
+    ULONGLONG ullName = 0;
+    DWORD i = 0, j = 0, k = 0;
+
+    // The pool is followed by the zero padding and the request records: it must end with a NULL character so that
+    // no string read in place can run past it
+    if (ullPoolEnd > sizeof(DIR_CRAWLER_SNAPSHOT_HEADER) && *(PTCHAR)(pSnapshot->pbBase + ullPoolEnd - sizeof(TCHAR)) != NULL_CHAR) {
+        return FALSE;
+    }
+
+    // Request names and their attribute names are few, they are walked entirely
+    for (i = 0; i < pHeader->dwRequestCount; i++) {
+        ullName = pSnapshot->pRequests[i].ullName;
+        for (j = 0; j <= pSnapshot->pRequests[i].dwAttrCount; j++) {
+            if (DirCrawlerSnapshotCheckString(ullPoolEnd, ullName) == FALSE) {
+                return FALSE;
+            }
+            ullName += (_tcslen(DIR_CRAWLER_SNAPSHOT_STRING(pSnapshot->pbBase, ullName)) + 1) * sizeof(TCHAR);
+        }
+    }
+
+    for (i = 0; i < pHeader->dwEntryCount; i++) {
+        pEntry = &pSnapshot->pEntries[i];
+        if (pEntry->dwRequest >= pHeader->dwRequestCount || DirCrawlerSnapshotCheckString(ullPoolEnd, pEntry->aullKeys[DirCrawlerSnapshotIndexDn]) == FALSE) {
+            return FALSE;
+        }
+        for (k = DirCrawlerSnapshotIndexDn + 1; k < DirCrawlerSnapshotIndexCount; k++) {
+            if (pEntry->aullKeys[k] != DIR_CRAWLER_SNAPSHOT_NO_STRING && DirCrawlerSnapshotCheckString(ullPoolEnd, pEntry->aullKeys[k]) == FALSE) {
+                return FALSE;
+            }
+        }
+    }
+
+    for (k = 0; k < DirCrawlerSnapshotIndexCount; k++) {
+        if (pHeader->adwIndexCount[k] > pHeader->dwEntryCount) {
+            return FALSE;
+        }
+        for (i = 0; i < pHeader->adwIndexCount[k]; i++) {
+            if (pSnapshot->apdwIndex[k][i] >= pHeader->dwEntryCount || pSnapshot->pEntries[pSnapshot->apdwIndex[k][i]].aullKeys[k] == DIR_CRAWLER_SNAPSHOT_NO_STRING) {
+                return FALSE;
+            }
+        }
+    }
+    return TRUE;
+}
+
+static void DirCrawlerSnapshotPrintEntry(
+    _In_ const PDIR_CRAWLER_SNAPSHOT pSnapshot,
+    _In_ const DWORD dwEntry
+    ) {
+    PDIR_CRAWLER_SNAPSHOT_ENTRY pEntry = &pSnapshot->pEntries[dwEntry];
+    PDIR_CRAWLER_SNAPSHOT_REQUEST pRequest = &pSnapshot->pRequests[pEntry->dwRequest];
+    PTCHAR ptName = DIR_CRAWLER_SNAPSHOT_STRING(pSnapshot->pbBase, pRequest->ullName);
+    PTCHAR ptValue = DIR_CRAWLER_SNAPSHOT_STRING(pSnapshot->pbBase, pEntry->aullKeys[DirCrawlerSnapshotIndexDn]);
+    DWORD i = 0;
+
+    LOG(Bypass, _T("[%s] %s"), ptName, ptValue);
+    for (i = 0; i < pRequest->dwAttrCount; i++) {
+        ptName += _tcslen(ptName) + 1;
+        ptValue += _tcslen(ptValue) + 1;
+        if (ptValue[0] != NULL_CHAR) {
+            LOG(Bypass, SUB_LOG(_T("%s: %s")), ptName, ptValue);
+        }
+    }
+}
+
+/* --- PUBLIC FUNCTIONS ----------------------------------------------------- */
+void DirCrawlerSnapshotInit(
+    _In_ const PTCHAR ptSnapshotFile
+    ) {
+    DIR_CRAWLER_SNAPSHOT_HEADER sHeader = { 0 };
+
+    InitializeCriticalSection(&gs_sSnapshotLock);
+    gs_ptSnapshotFile = ptSnapshotFile;
+    gs_hSnapshotFile = CreateFile(ptSnapshotFile, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (gs_hSnapshotFile == INVALID_HANDLE_VALUE) {
+        FATAL(_T("Failed to create snapshot <%s>: <gle:%#08x>"), ptSnapshotFile, GLE());
+    }
+
+    // Placeholder without magic, rewritten by DirCrawlerSnapshotFinalize
+    gs_ullFileEnd = 0;
+    DirCrawlerSnapshotAppend(&sHeader, sizeof(sHeader));
+}
+
+void DirCrawlerSnapshotCleanup(
+    ) {
+    if (gs_ptSnapshotFile == NULL) {
+        return;
+    }
+
+    if (gs_hSnapshotFile != INVALID_HANDLE_VALUE) {
+        CloseHandle(gs_hSnapshotFile);
+        gs_hSnapshotFile = INVALID_HANDLE_VALUE;
+    }
+    if (gs_pRequests != NULL) {
+        UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, gs_pRequests);
+    }
+    if (gs_pEntries != NULL) {
+        UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, gs_pEntries);
+    }
+    gs_dwRequestCount = 0;
+    gs_dwEntryCount = 0;
+    DeleteCriticalSection(&gs_sSnapshotLock);
+    gs_ptSnapshotFile = NULL;
+}
+
+PDIR_CRAWLER_SNAPSHOT_OUTPUT DirCrawlerSnapshotStartRequest(
+    _In_ const PDIR_CRAWLER_REQ_DESCR pReqDescr,
+    _In_opt_ const PTCHAR ptTargetName
+    ) {
+    PDIR_CRAWLER_SNAPSHOT_OUTPUT pOutput = NULL;
+    TCHAR atRequestName[MAX_PATH] = { 0 };
+    DWORD i = 0;
+
+    pOutput = UtilsHeapAllocStructHelper(g_pDirCrawlerHeap, DIR_CRAWLER_SNAPSHOT_OUTPUT);
+    pOutput->pReqDescr = pReqDescr;
+    pOutput->dwSidColumn = DIR_CRAWLER_SNAPSHOT_NO_COLUMN;
+    pOutput->dwGuidColumn = DIR_CRAWLER_SNAPSHOT_NO_COLUMN;
+    pOutput->pEntries = NULL;
+    pOutput->dwEntryCount = 0;
+    pOutput->dwEntryCapacity = 0;
+    pOutput->dwFlushedCount = 0;
+    pOutput->dwUsed = 0;
+    pOutput->dwSize = DIR_CRAWLER_SNAPSHOT_BUFFER_SIZE;
+    pOutput->pbBuffer = UtilsHeapAllocHelper(g_pDirCrawlerHeap, pOutput->dwSize);
+
+    for (i = 0; i < pReqDescr->ldap.attributes.dwAttrCount; i++) {
+        if (_tcsicmp(pReqDescr->ldap.attributes.pAttrArray[i].ptName, DIR_CRAWLER_SNAPSHOT_SID_ATTRIBUTE) == 0) {
+            pOutput->dwSidColumn = i;
+        }
+        else if (_tcsicmp(pReqDescr->ldap.attributes.pAttrArray[i].ptName, DIR_CRAWLER_SNAPSHOT_GUID_ATTRIBUTE) == 0) {
+            pOutput->dwGuidColumn = i;
+        }
+    }
+
+    // Requests of several targets are told apart by the target name, so that diffs match them by name
+    if (ptTargetName != NULL) {
+        _stprintf_s(atRequestName, MAX_PATH, _T("%s%s%s"), ptTargetName, DIR_CRAWLER_SNAPSHOT_TARGET_SEPARATOR, pReqDescr->infos.ptName);
+    }
+    else {
+        _tcscpy_s(atRequestName, MAX_PATH, pReqDescr->infos.ptName);
+    }
+
+    // The request record and its attribute names go to the pool right away
+    EnterCriticalSection(&gs_sSnapshotLock);
+    pOutput->dwRequest = gs_dwRequestCount;
+    gs_pRequests = UtilsHeapAllocOrReallocHelper(g_pDirCrawlerHeap, gs_pRequests, SIZEOF_ARRAY(DIR_CRAWLER_SNAPSHOT_REQUEST, gs_dwRequestCount + 1));
+    gs_pRequests[gs_dwRequestCount].ullName = DirCrawlerSnapshotAppendString(atRequestName);
+    gs_pRequests[gs_dwRequestCount].dwAttrCount = pReqDescr->ldap.attributes.dwAttrCount;
+    gs_pRequests[gs_dwRequestCount].dwReserved = 0;
+    for (i = 0; i < pReqDescr->ldap.attributes.dwAttrCount; i++) {
+        DirCrawlerSnapshotAppendString(pReqDescr->ldap.attributes.pAttrArray[i].ptName);
+    }
+    gs_dwRequestCount += 1;
+    LeaveCriticalSection(&gs_sSnapshotLock);
+
+    return pOutput;
+}
+
+void DirCrawlerSnapshotWriteEntry(
+    _In_ const PDIR_CRAWLER_SNAPSHOT_OUTPUT pOutput,
+    _In_ const PTCHAR pptCsvRecord[]
+    ) {
+    PDIR_CRAWLER_SNAPSHOT_ENTRY pEntry = NULL;
+    ULONGLONG ullOffset = 0;
+    DWORD i = 0;
+
+    if (pOutput->dwEntryCount == pOutput->dwEntryCapacity) {
+        pOutput->dwEntryCapacity = max(pOutput->dwEntryCapacity * 2, DIR_CRAWLER_SNAPSHOT_MIN_ENTRIES);
+        pOutput->pEntries = UtilsHeapAllocOrReallocHelper(g_pDirCrawlerHeap, pOutput->pEntries, SIZEOF_ARRAY(DIR_CRAWLER_SNAPSHOT_ENTRY, pOutput->dwEntryCapacity));
+    }
+    pEntry = &pOutput->pEntries[pOutput->dwEntryCount];
+    pEntry->dwRequest = pOutput->dwRequest;
+    pEntry->dwReserved = 0;
+    pEntry->aullKeys[DirCrawlerSnapshotIndexSid] = DIR_CRAWLER_SNAPSHOT_BUFFERED_NONE;
+    pEntry->aullKeys[DirCrawlerSnapshotIndexGuid] = DIR_CRAWLER_SNAPSHOT_BUFFERED_NONE;
+    pEntry->aullKeys[DirCrawlerSnapshotIndexDn] = DirCrawlerSnapshotBufferString(pOutput, pptCsvRecord[0]);
+
+    for (i = 0; i < pOutput->pReqDescr->ldap.attributes.dwAttrCount; i++) {
+        ullOffset = DirCrawlerSnapshotBufferString(pOutput, pptCsvRecord[i + 1]);
+        if (pptCsvRecord[i + 1][0] == NULL_CHAR) {
+            continue;
+        }
+        if (i == pOutput->dwSidColumn) {
+            pEntry->aullKeys[DirCrawlerSnapshotIndexSid] = ullOffset;
+        }
+        else if (i == pOutput->dwGuidColumn) {
+            pEntry->aullKeys[DirCrawlerSnapshotIndexGuid] = ullOffset;
+        }
+    }
+    pOutput->dwEntryCount += 1;
+
+    if (pOutput->dwUsed >= DIR_CRAWLER_SNAPSHOT_BUFFER_SIZE) {
+        DirCrawlerSnapshotFlush(pOutput);
+    }
+}
+
+void DirCrawlerSnapshotEndRequest(
+    _Inout_ PDIR_CRAWLER_SNAPSHOT_OUTPUT *ppOutput
+    ) {
+    PDIR_CRAWLER_SNAPSHOT_OUTPUT pOutput = *ppOutput;
+
+    if (pOutput == NULL) {
+        return;
+    }
+
+    DirCrawlerSnapshotFlush(pOutput);
+    if (pOutput->dwEntryCount > 0) {
+        EnterCriticalSection(&gs_sSnapshotLock);
+        gs_pEntries = UtilsHeapAllocOrReallocHelper(g_pDirCrawlerHeap, gs_pEntries, SIZEOF_ARRAY(DIR_CRAWLER_SNAPSHOT_ENTRY, gs_dwEntryCount + pOutput->dwEntryCount));
+        CopyMemory(gs_pEntries + gs_dwEntryCount, pOutput->pEntries, SIZEOF_ARRAY(DIR_CRAWLER_SNAPSHOT_ENTRY, pOutput->dwEntryCount));
+        gs_dwEntryCount += pOutput->dwEntryCount;
+        LeaveCriticalSection(&gs_sSnapshotLock);
+        UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, pOutput->pEntries);
+    }
+
+    UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, pOutput->pbBuffer);
+    UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, pOutput);
+    *ppOutput = NULL;
+}
+
+void DirCrawlerSnapshotFinalize(
+    ) {
+    DIR_CRAWLER_SNAPSHOT_HEADER sHeader = { 0 };
+    PDWORD apdwIndex[DirCrawlerSnapshotIndexCount] = { 0 };
+    BYTE abPadding[sizeof(ULONGLONG)] = { 0 };
+    HANDLE hMapping = NULL;
+    LARGE_INTEGER liZero = { 0 };
+    ULONGLONG ullTimeStart = GetTickCount64();
+    BOOL bResult = FALSE;
+    DWORD dwWritten = 0;
+    DWORD i = 0, k = 0;
+
+    if (gs_hSnapshotFile == INVALID_HANDLE_VALUE) {
+        return;
+    }
+
+    // Indexes only hold entry numbers, they are sorted on the pool mapped from the file written so far
+    for (k = 0; k < DirCrawlerSnapshotIndexCount; k++) {
+        apdwIndex[k] = UtilsHeapAllocArrayHelper(g_pDirCrawlerHeap, DWORD, max(gs_dwEntryCount, 1));
+        for (i = 0; i < gs_dwEntryCount; i++) {
+            if (gs_pEntries[i].aullKeys[k] != DIR_CRAWLER_SNAPSHOT_NO_STRING) {
+                apdwIndex[k][sHeader.adwIndexCount[k]++] = i;
+            }
+        }
+    }
+
+    if (gs_dwEntryCount > 0) {
+        hMapping = CreateFileMapping(gs_hSnapshotFile, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (hMapping == NULL) {
+            FATAL(_T("Failed to map snapshot <%s>: <gle:%#08x>"), gs_ptSnapshotFile, GLE());
+        }
+        gs_pbSortBase = MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+        if (gs_pbSortBase == NULL) {
+            FATAL(_T("Failed to map view of snapshot <%s>: <gle:%#08x>"), gs_ptSnapshotFile, GLE());
+        }
+        for (k = 0; k < DirCrawlerSnapshotIndexCount; k++) {
+            gs_eSortIndex = k;
+            qsort(apdwIndex[k], sHeader.adwIndexCount[k], sizeof(DWORD), DirCrawlerSnapshotCompareEntries);
+        }
+        UnmapViewOfFile(gs_pbSortBase);
+        CloseHandle(hMapping);
+        gs_pbSortBase = NULL;
+    }
+
+    // Records and indexes are appended after the pool, 8-bytes aligned
+    DirCrawlerSnapshotAppend(abPadding, (DWORD)(DIR_CRAWLER_SNAPSHOT_ALIGN(gs_ullFileEnd) - gs_ullFileEnd));
+    sHeader.ullRequests = DirCrawlerSnapshotAppend(gs_pRequests, SIZEOF_ARRAY(DIR_CRAWLER_SNAPSHOT_REQUEST, gs_dwRequestCount));
+    sHeader.ullEntries = DirCrawlerSnapshotAppend(gs_pEntries, SIZEOF_ARRAY(DIR_CRAWLER_SNAPSHOT_ENTRY, gs_dwEntryCount));
+    for (k = 0; k < DirCrawlerSnapshotIndexCount; k++) {
+        sHeader.aullIndex[k] = DirCrawlerSnapshotAppend(apdwIndex[k], SIZEOF_ARRAY(DWORD, sHeader.adwIndexCount[k]));
+        UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, apdwIndex[k]);
+    }
+
+    sHeader.dwMagic = DIR_CRAWLER_SNAPSHOT_MAGIC;
+    sHeader.dwVersion = DIR_CRAWLER_SNAPSHOT_VERSION;
+    sHeader.dwCharSize = sizeof(TCHAR);
+    sHeader.dwRequestCount = gs_dwRequestCount;
+    sHeader.dwEntryCount = gs_dwEntryCount;
+    bResult = SetFilePointerEx(gs_hSnapshotFile, liZero, NULL, FILE_BEGIN);
+    bResult &= WriteFile(gs_hSnapshotFile, &sHeader, sizeof(sHeader), &dwWritten, NULL);
+    if (bResult == FALSE || dwWritten != sizeof(sHeader)) {
+        FATAL(_T("Failed to write snapshot header <%s>: <gle:%#08x>"), gs_ptSnapshotFile, GLE());
+    }
+    CloseHandle(gs_hSnapshotFile);
+    gs_hSnapshotFile = INVALID_HANDLE_VALUE;
+
+    LOG(Info, SUB_LOG(_T("Snapshot written to <%s>: <entries:%u> <sids:%u> <guids:%u> <size:%llu> <time:%.3fs>")), gs_ptSnapshotFile, gs_dwEntryCount, sHeader.adwIndexCount[DirCrawlerSnapshotIndexSid], sHeader.adwIndexCount[DirCrawlerSnapshotIndexGuid], gs_ullFileEnd, TIME_DIFF_SEC(ullTimeStart, GetTickCount64()));
+}
+
+BOOL DirCrawlerSnapshotOpen(
+    _In_ const PTCHAR ptSnapshotFile,
+    _Out_ PDIR_CRAWLER_SNAPSHOT pSnapshot
+    ) {
+    LARGE_INTEGER liSize = { 0 };
+    PDIR_CRAWLER_SNAPSHOT_HEADER pHeader = NULL;
+    BOOL bValid = TRUE;
+    DWORD k = 0;
+
+    ZeroMemory(pSnapshot, sizeof(DIR_CRAWLER_SNAPSHOT));
+    pSnapshot->hFile = CreateFile(ptSnapshotFile, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, NULL);
+    if (pSnapshot->hFile == INVALID_HANDLE_VALUE) {
+        LOG(Err, _T("Failed to open snapshot <%s>: <gle:%#08x>"), ptSnapshotFile, GLE());
+        return FALSE;
+    }
+    if (GetFileSizeEx(pSnapshot->hFile, &liSize) == FALSE || (ULONGLONG)liSize.QuadPart < sizeof(DIR_CRAWLER_SNAPSHOT_HEADER)) {
+        LOG(Err, _T("Invalid snapshot size <%s>"), ptSnapshotFile);
+        DirCrawlerSnapshotClose(pSnapshot);
+        return FALSE;
+    }
+    pSnapshot->ullSize = liSize.QuadPart;
+
+    pSnapshot->hMapping = CreateFileMapping(pSnapshot->hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (pSnapshot->hMapping != NULL) {
+        pSnapshot->pbBase = MapViewOfFile(pSnapshot->hMapping, FILE_MAP_READ, 0, 0, 0);
+    }
+    if (pSnapshot->pbBase == NULL) {
+        LOG(Err, _T("Failed to map snapshot <%s>: <gle:%#08x>"), ptSnapshotFile, GLE());
+        DirCrawlerSnapshotClose(pSnapshot);
+        return FALSE;
+    }
+
+    // The header, the tables and every key are checked, strings are then used in place
+    pHeader = (PDIR_CRAWLER_SNAPSHOT_HEADER)pSnapshot->pbBase;
+    if (pHeader->dwMagic != DIR_CRAWLER_SNAPSHOT_MAGIC || pHeader->dwVersion != DIR_CRAWLER_SNAPSHOT_VERSION || pHeader->dwCharSize != sizeof(TCHAR)) {
+        LOG(Err, _T("Invalid or incomplete snapshot <%s>: <magic:%#08x> <version:%u> <charsize:%u>"), ptSnapshotFile, pHeader->dwMagic, pHeader->dwVersion, pHeader->dwCharSize);
+        DirCrawlerSnapshotClose(pSnapshot);
+        return FALSE;
+    }
+    bValid &= DirCrawlerSnapshotCheckTable(pSnapshot, pHeader->ullRequests, SIZEOF_ARRAY(DIR_CRAWLER_SNAPSHOT_REQUEST, (ULONGLONG)pHeader->dwRequestCount));
+    bValid &= DirCrawlerSnapshotCheckTable(pSnapshot, pHeader->ullEntries, SIZEOF_ARRAY(DIR_CRAWLER_SNAPSHOT_ENTRY, (ULONGLONG)pHeader->dwEntryCount));
+    for (k = 0; k < DirCrawlerSnapshotIndexCount; k++) {
+        bValid &= DirCrawlerSnapshotCheckTable(pSnapshot, pHeader->aullIndex[k], SIZEOF_ARRAY(DWORD, (ULONGLONG)pHeader->adwIndexCount[k]));
+    }
+    if (bValid == FALSE) {
+        LOG(Err, _T("Truncated or corrupt snapshot <%s>: <size:%llu>"), ptSnapshotFile, pSnapshot->ullSize);
+        DirCrawlerSnapshotClose(pSnapshot);
+        return FALSE;
+    }
+
+    pSnapshot->pHeader = pHeader;
+    pSnapshot->pRequests = (PDIR_CRAWLER_SNAPSHOT_REQUEST)(pSnapshot->pbBase + pHeader->ullRequests);
+    pSnapshot->pEntries = (PDIR_CRAWLER_SNAPSHOT_ENTRY)(pSnapshot->pbBase + pHeader->ullEntries);
+    for (k = 0; k < DirCrawlerSnapshotIndexCount; k++) {
+        pSnapshot->apdwIndex[k] = (PDWORD)(pSnapshot->pbBase + pHeader->aullIndex[k]);
+    }
+    if (DirCrawlerSnapshotCheckTables(pSnapshot) == FALSE) {
+        LOG(Err, _T("Corrupt snapshot <%s>: string offsets or index entries out of bounds"), ptSnapshotFile);
+        DirCrawlerSnapshotClose(pSnapshot);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+void DirCrawlerSnapshotClose(
+    _Inout_ PDIR_CRAWLER_SNAPSHOT pSnapshot
+    ) {
+    if (pSnapshot->pbBase != NULL) {
+        UnmapViewOfFile(pSnapshot->pbBase);
+    }
+    if (pSnapshot->hMapping != NULL) {
+        CloseHandle(pSnapshot->hMapping);
+    }
+    if (pSnapshot->hFile != INVALID_HANDLE_VALUE && pSnapshot->hFile != NULL) {
+        CloseHandle(pSnapshot->hFile);
+    }
+    ZeroMemory(pSnapshot, sizeof(DIR_CRAWLER_SNAPSHOT));
+}
+
+DWORD DirCrawlerSnapshotFind(
+    _In_ const PDIR_CRAWLER_SNAPSHOT pSnapshot,
+    _In_ const DIR_CRAWLER_SNAPSHOT_INDEX eIndex,
+    _In_ const PTCHAR ptKey,
+    _Out_ PDWORD pdwFirst
+    ) {
+    PDWORD pdwIndex = pSnapshot->apdwIndex[eIndex];
+    DWORD dwCount = pSnapshot->pHeader->adwIndexCount[eIndex];
+    DWORD dwLow = 0;
+    DWORD dwHigh = dwCount;
+    DWORD dwMid = 0;
+    DWORD dwEnd = 0;
+
+    // Lower bound, then every following entry with the same key (a DN can be returned by several requests)
+    while (dwLow < dwHigh) {
+        dwMid = dwLow + (dwHigh - dwLow) / 2;
+        if (_tcsicmp(DIR_CRAWLER_SNAPSHOT_STRING(pSnapshot->pbBase, pSnapshot->pEntries[pdwIndex[dwMid]].aullKeys[eIndex]), ptKey) < 0) {
+            dwLow = dwMid + 1;
+        }
+        else {
+            dwHigh = dwMid;
+        }
+    }
+
+    *pdwFirst = dwLow;
+    for (dwEnd = dwLow; dwEnd < dwCount; dwEnd++) {
+        if (_tcsicmp(DIR_CRAWLER_SNAPSHOT_STRING(pSnapshot->pbBase, pSnapshot->pEntries[pdwIndex[dwEnd]].aullKeys[eIndex]), ptKey) != 0) {
+            break;
+        }
+    }
+    return dwEnd - dwLow;
+}
+
+BOOL DirCrawlerSnapshotLookup(
+    _In_ const PTCHAR ptSnapshotFile,
+    _In_ const PTCHAR ptKey
+    ) {
+    DIR_CRAWLER_SNAPSHOT sSnapshot = { 0 };
+    DWORD adwFirst[DirCrawlerSnapshotIndexCount] = { 0 };
+    DWORD adwMatches[DirCrawlerSnapshotIndexCount] = { 0 };
+    DWORD dwTotal = 0;
+    LONGLONG llStart = 0;
+    LONGLONG llOpened = 0;
+    LONGLONG llFound = 0;
+    DWORD i = 0, k = 0;
+
+    llStart = DirCrawlerStatsNow();
+    if (DirCrawlerSnapshotOpen(ptSnapshotFile, &sSnapshot) == FALSE) {
+        return FALSE;
+    }
+    llOpened = DirCrawlerStatsNow();
+
+    // The key can be a DN, a SID or a GUID, formatted like in the CSV outfiles: every index is searched
+    for (k = 0; k < DirCrawlerSnapshotIndexCount; k++) {
+        adwMatches[k] = DirCrawlerSnapshotFind(&sSnapshot, k, ptKey, &adwFirst[k]);
+        dwTotal += adwMatches[k];
+    }
+    llFound = DirCrawlerStatsNow();
+
+    LOG(Info, _T("Snapshot <%s>: <entries:%u> <open:%.1fus> <lookup:%.1fus>"), ptSnapshotFile, sSnapshot.pHeader->dwEntryCount, DirCrawlerStatsTicksToSec(llOpened - llStart) * 1e6, DirCrawlerStatsTicksToSec(llFound - llOpened) * 1e6);
+    for (k = 0; k < DirCrawlerSnapshotIndexCount; k++) {
+        for (i = 0; i < adwMatches[k]; i++) {
+            LOG(Dbg, _T("Match on <%s>"), gsc_aptIndexNames[k]);
+            DirCrawlerSnapshotPrintEntry(&sSnapshot, sSnapshot.apdwIndex[k][adwFirst[k] + i]);
+        }
+    }
+    if (dwTotal == 0) {
+        LOG(Warn, _T("No entry matching <%s>"), ptKey);
+    }
+
+    DirCrawlerSnapshotClose(&sSnapshot);
+    return dwTotal > 0;
+}
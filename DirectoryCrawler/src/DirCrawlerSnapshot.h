@@ -0,0 +1,144 @@
+#ifndef __DIR_CRAWLER_SNAPSHOT_H__
+#define __DIR_CRAWLER_SNAPSHOT_H__
+
+/* --- INCLUDES ------------------------------------------------------------- */
+#include "DirectoryCrawler.h"
+
+/* --- DEFINES -------------------------------------------------------------- */
+//
+// Snapshot of the formatted entries of a run, made to be memory-mapped and read without any parsing
+// (all integers are little-endian, offsets are from the beginning of the file):
+//  - file header
+//  - string pool: TCHAR NULL-terminated strings. Each entry is its DN followed by one string per requested attribute
+//    (the same values as the CSV outfile columns), each request is its name followed by its attribute names
+//  - request records, entry records (8-bytes aligned)
+//  - DN, objectSid and objectGUID indexes: entry numbers sorted by key, case insensitive
+// The pool is streamed to the file while crawling, the records and indexes are appended when the run ends: the
+// magic is only written then, an interrupted run leaves an invalid snapshot.
+//
+#define DIR_CRAWLER_SNAPSHOT_MAGIC          0x50414E53  // 'SNAP'
+#define DIR_CRAWLER_SNAPSHOT_VERSION        1
+#define DIR_CRAWLER_SNAPSHOT_BUFFER_SIZE    (256 * 1024)
+#define DIR_CRAWLER_SNAPSHOT_MIN_ENTRIES    1024        // initial size of the per-request entry arrays
+#define DIR_CRAWLER_SNAPSHOT_NO_COLUMN      ((DWORD)-1)
+#define DIR_CRAWLER_SNAPSHOT_NO_STRING      0           // the header is at offset 0, no string can be there
+#define DIR_CRAWLER_SNAPSHOT_BUFFERED_NONE  ((ULONGLONG)-1) // missing key of an entry not flushed yet
+#define DIR_CRAWLER_SNAPSHOT_ALIGN(x)       (((x) + 7) & ~((ULONGLONG)7))
+#define DIR_CRAWLER_SNAPSHOT_STRING(base, off) ((PTCHAR)((base) + (off)))
+#define DIR_CRAWLER_SNAPSHOT_SID_ATTRIBUTE  _T("objectSid")
+#define DIR_CRAWLER_SNAPSHOT_GUID_ATTRIBUTE _T("objectGUID")
+#define DIR_CRAWLER_SNAPSHOT_TARGET_SEPARATOR _T("/")
+
+/* --- TYPES ---------------------------------------------------------------- */
+typedef enum _DIR_CRAWLER_SNAPSHOT_INDEX {
+    DirCrawlerSnapshotIndexDn,
+    DirCrawlerSnapshotIndexSid,
+    DirCrawlerSnapshotIndexGuid,
+    DirCrawlerSnapshotIndexCount,
+} DIR_CRAWLER_SNAPSHOT_INDEX;
+
+typedef struct _DIR_CRAWLER_SNAPSHOT_HEADER {
+    DWORD dwMagic;
+    DWORD dwVersion;
+    DWORD dwCharSize;                                           // sizeof(TCHAR) of the writer
+    DWORD dwRequestCount;
+    DWORD dwEntryCount;
+    DWORD adwIndexCount[DirCrawlerSnapshotIndexCount];          // entries having a DN, objectSid and objectGUID key
+    ULONGLONG ullRequests;
+    ULONGLONG ullEntries;
+    ULONGLONG aullIndex[DirCrawlerSnapshotIndexCount];
+} DIR_CRAWLER_SNAPSHOT_HEADER, *PDIR_CRAWLER_SNAPSHOT_HEADER;
+
+typedef struct _DIR_CRAWLER_SNAPSHOT_REQUEST {
+    ULONGLONG ullName;          // followed by the dwAttrCount attribute names
+    DWORD dwAttrCount;
+    DWORD dwReserved;
+} DIR_CRAWLER_SNAPSHOT_REQUEST, *PDIR_CRAWLER_SNAPSHOT_REQUEST;
+
+typedef struct _DIR_CRAWLER_SNAPSHOT_ENTRY {
+    ULONGLONG aullKeys[DirCrawlerSnapshotIndexCount];   // the DN is followed by the attribute values, DIR_CRAWLER_SNAPSHOT_NO_STRING if no key
+    DWORD dwRequest;
+    DWORD dwReserved;
+} DIR_CRAWLER_SNAPSHOT_ENTRY, *PDIR_CRAWLER_SNAPSHOT_ENTRY;
+
+typedef struct _DIR_CRAWLER_SNAPSHOT_OUTPUT {
+    PDIR_CRAWLER_REQ_DESCR pReqDescr;
+    DWORD dwRequest;
+    DWORD dwSidColumn;          // requested attribute index, DIR_CRAWLER_SNAPSHOT_NO_COLUMN if not requested
+    DWORD dwGuidColumn;
+
+    // Entries buffered by the request, their keys being offsets in pbBuffer until it is flushed in the pool
+    PDIR_CRAWLER_SNAPSHOT_ENTRY pEntries;
+    DWORD dwEntryCount;
+    DWORD dwEntryCapacity;
+    DWORD dwFlushedCount;       // entries whose keys are already file offsets
+    PBYTE pbBuffer;
+    DWORD dwUsed;
+    DWORD dwSize;
+} DIR_CRAWLER_SNAPSHOT_OUTPUT, *PDIR_CRAWLER_SNAPSHOT_OUTPUT;
+
+typedef struct _DIR_CRAWLER_SNAPSHOT {
+    HANDLE hFile;
+    HANDLE hMapping;
+    PBYTE pbBase;
+    ULONGLONG ullSize;
+    PDIR_CRAWLER_SNAPSHOT_HEADER pHeader;
+    PDIR_CRAWLER_SNAPSHOT_REQUEST pRequests;
+    PDIR_CRAWLER_SNAPSHOT_ENTRY pEntries;
+    PDWORD apdwIndex[DirCrawlerSnapshotIndexCount];
+} DIR_CRAWLER_SNAPSHOT, *PDIR_CRAWLER_SNAPSHOT;
+
+/* --- VARIABLES ------------------------------------------------------------ */
+/* --- PROTOTYPES ----------------------------------------------------------- */
+//
+// Writer (crawl)
+//
+void DirCrawlerSnapshotInit(
+    _In_ const PTCHAR ptSnapshotFile
+    );
+
+void DirCrawlerSnapshotCleanup(
+    );
+
+PDIR_CRAWLER_SNAPSHOT_OUTPUT DirCrawlerSnapshotStartRequest(
+    _In_ const PDIR_CRAWLER_REQ_DESCR pReqDescr,
+    _In_opt_ const PTCHAR ptTargetName     // multi-target runs: request records are named '<target>/<request>'
+    );
+
+void DirCrawlerSnapshotWriteEntry(
+    _In_ const PDIR_CRAWLER_SNAPSHOT_OUTPUT pOutput,
+    _In_ const PTCHAR pptCsvRecord[]    // DN, then one formatted value per requested attribute
+    );
+
+void DirCrawlerSnapshotEndRequest(
+    _Inout_ PDIR_CRAWLER_SNAPSHOT_OUTPUT *ppOutput
+    );
+
+void DirCrawlerSnapshotFinalize(
+    );
+
+//
+// Reader (lookup)
+//
+BOOL DirCrawlerSnapshotOpen(
+    _In_ const PTCHAR ptSnapshotFile,
+    _Out_ PDIR_CRAWLER_SNAPSHOT pSnapshot
+    );
+
+void DirCrawlerSnapshotClose(
+    _Inout_ PDIR_CRAWLER_SNAPSHOT pSnapshot
+    );
+
+DWORD DirCrawlerSnapshotFind(
+    _In_ const PDIR_CRAWLER_SNAPSHOT pSnapshot,
+    _In_ const DIR_CRAWLER_SNAPSHOT_INDEX eIndex,
+    _In_ const PTCHAR ptKey,
+    _Out_ PDWORD pdwFirst       // position in the index of the first match
+    );
+
+BOOL DirCrawlerSnapshotLookup(
+    _In_ const PTCHAR ptSnapshotFile,
+    _In_ const PTCHAR ptKey
+    );
+
+#endif // __DIR_CRAWLER_SNAPSHOT_H__
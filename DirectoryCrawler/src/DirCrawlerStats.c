@@ -0,0 +1,557 @@
+/* --- INCLUDES ------------------------------------------------------------- */
+#include "DirCrawlerStats.h"
+#include "DirCrawlerBudget.h"
+#include "DirCrawlerHeap.h"
+#include "DirCrawlerTls.h"
+#include "DirCrawlerSink.h"
+#include "DirCrawlerFormatPool.h"
+#include <Psapi.h>
+#include <io.h>
+#include <fcntl.h>
+
+/* --- PRIVATE VARIABLES ---------------------------------------------------- */
+static LARGE_INTEGER gs_liFrequency = { 0 };
+static CRITICAL_SECTION gs_sStatsLock = { 0 };
+static PDIR_CRAWLER_REQ_STATS gs_pStatsHead = NULL;
+static PDIR_CRAWLER_REQ_STATS gs_pStatsTail = NULL;
+static __declspec(thread) PDIR_CRAWLER_REQ_STATS gs_pThreadStats = NULL; // stats of the request being processed by the current thread
+static __declspec(thread) LONGLONG gs_llAllocStartTicks = 0;
+static volatile LONGLONG gs_llTotalEntries = 0;
+static volatile LONGLONG gs_llTotalFormattedBytes = 0;
+static const PTCHAR gsc_aptStopNames[] = { NULL, _T("timeout"), _T("maxentries"), _T("deadline") };   // in the order of DIR_CRAWLER_STOP
+
+/* --- PUBLIC VARIABLES ----------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS ---------------------------------------------------- */
+static double DirCrawlerStatsRate(
+    _In_ const LONGLONG llCount,
+    _In_ const double dSeconds
+    ) {
+    return dSeconds > 0 ? (double)llCount / dSeconds : 0;
+}
+
+static double DirCrawlerStatsPercentile(
+    _In_ const DWORD adwHistogram[DIR_CRAWLER_STATS_HISTOGRAM_BUCKETS],
+    _In_ const double dPercentile
+    ) {
+    ULONGLONG ullTotal = 0;
+    ULONGLONG ullSeen = 0;
+    DWORD i = 0;
+
+    for (i = 0; i < DIR_CRAWLER_STATS_HISTOGRAM_BUCKETS; i++) {
+        ullTotal += adwHistogram[i];
+    }
+    if (ullTotal == 0) {
+        return 0;
+    }
+
+    // Returns the upper bound of the bucket, in seconds
+    for (i = 0; i < DIR_CRAWLER_STATS_HISTOGRAM_BUCKETS; i++) {
+        ullSeen += adwHistogram[i];
+        if ((double)ullSeen >= dPercentile * (double)ullTotal) {
+            break;
+        }
+    }
+    return (double)(1ULL << (min(i, DIR_CRAWLER_STATS_HISTOGRAM_BUCKETS - 1) + 1)) / 1000000;
+}
+
+/* --- PUBLIC FUNCTIONS ----------------------------------------------------- */
+void DirCrawlerStatsInit(
+    ) {
+    QueryPerformanceFrequency(&gs_liFrequency);
+    InitializeCriticalSection(&gs_sStatsLock);
+}
+
+void DirCrawlerStatsCleanup(
+    ) {
+    PDIR_CRAWLER_REQ_STATS pCurrent = gs_pStatsHead;
+    PDIR_CRAWLER_REQ_STATS pNext = NULL;
+    PDIR_CRAWLER_NC_STATS pNcCurrent = NULL;
+    PDIR_CRAWLER_NC_STATS pNcNext = NULL;
+
+    while (pCurrent != NULL) {
+        pNext = pCurrent->pNext;
+        for (pNcCurrent = pCurrent->pNcHead; pNcCurrent != NULL; pNcCurrent = pNcNext) {
+            pNcNext = pNcCurrent->pNext;
+            UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, pNcCurrent->ptNc);
+            UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, pNcCurrent);
+        }
+        UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, pCurrent);
+        pCurrent = pNext;
+    }
+    gs_pStatsHead = NULL;
+    gs_pStatsTail = NULL;
+
+    DeleteCriticalSection(&gs_sStatsLock);
+}
+
+PDIR_CRAWLER_REQ_STATS DirCrawlerStatsStartRequest(
+    _In_ const PDIR_CRAWLER_REQ_DESCR pReqDescr
+    ) {
+    PDIR_CRAWLER_REQ_STATS pStats = NULL;
+
+    pStats = UtilsHeapAllocStructHelper(g_pDirCrawlerHeap, DIR_CRAWLER_REQ_STATS);
+    ZeroMemory(pStats, sizeof(DIR_CRAWLER_REQ_STATS));
+    pStats->pReqDescr = pReqDescr;
+    pStats->llStartTicks = DirCrawlerStatsNow();
+
+    EnterCriticalSection(&gs_sStatsLock);
+    if (gs_pStatsTail == NULL) {
+        gs_pStatsHead = pStats;
+    }
+    else {
+        gs_pStatsTail->pNext = pStats;
+    }
+    gs_pStatsTail = pStats;
+    LeaveCriticalSection(&gs_sStatsLock);
+
+    gs_pThreadStats = pStats;
+    return pStats;
+}
+
+void DirCrawlerStatsEndRequest(
+    _In_ const PDIR_CRAWLER_REQ_STATS pStats,
+    _In_opt_ const PTCHAR ptOutFile
+    ) {
+    WIN32_FILE_ATTRIBUTE_DATA sFileAttributes = { 0 };
+    PROCESS_MEMORY_COUNTERS sMemCounters = { 0 };
+
+    pStats->bSucceeded = TRUE; // before the end time: the progress monitor considers ended requests without it as failed
+    InterlockedExchange(&pStats->lSearching, FALSE);
+    pStats->llEndTicks = DirCrawlerStatsNow();
+
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &sMemCounters, sizeof(sMemCounters)) == TRUE) {
+        pStats->ullPeakWorkingSet = sMemCounters.PeakWorkingSetSize;
+    }
+
+    if (ptOutFile != NULL && GetFileAttributesEx(ptOutFile, GetFileExInfoStandard, &sFileAttributes) == TRUE) {
+        pStats->llOutputBytes = ((LONGLONG)sFileAttributes.nFileSizeHigh << 32) | sFileAttributes.nFileSizeLow;
+    }
+
+    gs_pThreadStats = NULL;
+}
+
+void DirCrawlerStatsAbortRequest(
+    ) {
+    // Called by the worker thread when its request raised an exception: the request is over but did not succeed
+    if (gs_pThreadStats != NULL) {
+        InterlockedExchange(&gs_pThreadStats->lSearching, FALSE);
+        gs_pThreadStats->llEndTicks = DirCrawlerStatsNow();
+        gs_pThreadStats = NULL;
+    }
+}
+
+void DirCrawlerStatsStartSearch(
+    _In_ const PDIR_CRAWLER_REQ_STATS pStats,
+    _In_ const PTCHAR ptNc
+    ) {
+    PDIR_CRAWLER_NC_STATS pNcStats = NULL;
+
+    pNcStats = UtilsHeapAllocStructHelper(g_pDirCrawlerHeap, DIR_CRAWLER_NC_STATS);
+    ZeroMemory(pNcStats, sizeof(DIR_CRAWLER_NC_STATS));
+    pNcStats->ptNc = UtilsHeapStrDupHelper(g_pDirCrawlerHeap, ptNc);
+    pNcStats->llStartTicks = DirCrawlerStatsNow();
+
+    // Only the thread processing the request accesses its NC list: no lock needed
+    if (pStats->pNcTail == NULL) {
+        pStats->pNcHead = pNcStats;
+    }
+    else {
+        pStats->pNcTail->pNext = pNcStats;
+    }
+    pStats->pNcTail = pNcStats;
+    InterlockedExchange(&pStats->lSearching, TRUE);
+}
+
+void DirCrawlerStatsEndSearch(
+    _In_ const PDIR_CRAWLER_REQ_STATS pStats
+    ) {
+    InterlockedExchange(&pStats->lSearching, FALSE);
+}
+
+void DirCrawlerStatsEntryReceived(
+    _In_ const PDIR_CRAWLER_REQ_STATS pStats,
+    _In_ const LONGLONG llWaitStartTicks
+    ) {
+    PDIR_CRAWLER_NC_STATS pNcStats = pStats->pNcTail;
+    LONGLONG llNow = DirCrawlerStatsNow();
+    ULONGLONG ullWaitUs = 0;
+    DWORD dwBucket = 0;
+
+    DirCrawlerStatsStageEnd(pStats, DirCrawlerStageSearch, llWaitStartTicks);
+    if (pNcStats == NULL) {
+        return;
+    }
+
+    ullWaitUs = (ULONGLONG)((llNow - llWaitStartTicks) * 1000000 / max(gs_liFrequency.QuadPart, 1));
+    if (pNcStats->llFirstEntryTicks == 0 || ullWaitUs >= DIR_CRAWLER_STATS_PAGE_THRESHOLD_US) {
+        while (dwBucket < DIR_CRAWLER_STATS_HISTOGRAM_BUCKETS - 1 && (ullWaitUs >> (dwBucket + 1)) != 0) {
+            dwBucket += 1;
+        }
+        pNcStats->adwPageLatencyHistogram[dwBucket] += 1;
+        pNcStats->llPages += 1;
+    }
+    if (pNcStats->llFirstEntryTicks == 0) {
+        pNcStats->llFirstEntryTicks = llNow;
+    }
+}
+
+void DirCrawlerStatsEntryWritten(
+    _In_ const PDIR_CRAWLER_REQ_STATS pStats,
+    _In_ const LONGLONG llFormattedBytes
+    ) {
+    InterlockedIncrement64(&pStats->llEntries);
+    InterlockedExchange64(&pStats->llLastEntryTicks, DirCrawlerStatsNow());
+    pStats->llFormattedBytes += llFormattedBytes;
+    InterlockedIncrement64(&gs_llTotalEntries);
+    InterlockedExchangeAdd64(&gs_llTotalFormattedBytes, llFormattedBytes);
+    if (pStats->pNcTail != NULL) {
+        pStats->pNcTail->llEntries += 1;
+        pStats->pNcTail->llFormattedBytes += llFormattedBytes;
+    }
+}
+
+LONGLONG DirCrawlerStatsNow(
+    ) {
+    LARGE_INTEGER liNow = { 0 };
+    QueryPerformanceCounter(&liNow);
+    return liNow.QuadPart;
+}
+
+void DirCrawlerStatsStageEnd(
+    _In_ const PDIR_CRAWLER_REQ_STATS pStats,
+    _In_ const DIR_CRAWLER_STAGE eStage,
+    _In_ const LONGLONG llStageStartTicks
+    ) {
+    DirCrawlerStatsStageAdd(pStats, eStage, DirCrawlerStatsNow() - llStageStartTicks);
+}
+
+void DirCrawlerStatsStageAdd(
+    _In_ const PDIR_CRAWLER_REQ_STATS pStats,
+    _In_ const DIR_CRAWLER_STAGE eStage,
+    _In_ const LONGLONG llTicks
+    ) {
+    pStats->allStageTicks[eStage] += llTicks;
+    if (pStats->pNcTail != NULL) {
+        pStats->pNcTail->allStageTicks[eStage] += llTicks;
+    }
+}
+
+void DirCrawlerStatsAllocStart(
+    ) {
+    if (gs_pThreadStats != NULL) {
+        gs_llAllocStartTicks = DirCrawlerStatsNow();
+    }
+}
+
+PVOID DirCrawlerStatsAllocEnd(
+    _In_ const SIZE_T sizeBytes,
+    _In_opt_ PVOID pvAllocated
+    ) {
+    if (gs_pThreadStats != NULL) {
+        gs_pThreadStats->llAllocTicks += DirCrawlerStatsNow() - gs_llAllocStartTicks;
+        gs_pThreadStats->llAllocations += 1;
+        gs_pThreadStats->llAllocatedBytes += sizeBytes;
+    }
+    return pvAllocated;
+}
+
+PTCHAR DirCrawlerStatsStopName(
+    _In_ const DIR_CRAWLER_STOP eStop
+    ) {
+    return ((DWORD)eStop < _countof(gsc_aptStopNames)) ? gsc_aptStopNames[eStop] : NULL;
+}
+
+double DirCrawlerStatsTicksToSec(
+    _In_ const LONGLONG llTicks
+    ) {
+    return gs_liFrequency.QuadPart > 0 ? (double)llTicks / (double)gs_liFrequency.QuadPart : 0;
+}
+
+void DirCrawlerStatsGetTotals(
+    _Out_ PLONGLONG pllEntries,
+    _Out_ PLONGLONG pllFormattedBytes
+    ) {
+    *pllEntries = InterlockedCompareExchange64(&gs_llTotalEntries, 0, 0);
+    *pllFormattedBytes = InterlockedCompareExchange64(&gs_llTotalFormattedBytes, 0, 0);
+}
+
+void DirCrawlerStatsForEach(
+    _In_ const PFN_DIR_CRAWLER_STATS_CALLBACK pfnCallback,
+    _In_opt_ PVOID pvContext
+    ) {
+    PDIR_CRAWLER_REQ_STATS pStats = NULL;
+
+    EnterCriticalSection(&gs_sStatsLock);
+    for (pStats = gs_pStatsHead; pStats != NULL; pStats = pStats->pNext) {
+        pfnCallback(pStats, pvContext);
+    }
+    LeaveCriticalSection(&gs_sStatsLock);
+}
+
+void DirCrawlerStatsReport(
+    ) {
+    PDIR_CRAWLER_REQ_STATS pStats = NULL;
+    PROCESS_MEMORY_COUNTERS sMemCounters = { 0 };
+    DIR_CRAWLER_BUDGET_STATS sBudget = { 0 };
+    DIR_CRAWLER_TLS_STATS sTls = { 0 };
+    DIR_CRAWLER_SINK_STATS sSink = { 0 };
+    DIR_CRAWLER_FORMAT_STATS sFormat = { 0 };
+    DIR_CRAWLER_REQ_STATS sTotal = { 0 };
+    double dElapsed = 0;
+    DWORD i = 0;
+
+    LOG(Succ, _T("Benchmark report:"));
+    for (pStats = gs_pStatsHead; pStats != NULL; pStats = pStats->pNext) {
+        dElapsed = DirCrawlerStatsTicksToSec((pStats->llEndTicks != 0 ? pStats->llEndTicks : DirCrawlerStatsNow()) - pStats->llStartTicks);
+        LOG(Succ, SUB_LOG(_T("[%s] <%s%s%s> <entries:%lld> <time:%.3fs> <entries/s:%.0f> <bytes:%lld> <MB/s:%.2f> <allocs/entry:%.2f> <connect:%.3fs> <search:%.3fs> <format:%.3fs> <write:%.3fs>")),
+            pStats->pReqDescr->infos.ptName,
+            pStats->bSucceeded ? _T("succ") : _T("fail"),
+            pStats->eStop != DirCrawlerStopNone ? _T(":partial:") : EMPTY_STR,
+            pStats->eStop != DirCrawlerStopNone ? DirCrawlerStatsStopName(pStats->eStop) : EMPTY_STR,
+            pStats->llEntries,
+            dElapsed,
+            DirCrawlerStatsRate(pStats->llEntries, dElapsed),
+            pStats->llOutputBytes,
+            DirCrawlerStatsRate(pStats->llOutputBytes, dElapsed) / (1024 * 1024),
+            pStats->llEntries > 0 ? (double)pStats->llAllocations / (double)pStats->llEntries : 0,
+            DirCrawlerStatsTicksToSec(pStats->allStageTicks[DirCrawlerStageConnect]),
+            DirCrawlerStatsTicksToSec(pStats->allStageTicks[DirCrawlerStageSearch]),
+            DirCrawlerStatsTicksToSec(pStats->allStageTicks[DirCrawlerStageFormat]),
+            DirCrawlerStatsTicksToSec(pStats->allStageTicks[DirCrawlerStageWrite]));
+
+        sTotal.llEntries += pStats->llEntries;
+        sTotal.llOutputBytes += pStats->llOutputBytes;
+        sTotal.llAllocations += pStats->llAllocations;
+        sTotal.llAllocatedBytes += pStats->llAllocatedBytes;
+        sTotal.llAllocTicks += pStats->llAllocTicks;
+        for (i = 0; i < DirCrawlerStageCount; i++) {
+            sTotal.allStageTicks[i] += pStats->allStageTicks[i];
+        }
+        if (sTotal.llStartTicks == 0 || pStats->llStartTicks < sTotal.llStartTicks) {
+            sTotal.llStartTicks = pStats->llStartTicks;
+        }
+        if (pStats->llEndTicks > sTotal.llEndTicks) {
+            sTotal.llEndTicks = pStats->llEndTicks;
+        }
+    }
+
+    // Stage times are summed over all worker threads, the total time is the wall-clock time of the requests
+    GetProcessMemoryInfo(GetCurrentProcess(), &sMemCounters, sizeof(sMemCounters));
+    dElapsed = DirCrawlerStatsTicksToSec(sTotal.llEndTicks - sTotal.llStartTicks);
+    LOG(Succ, SUB_LOG(_T("Total <entries:%lld> <time:%.3fs> <entries/s:%.0f> <MB/s:%.2f> <allocs/entry:%.2f> <peak-rss:%lluMB> <connect:%.3fs> <search:%.3fs> <format:%.3fs> <write:%.3fs>")),
+        sTotal.llEntries,
+        dElapsed,
+        DirCrawlerStatsRate(sTotal.llEntries, dElapsed),
+        DirCrawlerStatsRate(sTotal.llOutputBytes, dElapsed) / (1024 * 1024),
+        sTotal.llEntries > 0 ? (double)sTotal.llAllocations / (double)sTotal.llEntries : 0,
+        (ULONGLONG)sMemCounters.PeakWorkingSetSize / (1024 * 1024),
+        DirCrawlerStatsTicksToSec(sTotal.allStageTicks[DirCrawlerStageConnect]),
+        DirCrawlerStatsTicksToSec(sTotal.allStageTicks[DirCrawlerStageSearch]),
+        DirCrawlerStatsTicksToSec(sTotal.allStageTicks[DirCrawlerStageFormat]),
+        DirCrawlerStatsTicksToSec(sTotal.allStageTicks[DirCrawlerStageWrite]));
+
+    // Time in the allocator is summed over all worker threads: its growth per allocation with the thread count is the heap contention
+    LOG(Succ, SUB_LOG(_T("Allocator <heaps:%s> <allocations:%lld> <allocs/s:%.0f> <allocated:%lluMB> <alloc-time:%.3fs> <ns/alloc:%.0f>")),
+        DirCrawlerHeapIsShared() == TRUE ? _T("shared") : _T("per-thread"),
+        sTotal.llAllocations,
+        DirCrawlerStatsRate(sTotal.llAllocations, dElapsed),
+        (ULONGLONG)sTotal.llAllocatedBytes / (1024 * 1024),
+        DirCrawlerStatsTicksToSec(sTotal.llAllocTicks),
+        sTotal.llAllocations > 0 ? DirCrawlerStatsTicksToSec(sTotal.llAllocTicks) * 1000000000 / (double)sTotal.llAllocations : 0);
+
+    DirCrawlerBudgetGetStats(&sBudget);
+    LOG(Succ, SUB_LOG(_T("Large records <count:%lld> <largest:%lluKB> <peak-held:%lluKB> <budget:%lluKB> <waits:%lld>")),
+        sBudget.llReservations,
+        sBudget.ullLargestRecord / 1024,
+        sBudget.ullPeakReserved / 1024,
+        sBudget.ullBudget / 1024,
+        sBudget.llWaits);
+
+    // Same line with and without '--tls': the difference between two runs is the cost of TLS in connection setup
+    DirCrawlerTlsGetStats(&sTls);
+    LOG(Succ, SUB_LOG(_T("Connections <tls:%s> <setups:%lld> <ms/first-bind:%.2f>")),
+        DirCrawlerTlsIsEnabled() == TRUE ? _T("yes") : _T("no"),
+        sTls.llSetups,
+        sTls.llSetups > 0 ? DirCrawlerStatsTicksToSec(sTls.llSetupTicks) * 1000 / (double)sTls.llSetups : 0);
+
+    // Connect stage times above include the handshakes: resumed ones skip the certificate exchange and key agreement
+    if (DirCrawlerTlsIsEnabled() == TRUE) {
+        LOG(Succ, SUB_LOG(_T("TLS <handshakes:%lld> <resumed:%lld> <failures:%lld> <ms/full:%.2f> <ms/resumed:%.2f>")),
+            sTls.llHandshakes,
+            sTls.llResumed,
+            sTls.llFailures,
+            sTls.llHandshakes > sTls.llResumed ? DirCrawlerStatsTicksToSec(sTls.llFullTicks) * 1000 / (double)(sTls.llHandshakes - sTls.llResumed) : 0,
+            sTls.llResumed > 0 ? DirCrawlerStatsTicksToSec(sTls.llResumedTicks) * 1000 / (double)sTls.llResumed : 0);
+    }
+
+    // Write stage times above include the sends: a high <send> share means the consumer is the bottleneck
+    if (DirCrawlerSinkIsStream() == TRUE) {
+        DirCrawlerSinkGetStats(&sSink);
+        LOG(Succ, SUB_LOG(_T("Sink <streams:%lld> <aborted:%lld> <records:%lld> <MB:%.2f> <batches:%lld> <send:%.3fs>")),
+            sSink.llStreams,
+            sSink.llAborted,
+            sSink.llRecords,
+            (double)sSink.llBytes / (1024 * 1024),
+            sSink.llBatches,
+            DirCrawlerStatsTicksToSec(sSink.llSendTicks));
+    }
+
+    // Format stage times above include the pool threads: a high <wait> share means the pool is too small
+    if (DirCrawlerFormatPoolIsEnabled() == TRUE) {
+        DirCrawlerFormatPoolGetStats(&sFormat);
+        LOG(Succ, SUB_LOG(_T("Format pool <threads:%u> <batches:%lld> <entries:%lld> <bypassed:%lld> <format:%.3fs> <wait:%.3fs>")),
+            sFormat.dwThreads,
+            sFormat.llBatches,
+            sFormat.llEntries,
+            sFormat.llBypassed,
+            DirCrawlerStatsTicksToSec(sFormat.llFormatTicks),
+            DirCrawlerStatsTicksToSec(sFormat.llWaitTicks));
+    }
+}
+
+void DirCrawlerStatsWriteJsonString(
+    _In_ FILE *pFile,
+    _In_opt_ const PTCHAR ptStr
+    ) {
+    PTCHAR ptCurrent = NULL;
+
+    if (ptStr == NULL) {
+        _fputts(_T("null"), pFile);
+        return;
+    }
+
+    _fputtc(_T('"'), pFile);
+    for (ptCurrent = ptStr; *ptCurrent != NULL_CHAR; ptCurrent++) {
+        if (*ptCurrent == _T('"') || *ptCurrent == _T('\\')) {
+            _fputtc(_T('\\'), pFile);
+            _fputtc(*ptCurrent, pFile);
+        }
+        else if (*ptCurrent < _T(' ')) {
+            _ftprintf(pFile, _T("\\u%04x"), (DWORD)*ptCurrent);
+        }
+        else {
+            _fputtc(*ptCurrent, pFile);
+        }
+    }
+    _fputtc(_T('"'), pFile);
+}
+
+errno_t DirCrawlerStatsOpenJson(
+    _Out_ FILE **ppFile,
+    _In_ const PTCHAR ptOutFile
+    ) {
+    errno_t err = 0;
+
+    // "ccs=UTF-8" would start the file with a BOM, which most JSON parsers reject: the file is opened without any
+    // encoding and only then switched to the UTF-8 translation of the wide output, which never writes a BOM
+    err = _tfopen_s(ppFile, ptOutFile, _T("wb"));
+    if (err != 0 || *ppFile == NULL) {
+        return err != 0 ? err : EINVAL;
+    }
+    if (_setmode(_fileno(*ppFile), _O_U8TEXT) == -1) {
+        err = errno;
+        fclose(*ppFile);
+        *ppFile = NULL;
+    }
+    return err;
+}
+
+void DirCrawlerStatsWriteJson(
+    _In_ const PTCHAR ptOutFile,
+    _In_ const DWORD dwThreads
+    ) {
+    FILE *pFile = NULL;
+    errno_t err = 0;
+    PDIR_CRAWLER_REQ_STATS pStats = NULL;
+    PDIR_CRAWLER_NC_STATS pNcStats = NULL;
+    PROCESS_MEMORY_COUNTERS sMemCounters = { 0 };
+    DIR_CRAWLER_BUDGET_STATS sBudget = { 0 };
+    DIR_CRAWLER_TLS_STATS sTls = { 0 };
+    DIR_CRAWLER_SINK_STATS sSink = { 0 };
+    DIR_CRAWLER_FORMAT_STATS sFormat = { 0 };
+    LONGLONG llFirstStart = 0;
+    LONGLONG llLastEnd = 0;
+    LONGLONG llAllocations = 0;
+    LONGLONG llAllocatedBytes = 0;
+    LONGLONG llAllocTicks = 0;
+
+    err = DirCrawlerStatsOpenJson(&pFile, ptOutFile);
+    if (err != 0) {
+        LOG(Err, _T("Failed to open stats file <%s>: <errno:%#08x>"), ptOutFile, err);
+        return;
+    }
+
+    for (pStats = gs_pStatsHead; pStats != NULL; pStats = pStats->pNext) {
+        if (llFirstStart == 0 || pStats->llStartTicks < llFirstStart) {
+            llFirstStart = pStats->llStartTicks;
+        }
+        llLastEnd = max(llLastEnd, pStats->llEndTicks);
+        llAllocations += pStats->llAllocations;
+        llAllocatedBytes += pStats->llAllocatedBytes;
+        llAllocTicks += pStats->llAllocTicks;
+    }
+    GetProcessMemoryInfo(GetCurrentProcess(), &sMemCounters, sizeof(sMemCounters));
+    DirCrawlerBudgetGetStats(&sBudget);
+    DirCrawlerTlsGetStats(&sTls);
+    DirCrawlerSinkGetStats(&sSink);
+    DirCrawlerFormatPoolGetStats(&sFormat);
+
+    // Durations are in seconds, sizes in bytes. Stage times of a request are summed over its naming contexts
+    _ftprintf(pFile, _T("{\n  \"tool\": \"%s\",\n  \"threads\": %u,\n  \"time\": %.6f,\n  \"peakWorkingSet\": %llu,")
+        _T("\n  \"allocator\": {\n    \"heaps\": \"%s\",\n    \"allocations\": %lld,\n    \"allocationsPerSecond\": %.0f,\n    \"allocatedBytes\": %lld,\n    \"allocationTime\": %.6f\n  },")
+        _T("\n  \"largeRecords\": {\n    \"count\": %lld,\n    \"largestBytes\": %llu,\n    \"peakHeldBytes\": %llu,\n    \"budgetBytes\": %llu,\n    \"waits\": %lld\n  },")
+        _T("\n  \"tls\": {\n    \"enabled\": %s,\n    \"handshakes\": %lld,\n    \"resumed\": %lld,\n    \"failures\": %lld,\n    \"fullHandshakeTime\": %.6f,\n    \"resumedHandshakeTime\": %.6f,\n    \"connectionSetups\": %lld,\n    \"setupTime\": %.6f\n  },")
+        _T("\n  \"sink\": {\n    \"stream\": %s,\n    \"streams\": %lld,\n    \"aborted\": %lld,\n    \"records\": %lld,\n    \"bytes\": %lld,\n    \"batches\": %lld,\n    \"sendTime\": %.6f\n  },")
+        _T("\n  \"formatPool\": {\n    \"threads\": %u,\n    \"batches\": %lld,\n    \"entries\": %lld,\n    \"bypassed\": %lld,\n    \"formatTime\": %.6f,\n    \"waitTime\": %.6f\n  },\n  \"requests\": ["),
+        DIR_CRAWLER_TOOL_NAME, dwThreads, DirCrawlerStatsTicksToSec(llLastEnd - llFirstStart), (ULONGLONG)sMemCounters.PeakWorkingSetSize,
+        DirCrawlerHeapIsShared() == TRUE ? _T("shared") : _T("per-thread"), llAllocations, DirCrawlerStatsRate(llAllocations, DirCrawlerStatsTicksToSec(llLastEnd - llFirstStart)), llAllocatedBytes, DirCrawlerStatsTicksToSec(llAllocTicks),
+        sBudget.llReservations, sBudget.ullLargestRecord, sBudget.ullPeakReserved, sBudget.ullBudget, sBudget.llWaits,
+        DirCrawlerTlsIsEnabled() == TRUE ? _T("true") : _T("false"), sTls.llHandshakes, sTls.llResumed, sTls.llFailures, DirCrawlerStatsTicksToSec(sTls.llFullTicks), DirCrawlerStatsTicksToSec(sTls.llResumedTicks), sTls.llSetups, DirCrawlerStatsTicksToSec(sTls.llSetupTicks),
+        DirCrawlerSinkIsStream() == TRUE ? _T("true") : _T("false"), sSink.llStreams, sSink.llAborted, sSink.llRecords, sSink.llBytes, sSink.llBatches, DirCrawlerStatsTicksToSec(sSink.llSendTicks),
+        sFormat.dwThreads, sFormat.llBatches, sFormat.llEntries, sFormat.llBypassed, DirCrawlerStatsTicksToSec(sFormat.llFormatTicks), DirCrawlerStatsTicksToSec(sFormat.llWaitTicks));
+
+    for (pStats = gs_pStatsHead; pStats != NULL; pStats = pStats->pNext) {
+        _ftprintf(pFile, _T("%s\n    {\n      \"name\": "), pStats == gs_pStatsHead ? EMPTY_STR : _T(","));
+        DirCrawlerStatsWriteJsonString(pFile, pStats->pReqDescr->infos.ptName);
+        _ftprintf(pFile, _T(",\n      \"succeeded\": %s,\n      \"entries\": %lld,\n      \"outputBytes\": %lld,\n      \"formattedBytes\": %lld,\n      \"allocations\": %lld,\n      \"allocatedBytes\": %lld,\n      \"allocationTime\": %.6f,")
+            _T("\n      \"time\": %.6f,\n      \"connect\": %.6f,\n      \"networkWait\": %.6f,\n      \"format\": %.6f,\n      \"write\": %.6f,\n      \"retries\": %u,\n      \"peakWorkingSet\": %llu,\n      \"partial\": "),
+            pStats->bSucceeded ? _T("true") : _T("false"),
+            pStats->llEntries,
+            pStats->llOutputBytes,
+            pStats->llFormattedBytes,
+            pStats->llAllocations,
+            pStats->llAllocatedBytes,
+            DirCrawlerStatsTicksToSec(pStats->llAllocTicks),
+            pStats->llEndTicks != 0 ? DirCrawlerStatsTicksToSec(pStats->llEndTicks - pStats->llStartTicks) : 0,
+            DirCrawlerStatsTicksToSec(pStats->allStageTicks[DirCrawlerStageConnect]),
+            DirCrawlerStatsTicksToSec(pStats->allStageTicks[DirCrawlerStageSearch]),
+            DirCrawlerStatsTicksToSec(pStats->allStageTicks[DirCrawlerStageFormat]),
+            DirCrawlerStatsTicksToSec(pStats->allStageTicks[DirCrawlerStageWrite]),
+            pStats->dwRetries,
+            pStats->ullPeakWorkingSet);
+        DirCrawlerStatsWriteJsonString(pFile, DirCrawlerStatsStopName(pStats->eStop));
+        _ftprintf(pFile, _T(",\n      \"namingContexts\": ["));
+
+        for (pNcStats = pStats->pNcHead; pNcStats != NULL; pNcStats = pNcStats->pNext) {
+            _ftprintf(pFile, _T("%s\n        {\n          \"nc\": "), pNcStats == pStats->pNcHead ? EMPTY_STR : _T(","));
+            DirCrawlerStatsWriteJsonString(pFile, pNcStats->ptNc);
+            _ftprintf(pFile, _T(",\n          \"entries\": %lld,\n          \"formattedBytes\": %lld,\n          \"pages\": %lld,\n          \"bind\": %.6f,\n          \"timeToFirstEntry\": %.6f,")
+                _T("\n          \"networkWait\": %.6f,\n          \"format\": %.6f,\n          \"write\": %.6f,\n          \"pageLatencyP50\": %.6f,\n          \"pageLatencyP99\": %.6f\n        }"),
+                pNcStats->llEntries,
+                pNcStats->llFormattedBytes,
+                pNcStats->llPages,
+                DirCrawlerStatsTicksToSec(pNcStats->allStageTicks[DirCrawlerStageConnect]),
+                pNcStats->llFirstEntryTicks != 0 ? DirCrawlerStatsTicksToSec(pNcStats->llFirstEntryTicks - pNcStats->llStartTicks) : 0,
+                DirCrawlerStatsTicksToSec(pNcStats->allStageTicks[DirCrawlerStageSearch]),
+                DirCrawlerStatsTicksToSec(pNcStats->allStageTicks[DirCrawlerStageFormat]),
+                DirCrawlerStatsTicksToSec(pNcStats->allStageTicks[DirCrawlerStageWrite]),
+                DirCrawlerStatsPercentile(pNcStats->adwPageLatencyHistogram, 0.50),
+                DirCrawlerStatsPercentile(pNcStats->adwPageLatencyHistogram, 0.99));
+        }
+        _ftprintf(pFile, _T("%s]\n    }"), pStats->pNcHead != NULL ? _T("\n      ") : EMPTY_STR);
+    }
+
+    _ftprintf(pFile, _T("\n  ]\n}\n"));
+    fclose(pFile);
+    LOG(Info, SUB_LOG(_T("Stats written to <%s>")), ptOutFile);
+}
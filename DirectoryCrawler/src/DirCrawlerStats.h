@@ -0,0 +1,173 @@
+#ifndef __DIR_CRAWLER_STATS_H__
+#define __DIR_CRAWLER_STATS_H__
+
+/* --- INCLUDES ------------------------------------------------------------- */
+#include "DirectoryCrawler.h"
+
+/* --- DEFINES -------------------------------------------------------------- */
+//
+// Wraps an allocation made in the per-entry path so that it is accounted to the current request, with its size and
+// the time spent in the allocator (which grows with the contention on the heap lock)
+//
+#define DIR_CRAWLER_STATS_ALLOC(size, expr)     (DirCrawlerStatsAllocStart(), DirCrawlerStatsAllocEnd((size), (expr)))
+
+//
+// Pages are not visible through LdapLib: a LdapGetNextEntry call waiting longer than this
+// threshold is considered to have fetched a new page from the server
+//
+#define DIR_CRAWLER_STATS_PAGE_THRESHOLD_US     500
+#define DIR_CRAWLER_STATS_HISTOGRAM_BUCKETS     32      // log2 buckets of microseconds
+
+/* --- TYPES ---------------------------------------------------------------- */
+typedef enum _DIR_CRAWLER_STAGE {
+    DirCrawlerStageConnect,     // LDAP connection and bind
+    DirCrawlerStageSearch,      // search initialization and wait for entries (network, capture file or synthetic generator)
+    DirCrawlerStageFormat,      // attributes values formatting
+    DirCrawlerStageWrite,       // CSV record writing
+    DirCrawlerStageCount
+} DIR_CRAWLER_STAGE;
+
+typedef struct _DIR_CRAWLER_NC_STATS {
+    PTCHAR ptNc;
+    LONGLONG llStartTicks;
+    LONGLONG llFirstEntryTicks;     // 0 until the first entry is received
+    LONGLONG llEntries;
+    LONGLONG llFormattedBytes;
+    LONGLONG llPages;
+    LONGLONG allStageTicks[DirCrawlerStageCount];
+    DWORD adwPageLatencyHistogram[DIR_CRAWLER_STATS_HISTOGRAM_BUCKETS];
+    struct _DIR_CRAWLER_NC_STATS *pNext;
+} DIR_CRAWLER_NC_STATS, *PDIR_CRAWLER_NC_STATS;
+
+typedef struct _DIR_CRAWLER_REQ_STATS {
+    PDIR_CRAWLER_REQ_DESCR pReqDescr;
+    BOOL bSucceeded;
+    LONGLONG llStartTicks;
+    LONGLONG llEndTicks;
+    volatile LONGLONG llEntries;
+    LONGLONG llFormattedBytes;
+    LONGLONG llOutputBytes;
+    LONGLONG llAllocations;
+    LONGLONG llAllocatedBytes;
+    LONGLONG llAllocTicks;
+    LONGLONG allStageTicks[DirCrawlerStageCount];
+    DWORD dwRetries;                // reschedules of the request before this attempt
+    DIR_CRAWLER_STOP eStop;         // set by the request before DirCrawlerStatsEndRequest when it is partial
+    ULONGLONG ullPeakWorkingSet;    // of the whole process, when the request ended
+
+    // Also read by the progress monitor thread while the request runs
+    volatile LONG lSearching;
+    volatile LONGLONG llLastEntryTicks;
+
+    // One per searched naming context
+    PDIR_CRAWLER_NC_STATS pNcHead;
+    PDIR_CRAWLER_NC_STATS pNcTail;
+
+    struct _DIR_CRAWLER_REQ_STATS *pNext;
+} DIR_CRAWLER_REQ_STATS, *PDIR_CRAWLER_REQ_STATS;
+
+typedef void (FN_DIR_CRAWLER_STATS_CALLBACK)(
+    _In_ const PDIR_CRAWLER_REQ_STATS pStats,
+    _In_opt_ PVOID pvContext
+    );
+typedef FN_DIR_CRAWLER_STATS_CALLBACK *PFN_DIR_CRAWLER_STATS_CALLBACK;
+
+/* --- VARIABLES ------------------------------------------------------------ */
+/* --- PROTOTYPES ----------------------------------------------------------- */
+void DirCrawlerStatsInit(
+    );
+
+void DirCrawlerStatsCleanup(
+    );
+
+PDIR_CRAWLER_REQ_STATS DirCrawlerStatsStartRequest(
+    _In_ const PDIR_CRAWLER_REQ_DESCR pReqDescr
+    );
+
+void DirCrawlerStatsEndRequest(
+    _In_ const PDIR_CRAWLER_REQ_STATS pStats,
+    _In_opt_ const PTCHAR ptOutFile
+    );
+
+void DirCrawlerStatsAbortRequest(
+    );
+
+void DirCrawlerStatsStartSearch(
+    _In_ const PDIR_CRAWLER_REQ_STATS pStats,
+    _In_ const PTCHAR ptNc
+    );
+
+void DirCrawlerStatsEndSearch(
+    _In_ const PDIR_CRAWLER_REQ_STATS pStats
+    );
+
+void DirCrawlerStatsEntryReceived(
+    _In_ const PDIR_CRAWLER_REQ_STATS pStats,
+    _In_ const LONGLONG llWaitStartTicks
+    );
+
+void DirCrawlerStatsEntryWritten(
+    _In_ const PDIR_CRAWLER_REQ_STATS pStats,
+    _In_ const LONGLONG llFormattedBytes
+    );
+
+LONGLONG DirCrawlerStatsNow(
+    );
+
+void DirCrawlerStatsStageEnd(
+    _In_ const PDIR_CRAWLER_REQ_STATS pStats,
+    _In_ const DIR_CRAWLER_STAGE eStage,
+    _In_ const LONGLONG llStageStartTicks
+    );
+
+void DirCrawlerStatsStageAdd(       // time spent for the request by another thread (formatting pool)
+    _In_ const PDIR_CRAWLER_REQ_STATS pStats,
+    _In_ const DIR_CRAWLER_STAGE eStage,
+    _In_ const LONGLONG llTicks
+    );
+
+void DirCrawlerStatsAllocStart(
+    );
+
+PVOID DirCrawlerStatsAllocEnd(
+    _In_ const SIZE_T sizeBytes,
+    _In_opt_ PVOID pvAllocated
+    );
+
+PTCHAR DirCrawlerStatsStopName(    // NULL for DirCrawlerStopNone
+    _In_ const DIR_CRAWLER_STOP eStop
+    );
+
+double DirCrawlerStatsTicksToSec(
+    _In_ const LONGLONG llTicks
+    );
+
+void DirCrawlerStatsGetTotals(
+    _Out_ PLONGLONG pllEntries,
+    _Out_ PLONGLONG pllFormattedBytes
+    );
+
+void DirCrawlerStatsForEach(
+    _In_ const PFN_DIR_CRAWLER_STATS_CALLBACK pfnCallback,
+    _In_opt_ PVOID pvContext
+    );
+
+void DirCrawlerStatsReport(
+    );
+
+void DirCrawlerStatsWriteJsonString(
+    _In_ FILE *pFile,
+    _In_opt_ const PTCHAR ptStr
+    );
+
+errno_t DirCrawlerStatsOpenJson(    // UTF-8 without BOM, for the wide _ftprintf() output
+    _Out_ FILE **ppFile,
+    _In_ const PTCHAR ptOutFile
+    );
+
+void DirCrawlerStatsWriteJson(
+    _In_ const PTCHAR ptOutFile,
+    _In_ const DWORD dwThreads
+    );
+
+#endif // __DIR_CRAWLER_STATS_H__
@@ -0,0 +1,457 @@
+/* --- INCLUDES ------------------------------------------------------------- */
+#include "DirCrawlerSynthetic.h"
+
+/* --- PRIVATE VARIABLES ---------------------------------------------------- */
+static DIR_CRAWLER_SYNTHETIC_OPTIONS gs_sSyntheticOptions = {
+    .dwObjectCount = SYNTHETIC_DEFAULT_OBJECTS,
+    .dwStrSize = SYNTHETIC_DEFAULT_STRSIZE,
+    .dwBinSize = SYNTHETIC_DEFAULT_BINSIZE,
+    .dwSdSize = SYNTHETIC_DEFAULT_SDSIZE,
+    .dwFanout = SYNTHETIC_DEFAULT_FANOUT,
+    .dwPageSize = SYNTHETIC_DEFAULT_PAGESIZE,
+    .dwPageLatency = SYNTHETIC_DEFAULT_LATENCY,
+};
+
+static const PTCHAR gsc_aptSdAttributes[] = { _T("nTSecurityDescriptor"), _T("msExchMailboxSecurityDescriptor"), _T("msDS-AllowedToActOnBehalfOfOtherIdentity"), _T("fRSRootSecurity") };
+static const PTCHAR gsc_aptSidAttributes[] = { _T("objectSid"), _T("sIDHistory"), _T("securityIdentifier"), _T("msExchMasterAccountSid") };
+static const PTCHAR gsc_aptGuidAttributes[] = { _T("objectGUID"), _T("schemaIDGUID"), _T("attributeSecurityGUID"), _T("msExchMailboxGuid"), _T("invocationId") };
+static const PTCHAR gsc_aptFiletimeAttributes[] = { _T("pwdLastSet"), _T("lastLogon"), _T("lastLogonTimestamp"), _T("badPasswordTime"), _T("accountExpires"), _T("lockoutTime") };
+static const PTCHAR gsc_aptGentimeAttributes[] = { _T("whenCreated"), _T("whenChanged") };
+static const PTCHAR gsc_aptDnMultiValuedAttributes[] = { _T("member"), _T("memberOf"), _T("managedObjects"), _T("msDS-MembersForAzRole"), _T("msExchDelegateListLink"), _T("directReports") };
+static const PTCHAR gsc_aptStrMultiValuedAttributes[] = { _T("objectClass"), _T("servicePrincipalName"), _T("proxyAddresses"), _T("msDS-AllowedToDelegateTo"), _T("dSCorePropagationData"), _T("gPLink") };
+
+static const DWORD gsc_adwSdAceMasks[] = { 0x000F01FF, 0x00020094, 0x00000130, 0x00000010, 0x00000020, 0x00000100 };
+
+/* --- PUBLIC VARIABLES ----------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS ---------------------------------------------------- */
+static DWORD DirCrawlerSyntheticRandom(
+    _Inout_ PDWORD pdwState
+    ) {
+    // xorshift32, we only need cheap and reproducible values
+    DWORD dwState = *pdwState;
+    dwState ^= dwState << 13;
+    dwState ^= dwState >> 17;
+    dwState ^= dwState << 5;
+    *pdwState = dwState;
+    return dwState;
+}
+
+static DWORD DirCrawlerSyntheticSeed(
+    _In_ const DWORD dwIndex,
+    _In_ const DWORD dwSalt
+    ) {
+    DWORD dwSeed = (dwIndex * 0x9E3779B1) ^ (dwSalt * 0x85EBCA6B);
+    return dwSeed != 0 ? dwSeed : 0xA5A5A5A5;
+}
+
+static PBYTE DirCrawlerSyntheticPutByte(
+    _Inout_ PBYTE pbOut,
+    _In_ const BYTE bValue
+    ) {
+    *pbOut = bValue;
+    return pbOut + sizeof(BYTE);
+}
+
+static PBYTE DirCrawlerSyntheticPutWord(
+    _Inout_ PBYTE pbOut,
+    _In_ const WORD wValue
+    ) {
+    *(UNALIGNED WORD *)pbOut = wValue;
+    return pbOut + sizeof(WORD);
+}
+
+static PBYTE DirCrawlerSyntheticPutDword(
+    _Inout_ PBYTE pbOut,
+    _In_ const DWORD dwValue
+    ) {
+    *(UNALIGNED DWORD *)pbOut = dwValue;
+    return pbOut + sizeof(DWORD);
+}
+
+static PBYTE DirCrawlerSyntheticPutSid(
+    _Inout_ PBYTE pbOut,
+    _In_ const DWORD dwRid
+    ) {
+    // S-1-5-21-<fixed domain>-<rid>, all the generated principals belong to the same domain
+    pbOut = DirCrawlerSyntheticPutByte(pbOut, SID_REVISION);
+    pbOut = DirCrawlerSyntheticPutByte(pbOut, 5);
+    pbOut = DirCrawlerSyntheticPutWord(pbOut, 0);
+    pbOut = DirCrawlerSyntheticPutDword(pbOut, _byteswap_ulong(5)); // identifier authority is big-endian
+    pbOut = DirCrawlerSyntheticPutDword(pbOut, 21);
+    pbOut = DirCrawlerSyntheticPutDword(pbOut, 0x1A2B3C4D);
+    pbOut = DirCrawlerSyntheticPutDword(pbOut, 0x5E6F7081);
+    pbOut = DirCrawlerSyntheticPutDword(pbOut, 0x92A3B4C5);
+    pbOut = DirCrawlerSyntheticPutDword(pbOut, dwRid);
+    return pbOut;
+}
+
+static PBYTE DirCrawlerSyntheticPutGuid(
+    _Inout_ PBYTE pbOut,
+    _In_ const DWORD dwSeed
+    ) {
+    DWORD dwState = DirCrawlerSyntheticSeed(dwSeed, 0x47554944);
+    DWORD i = 0;
+
+    for (i = 0; i < SYNTHETIC_GUID_SIZE / sizeof(DWORD); i++) {
+        pbOut = DirCrawlerSyntheticPutDword(pbOut, DirCrawlerSyntheticRandom(&dwState));
+    }
+    pbOut[-9] = (pbOut[-9] & 0x0F) | 0x40; // version 4
+    pbOut[-8] = (pbOut[-8] & 0x3F) | 0x80; // RFC 4122 variant
+    return pbOut;
+}
+
+static DWORD DirCrawlerSyntheticAceSize(
+    _In_ const DWORD dwAceIndex
+    ) {
+    // Even ACEs are ACCESS_ALLOWED_ACE, odd ones are ACCESS_ALLOWED_OBJECT_ACE with an object type
+    return (dwAceIndex % 2 == 0) ? (sizeof(ACE_HEADER) + sizeof(DWORD) + SYNTHETIC_SID_SIZE) : (sizeof(ACE_HEADER) + 2 * sizeof(DWORD) + SYNTHETIC_GUID_SIZE + SYNTHETIC_SID_SIZE);
+}
+
+static DWORD DirCrawlerSyntheticSdLayout(
+    _Out_opt_ PDWORD pdwAceCount
+    ) {
+    DWORD dwSize = sizeof(SECURITY_DESCRIPTOR_RELATIVE) + 2 * SYNTHETIC_SID_SIZE + sizeof(ACL);
+    DWORD dwAclSize = sizeof(ACL);
+    DWORD dwAceCount = 0;
+
+    while (dwSize + DirCrawlerSyntheticAceSize(dwAceCount) <= gs_sSyntheticOptions.dwSdSize && dwAclSize + DirCrawlerSyntheticAceSize(dwAceCount) <= MAXWORD) {
+        dwSize += DirCrawlerSyntheticAceSize(dwAceCount);
+        dwAclSize += DirCrawlerSyntheticAceSize(dwAceCount);
+        dwAceCount += 1;
+    }
+
+    if (pdwAceCount != NULL) {
+        *pdwAceCount = dwAceCount;
+    }
+    return dwSize;
+}
+
+static DWORD DirCrawlerSyntheticFillSd(
+    _Out_ PBYTE pbOut,
+    _In_ const DWORD dwIndex
+    ) {
+    PBYTE pbStart = pbOut;
+    DWORD dwAceCount = 0;
+    DWORD dwSdSize = DirCrawlerSyntheticSdLayout(&dwAceCount);
+    DWORD dwOwnerOffset = sizeof(SECURITY_DESCRIPTOR_RELATIVE);
+    DWORD dwGroupOffset = dwOwnerOffset + SYNTHETIC_SID_SIZE;
+    DWORD dwDaclOffset = dwGroupOffset + SYNTHETIC_SID_SIZE;
+    DWORD dwVariant = dwIndex % SYNTHETIC_DACL_VARIANTS;
+    DWORD i = 0;
+
+    // Self-relative SECURITY_DESCRIPTOR, as returned by the server
+    pbOut = DirCrawlerSyntheticPutByte(pbOut, SECURITY_DESCRIPTOR_REVISION);
+    pbOut = DirCrawlerSyntheticPutByte(pbOut, 0);
+    pbOut = DirCrawlerSyntheticPutWord(pbOut, SE_SELF_RELATIVE | SE_DACL_PRESENT | SE_DACL_AUTO_INHERITED);
+    pbOut = DirCrawlerSyntheticPutDword(pbOut, dwOwnerOffset);
+    pbOut = DirCrawlerSyntheticPutDword(pbOut, dwGroupOffset);
+    pbOut = DirCrawlerSyntheticPutDword(pbOut, 0);
+    pbOut = DirCrawlerSyntheticPutDword(pbOut, dwDaclOffset);
+    pbOut = DirCrawlerSyntheticPutSid(pbOut, DOMAIN_GROUP_RID_ADMINS);
+    pbOut = DirCrawlerSyntheticPutSid(pbOut, DOMAIN_GROUP_RID_USERS);
+
+    pbOut = DirCrawlerSyntheticPutByte(pbOut, ACL_REVISION_DS);
+    pbOut = DirCrawlerSyntheticPutByte(pbOut, 0);
+    pbOut = DirCrawlerSyntheticPutWord(pbOut, (WORD)(dwSdSize - dwDaclOffset));
+    pbOut = DirCrawlerSyntheticPutWord(pbOut, (WORD)dwAceCount);
+    pbOut = DirCrawlerSyntheticPutWord(pbOut, 0);
+
+    // The DACL only depends on the variant, so that identical DACLs are shared between entries like in a real directory
+    for (i = 0; i < dwAceCount; i++) {
+        pbOut = DirCrawlerSyntheticPutByte(pbOut, (i % 2 == 0) ? ACCESS_ALLOWED_ACE_TYPE : ACCESS_ALLOWED_OBJECT_ACE_TYPE);
+        pbOut = DirCrawlerSyntheticPutByte(pbOut, (i % 3 == 0) ? (CONTAINER_INHERIT_ACE | INHERITED_ACE) : 0);
+        pbOut = DirCrawlerSyntheticPutWord(pbOut, (WORD)DirCrawlerSyntheticAceSize(i));
+        pbOut = DirCrawlerSyntheticPutDword(pbOut, gsc_adwSdAceMasks[(i + dwVariant) % _countof(gsc_adwSdAceMasks)]);
+        if (i % 2 != 0) {
+            pbOut = DirCrawlerSyntheticPutDword(pbOut, ACE_OBJECT_TYPE_PRESENT);
+            pbOut = DirCrawlerSyntheticPutGuid(pbOut, i % 8);
+        }
+        pbOut = DirCrawlerSyntheticPutSid(pbOut, 1000 + ((dwVariant * 31 + i) % 512));
+    }
+
+    return (DWORD)(pbOut - pbStart);
+}
+
+static DWORD DirCrawlerSyntheticFillStr(
+    _Out_ PCHAR pOut,
+    _In_ const DWORD dwIndex,
+    _In_ const DWORD dwSalt
+    ) {
+    DWORD dwLen = 0;
+    DWORD i = 0;
+
+    dwLen = (DWORD)_snprintf_s(pOut, gs_sSyntheticOptions.dwStrSize + 1, _TRUNCATE, "%u-%u-", dwIndex, dwSalt);
+    if (dwLen == (DWORD)-1) {
+        return gs_sSyntheticOptions.dwStrSize;
+    }
+
+    // Put a value separator from time to time to exercise the escaping path
+    for (i = dwLen; i < gs_sSyntheticOptions.dwStrSize; i++) {
+        pOut[i] = (i % 32 == 31) ? DIR_CRAWLER_LDAP_VAL_SEPARATOR : (CHAR)('a' + ((dwIndex + i) % 26));
+    }
+    pOut[i] = '\0';
+    return i;
+}
+
+static DWORD DirCrawlerSyntheticFillValue(
+    _In_ const PDIR_CRAWLER_SYNTHETIC_ATTRIBUTE pPlan,
+    _Out_ PBYTE pbOut,
+    _In_ const DWORD dwIndex,
+    _In_ const DWORD dwAttrIndex,
+    _In_ const DWORD dwValIndex
+    ) {
+    DWORD dwState = 0;
+    DWORD dwTarget = 0;
+    DWORD i = 0;
+
+    switch (pPlan->eKind) {
+    case SyntheticValueStr:
+        return DirCrawlerSyntheticFillStr((PCHAR)pbOut, dwIndex, dwAttrIndex * 1000 + dwValIndex);
+
+    case SyntheticValueDn:
+        // Links point to other generated entries, spread over the whole directory
+        dwTarget = (dwIndex * 7 + dwValIndex * 131 + 1) % gs_sSyntheticOptions.dwObjectCount;
+        return (DWORD)_snprintf_s((PCHAR)pbOut, pPlan->dwValueMaxSize, _TRUNCATE, SYNTHETIC_DN_FORMAT, dwTarget);
+
+    case SyntheticValueInt:
+        return (DWORD)_snprintf_s((PCHAR)pbOut, pPlan->dwValueMaxSize, _TRUNCATE, "%u", DirCrawlerSyntheticSeed(dwIndex, dwAttrIndex) % 0x7FFFFFFF);
+
+    case SyntheticValueBin:
+        dwState = DirCrawlerSyntheticSeed(dwIndex, dwAttrIndex);
+        for (i = 0; i < gs_sSyntheticOptions.dwBinSize; i++) {
+            pbOut[i] = (BYTE)DirCrawlerSyntheticRandom(&dwState);
+        }
+        return gs_sSyntheticOptions.dwBinSize;
+
+    case SyntheticValueSid:
+        DirCrawlerSyntheticPutSid(pbOut, 1000 + dwIndex + dwValIndex);
+        return SYNTHETIC_SID_SIZE;
+
+    case SyntheticValueGuid:
+        DirCrawlerSyntheticPutGuid(pbOut, dwIndex ^ (dwAttrIndex << 24));
+        return SYNTHETIC_GUID_SIZE;
+
+    case SyntheticValueSd:
+        return DirCrawlerSyntheticFillSd(pbOut, dwIndex);
+
+    case SyntheticValueFiletime:
+        if (dwIndex % SYNTHETIC_FILETIME_NEVER_RATIO == 0) {
+            return (DWORD)_snprintf_s((PCHAR)pbOut, pPlan->dwValueMaxSize, _TRUNCATE, "%llu", 0x7FFFFFFFFFFFFFFFULL);
+        }
+        dwState = DirCrawlerSyntheticSeed(dwIndex, dwAttrIndex);
+        return (DWORD)_snprintf_s((PCHAR)pbOut, pPlan->dwValueMaxSize, _TRUNCATE, "%llu", SYNTHETIC_FILETIME_BASE + (ULONGLONG)DirCrawlerSyntheticRandom(&dwState) * 10000000ULL);
+
+    case SyntheticValueGentime:
+        dwState = DirCrawlerSyntheticSeed(dwIndex, dwAttrIndex);
+        return (DWORD)_snprintf_s((PCHAR)pbOut, pPlan->dwValueMaxSize, _TRUNCATE, "%04u%02u%02u%02u%02u%02u.0Z",
+            2010 + DirCrawlerSyntheticRandom(&dwState) % 15, 1 + DirCrawlerSyntheticRandom(&dwState) % 12, 1 + DirCrawlerSyntheticRandom(&dwState) % 28,
+            DirCrawlerSyntheticRandom(&dwState) % 24, DirCrawlerSyntheticRandom(&dwState) % 60, DirCrawlerSyntheticRandom(&dwState) % 60);
+    }
+
+    return 0;
+}
+
+static void DirCrawlerSyntheticPlanAttribute(
+    _In_ const PDIR_CRAWLER_LDAP_ATTRIBUTE_DESCRIPTION pAttrDescr,
+    _Out_ PDIR_CRAWLER_SYNTHETIC_ATTRIBUTE pPlan
+    ) {
+    pPlan->dwValuesCount = 1;
+
+    if (IsInSetOfStrings(pAttrDescr->ptName, gsc_aptSdAttributes, _countof(gsc_aptSdAttributes), NULL)) {
+        pPlan->eKind = SyntheticValueSd;
+        pPlan->dwValueMaxSize = DirCrawlerSyntheticSdLayout(NULL);
+    }
+    else if (IsInSetOfStrings(pAttrDescr->ptName, gsc_aptSidAttributes, _countof(gsc_aptSidAttributes), NULL)) {
+        pPlan->eKind = SyntheticValueSid;
+        pPlan->dwValueMaxSize = SYNTHETIC_SID_SIZE;
+    }
+    else if (IsInSetOfStrings(pAttrDescr->ptName, gsc_aptGuidAttributes, _countof(gsc_aptGuidAttributes), NULL)) {
+        pPlan->eKind = SyntheticValueGuid;
+        pPlan->dwValueMaxSize = SYNTHETIC_GUID_SIZE;
+    }
+    else if (IsInSetOfStrings(pAttrDescr->ptName, gsc_aptFiletimeAttributes, _countof(gsc_aptFiletimeAttributes), NULL)) {
+        pPlan->eKind = SyntheticValueFiletime;
+        pPlan->dwValueMaxSize = SYNTHETIC_FILETIME_SIZE;
+    }
+    else if (IsInSetOfStrings(pAttrDescr->ptName, gsc_aptGentimeAttributes, _countof(gsc_aptGentimeAttributes), NULL)) {
+        pPlan->eKind = SyntheticValueGentime;
+        pPlan->dwValueMaxSize = SYNTHETIC_GENTIME_SIZE;
+    }
+    else if (IsInSetOfStrings(pAttrDescr->ptName, gsc_aptDnMultiValuedAttributes, _countof(gsc_aptDnMultiValuedAttributes), NULL)) {
+        pPlan->eKind = SyntheticValueDn;
+        pPlan->dwValuesCount = gs_sSyntheticOptions.dwFanout;
+        pPlan->dwValueMaxSize = SYNTHETIC_DN_VALUE_SIZE;
+    }
+    else if (IsInSetOfStrings(pAttrDescr->ptName, gsc_aptStrMultiValuedAttributes, _countof(gsc_aptStrMultiValuedAttributes), NULL)) {
+        pPlan->eKind = SyntheticValueStr;
+        pPlan->dwValuesCount = gs_sSyntheticOptions.dwFanout;
+        pPlan->dwValueMaxSize = gs_sSyntheticOptions.dwStrSize + 1;
+    }
+    else {
+        switch (pAttrDescr->eType) {
+        case DirCrawlerTypeInt:
+        case DirCrawlerTypeRaw:
+            pPlan->eKind = SyntheticValueInt;
+            pPlan->dwValueMaxSize = SYNTHETIC_INT_SIZE;
+            break;
+        case DirCrawlerTypeBin:
+            pPlan->eKind = SyntheticValueBin;
+            pPlan->dwValueMaxSize = max(gs_sSyntheticOptions.dwBinSize, 1);
+            break;
+        case DirCrawlerTypeSd:
+            pPlan->eKind = SyntheticValueSd;
+            pPlan->dwValueMaxSize = DirCrawlerSyntheticSdLayout(NULL);
+            break;
+        case DirCrawlerTypeSid:
+            pPlan->eKind = SyntheticValueSid;
+            pPlan->dwValueMaxSize = SYNTHETIC_SID_SIZE;
+            break;
+        case DirCrawlerTypeGuid:
+            pPlan->eKind = SyntheticValueGuid;
+            pPlan->dwValueMaxSize = SYNTHETIC_GUID_SIZE;
+            break;
+        case DirCrawlerTypeFiletime:
+            pPlan->eKind = SyntheticValueFiletime;
+            pPlan->dwValueMaxSize = SYNTHETIC_FILETIME_SIZE;
+            break;
+        case DirCrawlerTypeGentime:
+            pPlan->eKind = SyntheticValueGentime;
+            pPlan->dwValueMaxSize = SYNTHETIC_GENTIME_SIZE;
+            break;
+        case DirCrawlerTypeStr:
+        default:
+            pPlan->eKind = SyntheticValueStr;
+            pPlan->dwValueMaxSize = gs_sSyntheticOptions.dwStrSize + 1;
+            break;
+        }
+    }
+}
+
+/* --- PUBLIC FUNCTIONS ----------------------------------------------------- */
+void DirCrawlerSyntheticInit(
+    _In_ const PTCHAR ptSpec
+    ) {
+    PTCHAR ptCtx = NULL;
+    PTCHAR ptToken = NULL;
+    PTCHAR ptValue = NULL;
+    PDWORD pdwField = NULL;
+
+    while (StrNextToken(ptSpec, _T(","), &ptCtx, &ptToken)) {
+        ptValue = _tcschr(ptToken, _T('='));
+        if (ptValue == NULL || IsNumeric(ptValue + 1) == FALSE) {
+            FATAL(_T("Invalid synthetic directory specification token <%s> (expected <name>=<number>)"), ptToken);
+        }
+        *ptValue = NULL_CHAR;
+        ptValue += 1;
+
+        if (STR_EQ(ptToken, SYNTHETIC_TOKEN_OBJECTS)) pdwField = &gs_sSyntheticOptions.dwObjectCount;
+        else if (STR_EQ(ptToken, SYNTHETIC_TOKEN_STRSIZE)) pdwField = &gs_sSyntheticOptions.dwStrSize;
+        else if (STR_EQ(ptToken, SYNTHETIC_TOKEN_BINSIZE)) pdwField = &gs_sSyntheticOptions.dwBinSize;
+        else if (STR_EQ(ptToken, SYNTHETIC_TOKEN_SDSIZE)) pdwField = &gs_sSyntheticOptions.dwSdSize;
+        else if (STR_EQ(ptToken, SYNTHETIC_TOKEN_FANOUT)) pdwField = &gs_sSyntheticOptions.dwFanout;
+        else if (STR_EQ(ptToken, SYNTHETIC_TOKEN_PAGESIZE)) pdwField = &gs_sSyntheticOptions.dwPageSize;
+        else if (STR_EQ(ptToken, SYNTHETIC_TOKEN_LATENCY)) pdwField = &gs_sSyntheticOptions.dwPageLatency;
+        else {
+            FATAL(_T("Unknown synthetic directory parameter <%s>"), ptToken);
+        }
+        *pdwField = _tstoi(ptValue);
+    }
+
+    if (gs_sSyntheticOptions.dwObjectCount == 0 || gs_sSyntheticOptions.dwPageSize == 0) {
+        FATAL(_T("Synthetic directory parameters <%s> and <%s> must be greater than zero"), SYNTHETIC_TOKEN_OBJECTS, SYNTHETIC_TOKEN_PAGESIZE);
+    }
+
+    LOG(Info, SUB_LOG(_T("Using synthetic directory <objects:%u> <strsize:%u> <binsize:%u> <sdsize:%u> <fanout:%u> <pagesize:%u> <latency:%ums>")),
+        gs_sSyntheticOptions.dwObjectCount, gs_sSyntheticOptions.dwStrSize, gs_sSyntheticOptions.dwBinSize, gs_sSyntheticOptions.dwSdSize,
+        gs_sSyntheticOptions.dwFanout, gs_sSyntheticOptions.dwPageSize, gs_sSyntheticOptions.dwPageLatency);
+}
+
+PDIR_CRAWLER_SYNTHETIC_CURSOR DirCrawlerSyntheticStartRequest(
+    _In_ const PDIR_CRAWLER_REQ_DESCR pReqDescr
+    ) {
+    PDIR_CRAWLER_SYNTHETIC_CURSOR pCursor = NULL;
+    DWORD dwAttrCount = pReqDescr->ldap.attributes.dwAttrCount;
+    DWORD dwValCount = 0;
+    SIZE_T szArenaSize = 0;
+    PBYTE pbArena = NULL;
+    DWORD i = 0, j = 0;
+
+    pCursor = UtilsHeapAllocStructHelper(g_pDirCrawlerHeap, DIR_CRAWLER_SYNTHETIC_CURSOR);
+    ZeroMemory(pCursor, sizeof(DIR_CRAWLER_SYNTHETIC_CURSOR));
+    pCursor->pReqDescr = pReqDescr;
+    pCursor->pPlan = UtilsHeapAllocArrayHelper(g_pDirCrawlerHeap, DIR_CRAWLER_SYNTHETIC_ATTRIBUTE, max(dwAttrCount, 1));
+
+    for (i = 0; i < dwAttrCount; i++) {
+        DirCrawlerSyntheticPlanAttribute(&pReqDescr->ldap.attributes.pAttrArray[i], &pCursor->pPlan[i]);
+        dwValCount += pCursor->pPlan[i].dwValuesCount;
+        szArenaSize += (SIZE_T)pCursor->pPlan[i].dwValuesCount * DIR_CRAWLER_SYNTHETIC_ALIGN(pCursor->pPlan[i].dwValueMaxSize);
+    }
+
+    // Every entry of a request has the same shape: the values storage is laid out once and only the contents change
+    pCursor->storage.pAttrArray = UtilsHeapAllocArrayHelper(g_pDirCrawlerHeap, LDAP_ATTRIBUTE, max(dwAttrCount, 1));
+    pCursor->storage.ppAttrArray = UtilsHeapAllocArrayHelper(g_pDirCrawlerHeap, PLDAP_ATTRIBUTE, max(dwAttrCount, 1));
+    pCursor->storage.pValArray = UtilsHeapAllocArrayHelper(g_pDirCrawlerHeap, LDAP_VALUE, max(dwValCount, 1));
+    pCursor->storage.ppValArray = UtilsHeapAllocArrayHelper(g_pDirCrawlerHeap, PLDAP_VALUE, max(dwValCount, 1));
+    pCursor->storage.pbArena = UtilsHeapAllocHelper(g_pDirCrawlerHeap, max(szArenaSize, 1));
+
+    pbArena = pCursor->storage.pbArena;
+    dwValCount = 0;
+    for (i = 0; i < dwAttrCount; i++) {
+        pCursor->storage.pAttrArray[i].dwValuesCount = pCursor->pPlan[i].dwValuesCount;
+        pCursor->storage.pAttrArray[i].ppValues = &pCursor->storage.ppValArray[dwValCount];
+        pCursor->storage.ppAttrArray[i] = &pCursor->storage.pAttrArray[i];
+        for (j = 0; j < pCursor->pPlan[i].dwValuesCount; j++) {
+            pCursor->storage.pValArray[dwValCount].pbData = pbArena;
+            pCursor->storage.ppValArray[dwValCount] = &pCursor->storage.pValArray[dwValCount];
+            pbArena += DIR_CRAWLER_SYNTHETIC_ALIGN(pCursor->pPlan[i].dwValueMaxSize);
+            dwValCount += 1;
+        }
+    }
+
+    pCursor->sEntry.ptDn = pCursor->atDn;
+    pCursor->sEntry.dwAttributesCount = dwAttrCount;
+    pCursor->sEntry.ppAttributes = pCursor->storage.ppAttrArray;
+
+    return pCursor;
+}
+
+PDIR_CRAWLER_SYNTHETIC_ENTRY DirCrawlerSyntheticNextEntry(
+    _In_ const PDIR_CRAWLER_SYNTHETIC_CURSOR pCursor
+    ) {
+    PLDAP_ATTRIBUTE pAttribute = NULL;
+    DWORD i = 0, j = 0;
+
+    if (pCursor->dwIndex >= gs_sSyntheticOptions.dwObjectCount) {
+        return NULL;
+    }
+
+    // Simulates the round-trip of each page of a paged search
+    if (gs_sSyntheticOptions.dwPageLatency > 0 && pCursor->dwIndex % gs_sSyntheticOptions.dwPageSize == 0) {
+        Sleep(gs_sSyntheticOptions.dwPageLatency);
+    }
+
+    _sntprintf_s(pCursor->atDn, _countof(pCursor->atDn), _TRUNCATE, _T(SYNTHETIC_DN_FORMAT), pCursor->dwIndex);
+    for (i = 0; i < pCursor->sEntry.dwAttributesCount; i++) {
+        pAttribute = pCursor->storage.ppAttrArray[i];
+        for (j = 0; j < pAttribute->dwValuesCount; j++) {
+            pAttribute->ppValues[j]->dwSize = DirCrawlerSyntheticFillValue(&pCursor->pPlan[i], pAttribute->ppValues[j]->pbData, pCursor->dwIndex, i, j);
+        }
+    }
+
+    pCursor->dwIndex += 1;
+    return &pCursor->sEntry;
+}
+
+void DirCrawlerSyntheticEndRequest(
+    _Inout_ PDIR_CRAWLER_SYNTHETIC_CURSOR *ppCursor
+    ) {
+    if ((*ppCursor) != NULL) {
+        UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, (*ppCursor)->pPlan);
+        UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, (*ppCursor)->storage.pAttrArray);
+        UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, (*ppCursor)->storage.ppAttrArray);
+        UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, (*ppCursor)->storage.pValArray);
+        UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, (*ppCursor)->storage.ppValArray);
+        UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, (*ppCursor)->storage.pbArena);
+        UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, (*ppCursor));
+    }
+}
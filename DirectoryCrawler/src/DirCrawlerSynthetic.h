@@ -0,0 +1,112 @@
+#ifndef __DIR_CRAWLER_SYNTHETIC_H__
+#define __DIR_CRAWLER_SYNTHETIC_H__
+
+/* --- INCLUDES ------------------------------------------------------------- */
+#include "DirectoryCrawler.h"
+
+/* --- DEFINES -------------------------------------------------------------- */
+//
+// Synthetic directory specification tokens ("objects=100000,sdsize=4096,...")
+//
+#define SYNTHETIC_TOKEN_OBJECTS         _T("objects")
+#define SYNTHETIC_TOKEN_STRSIZE         _T("strsize")
+#define SYNTHETIC_TOKEN_BINSIZE         _T("binsize")
+#define SYNTHETIC_TOKEN_SDSIZE          _T("sdsize")
+#define SYNTHETIC_TOKEN_FANOUT          _T("fanout")
+#define SYNTHETIC_TOKEN_PAGESIZE        _T("pagesize")
+#define SYNTHETIC_TOKEN_LATENCY         _T("latency")
+
+#define SYNTHETIC_DEFAULT_OBJECTS       10000
+#define SYNTHETIC_DEFAULT_STRSIZE       24
+#define SYNTHETIC_DEFAULT_BINSIZE       16
+#define SYNTHETIC_DEFAULT_SDSIZE        1024
+#define SYNTHETIC_DEFAULT_FANOUT        8
+#define SYNTHETIC_DEFAULT_PAGESIZE      1000    // AD default MaxPageSize
+#define SYNTHETIC_DEFAULT_LATENCY       0       // milliseconds per page
+
+#define SYNTHETIC_DN_FORMAT             "CN=synthetic-%u,OU=Synthetic,DC=bench,DC=local" // entries DN and DN-valued attributes, so that links point to generated entries
+#define SYNTHETIC_DN_VALUE_SIZE         64
+#define SYNTHETIC_BASE_DN               _T("OU=Synthetic,DC=bench,DC=local")
+#define SYNTHETIC_DACL_VARIANTS         16      // number of distinct DACLs generated, AD has a lot of identical ones
+#define SYNTHETIC_SID_SIZE              28      // S-1-5-21-X-Y-Z-RID
+#define SYNTHETIC_GUID_SIZE             16
+#define SYNTHETIC_INT_SIZE              12
+#define SYNTHETIC_FILETIME_SIZE         21      // decimal ULONGLONG + NULL terminator
+#define SYNTHETIC_FILETIME_BASE         132500000000000000ULL // around 2020
+#define SYNTHETIC_FILETIME_NEVER_RATIO  16      // one generated FILETIME out of N is 0x7FFFFFFFFFFFFFFF ('never')
+#define SYNTHETIC_GENTIME_SIZE          18      // YYYYMMDDHHMMSS.0Z + NULL terminator
+
+#define DIR_CRAWLER_SYNTHETIC_ALIGN(x)  (((x) + 7) & ~((SIZE_T)7))
+
+/* --- TYPES ---------------------------------------------------------------- */
+typedef struct _DIR_CRAWLER_SYNTHETIC_OPTIONS {
+    DWORD dwObjectCount;
+    DWORD dwStrSize;
+    DWORD dwBinSize;
+    DWORD dwSdSize;
+    DWORD dwFanout;
+    DWORD dwPageSize;
+    DWORD dwPageLatency;
+} DIR_CRAWLER_SYNTHETIC_OPTIONS, *PDIR_CRAWLER_SYNTHETIC_OPTIONS;
+
+typedef enum _DIR_CRAWLER_SYNTHETIC_VALUE_KIND {
+    SyntheticValueStr,
+    SyntheticValueDn,
+    SyntheticValueInt,
+    SyntheticValueBin,
+    SyntheticValueSid,
+    SyntheticValueGuid,
+    SyntheticValueSd,
+    SyntheticValueFiletime,
+    SyntheticValueGentime,
+} DIR_CRAWLER_SYNTHETIC_VALUE_KIND;
+
+typedef struct _DIR_CRAWLER_SYNTHETIC_ATTRIBUTE {
+    DIR_CRAWLER_SYNTHETIC_VALUE_KIND eKind;
+    DWORD dwValuesCount;
+    DWORD dwValueMaxSize;   // in bytes, includes a NULL terminator
+} DIR_CRAWLER_SYNTHETIC_ATTRIBUTE, *PDIR_CRAWLER_SYNTHETIC_ATTRIBUTE;
+
+typedef struct _DIR_CRAWLER_SYNTHETIC_ENTRY {
+    PTCHAR ptDn;
+    DWORD dwAttributesCount;
+    PLDAP_ATTRIBUTE *ppAttributes;
+} DIR_CRAWLER_SYNTHETIC_ENTRY, *PDIR_CRAWLER_SYNTHETIC_ENTRY;
+
+typedef struct _DIR_CRAWLER_SYNTHETIC_CURSOR {
+    PDIR_CRAWLER_REQ_DESCR pReqDescr;
+    DWORD dwIndex;
+    TCHAR atDn[MAX_PATH];
+    PDIR_CRAWLER_SYNTHETIC_ATTRIBUTE pPlan;
+
+    // Allocated once per request and reused for every generated entry
+    struct {
+        LDAP_ATTRIBUTE *pAttrArray;
+        PLDAP_ATTRIBUTE *ppAttrArray;
+        LDAP_VALUE *pValArray;
+        PLDAP_VALUE *ppValArray;
+        PBYTE pbArena;
+    } storage;
+
+    DIR_CRAWLER_SYNTHETIC_ENTRY sEntry;
+} DIR_CRAWLER_SYNTHETIC_CURSOR, *PDIR_CRAWLER_SYNTHETIC_CURSOR;
+
+/* --- VARIABLES ------------------------------------------------------------ */
+/* --- PROTOTYPES ----------------------------------------------------------- */
+void DirCrawlerSyntheticInit(
+    _In_ const PTCHAR ptSpec
+    );
+
+PDIR_CRAWLER_SYNTHETIC_CURSOR DirCrawlerSyntheticStartRequest(
+    _In_ const PDIR_CRAWLER_REQ_DESCR pReqDescr
+    );
+
+PDIR_CRAWLER_SYNTHETIC_ENTRY DirCrawlerSyntheticNextEntry(
+    _In_ const PDIR_CRAWLER_SYNTHETIC_CURSOR pCursor
+    );
+
+void DirCrawlerSyntheticEndRequest(
+    _Inout_ PDIR_CRAWLER_SYNTHETIC_CURSOR *ppCursor
+    );
+
+#endif // __DIR_CRAWLER_SYNTHETIC_H__
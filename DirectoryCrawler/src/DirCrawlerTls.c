@@ -0,0 +1,668 @@
+/* --- INCLUDES ------------------------------------------------------------- */
+#include <WinSock2.h>   // before the Windows headers pulled by DirectoryCrawler.h
+#include <WS2tcpip.h>
+#include "DirCrawlerTls.h"
+#include "DirCrawlerStats.h"
+#define SECURITY_WIN32
+#include <Security.h>
+#include <schannel.h>
+
+/* --- PRIVATE VARIABLES ---------------------------------------------------- */
+typedef struct _DIR_CRAWLER_TLS_ENDPOINT {
+    PTCHAR ptServer;
+    DWORD dwServerPort;
+    SOCKET hListenSocket;           // on the loopback, LdapLib connects to it
+    DWORD dwRelayPort;
+    HANDLE hAcceptThread;
+    struct _DIR_CRAWLER_TLS_ENDPOINT *pNext;
+} DIR_CRAWLER_TLS_ENDPOINT, *PDIR_CRAWLER_TLS_ENDPOINT;
+
+typedef struct _DIR_CRAWLER_TLS_RELAY {
+    PDIR_CRAWLER_TLS_ENDPOINT pEndpoint;
+    SOCKET hClientSocket;           // plaintext, from LdapLib
+    SOCKET hServerSocket;           // TLS, to the server
+    CredHandle hCredentials;        // the shared one, unless '--tls-no-resume'
+    BOOL bOwnCredentials;
+    CtxtHandle hContext;
+    BOOL bContext;
+    SecPkgContext_StreamSizes sSizes;
+    PBYTE pbIn;                     // received from the server, not yet decrypted
+    DWORD cbIn;
+    PBYTE pbOut;                    // encrypted record being sent to the server
+} DIR_CRAWLER_TLS_RELAY, *PDIR_CRAWLER_TLS_RELAY;
+
+static DIR_CRAWLER_TLS_MODE gs_eTlsMode = DirCrawlerTlsNone;
+static BOOL gs_bTlsInsecure = FALSE;
+static BOOL gs_bTlsNoResume = FALSE;
+static CredHandle gs_hTlsCredentials = { 0 };
+static CRITICAL_SECTION gs_sTlsLock = { 0 };
+static PDIR_CRAWLER_TLS_ENDPOINT gs_pEndpoints = NULL;  // protected by the TLS lock
+static volatile LONG gs_lActiveRelays = 0;
+static DIR_CRAWLER_TLS_STATS gs_sTlsStats = { 0 };       // protected by the TLS lock
+static volatile LONGLONG gs_llSetups = 0;                 // also measured without TLS, when the lock does not exist
+static volatile LONGLONG gs_llSetupTicks = 0;
+
+// LDAPMessage { messageID 1, ExtendedRequest { requestName "1.3.6.1.4.1.1466.20037" } }
+static const BYTE gsc_abStartTlsRequest[] = {
+    0x30, 0x1D, 0x02, 0x01, 0x01, 0x77, 0x18, 0x80, 0x16,
+    '1', '.', '3', '.', '6', '.', '1', '.', '4', '.', '1', '.', '1', '4', '6', '6', '.', '2', '0', '0', '3', '7'
+};
+
+/* --- PUBLIC VARIABLES ----------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS ---------------------------------------------------- */
+static BOOL DirCrawlerTlsSendAll(
+    _In_ const SOCKET hSocket,
+    _In_ const PBYTE pbData,
+    _In_ const DWORD cbData
+    ) {
+    DWORD cbTotal = 0;
+    int iSent = 0;
+
+    while (cbTotal < cbData) {
+        iSent = send(hSocket, (PCHAR)pbData + cbTotal, (int)(cbData - cbTotal), 0);
+        if (iSent == SOCKET_ERROR) {
+            return FALSE;
+        }
+        cbTotal += iSent;
+    }
+    return TRUE;
+}
+
+static BOOL DirCrawlerTlsAcquireCredentials(
+    _Out_ PCredHandle phCredentials
+    ) {
+    SCHANNEL_CRED sCred = { 0 };
+    TimeStamp tsExpiry = { 0 };
+    SECURITY_STATUS status = SEC_E_OK;
+
+    // Protocol versions and cipher suites are the system ones, no client certificate
+    sCred.dwVersion = SCHANNEL_CRED_VERSION;
+    sCred.dwFlags = SCH_CRED_NO_DEFAULT_CREDS | (gs_bTlsInsecure == TRUE ? SCH_CRED_MANUAL_CRED_VALIDATION : SCH_CRED_AUTO_CRED_VALIDATION);
+    status = AcquireCredentialsHandle(NULL, UNISP_NAME, SECPKG_CRED_OUTBOUND, NULL, &sCred, NULL, NULL, phCredentials, &tsExpiry);
+    if (status != SEC_E_OK) {
+        LOG(Err, _T("Failed to acquire Schannel credentials: <status:%#08x>"), status);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static SOCKET DirCrawlerTlsConnectServer(
+    _In_ const PDIR_CRAWLER_TLS_ENDPOINT pEndpoint
+    ) {
+    ADDRINFOT sHints = { 0 };
+    PADDRINFOT pAddrInfo = NULL;
+    PADDRINFOT pCurrent = NULL;
+    SOCKET hSocket = INVALID_SOCKET;
+    TCHAR atPort[16] = { 0 };
+    BOOL bNoDelay = TRUE;
+    int iResult = 0;
+
+    _stprintf_s(atPort, _countof(atPort), _T("%u"), pEndpoint->dwServerPort);
+    sHints.ai_family = AF_UNSPEC;
+    sHints.ai_socktype = SOCK_STREAM;
+    sHints.ai_protocol = IPPROTO_TCP;
+    iResult = GetAddrInfo(pEndpoint->ptServer, atPort, &sHints, &pAddrInfo);
+    if (iResult != 0) {
+        LOG(Err, _T("Failed to resolve LDAP server <%s>: <err:%#08x>"), pEndpoint->ptServer, iResult);
+        return INVALID_SOCKET;
+    }
+
+    for (pCurrent = pAddrInfo; pCurrent != NULL && hSocket == INVALID_SOCKET; pCurrent = pCurrent->ai_next) {
+        hSocket = socket(pCurrent->ai_family, pCurrent->ai_socktype, pCurrent->ai_protocol);
+        if (hSocket != INVALID_SOCKET && connect(hSocket, pCurrent->ai_addr, (int)pCurrent->ai_addrlen) == SOCKET_ERROR) {
+            closesocket(hSocket);
+            hSocket = INVALID_SOCKET;
+        }
+    }
+    FreeAddrInfo(pAddrInfo);
+
+    if (hSocket == INVALID_SOCKET) {
+        LOG(Err, _T("Failed to connect to LDAP server <%s:%u>: <err:%#08x>"), pEndpoint->ptServer, pEndpoint->dwServerPort, WSAGetLastError());
+        return INVALID_SOCKET;
+    }
+    // LDAP requests are small: they are not delayed until more data is sent
+    setsockopt(hSocket, IPPROTO_TCP, TCP_NODELAY, (PCHAR)&bNoDelay, sizeof(bNoDelay));
+    return hSocket;
+}
+
+static BOOL DirCrawlerTlsSendStartTls(
+    _In_ const PDIR_CRAWLER_TLS_RELAY pRelay
+    ) {
+    BYTE abResponse[512] = { 0 };
+    DWORD cbResponse = 0;
+    DWORD cbExpected = 0;
+    DWORD i = 0;
+    int iRecv = 0;
+
+    if (DirCrawlerTlsSendAll(pRelay->hServerSocket, (PBYTE)gsc_abStartTlsRequest, sizeof(gsc_abStartTlsRequest)) == FALSE) {
+        return FALSE;
+    }
+
+    // Reads the whole ExtendedResponse: SEQUENCE tag, then its length in short or long (1 or 2 bytes) form
+    do {
+        iRecv = recv(pRelay->hServerSocket, (PCHAR)abResponse + cbResponse, (int)(sizeof(abResponse) - cbResponse), 0);
+        if (iRecv == SOCKET_ERROR || iRecv == 0) {
+            return FALSE;
+        }
+        cbResponse += iRecv;
+        if (cbExpected == 0 && cbResponse >= 4 && abResponse[0] == 0x30) {
+            switch (abResponse[1]) {
+            case 0x81: cbExpected = 3 + abResponse[2]; break;
+            case 0x82: cbExpected = 4 + ((abResponse[2] << 8) | abResponse[3]); break;
+            default: cbExpected = (abResponse[1] < 0x80) ? 2 + abResponse[1] : sizeof(abResponse) + 1; break;
+            }
+        }
+    } while ((cbExpected == 0 || cbResponse < cbExpected) && cbResponse < sizeof(abResponse));
+    if (cbExpected == 0 || cbExpected > sizeof(abResponse)) {
+        return FALSE;
+    }
+
+    // resultCode is the first ENUMERATED of the ExtendedResponse ([APPLICATION 24]), success is 0
+    for (i = 0; i + 5 < cbExpected; i++) {
+        if (abResponse[i] == 0x78) {
+            break;
+        }
+    }
+    for (; i + 2 < cbExpected; i++) {
+        if (abResponse[i] == 0x0A && abResponse[i + 1] == 0x01) {
+            if (abResponse[i + 2] != 0) {
+                LOG(Err, _T("StartTLS refused by <%s>: <resultCode:%u>"), pRelay->pEndpoint->ptServer, abResponse[i + 2]);
+                return FALSE;
+            }
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+static BOOL DirCrawlerTlsHandshake(
+    _In_ const PDIR_CRAWLER_TLS_RELAY pRelay,
+    _In_ const BOOL bInitial       // FALSE to process post-handshake messages (TLS 1.3 session tickets), already in pbIn
+    ) {
+    DWORD dwFlags = ISC_REQ_SEQUENCE_DETECT | ISC_REQ_REPLAY_DETECT | ISC_REQ_CONFIDENTIALITY | ISC_REQ_ALLOCATE_MEMORY | ISC_REQ_STREAM;
+    DWORD dwOutFlags = 0;
+    SecBuffer asInBuffers[2] = { 0 };
+    SecBuffer sOutBuffer = { 0 };
+    SecBufferDesc sInDesc = { SECBUFFER_VERSION, _countof(asInBuffers), asInBuffers };
+    SecBufferDesc sOutDesc = { SECBUFFER_VERSION, 1, &sOutBuffer };
+    SECURITY_STATUS status = SEC_E_OK;
+    BOOL bRead = FALSE;
+    int iRecv = 0;
+
+    if (bInitial == TRUE) {
+        sOutBuffer.BufferType = SECBUFFER_TOKEN;
+        status = InitializeSecurityContext(&pRelay->hCredentials, NULL, pRelay->pEndpoint->ptServer, dwFlags, 0, 0, NULL, 0, &pRelay->hContext, &sOutDesc, &dwOutFlags, NULL);
+        if (status != SEC_I_CONTINUE_NEEDED) {
+            LOG(Err, _T("Failed to start TLS handshake with <%s>: <status:%#08x>"), pRelay->pEndpoint->ptServer, status);
+            return FALSE;
+        }
+        pRelay->bContext = TRUE;
+        if (sOutBuffer.cbBuffer > 0 && sOutBuffer.pvBuffer != NULL) {
+            bRead = DirCrawlerTlsSendAll(pRelay->hServerSocket, sOutBuffer.pvBuffer, sOutBuffer.cbBuffer);
+            FreeContextBuffer(sOutBuffer.pvBuffer);
+            if (bRead == FALSE) {
+                return FALSE;
+            }
+        }
+        pRelay->cbIn = 0;
+    }
+
+    // Data left in pbIn is processed before anything is read
+    bRead = (pRelay->cbIn == 0);
+    for (;;) {
+        if (bRead == TRUE) {
+            if (pRelay->cbIn >= DIR_CRAWLER_TLS_BUFFER_SIZE) {
+                return FALSE;
+            }
+            iRecv = recv(pRelay->hServerSocket, (PCHAR)pRelay->pbIn + pRelay->cbIn, (int)(DIR_CRAWLER_TLS_BUFFER_SIZE - pRelay->cbIn), 0);
+            if (iRecv == SOCKET_ERROR || iRecv == 0) {
+                LOG(Err, _T("Connection to <%s> lost during TLS handshake: <err:%#08x>"), pRelay->pEndpoint->ptServer, WSAGetLastError());
+                return FALSE;
+            }
+            pRelay->cbIn += iRecv;
+        }
+
+        asInBuffers[0].BufferType = SECBUFFER_TOKEN;
+        asInBuffers[0].pvBuffer = pRelay->pbIn;
+        asInBuffers[0].cbBuffer = pRelay->cbIn;
+        asInBuffers[1].BufferType = SECBUFFER_EMPTY;
+        asInBuffers[1].pvBuffer = NULL;
+        asInBuffers[1].cbBuffer = 0;
+        sOutBuffer.BufferType = SECBUFFER_TOKEN;
+        sOutBuffer.pvBuffer = NULL;
+        sOutBuffer.cbBuffer = 0;
+
+        status = InitializeSecurityContext(&pRelay->hCredentials, &pRelay->hContext, pRelay->pEndpoint->ptServer, dwFlags, 0, 0, &sInDesc, 0, NULL, &sOutDesc, &dwOutFlags, NULL);
+        if (status == SEC_E_INCOMPLETE_MESSAGE) {
+            bRead = TRUE;
+            continue;
+        }
+
+        if (sOutBuffer.cbBuffer > 0 && sOutBuffer.pvBuffer != NULL) {
+            bRead = DirCrawlerTlsSendAll(pRelay->hServerSocket, sOutBuffer.pvBuffer, sOutBuffer.cbBuffer);
+            FreeContextBuffer(sOutBuffer.pvBuffer);
+            if (bRead == FALSE) {
+                return FALSE;
+            }
+        }
+
+        if (status != SEC_E_OK && status != SEC_I_CONTINUE_NEEDED && status != SEC_I_INCOMPLETE_CREDENTIALS) {
+            LOG(Err, _T("TLS handshake with <%s> failed: <status:%#08x>"), pRelay->pEndpoint->ptServer, status);
+            return FALSE;
+        }
+
+        // A client certificate is asked: nothing was consumed, the handshake goes on without one from the same input
+        if (status == SEC_I_INCOMPLETE_CREDENTIALS) {
+            bRead = FALSE;
+            continue;
+        }
+
+        // What follows the handshake messages stays in pbIn (start of the application data or of the next message)
+        if (asInBuffers[1].BufferType == SECBUFFER_EXTRA && asInBuffers[1].cbBuffer > 0) {
+            MoveMemory(pRelay->pbIn, pRelay->pbIn + (pRelay->cbIn - asInBuffers[1].cbBuffer), asInBuffers[1].cbBuffer);
+            pRelay->cbIn = asInBuffers[1].cbBuffer;
+        }
+        else {
+            pRelay->cbIn = 0;
+        }
+
+        if (status == SEC_E_OK) {
+            return TRUE;
+        }
+        bRead = (pRelay->cbIn == 0);
+    }
+}
+
+static BOOL DirCrawlerTlsForwardToServer(
+    _In_ const PDIR_CRAWLER_TLS_RELAY pRelay
+    ) {
+    SecBuffer asBuffers[4] = { 0 };
+    SecBufferDesc sDesc = { SECBUFFER_VERSION, _countof(asBuffers), asBuffers };
+    SECURITY_STATUS status = SEC_E_OK;
+    int iRecv = 0;
+
+    // The plaintext is read in place, between the record header and trailer
+    iRecv = recv(pRelay->hClientSocket, (PCHAR)pRelay->pbOut + pRelay->sSizes.cbHeader, (int)pRelay->sSizes.cbMaximumMessage, 0);
+    if (iRecv == SOCKET_ERROR || iRecv == 0) {
+        return FALSE;
+    }
+
+    asBuffers[0].BufferType = SECBUFFER_STREAM_HEADER;
+    asBuffers[0].pvBuffer = pRelay->pbOut;
+    asBuffers[0].cbBuffer = pRelay->sSizes.cbHeader;
+    asBuffers[1].BufferType = SECBUFFER_DATA;
+    asBuffers[1].pvBuffer = pRelay->pbOut + pRelay->sSizes.cbHeader;
+    asBuffers[1].cbBuffer = iRecv;
+    asBuffers[2].BufferType = SECBUFFER_STREAM_TRAILER;
+    asBuffers[2].pvBuffer = pRelay->pbOut + pRelay->sSizes.cbHeader + iRecv;
+    asBuffers[2].cbBuffer = pRelay->sSizes.cbTrailer;
+    asBuffers[3].BufferType = SECBUFFER_EMPTY;
+
+    status = EncryptMessage(&pRelay->hContext, 0, &sDesc, 0);
+    if (status != SEC_E_OK) {
+        LOG(Err, _T("Failed to encrypt LDAP data for <%s>: <status:%#08x>"), pRelay->pEndpoint->ptServer, status);
+        return FALSE;
+    }
+    return DirCrawlerTlsSendAll(pRelay->hServerSocket, pRelay->pbOut, asBuffers[0].cbBuffer + asBuffers[1].cbBuffer + asBuffers[2].cbBuffer);
+}
+
+static BOOL DirCrawlerTlsForwardToClient(
+    _In_ const PDIR_CRAWLER_TLS_RELAY pRelay
+    ) {
+    SecBuffer asBuffers[4] = { 0 };
+    SecBufferDesc sDesc = { SECBUFFER_VERSION, _countof(asBuffers), asBuffers };
+    SECURITY_STATUS status = SEC_E_OK;
+    PSecBuffer pData = NULL;
+    PSecBuffer pExtra = NULL;
+    DWORD i = 0;
+    int iRecv = 0;
+
+    if (pRelay->cbIn >= DIR_CRAWLER_TLS_BUFFER_SIZE) {
+        return FALSE;
+    }
+    iRecv = recv(pRelay->hServerSocket, (PCHAR)pRelay->pbIn + pRelay->cbIn, (int)(DIR_CRAWLER_TLS_BUFFER_SIZE - pRelay->cbIn), 0);
+    if (iRecv == SOCKET_ERROR || iRecv == 0) {
+        return FALSE;
+    }
+    pRelay->cbIn += iRecv;
+
+    // Decrypts every complete record received, the last one can be partial
+    while (pRelay->cbIn > 0) {
+        asBuffers[0].BufferType = SECBUFFER_DATA;
+        asBuffers[0].pvBuffer = pRelay->pbIn;
+        asBuffers[0].cbBuffer = pRelay->cbIn;
+        for (i = 1; i < _countof(asBuffers); i++) {
+            asBuffers[i].BufferType = SECBUFFER_EMPTY;
+            asBuffers[i].pvBuffer = NULL;
+            asBuffers[i].cbBuffer = 0;
+        }
+
+        status = DecryptMessage(&pRelay->hContext, &sDesc, 0, NULL);
+        if (status == SEC_E_INCOMPLETE_MESSAGE) {
+            return TRUE;
+        }
+        if (status != SEC_E_OK && status != SEC_I_RENEGOTIATE && status != SEC_I_CONTEXT_EXPIRED) {
+            LOG(Err, _T("Failed to decrypt LDAP data from <%s>: <status:%#08x>"), pRelay->pEndpoint->ptServer, status);
+            return FALSE;
+        }
+
+        pData = NULL;
+        pExtra = NULL;
+        for (i = 1; i < _countof(asBuffers); i++) {
+            if (asBuffers[i].BufferType == SECBUFFER_DATA && pData == NULL) {
+                pData = &asBuffers[i];
+            }
+            else if (asBuffers[i].BufferType == SECBUFFER_EXTRA && pExtra == NULL) {
+                pExtra = &asBuffers[i];
+            }
+        }
+        if (pData != NULL && pData->cbBuffer > 0 && DirCrawlerTlsSendAll(pRelay->hClientSocket, pData->pvBuffer, pData->cbBuffer) == FALSE) {
+            return FALSE;
+        }
+        if (status == SEC_I_CONTEXT_EXPIRED) {
+            return FALSE;   // close_notify from the server
+        }
+
+        if (pExtra != NULL && pExtra->cbBuffer > 0) {
+            MoveMemory(pRelay->pbIn, pRelay->pbIn + (pRelay->cbIn - pExtra->cbBuffer), pExtra->cbBuffer);
+            pRelay->cbIn = pExtra->cbBuffer;
+        }
+        else {
+            pRelay->cbIn = 0;
+        }
+
+        // Post-handshake messages (TLS 1.3 session tickets, key updates) go back through the handshake
+        if (status == SEC_I_RENEGOTIATE && DirCrawlerTlsHandshake(pRelay, FALSE) == FALSE) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+static void DirCrawlerTlsReleaseRelay(
+    _In_ const PDIR_CRAWLER_TLS_RELAY pRelay
+    ) {
+    if (pRelay->bContext == TRUE) {
+        DeleteSecurityContext(&pRelay->hContext);
+    }
+    if (pRelay->bOwnCredentials == TRUE) {
+        FreeCredentialsHandle(&pRelay->hCredentials);
+    }
+    if (pRelay->hServerSocket != INVALID_SOCKET) {
+        closesocket(pRelay->hServerSocket);
+    }
+    closesocket(pRelay->hClientSocket);
+    UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, pRelay->pbIn);
+    UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, pRelay->pbOut);
+    UtilsHeapFreeHelper(g_pDirCrawlerHeap, pRelay);
+}
+
+static DWORD WINAPI DirCrawlerTlsRelay(
+    LPVOID lpThreadParameter
+    ) {
+    PDIR_CRAWLER_TLS_RELAY pRelay = (PDIR_CRAWLER_TLS_RELAY)lpThreadParameter;
+    SecPkgContext_SessionInfo sSessionInfo = { 0 };
+    LONGLONG llStart = 0;
+    BOOL bResumed = FALSE;
+    BOOL bResult = FALSE;
+    fd_set sReadSet = { 0 };
+
+    pRelay->hServerSocket = DirCrawlerTlsConnectServer(pRelay->pEndpoint);
+    if (pRelay->hServerSocket != INVALID_SOCKET) {
+        llStart = DirCrawlerStatsNow();
+        bResult = TRUE;
+        if (gs_eTlsMode == DirCrawlerTlsStartTls) {
+            bResult = DirCrawlerTlsSendStartTls(pRelay);
+        }
+        if (bResult == TRUE && gs_bTlsNoResume == TRUE) {
+            bResult = pRelay->bOwnCredentials = DirCrawlerTlsAcquireCredentials(&pRelay->hCredentials);
+        }
+        if (bResult == TRUE) {
+            bResult = DirCrawlerTlsHandshake(pRelay, TRUE);
+        }
+        if (bResult == TRUE && QueryContextAttributes(&pRelay->hContext, SECPKG_ATTR_STREAM_SIZES, &pRelay->sSizes) != SEC_E_OK) {
+            bResult = FALSE;
+        }
+        if (bResult == TRUE && QueryContextAttributes(&pRelay->hContext, SECPKG_ATTR_SESSION_INFO, &sSessionInfo) == SEC_E_OK) {
+            bResumed = (sSessionInfo.dwFlags & SSL_SESSION_RECONNECT) != 0;
+        }
+    }
+
+    EnterCriticalSection(&gs_sTlsLock);
+    if (bResult == FALSE) {
+        gs_sTlsStats.llFailures += 1;
+    }
+    else {
+        gs_sTlsStats.llHandshakes += 1;
+        gs_sTlsStats.llResumed += bResumed ? 1 : 0;
+        if (bResumed == TRUE) {
+            gs_sTlsStats.llResumedTicks += DirCrawlerStatsNow() - llStart;
+        }
+        else {
+            gs_sTlsStats.llFullTicks += DirCrawlerStatsNow() - llStart;
+        }
+    }
+    LeaveCriticalSection(&gs_sTlsLock);
+
+    // Until LdapLib closes its connection, or the server closes its own: closing the other side ends the LDAP session
+    while (bResult == TRUE && pRelay->sSizes.cbHeader + pRelay->sSizes.cbMaximumMessage + pRelay->sSizes.cbTrailer <= DIR_CRAWLER_TLS_BUFFER_SIZE) {
+        FD_ZERO(&sReadSet);
+        FD_SET(pRelay->hClientSocket, &sReadSet);
+        FD_SET(pRelay->hServerSocket, &sReadSet);
+        if (select(0, &sReadSet, NULL, NULL, NULL) == SOCKET_ERROR) {
+            break;
+        }
+        if (FD_ISSET(pRelay->hClientSocket, &sReadSet) && DirCrawlerTlsForwardToServer(pRelay) == FALSE) {
+            break;
+        }
+        if (FD_ISSET(pRelay->hServerSocket, &sReadSet) && DirCrawlerTlsForwardToClient(pRelay) == FALSE) {
+            break;
+        }
+    }
+
+    DirCrawlerTlsReleaseRelay(pRelay);
+    InterlockedDecrement(&gs_lActiveRelays);
+    return EXIT_SUCCESS;
+}
+
+static DWORD WINAPI DirCrawlerTlsAccept(
+    LPVOID lpThreadParameter
+    ) {
+    PDIR_CRAWLER_TLS_ENDPOINT pEndpoint = (PDIR_CRAWLER_TLS_ENDPOINT)lpThreadParameter;
+    PDIR_CRAWLER_TLS_RELAY pRelay = NULL;
+    SOCKET hSocket = INVALID_SOCKET;
+    BOOL bNoDelay = TRUE;
+    HANDLE hThread = NULL;
+
+    // Until the listening socket is closed by DirCrawlerTlsCleanup
+    for (;;) {
+        hSocket = accept(pEndpoint->hListenSocket, NULL, NULL);
+        if (hSocket == INVALID_SOCKET) {
+            break;
+        }
+        setsockopt(hSocket, IPPROTO_TCP, TCP_NODELAY, (PCHAR)&bNoDelay, sizeof(bNoDelay));
+
+        pRelay = UtilsHeapAllocStructHelper(g_pDirCrawlerHeap, DIR_CRAWLER_TLS_RELAY);
+        ZeroMemory(pRelay, sizeof(DIR_CRAWLER_TLS_RELAY));
+        pRelay->pEndpoint = pEndpoint;
+        pRelay->hClientSocket = hSocket;
+        pRelay->hServerSocket = INVALID_SOCKET;
+        pRelay->hCredentials = gs_hTlsCredentials;
+        pRelay->pbIn = UtilsHeapAllocHelper(g_pDirCrawlerHeap, DIR_CRAWLER_TLS_BUFFER_SIZE);
+        pRelay->pbOut = UtilsHeapAllocHelper(g_pDirCrawlerHeap, DIR_CRAWLER_TLS_BUFFER_SIZE);
+
+        // One thread per connection: there is at most one per worker thread and server
+        InterlockedIncrement(&gs_lActiveRelays);
+        hThread = CreateThread(NULL, 0, DirCrawlerTlsRelay, pRelay, 0, NULL);
+        if (hThread == NULL) {
+            LOG(Err, _T("Failed to create TLS relay thread for <%s>: <gle:%#08x>"), pEndpoint->ptServer, GLE());
+            InterlockedDecrement(&gs_lActiveRelays);
+            DirCrawlerTlsReleaseRelay(pRelay);
+            continue;
+        }
+        CloseHandle(hThread);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+static PDIR_CRAWLER_TLS_ENDPOINT DirCrawlerTlsGetEndpoint(
+    _In_ const PTCHAR ptServer,
+    _In_ const DWORD dwPort
+    ) {
+    PDIR_CRAWLER_TLS_ENDPOINT pEndpoint = NULL;
+    SOCKADDR_IN sAddr = { 0 };
+    int iAddrLen = sizeof(sAddr);
+
+    EnterCriticalSection(&gs_sTlsLock);
+    for (pEndpoint = gs_pEndpoints; pEndpoint != NULL; pEndpoint = pEndpoint->pNext) {
+        if (_tcsicmp(pEndpoint->ptServer, ptServer) == 0 && pEndpoint->dwServerPort == dwPort) {
+            LeaveCriticalSection(&gs_sTlsLock);
+            return pEndpoint;
+        }
+    }
+
+    pEndpoint = UtilsHeapAllocStructHelper(g_pDirCrawlerHeap, DIR_CRAWLER_TLS_ENDPOINT);
+    ZeroMemory(pEndpoint, sizeof(DIR_CRAWLER_TLS_ENDPOINT));
+    pEndpoint->ptServer = UtilsHeapStrDupHelper(g_pDirCrawlerHeap, ptServer);
+    pEndpoint->dwServerPort = dwPort;
+
+    // Ephemeral port on the loopback only
+    sAddr.sin_family = AF_INET;
+    sAddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    sAddr.sin_port = 0;
+    pEndpoint->hListenSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (pEndpoint->hListenSocket == INVALID_SOCKET
+        || bind(pEndpoint->hListenSocket, (PSOCKADDR)&sAddr, sizeof(sAddr)) == SOCKET_ERROR
+        || listen(pEndpoint->hListenSocket, SOMAXCONN) == SOCKET_ERROR
+        || getsockname(pEndpoint->hListenSocket, (PSOCKADDR)&sAddr, &iAddrLen) == SOCKET_ERROR) {
+        FATAL(_T("Failed to create TLS relay for <%s:%u>: <err:%#08x>"), ptServer, dwPort, WSAGetLastError());
+    }
+    pEndpoint->dwRelayPort = ntohs(sAddr.sin_port);
+
+    pEndpoint->hAcceptThread = CreateThread(NULL, 0, DirCrawlerTlsAccept, pEndpoint, 0, NULL);
+    if (pEndpoint->hAcceptThread == NULL) {
+        FATAL(_T("Failed to create TLS relay thread for <%s:%u>: <gle:%#08x>"), ptServer, dwPort, GLE());
+    }
+
+    pEndpoint->pNext = gs_pEndpoints;
+    gs_pEndpoints = pEndpoint;
+    LeaveCriticalSection(&gs_sTlsLock);
+
+    LOG(Dbg, SUB_LOG(_T("TLS relay for <%s:%u> on <%s:%u>")), ptServer, dwPort, DIR_CRAWLER_TLS_RELAY_HOST, pEndpoint->dwRelayPort);
+    return pEndpoint;
+}
+
+/* --- PUBLIC FUNCTIONS ----------------------------------------------------- */
+void DirCrawlerTlsInit(
+    _In_ const PTCHAR ptMode,
+    _In_ const BOOL bInsecure,
+    _In_ const BOOL bNoResume
+    ) {
+    WSADATA sWsaData = { 0 };
+    int iResult = 0;
+
+    if (ptMode == NULL) {
+        return;
+    }
+    if (_tcsicmp(ptMode, DIR_CRAWLER_TLS_LDAPS) == 0) {
+        gs_eTlsMode = DirCrawlerTlsLdaps;
+    }
+    else if (_tcsicmp(ptMode, DIR_CRAWLER_TLS_STARTTLS) == 0) {
+        gs_eTlsMode = DirCrawlerTlsStartTls;
+    }
+    else {
+        FATAL(_T("Invalid TLS mode <%s>, expecting <%s> or <%s>"), ptMode, DIR_CRAWLER_TLS_LDAPS, DIR_CRAWLER_TLS_STARTTLS);
+    }
+    gs_bTlsInsecure = bInsecure;
+    gs_bTlsNoResume = bNoResume;
+
+    iResult = WSAStartup(MAKEWORD(2, 2), &sWsaData);
+    if (iResult != 0) {
+        FATAL(_T("Failed to initialize Winsock: <err:%#08x>"), iResult);
+    }
+    InitializeCriticalSection(&gs_sTlsLock);
+    if (DirCrawlerTlsAcquireCredentials(&gs_hTlsCredentials) == FALSE) {
+        FATAL(_T("Failed to initialize TLS"));
+    }
+
+    LOG(Info, SUB_LOG(_T("LDAP over TLS <mode:%s> <certificate:%s> <resumption:%s>")), ptMode, bInsecure ? _T("not validated") : _T("validated"), bNoResume ? _T("off") : _T("on"));
+}
+
+void DirCrawlerTlsCleanup(
+    ) {
+    PDIR_CRAWLER_TLS_ENDPOINT pEndpoint = NULL;
+    ULONGLONG ullStart = GetTickCount64();
+
+    if (gs_eTlsMode == DirCrawlerTlsNone) {
+        return;
+    }
+
+    for (pEndpoint = gs_pEndpoints; pEndpoint != NULL; pEndpoint = pEndpoint->pNext) {
+        closesocket(pEndpoint->hListenSocket);
+        WaitForSingleObject(pEndpoint->hAcceptThread, INFINITE);
+        CloseHandle(pEndpoint->hAcceptThread);
+    }
+    // Relays end with the LDAP connections: all of them are closed by now
+    while (InterlockedCompareExchange(&gs_lActiveRelays, 0, 0) > 0 && GetTickCount64() - ullStart < DIR_CRAWLER_TLS_STOP_TIMEOUT) {
+        Sleep(10);
+    }
+    if (gs_lActiveRelays > 0) {
+        LOG(Warn, _T("<%d> TLS relays still running at exit"), gs_lActiveRelays);
+        return;     // their credentials and lock are left to the process exit
+    }
+
+    while (gs_pEndpoints != NULL) {
+        pEndpoint = gs_pEndpoints;
+        gs_pEndpoints = pEndpoint->pNext;
+        UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, pEndpoint->ptServer);
+        UtilsHeapFreeHelper(g_pDirCrawlerHeap, pEndpoint);
+    }
+    FreeCredentialsHandle(&gs_hTlsCredentials);
+    DeleteCriticalSection(&gs_sTlsLock);
+    WSACleanup();
+    gs_eTlsMode = DirCrawlerTlsNone;
+}
+
+BOOL DirCrawlerTlsConnect(
+    _In_ const PTCHAR ptServer,
+    _In_ const DWORD dwPort,
+    _Out_ PLDAP_CONNECT *ppLdapConnect,
+    _Out_opt_ PLDAP_ROOT_DSE *ppRootDse
+    ) {
+    PDIR_CRAWLER_TLS_ENDPOINT pEndpoint = NULL;
+
+    if (gs_eTlsMode == DirCrawlerTlsNone) {
+        return LdapConnect(ptServer, dwPort, ppLdapConnect, ppRootDse);
+    }
+
+    pEndpoint = DirCrawlerTlsGetEndpoint(ptServer, (gs_eTlsMode == DirCrawlerTlsLdaps && dwPort == LDAP_DEFAULT_PORT) ? DIR_CRAWLER_TLS_LDAPS_PORT : dwPort);
+    return LdapConnect(DIR_CRAWLER_TLS_RELAY_HOST, pEndpoint->dwRelayPort, ppLdapConnect, ppRootDse);
+}
+
+void DirCrawlerTlsSetupDone(
+    _In_ const LONGLONG llConnectStart
+    ) {
+    InterlockedIncrement64(&gs_llSetups);
+    InterlockedAdd64(&gs_llSetupTicks, DirCrawlerStatsNow() - llConnectStart);
+}
+
+BOOL DirCrawlerTlsIsEnabled(
+    ) {
+    return (BOOL)(gs_eTlsMode != DirCrawlerTlsNone);
+}
+
+void DirCrawlerTlsGetStats(
+    _Out_ PDIR_CRAWLER_TLS_STATS pStats
+    ) {
+    if (gs_eTlsMode == DirCrawlerTlsNone) {
+        ZeroMemory(pStats, sizeof(DIR_CRAWLER_TLS_STATS));
+    }
+    else {
+        EnterCriticalSection(&gs_sTlsLock);
+        *pStats = gs_sTlsStats;
+        LeaveCriticalSection(&gs_sTlsLock);
+    }
+    pStats->llSetups = gs_llSetups;
+    pStats->llSetupTicks = gs_llSetupTicks;
+}
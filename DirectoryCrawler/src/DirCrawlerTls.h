@@ -0,0 +1,75 @@
+#ifndef __DIR_CRAWLER_TLS_H__
+#define __DIR_CRAWLER_TLS_H__
+
+/* --- INCLUDES ------------------------------------------------------------- */
+#include "DirectoryCrawler.h"
+
+/* --- DEFINES -------------------------------------------------------------- */
+//
+// LDAP over TLS ('--tls ldaps' or '--tls starttls'). LdapLib only opens plaintext connections: with TLS, they are made
+// to a relay listening on the loopback for each server, which opens the TLS connection to the server (after a StartTLS
+// extended operation for 'starttls') and encrypts and decrypts the LDAP traffic with Schannel.
+// All the relayed connections share one Schannel credential, so the session of the first handshake with a server is
+// resumed by the following ones (session ID or ticket) instead of paying a full handshake per request and reconnect.
+// '--tls-no-resume' uses a credential per connection, to measure the cost of full handshakes. The certificate of the
+// server is validated against its name unless '--tls-insecure' (self-signed test servers).
+// Binds go to the loopback: Kerberos cannot get a ticket for it, Negotiate falls back to NTLM (explicit credentials),
+// and they carry no channel binding token (DCs enforcing channel binding reject them). wldap32's own TLS would keep
+// both, but LdapLib has no function opening a TLS connection.
+// The setup of the connections of the requests (from the connection to the end of its first bind) is measured with and
+// without TLS, so that runs with and without '--tls' compare their connection costs.
+//
+#define DIR_CRAWLER_TLS_LDAPS               _T("ldaps")
+#define DIR_CRAWLER_TLS_STARTTLS            _T("starttls")
+#define DIR_CRAWLER_TLS_LDAPS_PORT          636         // used instead of the default LDAP port with 'ldaps'
+#define DIR_CRAWLER_TLS_RELAY_HOST          _T("127.0.0.1")
+#define DIR_CRAWLER_TLS_BUFFER_SIZE         (64 * 1024) // larger than a TLS record and its header and trailer
+#define DIR_CRAWLER_TLS_STOP_TIMEOUT        5000        // ms, for the relays of connections still open at exit
+
+/* --- TYPES ---------------------------------------------------------------- */
+typedef enum _DIR_CRAWLER_TLS_MODE {
+    DirCrawlerTlsNone,
+    DirCrawlerTlsLdaps,             // TLS from the start of the connection
+    DirCrawlerTlsStartTls,          // StartTLS extended operation on the LDAP port, then TLS
+} DIR_CRAWLER_TLS_MODE;
+
+typedef struct _DIR_CRAWLER_TLS_STATS {
+    LONGLONG llHandshakes;
+    LONGLONG llResumed;             // abbreviated handshakes
+    LONGLONG llFailures;            // connection, StartTLS or handshake failures
+    LONGLONG llFullTicks;           // time of the full handshakes (QueryPerformanceCounter ticks)
+    LONGLONG llResumedTicks;
+    LONGLONG llSetups;              // connections of the requests, with or without TLS
+    LONGLONG llSetupTicks;          // from their connection to the end of their first bind
+} DIR_CRAWLER_TLS_STATS, *PDIR_CRAWLER_TLS_STATS;
+
+/* --- VARIABLES ------------------------------------------------------------ */
+/* --- PROTOTYPES ----------------------------------------------------------- */
+void DirCrawlerTlsInit(
+    _In_ const PTCHAR ptMode,
+    _In_ const BOOL bInsecure,
+    _In_ const BOOL bNoResume
+    );
+
+void DirCrawlerTlsCleanup(
+    );
+
+BOOL DirCrawlerTlsConnect(  // LdapConnect, through the relay of the server when TLS is enabled
+    _In_ const PTCHAR ptServer,
+    _In_ const DWORD dwPort,
+    _Out_ PLDAP_CONNECT *ppLdapConnect,
+    _Out_opt_ PLDAP_ROOT_DSE *ppRootDse
+    );
+
+void DirCrawlerTlsSetupDone(
+    _In_ const LONGLONG llConnectStart
+    );
+
+BOOL DirCrawlerTlsIsEnabled(
+    );
+
+void DirCrawlerTlsGetStats(
+    _Out_ PDIR_CRAWLER_TLS_STATS pStats
+    );
+
+#endif // __DIR_CRAWLER_TLS_H__
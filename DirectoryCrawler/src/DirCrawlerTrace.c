@@ -0,0 +1,167 @@
+/* --- INCLUDES ------------------------------------------------------------- */
+#include "DirCrawlerTrace.h"
+#include "DirCrawlerStats.h"
+
+/* --- PRIVATE VARIABLES ---------------------------------------------------- */
+static const DIR_CRAWLER_TRACE_EVENT_DESCR gsc_asEventsDescr[DirCrawlerTraceEventCount] = {
+    [DirCrawlerTraceRequest] = { .ptName = _T("Request"), .ptCategory = _T("request"), .dwMinDurationUs = 0, .bMergeable = FALSE },
+    [DirCrawlerTraceLdapConnect] = { .ptName = _T("LdapConnect"), .ptCategory = _T("ldap"), .dwMinDurationUs = 0, .bMergeable = FALSE },
+    [DirCrawlerTraceLdapBind] = { .ptName = _T("LdapBind"), .ptCategory = _T("ldap"), .dwMinDurationUs = 0, .bMergeable = FALSE },
+    [DirCrawlerTraceLdapInitRequest] = { .ptName = _T("LdapInitRequestEx"), .ptCategory = _T("ldap"), .dwMinDurationUs = 0, .bMergeable = FALSE },
+    [DirCrawlerTraceLdapGetNextEntry] = { .ptName = _T("LdapGetNextEntry"), .ptCategory = _T("ldap"), .dwMinDurationUs = DIR_CRAWLER_STATS_PAGE_THRESHOLD_US, .bMergeable = FALSE },
+    [DirCrawlerTraceWriteEntry] = { .ptName = _T("WriteEntries"), .ptCategory = _T("output"), .dwMinDurationUs = 0, .bMergeable = TRUE },
+    [DirCrawlerTraceCsvClose] = { .ptName = _T("CsvClose"), .ptCategory = _T("output"), .dwMinDurationUs = 0, .bMergeable = FALSE },
+};
+
+static LARGE_INTEGER gs_liFrequency = { 0 };
+static LONGLONG gs_llOriginTicks = 0;
+static DWORD gs_dwMainThreadId = 0;
+static CRITICAL_SECTION gs_sThreadsLock = { 0 };
+static PDIR_CRAWLER_TRACE_THREAD gs_pThreadsHead = NULL;
+static __declspec(thread) PDIR_CRAWLER_TRACE_THREAD gs_pThreadTrace = NULL; // ring buffer of the current thread, only written by it
+
+/* --- PUBLIC VARIABLES ----------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS ---------------------------------------------------- */
+static LONGLONG DirCrawlerTraceTicksToUs(
+    _In_ const LONGLONG llTicks
+    ) {
+    return (llTicks * 1000000) / gs_liFrequency.QuadPart;
+}
+
+static PDIR_CRAWLER_TRACE_THREAD DirCrawlerTraceGetThread(
+    ) {
+    PDIR_CRAWLER_TRACE_THREAD pThread = NULL;
+
+    if (gs_pThreadTrace == NULL) {
+        pThread = UtilsHeapAllocStructHelper(g_pDirCrawlerHeap, DIR_CRAWLER_TRACE_THREAD);
+        pThread->dwThreadId = GetCurrentThreadId();
+        pThread->ullRecorded = 0;
+
+        EnterCriticalSection(&gs_sThreadsLock);
+        pThread->pNext = gs_pThreadsHead;
+        gs_pThreadsHead = pThread;
+        LeaveCriticalSection(&gs_sThreadsLock);
+
+        gs_pThreadTrace = pThread;
+    }
+    return gs_pThreadTrace;
+}
+
+/* --- PUBLIC FUNCTIONS ----------------------------------------------------- */
+void DirCrawlerTraceInit(
+    ) {
+    QueryPerformanceFrequency(&gs_liFrequency);
+    InitializeCriticalSection(&gs_sThreadsLock);
+    gs_llOriginTicks = DirCrawlerTraceNow();
+    gs_dwMainThreadId = GetCurrentThreadId();
+}
+
+void DirCrawlerTraceCleanup(
+    ) {
+    PDIR_CRAWLER_TRACE_THREAD pCurrent = gs_pThreadsHead;
+    PDIR_CRAWLER_TRACE_THREAD pNext = NULL;
+
+    while (pCurrent != NULL) {
+        pNext = pCurrent->pNext;
+        UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, pCurrent);
+        pCurrent = pNext;
+    }
+    gs_pThreadsHead = NULL;
+
+    DeleteCriticalSection(&gs_sThreadsLock);
+}
+
+LONGLONG DirCrawlerTraceNow(
+    ) {
+    LARGE_INTEGER liNow = { 0 };
+
+    QueryPerformanceCounter(&liNow);
+    return liNow.QuadPart;
+}
+
+void DirCrawlerTraceRecord(
+    _In_ const DIR_CRAWLER_TRACE_EVENT eEvent,
+    _In_ const LONGLONG llStartTicks,
+    _In_opt_ const PTCHAR ptArg
+    ) {
+    LONGLONG llEndTicks = DirCrawlerTraceNow();
+    PDIR_CRAWLER_TRACE_THREAD pThread = NULL;
+    PDIR_CRAWLER_TRACE_RECORD pRecord = NULL;
+
+    if (DirCrawlerTraceTicksToUs(llEndTicks - llStartTicks) < gsc_asEventsDescr[eEvent].dwMinDurationUs) {
+        return;
+    }
+
+    pThread = DirCrawlerTraceGetThread();
+
+    // Extend the previous batch instead of recording a new event
+    if (gsc_asEventsDescr[eEvent].bMergeable == TRUE && pThread->ullRecorded > 0) {
+        pRecord = &pThread->asRing[(pThread->ullRecorded - 1) % DIR_CRAWLER_TRACE_RING_SIZE];
+        if (pRecord->eEvent == eEvent && pRecord->ptArg == ptArg && DirCrawlerTraceTicksToUs(llStartTicks - pRecord->llEndTicks) <= DIR_CRAWLER_TRACE_MERGE_GAP_US) {
+            pRecord->llEndTicks = llEndTicks;
+            pRecord->dwCount += 1;
+            return;
+        }
+    }
+
+    pRecord = &pThread->asRing[pThread->ullRecorded % DIR_CRAWLER_TRACE_RING_SIZE];
+    pRecord->eEvent = eEvent;
+    pRecord->dwCount = 1;
+    pRecord->llStartTicks = llStartTicks;
+    pRecord->llEndTicks = llEndTicks;
+    pRecord->ptArg = ptArg;
+    pThread->ullRecorded += 1;
+}
+
+void DirCrawlerTraceWriteJson(
+    _In_ const PTCHAR ptOutFile
+    ) {
+    FILE *pFile = NULL;
+    errno_t err = 0;
+    PDIR_CRAWLER_TRACE_THREAD pThread = NULL;
+    PDIR_CRAWLER_TRACE_RECORD pRecord = NULL;
+    ULONGLONG ullFirst = 0;
+    ULONGLONG ullDropped = 0;
+    ULONGLONG i = 0;
+    BOOL bFirstEvent = TRUE;
+
+    err = DirCrawlerStatsOpenJson(&pFile, ptOutFile);
+    if (err != 0) {
+        LOG(Err, _T("Failed to open trace file <%s>: <errno:%#08x>"), ptOutFile, err);
+        return;
+    }
+
+    // Chrome trace event format (chrome://tracing, ui.perfetto.dev): complete events, timestamps and durations in microseconds
+    _ftprintf(pFile, _T("{\n  \"displayTimeUnit\": \"ms\",\n  \"traceEvents\": ["));
+
+    EnterCriticalSection(&gs_sThreadsLock);
+    for (pThread = gs_pThreadsHead; pThread != NULL; pThread = pThread->pNext) {
+        _ftprintf(pFile, _T("%s\n    {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %u, \"args\": {\"name\": \"%s <%u>\"}}"),
+            bFirstEvent ? EMPTY_STR : _T(","), pThread->dwThreadId, pThread->dwThreadId == gs_dwMainThreadId ? _T("main") : _T("worker"), pThread->dwThreadId);
+        bFirstEvent = FALSE;
+
+        ullFirst = pThread->ullRecorded > DIR_CRAWLER_TRACE_RING_SIZE ? pThread->ullRecorded - DIR_CRAWLER_TRACE_RING_SIZE : 0;
+        ullDropped += ullFirst;
+        for (i = ullFirst; i < pThread->ullRecorded; i++) {
+            pRecord = &pThread->asRing[i % DIR_CRAWLER_TRACE_RING_SIZE];
+            _ftprintf(pFile, _T(",\n    {\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %u, \"ts\": %lld, \"dur\": %lld, \"args\": {\"count\": %u, \"arg\": "),
+                gsc_asEventsDescr[pRecord->eEvent].ptName,
+                gsc_asEventsDescr[pRecord->eEvent].ptCategory,
+                pThread->dwThreadId,
+                DirCrawlerTraceTicksToUs(pRecord->llStartTicks - gs_llOriginTicks),
+                DirCrawlerTraceTicksToUs(pRecord->llEndTicks - pRecord->llStartTicks),
+                pRecord->dwCount);
+            DirCrawlerStatsWriteJsonString(pFile, pRecord->ptArg);
+            _ftprintf(pFile, _T("}}"));
+        }
+    }
+    LeaveCriticalSection(&gs_sThreadsLock);
+
+    _ftprintf(pFile, _T("\n  ],\n  \"otherData\": {\"tool\": \"%s\", \"droppedEvents\": %llu}\n}\n"), DIR_CRAWLER_TOOL_NAME, ullDropped);
+    fclose(pFile);
+
+    if (ullDropped > 0) {
+        LOG(Warn, _T("Trace ring buffers overflowed: <%llu> oldest events dropped"), ullDropped);
+    }
+    LOG(Info, _T("Trace written to <%s>"), ptOutFile);
+}
@@ -0,0 +1,85 @@
+#ifndef __DIR_CRAWLER_TRACE_H__
+#define __DIR_CRAWLER_TRACE_H__
+
+/* --- INCLUDES ------------------------------------------------------------- */
+#include "DirectoryCrawler.h"
+
+/* --- DEFINES -------------------------------------------------------------- */
+//
+// Timeline instrumentation, compiled only when DIR_CRAWLER_TRACE is defined (ex: 'set CL=/DDIR_CRAWLER_TRACE' before building).
+// Otherwise the macros only keep the traced call.
+//
+#ifdef DIR_CRAWLER_TRACE
+#define DIR_CRAWLER_TRACE_START(var)                LONGLONG var = DirCrawlerTraceNow()
+#define DIR_CRAWLER_TRACE_STOP(var, event, arg)     DirCrawlerTraceRecord(event, var, arg)
+#define DIR_CRAWLER_TRACE_CALL(event, arg, call)    MULTI_LINE_MACRO_BEGIN                          \
+                                                        DIR_CRAWLER_TRACE_START(__llTraceStart);    \
+                                                        call;                                       \
+                                                        DIR_CRAWLER_TRACE_STOP(__llTraceStart, event, arg); \
+                                                    MULTI_LINE_MACRO_END
+#else
+#define DIR_CRAWLER_TRACE_START(var)
+#define DIR_CRAWLER_TRACE_STOP(var, event, arg)
+#define DIR_CRAWLER_TRACE_CALL(event, arg, call)    call
+#endif
+
+#define DIR_CRAWLER_TRACE_RING_SIZE         0x10000 // events kept per thread, the oldest ones are overwritten
+#define DIR_CRAWLER_TRACE_MERGE_GAP_US      500     // mergeable events closer than this are reported as a single batch
+#define DIR_CRAWLER_TRACE_FILE_KEYWORD      _T("trace")
+
+/* --- TYPES ---------------------------------------------------------------- */
+typedef enum _DIR_CRAWLER_TRACE_EVENT {
+    DirCrawlerTraceRequest,
+    DirCrawlerTraceLdapConnect,
+    DirCrawlerTraceLdapBind,
+    DirCrawlerTraceLdapInitRequest,
+    DirCrawlerTraceLdapGetNextEntry,
+    DirCrawlerTraceWriteEntry,
+    DirCrawlerTraceCsvClose,
+    DirCrawlerTraceEventCount
+} DIR_CRAWLER_TRACE_EVENT;
+
+typedef struct _DIR_CRAWLER_TRACE_EVENT_DESCR {
+    PTCHAR ptName;
+    PTCHAR ptCategory;
+    DWORD dwMinDurationUs;  // shorter events are not recorded (ex: LdapGetNextEntry served from the current page)
+    BOOL bMergeable;        // consecutive events with the same argument are merged (ex: one span per batch of written entries)
+} DIR_CRAWLER_TRACE_EVENT_DESCR, *PDIR_CRAWLER_TRACE_EVENT_DESCR;
+
+typedef struct _DIR_CRAWLER_TRACE_RECORD {
+    DIR_CRAWLER_TRACE_EVENT eEvent;
+    DWORD dwCount;
+    LONGLONG llStartTicks;
+    LONGLONG llEndTicks;
+    PTCHAR ptArg;           // must outlive the trace (request names, naming contexts, server name)
+} DIR_CRAWLER_TRACE_RECORD, *PDIR_CRAWLER_TRACE_RECORD;
+
+typedef struct _DIR_CRAWLER_TRACE_THREAD {
+    DWORD dwThreadId;
+    ULONGLONG ullRecorded;  // total, the ring only keeps the last DIR_CRAWLER_TRACE_RING_SIZE ones
+    DIR_CRAWLER_TRACE_RECORD asRing[DIR_CRAWLER_TRACE_RING_SIZE];
+    struct _DIR_CRAWLER_TRACE_THREAD *pNext;
+} DIR_CRAWLER_TRACE_THREAD, *PDIR_CRAWLER_TRACE_THREAD;
+
+/* --- VARIABLES ------------------------------------------------------------ */
+/* --- PROTOTYPES ----------------------------------------------------------- */
+void DirCrawlerTraceInit(
+    );
+
+void DirCrawlerTraceCleanup(
+    );
+
+LONGLONG DirCrawlerTraceNow(
+    );
+
+void DirCrawlerTraceRecord(
+    _In_ const DIR_CRAWLER_TRACE_EVENT eEvent,
+    _In_ const LONGLONG llStartTicks,
+    _In_opt_ const PTCHAR ptArg
+    );
+
+void DirCrawlerTraceWriteJson(
+    _In_ const PTCHAR ptOutFile
+    );
+
+#endif // __DIR_CRAWLER_TRACE_H__
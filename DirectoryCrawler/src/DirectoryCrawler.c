@@ -2,13 +2,43 @@
 #include "DirectoryCrawler.h"
 #include "DirCrawlerJson.h"
 #include "DirCrawlerFormatters.h"
+#include "DirCrawlerCapture.h"
+#include "DirCrawlerStats.h"
+#include "DirCrawlerSynthetic.h"
+#include "DirCrawlerProgress.h"
+#include "DirCrawlerTrace.h"
+#include "DirCrawlerSd.h"
+#include "DirCrawlerSchema.h"
+#include "DirCrawlerEdges.h"
+#include "DirCrawlerMembership.h"
+#include "DirCrawlerSnapshot.h"
+#include "DirCrawlerDiff.h"
+#include "DirCrawlerReplicas.h"
+#include "DirCrawlerCluster.h"
+#include "DirCrawlerBudget.h"
+#include "DirCrawlerHeap.h"
+#include "DirCrawlerLog.h"
+#include "DirCrawlerTls.h"
+#include "DirCrawlerShard.h"
+#include "DirCrawlerSink.h"
+#include "DirCrawlerFormatPool.h"
 #include <Winber.h>
 
 /* --- PRIVATE VARIABLES ---------------------------------------------------- */
 static PSLIST_HEADER gs_pReqListHead = NULL;
 static DIR_CRAWLER_OPTIONS gs_sOptions = { 0 };
-static PLDAP_ROOT_DSE gs_pRootDse = NULL;
+static PDIR_CRAWLER_TARGET gs_pTargets = NULL;   // the '-s' server, or one per '--target'
+static DWORD gs_dwTargetCount = 0;
 static PLONG gs_plSucceededRequestsCount = NULL;
+static PDIR_CRAWLER_REQ_DESCR_ARRAY gs_pRequestsDescriptions = NULL;
+static ULONGLONG gs_ullRunHash = 0;             // '--worker': checked by the coordinator
+static LONG gs_lClusterItemsCount = 0;          // '--worker': requests received from the coordinator
+static LONG gs_lClusterLinkFailures = 0;        // '--worker': threads that could not talk to the coordinator until the end
+static PSLIST_HEADER gs_pRetryListHead = NULL;  // requests stopped by their timeout, run once gs_pReqListHead is empty
+static ULONGLONG gs_ullRunDeadline = 0;         // '--deadline': GetTickCount64 value at which the run stops, 0 for none
+static LONG gs_lPartialRequestsCount = 0;       // requests that kept their entries after being stopped by their limits
+static LONG gs_lRescheduledRequestsCount = 0;
+static LONG gs_lDeadlineSkippedCount = 0;       // requests never started because of the deadline
 
 static const DIR_CRAWLER_LDAP_CONTROL_DESCRIPTION gsc_asAlwaysOnCtrlsList[] = {
     // NOTE: Control 'LDAP_SERVER_SHOW_DELETED_OID' is useless here (redundant with 'LDAP_SERVER_SHOW_RECYCLED_OID')
@@ -33,6 +63,38 @@ static const DIR_CRAWLER_LDAP_CONTROL_DESCRIPTION gsc_asAlwaysOnCtrlsList[] = {
     }
 };
 
+static const struct option gsc_asLongOptions[] = {
+    { _T("capture"), required_argument, NULL, DIR_CRAWLER_LONGOPT_CAPTURE },
+    { _T("replay"), required_argument, NULL, DIR_CRAWLER_LONGOPT_REPLAY },
+    { _T("synthetic"), required_argument, NULL, DIR_CRAWLER_LONGOPT_SYNTHETIC },
+    { _T("bench"), no_argument, NULL, DIR_CRAWLER_LONGOPT_BENCH },
+    { _T("progress"), required_argument, NULL, DIR_CRAWLER_LONGOPT_PROGRESS },
+    { _T("progress-interval"), required_argument, NULL, DIR_CRAWLER_LONGOPT_PROGRESS_INTERVAL },
+    { _T("schema-cache"), required_argument, NULL, DIR_CRAWLER_LONGOPT_SCHEMA_CACHE },
+    { _T("edges"), no_argument, NULL, DIR_CRAWLER_LONGOPT_EDGES },
+    { _T("memberships"), no_argument, NULL, DIR_CRAWLER_LONGOPT_MEMBERSHIPS },
+    { _T("snapshot"), required_argument, NULL, DIR_CRAWLER_LONGOPT_SNAPSHOT },
+    { _T("lookup"), required_argument, NULL, DIR_CRAWLER_LONGOPT_LOOKUP },
+    { _T("diff"), required_argument, NULL, DIR_CRAWLER_LONGOPT_DIFF },
+    { _T("target"), required_argument, NULL, DIR_CRAWLER_LONGOPT_TARGET },
+    { _T("replicas"), required_argument, NULL, DIR_CRAWLER_LONGOPT_REPLICAS },
+    { _T("replica-requests"), required_argument, NULL, DIR_CRAWLER_LONGOPT_REPLICA_REQUESTS },
+    { _T("coordinator"), required_argument, NULL, DIR_CRAWLER_LONGOPT_COORDINATOR },
+    { _T("worker"), required_argument, NULL, DIR_CRAWLER_LONGOPT_WORKER },
+    { _T("memory-budget"), required_argument, NULL, DIR_CRAWLER_LONGOPT_MEMORY_BUDGET },
+    { _T("shared-heap"), no_argument, NULL, DIR_CRAWLER_LONGOPT_SHARED_HEAP },
+    { _T("log-burst"), required_argument, NULL, DIR_CRAWLER_LONGOPT_LOG_BURST },
+    { _T("tls"), required_argument, NULL, DIR_CRAWLER_LONGOPT_TLS },
+    { _T("tls-insecure"), no_argument, NULL, DIR_CRAWLER_LONGOPT_TLS_INSECURE },
+    { _T("tls-no-resume"), no_argument, NULL, DIR_CRAWLER_LONGOPT_TLS_NO_RESUME },
+    { _T("shard-rows"), required_argument, NULL, DIR_CRAWLER_LONGOPT_SHARD_ROWS },
+    { _T("shard-size"), required_argument, NULL, DIR_CRAWLER_LONGOPT_SHARD_SIZE },
+    { _T("deadline"), required_argument, NULL, DIR_CRAWLER_LONGOPT_DEADLINE },
+    { _T("sink"), required_argument, NULL, DIR_CRAWLER_LONGOPT_SINK },
+    { _T("format-threads"), required_argument, NULL, DIR_CRAWLER_LONGOPT_FORMAT_THREADS },
+    { NULL, 0, NULL, 0 }
+};
+
 /* --- PUBLIC VARIABLES ----------------------------------------------------- */
 PUTILS_HEAP g_pDirCrawlerHeap = NULL;
 
@@ -52,11 +114,72 @@ __declspec(noreturn) static void DirCrawlerUsage(
     LOG(Bypass, SUB_LOG(_T("-p <password>: AD password for explicit authentification")));
     LOG(Bypass, SUB_LOG(_T("-n <port>    : ldap port (default: <%u>)")), LDAP_DEFAULT_PORT);
     LOG(Bypass, SUB_LOG(_T("-d <dns name>: explicit domain dns name (default: resolved dynamically)")));
+    LOG(Bypass, SUB_LOG(_T("--target <dns name>,<server>[,<username>,<password>]: crawl this domain from this server instead of '-s'")));
+    LOG(Bypass, SUB_LOG(_T("               Can be repeated: the requests of all the targets share the '-t' threads, each target getting")));
+    LOG(Bypass, SUB_LOG(_T("               its own outfiles folder, and the configuration and schema NCs are only crawled once per forest")));
+    LOG(Bypass, SUB_LOG(_T("--replicas <servers>    : Spread the requests over these DCs of the '-s' domain (comma separated),")));
+    LOG(Bypass, SUB_LOG(_T("                          or over all its writable DCs found in the configuration NC with 'auto'")));
+    LOG(Bypass, SUB_LOG(_T("--replica-requests <num>: Requests run at the same time on one DC (default: the number of threads)")));
+    LOG(Bypass, SUB_LOG(_T("--tls <ldaps|starttls>: LDAP over TLS ('ldaps' uses port <%u> instead of the default one), TLS sessions are resumed across connections")), DIR_CRAWLER_TLS_LDAPS_PORT);
+    LOG(Bypass, SUB_LOG(_T("--tls-insecure        : Do not validate the certificate of the servers (self-signed test servers)")));
+    LOG(Bypass, SUB_LOG(_T("--tls-no-resume       : Full TLS handshake for every connection (to compare with --bench)")));
 
     LOG(Bypass, _T("Dump options:"));
     LOG(Bypass, SUB_LOG(_T("-j <jsonfile> : JSON file containing LDAP requests description")));
     LOG(Bypass, SUB_LOG(_T("-o <outputdir>: Output directory")));
     LOG(Bypass, SUB_LOG(_T("-r <requests> : Sublist of requests names in the json file (comma separated)")));
+    LOG(Bypass, SUB_LOG(_T("--shard-rows <num>: Split outfiles into shards of at most <num> rows (<outfile>.000.csv, .001.csv...)")));
+    LOG(Bypass, SUB_LOG(_T("--shard-size <MB> : Split outfiles into shards of about <MB> megabytes, listed with their rows, size, columns")));
+    LOG(Bypass, SUB_LOG(_T("                    and SHA-256 in the '%s' file of the stats folder (both options can be combined)")), DIR_CRAWLER_SHARD_MANIFEST_OUTFILE);
+    LOG(Bypass, SUB_LOG(_T("--sink <spec>     : Stream the rows of every outfile to an ingestion service instead of writing CSV outfiles,")));
+    LOG(Bypass, SUB_LOG(_T("                    <spec> is '%s<name>', '%s<path>' (unix socket) or '%s<host>:<port>'")), DIR_CRAWLER_SINK_PIPE, DIR_CRAWLER_SINK_UNIX, DIR_CRAWLER_SINK_TCP);
+    LOG(Bypass, SUB_LOG(_T("--deadline <sec>  : Stop the run <sec> seconds after the start of the requests: running requests keep their entries")));
+    LOG(Bypass, SUB_LOG(_T("                    and get a '<outfile>.%s' marker, requests not started yet are skipped")), DIR_CRAWLER_PARTIAL_EXT);
+    LOG(Bypass, SUB_LOG(_T("                    Requests can also have their own \"timeout\" (seconds) and \"maxentries\" in the JSON file,")));
+    LOG(Bypass, SUB_LOG(_T("                    requests stopped by their timeout are run again at the end (up to <%u> times, doubling it)")), DIR_CRAWLER_MAX_RESCHEDULES);
+
+    LOG(Bypass, _T("Distributed crawl options:"));
+    LOG(Bypass, SUB_LOG(_T("--coordinator <port>     : Hand out the requests to the workers connecting on <port> instead of running them,")));
+    LOG(Bypass, SUB_LOG(_T("                           and write the '%s' file of the run in the stats folder")), DIR_CRAWLER_CLUSTER_MANIFEST_OUTFILE);
+    LOG(Bypass, SUB_LOG(_T("--worker <host>:<port>   : Run the requests handed out by this coordinator, one connection per thread")));
+    LOG(Bypass, SUB_LOG(_T("                           (same JSON file, targets, prefix and output directory as the coordinator)")));
+
+    LOG(Bypass, _T("Capture options:"));
+    LOG(Bypass, SUB_LOG(_T("--capture <file>: Record the raw LDAP results of every request in a capture file")));
+    LOG(Bypass, SUB_LOG(_T("--replay <file> : Produce outfiles from a capture file instead of the LDAP server (no '-s' needed)")));
+
+    LOG(Bypass, _T("Benchmark options:"));
+    LOG(Bypass, SUB_LOG(_T("--synthetic <spec>: Produce outfiles from a generated directory instead of the LDAP server (no '-s' needed)")));
+    LOG(Bypass, SUB_LOG(_T("                    <spec> is a comma separated list of <name>=<number>, possibles names are")));
+    LOG(Bypass, SUB_LOG(_T("                    <objects,strsize,binsize,sdsize,fanout,pagesize,latency> (ex: objects=100000,sdsize=4096,latency=20)")));
+    LOG(Bypass, SUB_LOG(_T("--bench           : Print throughput, allocations and per-stage timings of every request at exit")));
+    LOG(Bypass, SUB_LOG(_T("--memory-budget <MB>: Formatted records held at once by all the threads (default: unlimited),")));
+    LOG(Bypass, SUB_LOG(_T("                      threads formatting entries with huge attributes wait for each other beyond it")));
+    LOG(Bypass, SUB_LOG(_T("--shared-heap     : Worker threads allocate from the process heap instead of their own (to compare with --bench)")));
+    LOG(Bypass, SUB_LOG(_T("--format-threads <num>: Format the entries of all the requests in a pool of <num> threads (default: 0, each")));
+    LOG(Bypass, SUB_LOG(_T("                        search thread formats its entries), outfiles keep the order of the entries")));
+
+    LOG(Bypass, _T("Progress options:"));
+    LOG(Bypass, SUB_LOG(_T("--progress <file>        : Periodically rewrite live metrics in <file> (Prometheus text format)")));
+    LOG(Bypass, SUB_LOG(_T("                           Reuse the same <file> across runs to get an ETA based on the previous run")));
+    LOG(Bypass, SUB_LOG(_T("--progress-interval <sec>: Seconds between two rewrites of the metrics file (default: <%u>)")), DIR_CRAWLER_PROGRESS_DEFAULT_INTERVAL);
+
+    LOG(Bypass, _T("Schema options:"));
+    LOG(Bypass, SUB_LOG(_T("--schema-cache <file>: Keep the attribute catalog read from the schema NC in <file>, reused while the schema is unchanged")));
+    LOG(Bypass, SUB_LOG(_T("                       Also used by '--replay' and '--synthetic' to resolve 'auto' attributes and the '*' wildcard")));
+
+    LOG(Bypass, _T("Control-path options:"));
+    LOG(Bypass, SUB_LOG(_T("--edges: Extract control-path edges (membership, ACEs, gPLink, managedBy, primary group...) while crawling")));
+    LOG(Bypass, SUB_LOG(_T("         into binary '_edges' outfiles, and their nodes (DNs, SIDs, GUIDs) into the '_edges_nodes' outfile")));
+    LOG(Bypass, SUB_LOG(_T("--memberships: Implies '--edges', and expands the transitive group memberships of every principal at exit")));
+    LOG(Bypass, SUB_LOG(_T("               (through 'member' and primary groups) into the binary '_memberships' outfile")));
+
+    LOG(Bypass, _T("Snapshot options:"));
+    LOG(Bypass, SUB_LOG(_T("--snapshot <file>: Also write every formatted entry to <file>, a memory-mappable snapshot indexed on DN, objectSid and objectGUID")));
+    LOG(Bypass, SUB_LOG(_T("--lookup <key>   : Print the entries of the '--snapshot' file whose DN, objectSid or objectGUID is <key>, and exit")));
+    LOG(Bypass, SUB_LOG(_T("--diff <old>     : Write the entries and attributes added, removed or modified between the <old> snapshot and the")));
+    LOG(Bypass, SUB_LOG(_T("                   '--snapshot' one to '<snapshot>%s', and exit")), DIR_CRAWLER_DIFF_OUTFILE_SUFFIX);
+    LOG(Bypass, SUB_LOG(_T("                   (no LDAP server, requests or output directory needed by '--lookup' and '--diff')")));
 
     LOG(Bypass, _T("Misc options:"));
     LOG(Bypass, SUB_LOG(_T("-h/H         : Show this help")));
@@ -65,17 +188,32 @@ __declspec(noreturn) static void DirCrawlerUsage(
     LOG(Bypass, SUB_LOG(_T("-v <level>   : Set console log level. Possibles values are <ALL,DBG,INFO,WARN,ERR,SUCC,NONE>")));
     LOG(Bypass, SUB_LOG(_T("-w <level>   : Set logfile log level (default: same as console log level)")));
     LOG(Bypass, SUB_LOG(_T("-f <logfile> : Log file name (default is none)")));
+    LOG(Bypass, SUB_LOG(_T("--log-burst <num>: Messages a worker thread log call below ERR writes per second before being muted (default: %u, 0: no limit)")), DIR_CRAWLER_LOG_DEFAULT_BURST);
 
     ExitProcess(EXIT_FAILURE);
 }
 
+static void DirCrawlerSplitLogin(
+    _Inout_ PLDAP_OPTIONS pLdapOptions
+    ) {
+    PTCHAR ptSlashInLogin = NULL;
+
+    if (pLdapOptions->ptLogin != NULL) {
+        ptSlashInLogin = _tcschr(pLdapOptions->ptLogin, _T('\\'));
+        if (ptSlashInLogin != NULL) { // userName actually starts with the domain name (ex: DOMAIN\username)
+            *ptSlashInLogin = 0;
+            pLdapOptions->ptExplicitDomain = pLdapOptions->ptLogin;
+            pLdapOptions->ptLogin = ptSlashInLogin + 1;
+        }
+    }
+}
+
 static void DirCrawlerParseOptions(
     _In_ const PDIR_CRAWLER_OPTIONS pOpt,
     _In_ const int argc,
     _In_ const PTCHAR argv[]
     ) {
     int curropt = 0;
-    PTCHAR ptSlashInLogin = NULL;
     PTCHAR ptReq = NULL;
     PTCHAR ptCtx = NULL;
     SYSTEM_INFO sSystemInfo = { 0 };
@@ -87,8 +225,10 @@ static void DirCrawlerParseOptions(
     pOpt->log.ptLogLevelConsole = DEFAULT_OPT_LOG_LEVEL;
     pOpt->log.ptLogLevelFile = DEFAULT_OPT_LOG_LEVEL;
     pOpt->misc.dwMaxThreads = sSystemInfo.dwNumberOfProcessors;
+    pOpt->progress.dwInterval = DIR_CRAWLER_PROGRESS_DEFAULT_INTERVAL;
+    pOpt->log.dwBurst = DIR_CRAWLER_LOG_DEFAULT_BURST;
 
-    while ((curropt = getopt(argc, argv, _T("s:l:p:n:d:j:o:r:t:c:v:w:f:Hh"))) != -1) {
+    while ((curropt = getopt_long(argc, argv, _T("s:l:p:n:d:j:o:r:t:c:v:w:f:Hh"), gsc_asLongOptions, NULL)) != -1) {
         switch (curropt) {
 
         case _T('s'): pOpt->ldap.ptLdapServer = optarg; break;
@@ -109,19 +249,45 @@ static void DirCrawlerParseOptions(
         case _T('w'): pOpt->log.ptLogLevelFile = optarg; bLogLevelFileSet = TRUE; break;
         case _T('f'): pOpt->log.ptLogFile = optarg; break;
 
+        case DIR_CRAWLER_LONGOPT_CAPTURE: pOpt->capture.ptCaptureFile = optarg; break;
+        case DIR_CRAWLER_LONGOPT_REPLAY: pOpt->capture.ptReplayFile = optarg; break;
+        case DIR_CRAWLER_LONGOPT_SYNTHETIC: pOpt->bench.ptSyntheticSpec = optarg; break;
+        case DIR_CRAWLER_LONGOPT_BENCH: pOpt->bench.bReport = TRUE; break;
+        case DIR_CRAWLER_LONGOPT_PROGRESS: pOpt->progress.ptMetricsFile = optarg; break;
+        case DIR_CRAWLER_LONGOPT_PROGRESS_INTERVAL: pOpt->progress.dwInterval = _tstoi(optarg); break;
+        case DIR_CRAWLER_LONGOPT_SCHEMA_CACHE: pOpt->schema.ptCacheFile = optarg; break;
+        case DIR_CRAWLER_LONGOPT_EDGES: pOpt->edges.bEnabled = TRUE; break;
+        case DIR_CRAWLER_LONGOPT_MEMBERSHIPS: pOpt->edges.bEnabled = TRUE; pOpt->edges.bMemberships = TRUE; break;
+        case DIR_CRAWLER_LONGOPT_SNAPSHOT: pOpt->snapshot.ptFile = optarg; break;
+        case DIR_CRAWLER_LONGOPT_LOOKUP: pOpt->snapshot.ptLookupKey = optarg; break;
+        case DIR_CRAWLER_LONGOPT_DIFF: pOpt->snapshot.ptDiffFile = optarg; break;
+        case DIR_CRAWLER_LONGOPT_REPLICAS: pOpt->replicas.ptList = optarg; break;
+        case DIR_CRAWLER_LONGOPT_REPLICA_REQUESTS: pOpt->replicas.dwMaxRequests = _tstoi(optarg); break;
+        case DIR_CRAWLER_LONGOPT_COORDINATOR: pOpt->cluster.ptListenPort = optarg; break;
+        case DIR_CRAWLER_LONGOPT_WORKER: pOpt->cluster.ptCoordinator = optarg; break;
+        case DIR_CRAWLER_LONGOPT_MEMORY_BUDGET: pOpt->budget.ullBytes = (ULONGLONG)_tstoi(optarg) * DIR_CRAWLER_BUDGET_MB; break;
+        case DIR_CRAWLER_LONGOPT_SHARED_HEAP: pOpt->heap.bShared = TRUE; break;
+        case DIR_CRAWLER_LONGOPT_LOG_BURST: pOpt->log.dwBurst = _tstoi(optarg); break;
+        case DIR_CRAWLER_LONGOPT_TLS: pOpt->tls.ptMode = optarg; break;
+        case DIR_CRAWLER_LONGOPT_TLS_INSECURE: pOpt->tls.bInsecure = TRUE; break;
+        case DIR_CRAWLER_LONGOPT_TLS_NO_RESUME: pOpt->tls.bNoResume = TRUE; break;
+        case DIR_CRAWLER_LONGOPT_SHARD_ROWS: pOpt->shard.ullMaxRows = _tcstoui64(optarg, NULL, 10); break;
+        case DIR_CRAWLER_LONGOPT_SHARD_SIZE: pOpt->shard.ullMaxBytes = _tcstoui64(optarg, NULL, 10) * DIR_CRAWLER_SHARD_MB; break;
+        case DIR_CRAWLER_LONGOPT_DEADLINE: pOpt->limits.dwDeadline = _tstoi(optarg); break;
+        case DIR_CRAWLER_LONGOPT_SINK: pOpt->sink.ptSpec = optarg; break;
+        case DIR_CRAWLER_LONGOPT_FORMAT_THREADS: pOpt->format.dwThreads = _tstoi(optarg); break;
+        case DIR_CRAWLER_LONGOPT_TARGET:
+            pOpt->targets.dwCount += 1;
+            pOpt->targets.pptSpecs = UtilsHeapAllocOrReallocHelper(g_pDirCrawlerHeap, pOpt->targets.pptSpecs, SIZEOF_ARRAY(PTCHAR, pOpt->targets.dwCount));
+            pOpt->targets.pptSpecs[pOpt->targets.dwCount - 1] = optarg;
+            break;
+
         default:
             FATAL(_T("Unknown option <%u>"), curropt);
         }
     }
 
-    if (pOpt->ldap.ptLogin != NULL) {
-        ptSlashInLogin = _tcschr(pOpt->ldap.ptLogin, _T('\\'));
-        if (ptSlashInLogin != NULL) { // userName actually starts with the domain name (ex: DOMAIN\username)
-            *ptSlashInLogin = 0;
-            pOpt->ldap.ptExplicitDomain = pOpt->ldap.ptLogin;
-            pOpt->ldap.ptLogin = ptSlashInLogin + 1;
-        }
-    }
+    DirCrawlerSplitLogin(&pOpt->ldap);
 
     if (pOpt->dump.ptRequestSublist != NULL) {
         while (StrNextToken(pOpt->dump.ptRequestSublist, _T(","), &ptCtx, &ptReq)) {
@@ -135,36 +301,73 @@ static void DirCrawlerParseOptions(
         pOpt->log.ptLogLevelFile = pOpt->log.ptLogLevelConsole;
     }
 
+    if (pOpt->replicas.dwMaxRequests == 0) {
+        pOpt->replicas.dwMaxRequests = max(pOpt->misc.dwMaxThreads, 1);
+    }
+
     if (pOpt->misc.bShowHelp) {
         DirCrawlerUsage(argv[0], NULL);
     }
 }
 
+static void DirCrawlerParseTarget(
+    _In_ const PTCHAR ptTargetSpec,
+    _In_ const DWORD dwLdapPort,
+    _Out_ PDIR_CRAWLER_TARGET pTarget
+    ) {
+    PTCHAR ptCtx = NULL;
+    PTCHAR ptField = NULL;
+    PTCHAR *apptFields[] = { &pTarget->ldap.ptDnsName, &pTarget->ldap.ptLdapServer, &pTarget->ldap.ptLogin, &pTarget->ldap.ptPassword };
+    DWORD dwFieldCount = 0;
+
+    ZeroMemory(pTarget, sizeof(DIR_CRAWLER_TARGET));
+    pTarget->ldap.dwLdapPort = dwLdapPort;
+
+    while (StrNextToken(ptTargetSpec, _T(","), &ptCtx, &ptField)) {
+        if (dwFieldCount == _countof(apptFields)) {
+            FATAL(_T("Too many fields in target <%s>"), pTarget->ldap.ptDnsName);
+        }
+        *apptFields[dwFieldCount] = ptField;
+        dwFieldCount += 1;
+    }
+
+    if (dwFieldCount != 2 && dwFieldCount != 4) {
+        FATAL(_T("Invalid target <%s>: expecting <dns name>,<server>[,<username>,<password>]"), pTarget->ldap.ptDnsName != NULL ? pTarget->ldap.ptDnsName : EMPTY_STR);
+    }
+    DirCrawlerSplitLogin(&pTarget->ldap);
+}
+
 static void DirCrawlerSetDefaultPrefix(
-    _In_ const PDIR_CRAWLER_OPTIONS pOpt,
-    _In_ const PLDAP_ROOT_DSE pRootDse
+    _Inout_ PDIR_CRAWLER_TARGET pTarget
     ) {
-    static TCHAR s_atDefaultPrefix[3] = { 0 };
-    PTCHAR ptDomDnsName = pOpt->ldap.ptDnsName != NULL ? pOpt->ldap.ptDnsName : pRootDse->extracted.ptLdapServiceName;
+    PTCHAR ptDomDnsName = pTarget->ldap.ptDnsName != NULL ? pTarget->ldap.ptDnsName : (pTarget->pRootDse != NULL ? pTarget->pRootDse->extracted.ptLdapServiceName : NULL);
 
     if (ptDomDnsName == NULL) {
         FATAL(_T("Failed to automatically retrieve domain DNS name, and none was explicitely specified"));
     }
 
-    s_atDefaultPrefix[0] = (TCHAR)_totupper(ptDomDnsName[0]);
-    s_atDefaultPrefix[1] = (TCHAR)_totupper(ptDomDnsName[1]);
-    s_atDefaultPrefix[2] = NULL_CHAR;
+    pTarget->atDefaultPrefix[0] = (TCHAR)_totupper(ptDomDnsName[0]);
+    pTarget->atDefaultPrefix[1] = (TCHAR)_totupper(ptDomDnsName[1]);
+    pTarget->atDefaultPrefix[2] = NULL_CHAR;
 
-    pOpt->misc.ptOutfilesPrefix = s_atDefaultPrefix; // Used only here, only once, with only one possible destination, so not a problem.
+    pTarget->ptOutfilesPrefix = pTarget->atDefaultPrefix;
+}
+
+static BOOL DirCrawlerIsForestNc(
+    _In_ const PDIR_CRAWLER_TARGET pTarget,
+    _In_ const PTCHAR ptNc
+    ) {
+    return pTarget->pRootDse != NULL
+        && (_tcsicmp(ptNc, pTarget->pRootDse->extracted.ptConfigurationNamingContext) == 0 || _tcsicmp(ptNc, pTarget->pRootDse->extracted.ptSchemaNamingContext) == 0);
 }
 
 PTCHAR DirCrawlerComputeOutputRootFolderName(
+   _In_opt_ const PTCHAR tDomainFQDN
    ) {
    PTCHAR tFormatedOutput = NULL;
    DWORD dwFormatedOutputLen = 0;
    SYSTEMTIME sSystemTime = { 0 };
    INT dwRes = 0;
-   PTCHAR tDomainFQDN = gs_sOptions.ldap.ptDnsName;
 
    if (tDomainFQDN == NULL) {
       FATAL(_T("Unable to retrieve DNS domain name. Please provide it in the cmdline."));
@@ -207,6 +410,7 @@ PTCHAR DirCrawlerComputeOutputRootFolderName(
 static BOOL DirCrawlerFormatOutfile(
     _Inout_ const PTCHAR ptOutFileName, // Must be able to receive MAX_PATH chars
     _In_ const PTCHAR ptOutputDirName,
+    _In_ const PTCHAR ptRootFolderName,
    _In_ const PTCHAR ptOutputFolderName,
     _In_ const PTCHAR ptFilePrefix,
     _In_ const PTCHAR ptFileNameElmt1,
@@ -214,7 +418,6 @@ static BOOL DirCrawlerFormatOutfile(
     _In_ const PTCHAR ptFileExtension
     ) {
     int size = -1;
-    PTCHAR ptRootFolderName = DirCrawlerComputeOutputRootFolderName();
 
     if (ptFileNameElmt2 != NULL) {
         size = _stprintf_s(ptOutFileName, MAX_PATH, _T("%s\\%s\\%s\\%s_%s_%s.%s"), ptOutputDirName, ptRootFolderName, ptOutputFolderName, ptFilePrefix, ptFileNameElmt1, ptFileNameElmt2, ptFileExtension);
@@ -223,9 +426,6 @@ static BOOL DirCrawlerFormatOutfile(
         size = _stprintf_s(ptOutFileName, MAX_PATH, _T("%s\\%s\\%s\\%s_%s.%s"), ptOutputDirName, ptRootFolderName, ptOutputFolderName, ptFilePrefix, ptFileNameElmt1, ptFileExtension);
     }
 
-    if (ptRootFolderName) {
-       UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, ptRootFolderName);
-    }
     return (BOOL)(size != -1);
 }
 
@@ -261,6 +461,7 @@ static PTCHAR DirCrawlerGetBindingNc(
 
 static BOOL DirCrawlerAddControlsArray(
     _In_ const PDIR_CRAWLER_REQ_DESCR pReqDescr,
+    _In_ const PLDAP_ROOT_DSE pRootDse,
     _In_ const DIR_CRAWLER_LDAP_CONTROL_DESCRIPTION * const pCtrlsList,
     _In_ const DWORD dwCtrlsCount,
     _Inout_ PLDAPControl *pppClientCtrlsList[],
@@ -277,7 +478,7 @@ static BOOL DirCrawlerAddControlsArray(
 
     for (i = 0; i < dwCtrlsCount; i++) {
 
-        if (IsInSetOfStrings(pCtrlsList[i].ptOid, gs_pRootDse->extracted.pptSupportedControl, gs_pRootDse->computed.count.dwSupportedControlCount, NULL) == FALSE) {
+        if (IsInSetOfStrings(pCtrlsList[i].ptOid, pRootDse->extracted.pptSupportedControl, pRootDse->computed.count.dwSupportedControlCount, NULL) == FALSE) {
             if (bFailIfNotSupported == TRUE) {
                 REQ_FATAL(pReqDescr, _T("Using a non-supported LDAP control <%s:%s>"), pCtrlsList[i].ptName, pCtrlsList[i].ptOid);
             }
@@ -289,19 +490,19 @@ static BOOL DirCrawlerAddControlsArray(
             switch (pCtrlsList[i].eCtrlType) {
             case DirCrawlerLdapCtrlClient:
                 (*pdwClientCtrlsCount) += 1;
-                (*pppClientCtrlsList) = UtilsHeapAllocOrReallocHelper(g_pDirCrawlerHeap, (*pppClientCtrlsList), SIZEOF_ARRAY(PLDAPControl, (*pdwClientCtrlsCount) + 1)); // +1 because it needs to be NULL terminated
+                (*pppClientCtrlsList) = UtilsHeapAllocOrReallocHelper(DIR_CRAWLER_THREAD_HEAP, (*pppClientCtrlsList), SIZEOF_ARRAY(PLDAPControl, (*pdwClientCtrlsCount) + 1)); // +1 because it needs to be NULL terminated
                 ppCurrentLdapCtrl = &(*pppClientCtrlsList)[(*pdwClientCtrlsCount) - 1];
                 break;
             case DirCrawlerLdapCtrlServer:
                 (*pdwServerCtrlsCount) += 1;
-                (*pppServerCtrlsList) = UtilsHeapAllocOrReallocHelper(g_pDirCrawlerHeap, (*pppServerCtrlsList), SIZEOF_ARRAY(PLDAPControl, (*pdwServerCtrlsCount) + 1)); // +1 because it needs to be NULL terminated
+                (*pppServerCtrlsList) = UtilsHeapAllocOrReallocHelper(DIR_CRAWLER_THREAD_HEAP, (*pppServerCtrlsList), SIZEOF_ARRAY(PLDAPControl, (*pdwServerCtrlsCount) + 1)); // +1 because it needs to be NULL terminated
                 ppCurrentLdapCtrl = &(*pppServerCtrlsList)[(*pdwServerCtrlsCount) - 1];
                 break;
             default:
                 REQ_FATAL(pReqDescr, _T("Invalid control type <%u> for control <%s>"), pCtrlsList[i].eCtrlType, pCtrlsList[i].ptName);
             }
 
-            (*ppCurrentLdapCtrl) = UtilsHeapAllocStructHelper(g_pDirCrawlerHeap, LDAPControl);
+            (*ppCurrentLdapCtrl) = UtilsHeapAllocStructHelper(DIR_CRAWLER_THREAD_HEAP, LDAPControl);
             (*ppCurrentLdapCtrl)->ldctl_iscritical = TRUE;
             (*ppCurrentLdapCtrl)->ldctl_oid = pCtrlsList[i].ptOid;
             (*ppCurrentLdapCtrl)->ldctl_value.bv_len = 0;
@@ -334,7 +535,7 @@ static BOOL DirCrawlerAddControlsArray(
                 }
 
                 (*ppCurrentLdapCtrl)->ldctl_value.bv_len = pBerVal->bv_len;
-                (*ppCurrentLdapCtrl)->ldctl_value.bv_val = UtilsHeapMemDupHelper(g_pDirCrawlerHeap, pBerVal->bv_val, pBerVal->bv_len);
+                (*ppCurrentLdapCtrl)->ldctl_value.bv_val = UtilsHeapMemDupHelper(DIR_CRAWLER_THREAD_HEAP, pBerVal->bv_val, pBerVal->bv_len);
 
                 ber_bvfree(pBerVal);
                 ber_free(pBerElmt, 1);
@@ -352,10 +553,10 @@ static void DirCrawlerDestroyControlArray(
 
     if ((*pppCtrlsList) != NULL) {
         for (i = 0; (*pppCtrlsList)[i] != NULL; i++) {
-            UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, (*pppCtrlsList)[i]->ldctl_value.bv_val);
-            UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, (*pppCtrlsList)[i]);
+            UtilsHeapFreeAndNullHelper(DIR_CRAWLER_THREAD_HEAP, (*pppCtrlsList)[i]->ldctl_value.bv_val);
+            UtilsHeapFreeAndNullHelper(DIR_CRAWLER_THREAD_HEAP, (*pppCtrlsList)[i]);
         }
-        UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, (*pppCtrlsList));
+        UtilsHeapFreeAndNullHelper(DIR_CRAWLER_THREAD_HEAP, (*pppCtrlsList));
     }
 }
 
@@ -366,129 +567,367 @@ static BOOL DirCrawlerCreateAttributesArray(
     ) {
     DWORD i = 0;
 
-    (*ppptAttrsList) = UtilsHeapAllocArrayHelper(g_pDirCrawlerHeap, PDIR_CRAWLER_LDAP_ATTRIBUTE_DESCRIPTION, pReqDescr->ldap.attributes.dwAttrCount + 1); // +1 because it always starts with DN
+    (*ppptAttrsList) = UtilsHeapAllocArrayHelper(DIR_CRAWLER_THREAD_HEAP, PDIR_CRAWLER_LDAP_ATTRIBUTE_DESCRIPTION, pReqDescr->ldap.attributes.dwAttrCount + 1); // +1 because it always starts with DN
     (*pdwAttrsCount) = pReqDescr->ldap.attributes.dwAttrCount + 1;
-    ((*ppptAttrsList)[0]) = UtilsHeapAllocHelper(g_pDirCrawlerHeap, sizeof(DIR_CRAWLER_LDAP_ATTRIBUTE_DESCRIPTION));
-    ((*ppptAttrsList)[0])->ptName = UtilsHeapStrDupHelper(g_pDirCrawlerHeap, LDAP_ATTR_DISTINGUISHED_NAME);
+    ((*ppptAttrsList)[0]) = UtilsHeapAllocHelper(DIR_CRAWLER_THREAD_HEAP, sizeof(DIR_CRAWLER_LDAP_ATTRIBUTE_DESCRIPTION));
+    ((*ppptAttrsList)[0])->ptName = UtilsHeapStrDupHelper(DIR_CRAWLER_THREAD_HEAP, LDAP_ATTR_DISTINGUISHED_NAME);
 
     for (i = 0; i < (*pdwAttrsCount) - 1 ; i++) {
-        ((*ppptAttrsList)[i + 1]) = UtilsHeapAllocHelper(g_pDirCrawlerHeap, sizeof(DIR_CRAWLER_LDAP_ATTRIBUTE_DESCRIPTION));
-        ((*ppptAttrsList)[i + 1])->ptName = UtilsHeapStrDupHelper(g_pDirCrawlerHeap, pReqDescr->ldap.attributes.pAttrArray[i].ptName);
+        ((*ppptAttrsList)[i + 1]) = UtilsHeapAllocHelper(DIR_CRAWLER_THREAD_HEAP, sizeof(DIR_CRAWLER_LDAP_ATTRIBUTE_DESCRIPTION));
+        ((*ppptAttrsList)[i + 1])->ptName = UtilsHeapStrDupHelper(DIR_CRAWLER_THREAD_HEAP, pReqDescr->ldap.attributes.pAttrArray[i].ptName);
         ((*ppptAttrsList)[i + 1])->eType = pReqDescr->ldap.attributes.pAttrArray[i].eType;
     }
 
     return TRUE;
 }
 
-static PTCHAR DirCrawlerStringifyAttribute(
-    _In_ const PLDAP_ATTRIBUTE pLdapAttribute,
+static DWORD DirCrawlerMeasureAttribute(
+    _In_opt_ const PLDAP_ATTRIBUTE pLdapAttribute,
     _In_ const PDIR_CRAWLER_LDAP_ATTRIBUTE_DESCRIPTION pAttrDesc
     ) {
     DWORD i = 0;
     DWORD dwLen = 0;
-    LPSTR pOutBuff = NULL;
-    LPSTR pCurrentBuff = NULL;
     PFN_LDAP_ATTR_VALUE_FORMATTER pfnFormatter = gc_ppfnFormatters[pAttrDesc->eType];
-    DWORD szMbBuffer = 0;
-    LPWSTR lpwOutBuff = NULL;
 
+    if (pLdapAttribute == NULL || pLdapAttribute->dwValuesCount == 0) {
+        return 1;
+    }
+    // Single short values are formatted on the stack: their upper bound is enough
+    if (pLdapAttribute->dwValuesCount == 1 && FormatLdapAttrMaxLen(pAttrDesc->eType, pLdapAttribute->ppValues[0]) <= DIR_CRAWLER_SINGLE_VALUE_MAX_LEN) {
+        return FormatLdapAttrMaxLen(pAttrDesc->eType, pLdapAttribute->ppValues[0]);
+    }
     for (i = 0; i < pLdapAttribute->dwValuesCount; i++) {
-        dwLen += pfnFormatter(pLdapAttribute->ppValues[i], NULL); // NULL as buffer == only return the required len
-        dwLen += 1; // attribute values separator
+        dwLen += pfnFormatter(pLdapAttribute->ppValues[i], NULL); // NULL as buffer == only return the required len, its NULL terminator becoming the separator
     }
+    return dwLen;
+}
 
-    pOutBuff = UtilsHeapAllocStrHelper(g_pDirCrawlerHeap, dwLen);
-    pCurrentBuff = pOutBuff;
+static void DirCrawlerStringifyAttributeTo(
+    _In_ const PLDAP_ATTRIBUTE pLdapAttribute,
+    _In_ const PDIR_CRAWLER_LDAP_ATTRIBUTE_DESCRIPTION pAttrDesc,
+    _Out_ PTCHAR ptOutBuff,
+    _In_ const DWORD dwOutLen       // from DirCrawlerMeasureAttribute
+    ) {
+    DWORD i = 0;
+    DWORD dwValueLen = 0;
+    PFN_LDAP_ATTR_VALUE_FORMATTER pfnFormatter = gc_ppfnFormatters[pAttrDesc->eType];
+    PTCHAR ptCurrentBuff = ptOutBuff;
+#ifdef UNICODE
+    DWORD dwValueMaxLen = 0;
+    DWORD dwScratchLen = 0;
+    LPSTR pScratch = NULL;
+    LPSTR pValueBuff = NULL;
+    CHAR acSingleValue[DIR_CRAWLER_SINGLE_VALUE_MAX_LEN];
+#endif
 
+    // Values are formatted one by one straight into the outfile buffer: no intermediate copy of the joined values
     for (i = 0; i < pLdapAttribute->dwValuesCount; i++) {
-        pCurrentBuff += pfnFormatter(pLdapAttribute->ppValues[i], pCurrentBuff);
-        *(pCurrentBuff - 1) = (i == pLdapAttribute->dwValuesCount - 1 ? NULL_CHAR : DIR_CRAWLER_LDAP_VAL_SEPARATOR);
+#ifdef UNICODE
+        // Each value goes through a scratch UTF-8 buffer, the stack one for short values
+        dwValueMaxLen = FormatLdapAttrMaxLen(pAttrDesc->eType, pLdapAttribute->ppValues[i]);
+        if (dwValueMaxLen <= DIR_CRAWLER_SINGLE_VALUE_MAX_LEN) {
+            pValueBuff = acSingleValue;
+        }
+        else {
+            if (dwValueMaxLen > dwScratchLen) {
+                if (pScratch != NULL) {
+                    UtilsHeapFreeAndNullHelper(DIR_CRAWLER_THREAD_HEAP, pScratch);
+                }
+                dwScratchLen = dwValueMaxLen;
+                pScratch = DIR_CRAWLER_STATS_ALLOC(dwScratchLen, UtilsHeapAllocStrHelper(DIR_CRAWLER_THREAD_HEAP, dwScratchLen));
+            }
+            pValueBuff = pScratch;
+        }
+        dwValueLen = pfnFormatter(pLdapAttribute->ppValues[i], pValueBuff);
+        // UTF-8 never needs more UTF-16 code units than bytes: the value fits in what was measured for it
+        dwValueLen = MultiByteToWideChar(CP_UTF8, MB_ERR_INVALID_CHARS, (LPCCH)pValueBuff, dwValueLen, ptCurrentBuff, (int)(dwOutLen - (ptCurrentBuff - ptOutBuff)));
+        if (dwValueLen == 0) {
+            ptCurrentBuff[0] = NULL_CHAR;   // invalid UTF-8: empty value
+            dwValueLen = 1;
+        }
+#else
+        dwValueLen = pfnFormatter(pLdapAttribute->ppValues[i], ptCurrentBuff);
+#endif
+        ptCurrentBuff += dwValueLen;
+        *(ptCurrentBuff - 1) = (i == pLdapAttribute->dwValuesCount - 1 ? NULL_CHAR : DIR_CRAWLER_LDAP_VAL_SEPARATOR);
     }
 
 #ifdef UNICODE
-    szMbBuffer = MultiByteToWideChar(CP_UTF8, MB_ERR_INVALID_CHARS, (LPCCH)pOutBuff, -1, NULL, 0);
-    lpwOutBuff = UtilsHeapAllocStrHelper(g_pDirCrawlerHeap, szMbBuffer * sizeof(TCHAR));
-    MultiByteToWideChar(CP_UTF8, MB_ERR_INVALID_CHARS, (LPCCH)pOutBuff, -1, lpwOutBuff, szMbBuffer);
-    UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, pOutBuff);
-    return lpwOutBuff;
+    if (pScratch != NULL) {
+        UtilsHeapFreeAndNullHelper(DIR_CRAWLER_THREAD_HEAP, pScratch);
+    }
+#endif
+}
+
+static PTCHAR DirCrawlerStringifyAttribute(
+    _In_ const PLDAP_ATTRIBUTE pLdapAttribute,
+    _In_ const PDIR_CRAWLER_LDAP_ATTRIBUTE_DESCRIPTION pAttrDesc,
+    _In_ const DWORD dwLen          // from DirCrawlerMeasureAttribute, 0 if not measured yet
+    ) {
+    DWORD dwOutLen = dwLen;
+    DWORD dwValueLen = 0;
+    PFN_LDAP_ATTR_VALUE_FORMATTER pfnFormatter = gc_ppfnFormatters[pAttrDesc->eType];
+    PTCHAR ptOutBuff = NULL;
+    CHAR acSingleValue[DIR_CRAWLER_SINGLE_VALUE_MAX_LEN];
+
+    // Most attributes have a single short value: format it once on the stack instead of measuring it first
+    if (pLdapAttribute->dwValuesCount == 1 && FormatLdapAttrMaxLen(pAttrDesc->eType, pLdapAttribute->ppValues[0]) <= DIR_CRAWLER_SINGLE_VALUE_MAX_LEN) {
+        dwValueLen = pfnFormatter(pLdapAttribute->ppValues[0], acSingleValue);
+#ifdef UNICODE
+        // UTF-8 never needs more UTF-16 code units than bytes
+        ptOutBuff = DIR_CRAWLER_STATS_ALLOC(dwValueLen * sizeof(TCHAR), UtilsHeapAllocStrHelper(DIR_CRAWLER_THREAD_HEAP, dwValueLen * sizeof(TCHAR)));
+        if (MultiByteToWideChar(CP_UTF8, MB_ERR_INVALID_CHARS, (LPCCH)acSingleValue, dwValueLen, ptOutBuff, dwValueLen) == 0) {
+            ptOutBuff[0] = NULL_CHAR;
+        }
+        return ptOutBuff;
 #else
-    return pOutBuff;
+        return DIR_CRAWLER_STATS_ALLOC(dwValueLen * sizeof(TCHAR), UtilsHeapStrDupHelper(DIR_CRAWLER_THREAD_HEAP, acSingleValue));
 #endif
+    }
+
+    if (dwOutLen == 0) {
+        dwOutLen = DirCrawlerMeasureAttribute(pLdapAttribute, pAttrDesc);
+    }
+    ptOutBuff = DIR_CRAWLER_STATS_ALLOC(dwOutLen * sizeof(TCHAR), UtilsHeapAllocStrHelper(DIR_CRAWLER_THREAD_HEAP, dwOutLen * sizeof(TCHAR)));
+    DirCrawlerStringifyAttributeTo(pLdapAttribute, pAttrDesc, ptOutBuff, dwOutLen);
+    return ptOutBuff;
 }
 
 static PTCHAR DirCrawlerFormatAttribute(
-    _In_ const PLDAP_CONNECT pLdapConnect,
-    _In_ const PLDAP_ENTRY pLdapEntry,
-    _In_ const PDIR_CRAWLER_LDAP_ATTRIBUTE_DESCRIPTION pAttrDesc
+    _In_opt_ const PLDAP_ATTRIBUTE pLdapAttribute,
+    _In_ const PDIR_CRAWLER_LDAP_ATTRIBUTE_DESCRIPTION pAttrDesc,
+    _In_ const DWORD dwLen
     ) {
-    BOOL bResult = FALSE;
-    PLDAP_ATTRIBUTE pDuplicatedAttribute = NULL;
-    PTCHAR ptFormatted = NULL;
-
-    bResult = LdapDupNamedAttr(pLdapConnect, pLdapEntry, pAttrDesc->ptName, &pDuplicatedAttribute);
-    if (bResult == TRUE && pDuplicatedAttribute->dwValuesCount > 0) {
-        ptFormatted = DirCrawlerStringifyAttribute(pDuplicatedAttribute, pAttrDesc);
+    if (pLdapAttribute != NULL && pLdapAttribute->dwValuesCount > 0) {
+        return DirCrawlerStringifyAttribute(pLdapAttribute, pAttrDesc, dwLen);
     }
     else {
-        ptFormatted = UtilsHeapStrDupHelper(g_pDirCrawlerHeap, EMPTY_STR);
+        return DIR_CRAWLER_STATS_ALLOC(sizeof(TCHAR), UtilsHeapStrDupHelper(DIR_CRAWLER_THREAD_HEAP, EMPTY_STR));
     }
+}
 
-    if (pDuplicatedAttribute != NULL) {
-        LdapReleaseAttribute(pLdapConnect, &pDuplicatedAttribute);
+// FN_DIR_CRAWLER_FORMAT_FIELD: the field of an entry batched for the formatting pool, into the buffer measured for it
+static void DirCrawlerFormatAttributeTo(
+    _In_opt_ const PLDAP_ATTRIBUTE pLdapAttribute,
+    _In_ const PDIR_CRAWLER_LDAP_ATTRIBUTE_DESCRIPTION pAttrDesc,
+    _Out_ PTCHAR ptOutBuff,
+    _In_ const DWORD dwLen
+    ) {
+    if (pLdapAttribute != NULL && pLdapAttribute->dwValuesCount > 0) {
+        DirCrawlerStringifyAttributeTo(pLdapAttribute, pAttrDesc, ptOutBuff, dwLen);
+    }
+    else {
+        ptOutBuff[0] = NULL_CHAR;
     }
-    return ptFormatted;
 }
 
-static BOOL DirCrawlerWriteLdapEntryToTsvOutfile(
-    _In_ const CSV_HANDLE hCsvOutfile,
+// FN_DIR_CRAWLER_FORMAT_SIDE: the 'sd' values of an entry batched for the formatting pool, parsed with their ACE rows
+static PVOID DirCrawlerFormatEntrySide(
+    _In_ const PDIR_CRAWLER_REQ_DESCR pReqDescr,
+    _In_ const PLDAP_ATTRIBUTE ppLdapAttributes[],
+    _In_ const PVOID apvPrevious[],
+    _In_ const DWORD dwPreviousCount
+    ) {
+    return DirCrawlerSdFormatEntry(pReqDescr, ppLdapAttributes, (PDIR_CRAWLER_SD_ENTRY *)apvPrevious, dwPreviousCount);
+}
+
+static void DirCrawlerDupEntryAttributes(
     _In_ const PLDAP_CONNECT pLdapConnect,
     _In_ const PLDAP_ENTRY pLdapEntry,
-    _In_ const PDIR_CRAWLER_REQ_DESCR pReqDescr
+    _In_ const PDIR_CRAWLER_REQ_DESCR pReqDescr,
+    _Out_ PLDAP_ATTRIBUTE ppLdapAttributes[]
     ) {
-    PTCHAR *pptCsvRecord = NULL;
     BOOL bResult = FALSE;
     DWORD i = 0;
-    DWORD dwAttrCount = pReqDescr->ldap.attributes.dwAttrCount;
-    DWORD dwCsvHeaderCount = 0;
 
-    // Format attributes
-    pptCsvRecord = UtilsHeapAllocArrayHelper(g_pDirCrawlerHeap, PTCHAR, dwAttrCount + 1); // +1 for the DN
-    pptCsvRecord[0] = pLdapEntry->ptDn;
+    for (i = 0; i < pReqDescr->ldap.attributes.dwAttrCount; i++) {
+        ppLdapAttributes[i] = NULL;
+        bResult = LdapDupNamedAttr(pLdapConnect, pLdapEntry, pReqDescr->ldap.attributes.pAttrArray[i].ptName, &ppLdapAttributes[i]);
+        if (bResult == FALSE && ppLdapAttributes[i] != NULL) {
+            LdapReleaseAttribute(pLdapConnect, &ppLdapAttributes[i]);
+        }
+    }
+}
 
-    for (i = 0; i < dwAttrCount; i++) {
-        pptCsvRecord[i + 1] = DirCrawlerFormatAttribute(pLdapConnect, pLdapEntry, &pReqDescr->ldap.attributes.pAttrArray[i]);
-        if (pptCsvRecord[i + 1] == NULL) {
-            REQ_FATAL(pReqDescr, _T("Failed to format attribute <%s> of entry <%s>"), pReqDescr->ldap.attributes.pAttrArray[i].ptName, pLdapEntry->ptDn);
+static void DirCrawlerReleaseEntryAttributes(
+    _In_ const PLDAP_CONNECT pLdapConnect,
+    _In_ const PDIR_CRAWLER_REQ_DESCR pReqDescr,
+    _Inout_ PLDAP_ATTRIBUTE ppLdapAttributes[]
+    ) {
+    DWORD i = 0;
+
+    for (i = 0; i < pReqDescr->ldap.attributes.dwAttrCount; i++) {
+        if (ppLdapAttributes[i] != NULL) {
+            LdapReleaseAttribute(pLdapConnect, &ppLdapAttributes[i]);
         }
     }
+}
 
-    // Retrieve expected csv column count and compare it with record count
-    bResult = CsvGetHeaderNumberOfFields(hCsvOutfile, &dwCsvHeaderCount);
-    if (API_FAILED(bResult)) {
-       REQ_FATAL(pReqDescr, _T("Failed to retrieve header fields count for current CSV : <err:%#08x>"), CsvGetLastError(hCsvOutfile));
+// FN_DIR_CRAWLER_FORMAT_WRITE: side outputs and record of a formatted entry
+static void DirCrawlerWriteFormattedEntry(
+    _In_ const PDIR_CRAWLER_REQ_CONTEXT pReqContext,
+    _In_ const PTCHAR ptDn,
+    _In_ const PLDAP_ATTRIBUTE ppLdapAttributes[],
+    _In_ const PTCHAR pptCsvRecord[],
+    _In_opt_ const PVOID pvSide,
+    _In_ const LONGLONG llFormattedBytes
+    ) {
+    PDIR_CRAWLER_REQ_DESCR pReqDescr = pReqContext->pReqDescr;
+    BOOL bResult = FALSE;
+    DWORD dwAttrCount = pReqDescr->ldap.attributes.dwAttrCount;
+    DWORD dwCsvHeaderCount = 0;
+    LONGLONG llStageStart = DirCrawlerStatsNow();
+
+    // Side outputs are written in the order of the records: ACEs are only written for the first object of each DACL
+    if (pReqContext->pSdOutput != NULL && pvSide != NULL) {
+        DirCrawlerSdWriteEntry(pReqContext->pSdOutput, pReqDescr, ptDn, (PDIR_CRAWLER_SD_ENTRY)pvSide);
     }
+    if (pReqContext->pEdgesOutput != NULL) {
+        DirCrawlerEdgesWriteEntry(pReqContext->pEdgesOutput, ptDn, ppLdapAttributes);
+    }
+    DirCrawlerStatsStageEnd(pReqContext->pStats, DirCrawlerStageFormat, llStageStart);
+    llStageStart = DirCrawlerStatsNow();
+
+    // Retrieve expected csv column count and compare it with record count
+    dwCsvHeaderCount = DirCrawlerSinkGetColumnCount(pReqContext->pSink);
     if (dwCsvHeaderCount != (dwAttrCount + 1)) {
        REQ_FATAL(pReqDescr, _T("Incoherent record count : excepted %d records but %d provided."), dwCsvHeaderCount, (dwAttrCount + 1));
     }
 
     // Write CSV record
-    bResult = CsvWriteNextRecord(hCsvOutfile, pptCsvRecord, NULL);
+    bResult = DirCrawlerSinkWriteRecord(pReqContext->pSink, (PTCHAR *)pptCsvRecord);
     if (API_FAILED(bResult)) {
-        REQ_FATAL(pReqDescr, _T("Failed to write csv record for entry <%s>: <err:%#08x>"), pLdapEntry->ptDn, CsvGetLastError(hCsvOutfile));
+        REQ_FATAL(pReqDescr, _T("Failed to write csv record for entry <%s>: <err:%#08x>"), ptDn, DirCrawlerSinkGetLastError(pReqContext->pSink));
+    }
+    if (pReqContext->pSnapshotOutput != NULL) {
+        DirCrawlerSnapshotWriteEntry(pReqContext->pSnapshotOutput, (PTCHAR *)pptCsvRecord);
     }
+    DirCrawlerStatsStageEnd(pReqContext->pStats, DirCrawlerStageWrite, llStageStart);
+    DirCrawlerStatsEntryWritten(pReqContext->pStats, llFormattedBytes);
+}
+
+static BOOL DirCrawlerWriteLdapEntryToTsvOutfile(
+    _In_ const PDIR_CRAWLER_REQ_CONTEXT pReqContext,
+    _In_ const PTCHAR ptDn,
+    _In_ const PLDAP_ATTRIBUTE ppLdapAttributes[] // one per requested attribute, NULL if missing
+    ) {
+    PDIR_CRAWLER_REQ_DESCR pReqDescr = pReqContext->pReqDescr;
+    PTCHAR *pptCsvRecord = NULL;
+    PDIR_CRAWLER_SD_ENTRY pSdEntry = NULL;
+    DWORD i = 0;
+    DWORD dwAttrCount = pReqDescr->ldap.attributes.dwAttrCount;
+    LONGLONG llFormattedBytes = 0;
+    LONGLONG llStageStart = DirCrawlerStatsNow();
+    DWORD adwLens[DIR_CRAWLER_MEASURED_ATTRS_MAX] = { 0 };
+    DWORD dwLen = 0;
+    ULONGLONG ullRecordBytes = 0;
+    BOOL bReserved = FALSE;
 
-    // Cleanup
+    // Measure the record first, so that the memory budget is taken before any large buffer is allocated
     for (i = 0; i < dwAttrCount; i++) {
-        UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, pptCsvRecord[i + 1]);
+        dwLen = DirCrawlerMeasureAttribute(ppLdapAttributes[i], &pReqDescr->ldap.attributes.pAttrArray[i]);
+        if (i < _countof(adwLens)) {
+            adwLens[i] = dwLen;
+        }
+        ullRecordBytes += (ULONGLONG)dwLen * sizeof(TCHAR);
     }
-    UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, pptCsvRecord);
 
+    // Records small enough to skip the budget go to the formatting pool, the others are formatted here, in order
+    if (pReqContext->pFormatStream != NULL) {
+        if (ullRecordBytes < DIR_CRAWLER_BUDGET_MIN_BYTES && dwAttrCount <= _countof(adwLens)) {
+            DirCrawlerFormatStreamAdd(pReqContext->pFormatStream, ptDn, ppLdapAttributes, adwLens);
+            DirCrawlerStatsStageEnd(pReqContext->pStats, DirCrawlerStageFormat, llStageStart);
+            return TRUE;
+        }
+        DirCrawlerFormatStreamBypass(pReqContext->pFormatStream);
+    }
+    bReserved = DirCrawlerBudgetReserve(pReqDescr, ullRecordBytes);
+
+    __try {
+        // Format attributes
+        pptCsvRecord = DIR_CRAWLER_STATS_ALLOC(SIZEOF_ARRAY(PTCHAR, dwAttrCount + 1), UtilsHeapAllocArrayHelper(DIR_CRAWLER_THREAD_HEAP, PTCHAR, dwAttrCount + 1)); // +1 for the DN
+        pptCsvRecord[0] = ptDn;
+
+        for (i = 0; i < dwAttrCount; i++) {
+            pptCsvRecord[i + 1] = DirCrawlerFormatAttribute(ppLdapAttributes[i], &pReqDescr->ldap.attributes.pAttrArray[i], i < _countof(adwLens) ? adwLens[i] : 0);
+            if (pptCsvRecord[i + 1] == NULL) {
+                REQ_FATAL(pReqDescr, _T("Failed to format attribute <%s> of entry <%s>"), pReqDescr->ldap.attributes.pAttrArray[i].ptName, ptDn);
+            }
+            llFormattedBytes += _tcslen(pptCsvRecord[i + 1]) * sizeof(TCHAR);
+        }
+        if (pReqContext->pSdOutput != NULL) {
+            pSdEntry = DirCrawlerSdFormatEntry(pReqDescr, ppLdapAttributes, NULL, 0);
+        }
+        DirCrawlerStatsStageEnd(pReqContext->pStats, DirCrawlerStageFormat, llStageStart);
+
+        DirCrawlerWriteFormattedEntry(pReqContext, ptDn, ppLdapAttributes, pptCsvRecord, pSdEntry, llFormattedBytes);
+
+        // Cleanup
+        for (i = 0; i < dwAttrCount; i++) {
+            UtilsHeapFreeAndNullHelper(DIR_CRAWLER_THREAD_HEAP, pptCsvRecord[i + 1]);
+        }
+        UtilsHeapFreeAndNullHelper(DIR_CRAWLER_THREAD_HEAP, pptCsvRecord);
+    }
+    __finally {
+        // Also when the request is aborted by an exception
+        DirCrawlerSdFreeEntry(&pSdEntry);
+        if (bReserved == TRUE) {
+            DirCrawlerBudgetRelease(ullRecordBytes);
+        }
+    }
+
+    return TRUE;
+}
+
+static BOOL DirCrawlerLimitReached(
+    _Inout_ const PDIR_CRAWLER_REQ_CONTEXT pReqContext
+    ) {
+    // Checked before waiting for every entry: LdapLib cannot interrupt a wait, so a search overruns its deadline
+    // by at most the time the server takes to return a page
+    if (pReqContext->eStop != DirCrawlerStopNone) {
+        return TRUE;
+    }
+    if (pReqContext->dwMaxEntries > 0 && pReqContext->dwEntries >= pReqContext->dwMaxEntries) {
+        pReqContext->eStop = DirCrawlerStopMaxEntries;
+    }
+    else if (pReqContext->ullDeadline > 0 && GetTickCount64() >= pReqContext->ullDeadline) {
+        pReqContext->eStop = (pReqContext->bRunDeadline == TRUE) ? DirCrawlerStopDeadline : DirCrawlerStopTimeout;
+    }
+    else {
+        return FALSE;
+    }
+
+    REQ_LOG(pReqContext->pReqDescr, Warn, _T("Stopping searches: <%s> reached after <%u> entries"), DirCrawlerStatsStopName(pReqContext->eStop), pReqContext->dwEntries);
     return TRUE;
 }
 
+static void DirCrawlerWritePartialMarker(
+    _In_ const PDIR_CRAWLER_REQ_CONTEXT pReqContext,
+    _In_ const PTCHAR ptOutFile,
+    _In_ const DWORD dwAttempt
+    ) {
+    TCHAR atMarkerFile[MAX_PATH] = { 0 };
+    FILE *pFile = NULL;
+    errno_t err = 0;
+
+    _stprintf_s(atMarkerFile, MAX_PATH, _T("%s.%s"), ptOutFile, DIR_CRAWLER_PARTIAL_EXT);
+    if (pReqContext->eStop == DirCrawlerStopNone) {
+        // Left by a previous attempt or run
+        DeleteFile(atMarkerFile);
+        return;
+    }
+
+    err = DirCrawlerStatsOpenJson(&pFile, atMarkerFile);
+    if (err != 0) {
+        REQ_LOG(pReqContext->pReqDescr, Err, _T("Failed to open partial marker <%s>: <errno:%#08x>"), atMarkerFile, err);
+        return;
+    }
+    _ftprintf(pFile, _T("{\n  \"reason\": \"%s\",\n  \"entries\": %u,\n  \"attempt\": %u\n}\n"), DirCrawlerStatsStopName(pReqContext->eStop), pReqContext->dwEntries, dwAttempt);
+    fclose(pFile);
+}
+
 static DWORD DirCrawlerBindAndSearch(
-    _In_ const PDIR_CRAWLER_REQ_DESCR pReqDescr,
-    _In_ const CSV_HANDLE hCsvOutfile,
+    _In_ const PDIR_CRAWLER_REQ_CONTEXT pReqContext,
     _In_ const PTCHAR pptAttrsList[],
     _In_ const PLDAP_CONNECT pLdapConnect,
     _In_ const PLDAP_OPTIONS pLdapOptions,
@@ -496,65 +935,201 @@ static DWORD DirCrawlerBindAndSearch(
     _In_ PLDAPControl ppClientCtrlsList[],
     _In_ PLDAPControl ppServerCtrlsList[]
     ) {
+    PDIR_CRAWLER_REQ_DESCR pReqDescr = pReqContext->pReqDescr;
     BOOL bResult = FALSE;
     PLDAP_REQUEST pLdapRequest = NULL;
     PLDAP_ENTRY pLdapEntry = NULL;
+    PLDAP_ATTRIBUTE *ppLdapAttributes = NULL;
     DWORD dwEntryCount = 0;
     BOOL bLdapNoMoreEntries = FALSE;
+    LONGLONG llStageStart = 0;
+
+    DirCrawlerStatsStartSearch(pReqContext->pStats, ptLdapBindingNc);
 
     // Ldap Bind
-    bResult = LdapBind(pLdapConnect, ptLdapBindingNc, pLdapOptions->ptLogin, pLdapOptions->ptPassword, pLdapOptions->ptExplicitDomain);
+    llStageStart = DirCrawlerStatsNow();
+    DIR_CRAWLER_TRACE_CALL(DirCrawlerTraceLdapBind, ptLdapBindingNc, bResult = LdapBind(pLdapConnect, ptLdapBindingNc, pLdapOptions->ptLogin, pLdapOptions->ptPassword, pLdapOptions->ptExplicitDomain));
     if (!bResult) {
         REQ_FATAL(pReqDescr, _T("Failed to bind to ldap server: <err:%#08x>"), LdapLastError());
     }
+    DirCrawlerStatsStageEnd(pReqContext->pStats, DirCrawlerStageConnect, llStageStart);
+    if (pReqContext->llConnectStart != 0) {
+        DirCrawlerTlsSetupDone(pReqContext->llConnectStart);
+        pReqContext->llConnectStart = 0;
+    }
 
     // Ldap Search
-    bResult = LdapInitRequestEx(pLdapConnect, ptLdapBindingNc, pReqDescr->ldap.ptFilter, pReqDescr->ldap.eScope, pptAttrsList, ppServerCtrlsList, ppClientCtrlsList, &pLdapRequest);
+    llStageStart = DirCrawlerStatsNow();
+    DIR_CRAWLER_TRACE_CALL(DirCrawlerTraceLdapInitRequest, ptLdapBindingNc, bResult = LdapInitRequestEx(pLdapConnect, ptLdapBindingNc, pReqDescr->ldap.ptFilter, pReqDescr->ldap.eScope, pptAttrsList, ppServerCtrlsList, ppClientCtrlsList, &pLdapRequest));
     if (API_FAILED(bResult)) {
         REQ_FATAL(pReqDescr, _T("Failed to init ldap request <%s> on <%s>: <err:%#08x>"), pReqDescr->ldap.ptFilter, ptLdapBindingNc, LdapLastError());
     }
+    DirCrawlerStatsStageEnd(pReqContext->pStats, DirCrawlerStageSearch, llStageStart);
+
+    if (pReqContext->pCaptureStream != NULL) {
+        DirCrawlerCaptureSearch(pReqContext->pCaptureStream, ptLdapBindingNc);
+    }
+    ppLdapAttributes = UtilsHeapAllocArrayHelper(DIR_CRAWLER_THREAD_HEAP, PLDAP_ATTRIBUTE, pReqDescr->ldap.attributes.dwAttrCount + 1);
 
     // Parse Results
-    while (bLdapNoMoreEntries == FALSE) {
-        bResult = LdapGetNextEntry(pLdapConnect, pLdapRequest, &pLdapEntry);
+    while (bLdapNoMoreEntries == FALSE && DirCrawlerLimitReached(pReqContext) == FALSE) {
+        llStageStart = DirCrawlerStatsNow();
+        DIR_CRAWLER_TRACE_CALL(DirCrawlerTraceLdapGetNextEntry, ptLdapBindingNc, bResult = LdapGetNextEntry(pLdapConnect, pLdapRequest, &pLdapEntry));
         if (API_FAILED(bResult)) {
             REQ_FATAL(pReqDescr, _T("Unable to get next LDAP entry <%u>: <err:%#08x>"), dwEntryCount, LdapLastError());
         }
         if (pLdapEntry == NULL) {
+            DirCrawlerStatsStageEnd(pReqContext->pStats, DirCrawlerStageSearch, llStageStart);
             bLdapNoMoreEntries = TRUE;
         }
         else {
+            DirCrawlerStatsEntryReceived(pReqContext->pStats, llStageStart);
             dwEntryCount++;
+            pReqContext->dwEntries++;
 
             if (pLdapEntry->dwAttributesCount != pLdapRequest->dwRequestedAttrCount) {
                 REQ_FATAL(pReqDescr, _T("Wrong count of retreived attributes for <%s>: <%u/%u>"), pLdapEntry->ptDn, pLdapEntry->dwAttributesCount, pLdapRequest->dwRequestedAttrCount);
             }
-            bResult = DirCrawlerWriteLdapEntryToTsvOutfile(hCsvOutfile, pLdapConnect, pLdapEntry, pReqDescr);
+
+            DirCrawlerDupEntryAttributes(pLdapConnect, pLdapEntry, pReqDescr, ppLdapAttributes);
+            if (pReqContext->pCaptureStream != NULL) {
+                DirCrawlerCaptureEntry(pReqContext->pCaptureStream, pLdapEntry->ptDn, ppLdapAttributes, pReqDescr->ldap.attributes.dwAttrCount);
+            }
+
+            DIR_CRAWLER_TRACE_CALL(DirCrawlerTraceWriteEntry, pReqDescr->infos.ptName, bResult = DirCrawlerWriteLdapEntryToTsvOutfile(pReqContext, pLdapEntry->ptDn, ppLdapAttributes));
             if (bResult == FALSE) {
                 REQ_FATAL(pReqDescr, _T("Failed to write entry <%s>"), pLdapEntry->ptDn);
             }
 
+            DirCrawlerReleaseEntryAttributes(pLdapConnect, pReqDescr, ppLdapAttributes);
             LdapReleaseEntry(pLdapConnect, &pLdapEntry);
         }
     }
 
-    // Cleanup
+    // Cleanup (a search stopped by its limits is abandoned: its remaining pages are never requested)
+    if (pReqContext->pFormatStream != NULL) {
+        DirCrawlerFormatStreamFlush(pReqContext->pFormatStream);
+    }
+    DirCrawlerStatsEndSearch(pReqContext->pStats);
+    UtilsHeapFreeAndNullHelper(DIR_CRAWLER_THREAD_HEAP, ppLdapAttributes);
     LdapReleaseRequest(pLdapConnect, &pLdapRequest);
 
     return dwEntryCount;
 }
 
-static void DirCrawlerProcessLdapRequest(
+static DWORD DirCrawlerReplaySearches(
+    _In_ const PDIR_CRAWLER_REQ_CONTEXT pReqContext
+    ) {
+    PDIR_CRAWLER_REQ_DESCR pReqDescr = pReqContext->pReqDescr;
+    PDIR_CRAWLER_REPLAY_CURSOR pCursor = NULL;
+    PDIR_CRAWLER_REPLAY_RECORD pRecord = NULL;
+    DWORD dwEntryCount = 0;
+    BOOL bResult = FALSE;
+    LONGLONG llStageStart = DirCrawlerStatsNow();
+
+    pCursor = DirCrawlerReplayStartRequest(pReqDescr);
+
+    __try {
+        while (DirCrawlerLimitReached(pReqContext) == FALSE && (pRecord = DirCrawlerReplayNextRecord(pCursor)) != NULL) {
+            switch (pRecord->eType) {
+            case DirCrawlerCaptureRecordSearch:
+                // Entries of the previous search are accounted to its naming context
+                if (pReqContext->pFormatStream != NULL) {
+                    DirCrawlerFormatStreamFlush(pReqContext->pFormatStream);
+                }
+                DirCrawlerStatsStageEnd(pReqContext->pStats, DirCrawlerStageSearch, llStageStart);
+                DirCrawlerStatsStartSearch(pReqContext->pStats, pRecord->ptNc);
+                REQ_LOG(pReqDescr, Dbg, _T("Replaying search on <%s>"), pRecord->ptNc);
+                break;
+            case DirCrawlerCaptureRecordEntry:
+                DirCrawlerStatsEntryReceived(pReqContext->pStats, llStageStart);
+                dwEntryCount++;
+                pReqContext->dwEntries++;
+
+                if (pRecord->dwAttributesCount != pReqDescr->ldap.attributes.dwAttrCount) {
+                    REQ_FATAL(pReqDescr, _T("Captured entry <%s> does not match the request attributes: <%u/%u>"), pRecord->ptDn, pRecord->dwAttributesCount, pReqDescr->ldap.attributes.dwAttrCount);
+                }
+
+                DIR_CRAWLER_TRACE_CALL(DirCrawlerTraceWriteEntry, pReqDescr->infos.ptName, bResult = DirCrawlerWriteLdapEntryToTsvOutfile(pReqContext, pRecord->ptDn, pRecord->ppAttributes));
+                if (bResult == FALSE) {
+                    REQ_FATAL(pReqDescr, _T("Failed to write entry <%s>"), pRecord->ptDn);
+                }
+                break;
+            }
+            llStageStart = DirCrawlerStatsNow();
+        }
+
+        if (pReqContext->pFormatStream != NULL) {
+            DirCrawlerFormatStreamFlush(pReqContext->pFormatStream);
+        }
+        DirCrawlerStatsEndSearch(pReqContext->pStats);
+        if (dwEntryCount == 0 && pReqContext->eStop == DirCrawlerStopNone) {
+            REQ_LOG(pReqDescr, Warn, _T("No captured entry found for this request"));
+        }
+    }
+    __finally {
+        // Also when the request is aborted by a corrupted capture file
+        DirCrawlerReplayEndRequest(&pCursor);
+    }
+
+    return dwEntryCount;
+}
+
+static DWORD DirCrawlerSyntheticSearches(
+    _In_ const PDIR_CRAWLER_REQ_CONTEXT pReqContext
+    ) {
+    PDIR_CRAWLER_REQ_DESCR pReqDescr = pReqContext->pReqDescr;
+    PDIR_CRAWLER_SYNTHETIC_CURSOR pCursor = NULL;
+    PDIR_CRAWLER_SYNTHETIC_ENTRY pEntry = NULL;
+    DWORD dwEntryCount = 0;
+    BOOL bResult = FALSE;
+    LONGLONG llStageStart = DirCrawlerStatsNow();
+
+    DirCrawlerStatsStartSearch(pReqContext->pStats, SYNTHETIC_BASE_DN);
+    pCursor = DirCrawlerSyntheticStartRequest(pReqDescr);
+
+    while (DirCrawlerLimitReached(pReqContext) == FALSE && (pEntry = DirCrawlerSyntheticNextEntry(pCursor)) != NULL) {
+        DirCrawlerStatsEntryReceived(pReqContext->pStats, llStageStart);
+        dwEntryCount++;
+        pReqContext->dwEntries++;
+
+        if (pReqContext->pCaptureStream != NULL) {
+            DirCrawlerCaptureEntry(pReqContext->pCaptureStream, pEntry->ptDn, pEntry->ppAttributes, pEntry->dwAttributesCount);
+        }
+
+        DIR_CRAWLER_TRACE_CALL(DirCrawlerTraceWriteEntry, pReqDescr->infos.ptName, bResult = DirCrawlerWriteLdapEntryToTsvOutfile(pReqContext, pEntry->ptDn, pEntry->ppAttributes));
+        if (bResult == FALSE) {
+            REQ_FATAL(pReqDescr, _T("Failed to write entry <%s>"), pEntry->ptDn);
+        }
+        llStageStart = DirCrawlerStatsNow();
+    }
+
+    DirCrawlerStatsStageEnd(pReqContext->pStats, DirCrawlerStageSearch, llStageStart);
+    if (pReqContext->pFormatStream != NULL) {
+        DirCrawlerFormatStreamFlush(pReqContext->pFormatStream);
+    }
+    DirCrawlerStatsEndSearch(pReqContext->pStats);
+    DirCrawlerSyntheticEndRequest(&pCursor);
+    return dwEntryCount;
+}
+
+static DWORD DirCrawlerProcessLdapRequest(
     _In_ const PDIR_CRAWLER_REQ_DESCR pReqDescr,
+    _In_ const PDIR_CRAWLER_TARGET pTarget,
+    _In_ const PTCHAR ptLdapServer,     // the server of the target, or one of its replicas
     _In_ const PDIR_CRAWLER_OPTIONS pOptions,
-    _In_ const PLDAP_ROOT_DSE pLdapRootDse
+    _In_ const DWORD dwAttempt,
+    _Out_ PDIR_CRAWLER_STOP peStop
     ) {
     BOOL bResult = FALSE;
     DWORD dwResultCount = 0;
+    DIR_CRAWLER_REQ_CONTEXT sReqContext = { .pReqDescr = pReqDescr, .pSink = NULL, .pCaptureStream = NULL, .pStats = NULL, .pSdOutput = NULL, .pEdgesOutput = NULL, .pSnapshotOutput = NULL, .pFormatStream = NULL, .ullDeadline = 0, .bRunDeadline = FALSE, .dwMaxEntries = pReqDescr->limits.dwMaxEntries, .dwEntries = 0, .llConnectStart = 0, .eStop = DirCrawlerStopNone };
     PTCHAR ptLdapBindingNc = NULL;
     PLDAP_CONNECT pLdapConnect = NULL;
     TCHAR atOutFileName[MAX_PATH] = { 0 };
-    CSV_HANDLE hCsvOutfile = CSV_INVALID_HANDLE_VALUE;
+    TCHAR atSideFileName[MAX_PATH] = { 0 };
+    TCHAR atSideFileElmt[MAX_PATH] = { 0 };
+    TCHAR atAceFileName[MAX_PATH] = { 0 };
     PDIR_CRAWLER_LDAP_ATTRIBUTE_DESCRIPTION *pptAttrsList = { 0 };
     PTCHAR *pptAttrsListForLdap = { 0 };
     PTCHAR *pptAttrsListForCsv = { 0 };
@@ -565,11 +1140,25 @@ static void DirCrawlerProcessLdapRequest(
     DWORD dwClientCtrlsCount = 0;
     DWORD dwServerCtrlsCount = 0;
     ULONGLONG ullTimeStart = GetTickCount64();
+    ULONGLONG ullSinkBytes = 0;
+    LONGLONG llStageStart = 0;
+    PLDAP_ROOT_DSE pLdapRootDse = pTarget->pRootDse;
 
     REQ_LOG(pReqDescr, Info, _T("Starting request: <%s>"), pReqDescr->infos.ptDescription);
+    sReqContext.pStats = DirCrawlerStatsStartRequest(pReqDescr);
+    sReqContext.pStats->dwRetries = dwAttempt;
+
+    // The timeout doubles on every reschedule, and never goes past the deadline of the run
+    if (pReqDescr->limits.dwTimeout > 0) {
+        sReqContext.ullDeadline = ullTimeStart + (((ULONGLONG)pReqDescr->limits.dwTimeout * 1000) << dwAttempt);
+    }
+    if (gs_ullRunDeadline > 0 && (sReqContext.ullDeadline == 0 || gs_ullRunDeadline <= sReqContext.ullDeadline)) {
+        sReqContext.ullDeadline = gs_ullRunDeadline;
+        sReqContext.bRunDeadline = TRUE;
+    }
 
     // Create parameters (outfile, controls, attributes, ...)
-    bResult = DirCrawlerFormatOutfile(atOutFileName, pOptions->dump.ptOutputDir, DIR_CRAWLER_OUTPUT_DIR, pOptions->misc.ptOutfilesPrefix, DIR_CRAWLER_OUTFILES_KEYWORD, pReqDescr->infos.ptName, DIR_CRAWLER_OUTFILES_EXT);
+    bResult = DirCrawlerFormatOutfile(atOutFileName, pOptions->dump.ptOutputDir, pTarget->ptRootFolderName, DIR_CRAWLER_OUTPUT_DIR, pTarget->ptOutfilesPrefix, DIR_CRAWLER_OUTFILES_KEYWORD, pReqDescr->infos.ptName, DIR_CRAWLER_OUTFILES_EXT);
     if (bResult == FALSE) {
         REQ_FATAL(pReqDescr, _T("Failed to format outfile path"));
     }
@@ -578,55 +1167,134 @@ static void DirCrawlerProcessLdapRequest(
     if (bResult == FALSE) {
         REQ_FATAL(pReqDescr, _T("Failed to create attribute list"));
     }
-    pptAttrsListForCsv = UtilsHeapAllocArrayHelper(g_pDirCrawlerHeap, PTCHAR, dwAttrsCount + 1); // Apparently LdapLib needs a final NULL...
+    pptAttrsListForCsv = UtilsHeapAllocArrayHelper(DIR_CRAWLER_THREAD_HEAP, PTCHAR, dwAttrsCount + 1); // Apparently LdapLib needs a final NULL...
     for (i = 0; i < dwAttrsCount ; i++) {
-        pptAttrsListForCsv[i] = UtilsHeapStrDupHelper(g_pDirCrawlerHeap,pptAttrsList[i]->ptName);
+        pptAttrsListForCsv[i] = UtilsHeapStrDupHelper(DIR_CRAWLER_THREAD_HEAP, pptAttrsList[i]->ptName);
     }
     pptAttrsListForCsv[dwAttrsCount] = NULL;
     pptAttrsListForLdap = &pptAttrsListForCsv[1]; // skip 'DN' for the LDAP request
     pptAttrsList = &pptAttrsList[1];
 
-    bResult = DirCrawlerAddControlsArray(pReqDescr, gsc_asAlwaysOnCtrlsList, _countof(gsc_asAlwaysOnCtrlsList), &ppClientCtrlsList, &ppServerCtrlsList, &dwClientCtrlsCount, &dwServerCtrlsCount, FALSE);
-    if (bResult == FALSE) {
-        REQ_FATAL(pReqDescr, _T("Failed to add always-on controls to control list"));
+    // Open Csv outfile (its first shard, or its stream)
+    sReqContext.pSink = DirCrawlerSinkOpen(pReqDescr, atOutFileName, dwAttrsCount, pptAttrsListForCsv);
+
+    // Security descriptors side outfiles
+    if (DirCrawlerSdHasSdAttribute(pReqDescr) == TRUE) {
+        _stprintf_s(atSideFileElmt, MAX_PATH, _T("%s_%s"), pReqDescr->infos.ptName, DIR_CRAWLER_SD_OUTFILES_SUFFIX);
+        bResult = DirCrawlerFormatOutfile(atSideFileName, pOptions->dump.ptOutputDir, pTarget->ptRootFolderName, DIR_CRAWLER_OUTPUT_DIR, pTarget->ptOutfilesPrefix, DIR_CRAWLER_OUTFILES_KEYWORD, atSideFileElmt, DIR_CRAWLER_OUTFILES_EXT);
+        _stprintf_s(atSideFileElmt, MAX_PATH, _T("%s_%s"), pReqDescr->infos.ptName, DIR_CRAWLER_ACE_OUTFILES_SUFFIX);
+        bResult &= DirCrawlerFormatOutfile(atAceFileName, pOptions->dump.ptOutputDir, pTarget->ptRootFolderName, DIR_CRAWLER_OUTPUT_DIR, pTarget->ptOutfilesPrefix, DIR_CRAWLER_OUTFILES_KEYWORD, atSideFileElmt, DIR_CRAWLER_OUTFILES_EXT);
+        if (bResult == FALSE) {
+            REQ_FATAL(pReqDescr, _T("Failed to format security descriptors outfiles path"));
+        }
+        sReqContext.pSdOutput = DirCrawlerSdStartRequest(pReqDescr, atSideFileName, atAceFileName);
     }
 
-    bResult = DirCrawlerAddControlsArray(pReqDescr, pReqDescr->ldap.controls.pCtrlArray, pReqDescr->ldap.controls.dwCtrlCount, &ppClientCtrlsList, &ppServerCtrlsList, &dwClientCtrlsCount, &dwServerCtrlsCount, TRUE);
-    if (bResult == FALSE) {
-        REQ_FATAL(pReqDescr, _T("Failed to add request-specific controls to control list"));
+    // Control-path edges outfile
+    if (pOptions->edges.bEnabled == TRUE && DirCrawlerEdgesHasEdgeAttribute(pReqDescr) == TRUE) {
+        _stprintf_s(atSideFileElmt, MAX_PATH, _T("%s_%s"), pReqDescr->infos.ptName, DIR_CRAWLER_EDGES_OUTFILES_SUFFIX);
+        bResult = DirCrawlerFormatOutfile(atSideFileName, pOptions->dump.ptOutputDir, pTarget->ptRootFolderName, DIR_CRAWLER_OUTPUT_DIR, pTarget->ptOutfilesPrefix, DIR_CRAWLER_OUTFILES_KEYWORD, atSideFileElmt, DIR_CRAWLER_EDGES_OUTFILES_EXT);
+        if (bResult == FALSE) {
+            REQ_FATAL(pReqDescr, _T("Failed to format edges outfile path"));
+        }
+        sReqContext.pEdgesOutput = DirCrawlerEdgesStartRequest(pReqDescr, atSideFileName);
     }
 
-    // Open Csv outfile
-    bResult = CsvOpenWrite(atOutFileName, dwAttrsCount, pptAttrsListForCsv, &hCsvOutfile); // +1 for the DN
-    if (API_FAILED(bResult)) {
-        REQ_FATAL(pReqDescr, _T("Failed to open CSV outfile <%s>: <err:%#08x>"), atOutFileName, CsvGetLastError(hCsvOutfile));
+    if (pOptions->snapshot.ptFile != NULL) {
+        sReqContext.pSnapshotOutput = DirCrawlerSnapshotStartRequest(pReqDescr, gs_dwTargetCount > 1 ? pTarget->ldap.ptDnsName : NULL);
     }
 
-    // Ldap Connect
-    bResult = LdapConnect(pOptions->ldap.ptLdapServer, pOptions->ldap.dwLdapPort, &pLdapConnect, NULL);
-    if (!bResult) {
-        REQ_FATAL(pReqDescr, _T("Failed to connect to ldap server: <err:%#08x>"), LdapLastError());
+    if (DirCrawlerFormatPoolIsEnabled() == TRUE) {
+        sReqContext.pFormatStream = DirCrawlerFormatStreamStart(&sReqContext, DirCrawlerWriteFormattedEntry);
     }
 
-    // Ldap Bind
-    if (pReqDescr->ldap.base.eType != DirCrawlerLdapBaseWildcardAll) {
-        ptLdapBindingNc = DirCrawlerGetBindingNc(pLdapRootDse, pReqDescr);
-        dwResultCount = DirCrawlerBindAndSearch(pReqDescr, hCsvOutfile, pptAttrsListForLdap, pLdapConnect, &pOptions->ldap, ptLdapBindingNc, ppClientCtrlsList, ppServerCtrlsList);
+    if (pOptions->capture.ptReplayFile != NULL) {
+        // Replay: entries come from the capture file, the LDAP server is never contacted
+        dwResultCount = DirCrawlerReplaySearches(&sReqContext);
+    }
+    else if (pOptions->bench.ptSyntheticSpec != NULL) {
+        // Synthetic: entries are generated in-process, the LDAP server is never contacted either
+        if (pOptions->capture.ptCaptureFile != NULL) {
+            sReqContext.pCaptureStream = DirCrawlerCaptureStartRequest(pReqDescr);
+            DirCrawlerCaptureSearch(sReqContext.pCaptureStream, SYNTHETIC_BASE_DN);
+        }
+        dwResultCount = DirCrawlerSyntheticSearches(&sReqContext);
+        DirCrawlerCaptureEndRequest(&sReqContext.pCaptureStream);
     }
     else {
-        for (i = 0; i < pLdapRootDse->computed.count.dwNamingContextsCount; i++) {
-            dwResultCount += DirCrawlerBindAndSearch(pReqDescr, hCsvOutfile, pptAttrsListForLdap, pLdapConnect, &pOptions->ldap, pLdapRootDse->extracted.pptNamingContexts[i], ppClientCtrlsList, ppServerCtrlsList);
+        bResult = DirCrawlerAddControlsArray(pReqDescr, pLdapRootDse, gsc_asAlwaysOnCtrlsList, _countof(gsc_asAlwaysOnCtrlsList), &ppClientCtrlsList, &ppServerCtrlsList, &dwClientCtrlsCount, &dwServerCtrlsCount, FALSE);
+        if (bResult == FALSE) {
+            REQ_FATAL(pReqDescr, _T("Failed to add always-on controls to control list"));
+        }
+
+        bResult = DirCrawlerAddControlsArray(pReqDescr, pLdapRootDse, pReqDescr->ldap.controls.pCtrlArray, pReqDescr->ldap.controls.dwCtrlCount, &ppClientCtrlsList, &ppServerCtrlsList, &dwClientCtrlsCount, &dwServerCtrlsCount, TRUE);
+        if (bResult == FALSE) {
+            REQ_FATAL(pReqDescr, _T("Failed to add request-specific controls to control list"));
+        }
+
+        if (pOptions->capture.ptCaptureFile != NULL) {
+            sReqContext.pCaptureStream = DirCrawlerCaptureStartRequest(pReqDescr);
+        }
+
+        // Ldap Connect
+        llStageStart = DirCrawlerStatsNow();
+        sReqContext.llConnectStart = llStageStart;
+        DIR_CRAWLER_TRACE_CALL(DirCrawlerTraceLdapConnect, ptLdapServer, bResult = DirCrawlerTlsConnect(ptLdapServer, pTarget->ldap.dwLdapPort, &pLdapConnect, NULL));
+        if (!bResult) {
+            REQ_FATAL(pReqDescr, _T("Failed to connect to ldap server <%s>: <err:%#08x>"), ptLdapServer, LdapLastError());
+        }
+        DirCrawlerStatsStageEnd(sReqContext.pStats, DirCrawlerStageConnect, llStageStart);
+
+        // Ldap Bind
+        if (pReqDescr->ldap.base.eType != DirCrawlerLdapBaseWildcardAll) {
+            ptLdapBindingNc = DirCrawlerGetBindingNc(pLdapRootDse, pReqDescr);
+            dwResultCount = DirCrawlerBindAndSearch(&sReqContext, pptAttrsListForLdap, pLdapConnect, &pTarget->ldap, ptLdapBindingNc, ppClientCtrlsList, ppServerCtrlsList);
+        }
+        else {
+            for (i = 0; i < pLdapRootDse->computed.count.dwNamingContextsCount && sReqContext.eStop == DirCrawlerStopNone; i++) {
+                // Configuration and schema NCs are the same for the whole forest: only its first target crawls them
+                if (pTarget->bForestNcs == FALSE && DirCrawlerIsForestNc(pTarget, pLdapRootDse->extracted.pptNamingContexts[i]) == TRUE) {
+                    REQ_LOG(pReqDescr, Dbg, _T("Skipping forest NC <%s>"), pLdapRootDse->extracted.pptNamingContexts[i]);
+                    continue;
+                }
+                dwResultCount += DirCrawlerBindAndSearch(&sReqContext, pptAttrsListForLdap, pLdapConnect, &pTarget->ldap, pLdapRootDse->extracted.pptNamingContexts[i], ppClientCtrlsList, ppServerCtrlsList);
+            }
         }
+
+        DirCrawlerCaptureEndRequest(&sReqContext.pCaptureStream);
+        DirCrawlerDestroyControlArray(&ppServerCtrlsList);
+        DirCrawlerDestroyControlArray(&ppClientCtrlsList);
+        LdapCloseConnection(&pLdapConnect, NULL);
     }
 
-    // Cleanup & close
-    UtilsHeapFreeAndNullArrayHelper(g_pDirCrawlerHeap, pptAttrsListForCsv, dwAttrsCount, i);
-    DirCrawlerDestroyControlArray(&ppServerCtrlsList);
-    DirCrawlerDestroyControlArray(&ppClientCtrlsList);
-    LdapCloseConnection(&pLdapConnect, NULL);
-    CsvClose(&hCsvOutfile);
+    // Cleanup & close (a partial request keeps the entries already written)
+    DirCrawlerFormatStreamEnd(&sReqContext.pFormatStream);
+    UtilsHeapFreeAndNullArrayHelper(DIR_CRAWLER_THREAD_HEAP, pptAttrsListForCsv, dwAttrsCount, i);
+    if (sReqContext.eStop != DirCrawlerStopNone) {
+        DirCrawlerSinkMarkPartial(sReqContext.pSink, DirCrawlerStatsStopName(sReqContext.eStop));
+    }
+    DIR_CRAWLER_TRACE_CALL(DirCrawlerTraceCsvClose, pReqDescr->infos.ptName, ullSinkBytes = DirCrawlerSinkClose(&sReqContext.pSink));
+    DirCrawlerSdEndRequest(&sReqContext.pSdOutput);
+    DirCrawlerEdgesEndRequest(&sReqContext.pEdgesOutput);
+    DirCrawlerSnapshotEndRequest(&sReqContext.pSnapshotOutput);
+    // Sharded and streamed outfiles do not exist under their own name: their size is the one of their shards or stream
+    if (ullSinkBytes > 0) {
+        sReqContext.pStats->llOutputBytes = (LONGLONG)ullSinkBytes;
+    }
+    if (DirCrawlerSinkIsStream() == FALSE) {
+        DirCrawlerWritePartialMarker(&sReqContext, atOutFileName, dwAttempt);
+    }
+    sReqContext.pStats->eStop = sReqContext.eStop;
+    DirCrawlerStatsEndRequest(sReqContext.pStats, atOutFileName);
 
-    REQ_LOG(pReqDescr, Succ, _T("<count:%u> <time:%.3fs>"), dwResultCount, TIME_DIFF_SEC(ullTimeStart, GetTickCount64()));
+    if (sReqContext.eStop != DirCrawlerStopNone) {
+        REQ_LOG(pReqDescr, Warn, _T("Partial <reason:%s> <count:%u> <time:%.3fs>"), DirCrawlerStatsStopName(sReqContext.eStop), dwResultCount, TIME_DIFF_SEC(ullTimeStart, GetTickCount64()));
+    }
+    else {
+        REQ_LOG(pReqDescr, Succ, _T("<count:%u> <time:%.3fs>"), dwResultCount, TIME_DIFF_SEC(ullTimeStart, GetTickCount64()));
+    }
+    *peStop = sReqContext.eStop;
+    return dwResultCount;
 }
 
 static BOOL DirCrawlerCreateFolderRecursively(
@@ -675,6 +1343,76 @@ static BOOL DirCrawlerCreateFolderRecursively(
    return TRUE;
 }
 
+static void DirCrawlerCreateOutputFolders(
+    _In_ const PTCHAR ptOutputDir,
+    _In_ const PDIR_CRAWLER_TARGET pTarget
+    ) {
+    TCHAR ptRootFolderPath[MAX_PATH] = { 0 };
+    TCHAR ptDefaultResultsFolderPath[MAX_PATH] = { 0 };
+    TCHAR ptDefaultLogPath[MAX_PATH] = { 0 };
+    TCHAR ptDefaultStatsPath[MAX_PATH] = { 0 };
+
+    _stprintf_s(ptRootFolderPath, MAX_PATH, _T("%s\\%s"), ptOutputDir, pTarget->ptRootFolderName);
+    if (DirCrawlerCreateFolderRecursively(ptRootFolderPath) != TRUE) {
+       FATAL(_T("Unable to manually create directory architecture <%s>"), ptRootFolderPath);
+    }
+
+    _stprintf_s(ptDefaultResultsFolderPath, MAX_PATH, _T("%s\\%s\\Ldap"), ptOutputDir, pTarget->ptRootFolderName);
+    if (DirCrawlerCreateFolderRecursively(ptDefaultResultsFolderPath) != TRUE) {
+       FATAL(_T("Unable to manually create directory architecture <%s>"), ptDefaultResultsFolderPath);
+    }
+
+    _stprintf_s(ptDefaultLogPath, MAX_PATH, _T("%s\\%s\\Logs"), ptOutputDir, pTarget->ptRootFolderName);
+    if (DirCrawlerCreateFolderRecursively(ptDefaultLogPath) != TRUE) {
+       FATAL(_T("Unable to manually create directory architecture <%s>"), ptDefaultLogPath);
+    }
+
+    _stprintf_s(ptDefaultStatsPath, MAX_PATH, _T("%s\\%s\\%s"), ptOutputDir, pTarget->ptRootFolderName, DIR_CRAWLER_STATS_DIR);
+    if (DirCrawlerCreateFolderRecursively(ptDefaultStatsPath) != TRUE) {
+       FATAL(_T("Unable to manually create directory architecture <%s>"), ptDefaultStatsPath);
+    }
+}
+
+static BOOL DirCrawlerRunRequest(
+    _In_ const PDIR_CRAWLER_REQ_DESCR pReqDescr,
+    _In_ const PDIR_CRAWLER_TARGET pTarget,
+    _In_ const DWORD dwAttempt,
+    _Out_ PDWORD pdwResultCount,
+    _Out_ PDIR_CRAWLER_STOP peStop
+    ) {
+    PDIR_CRAWLER_REPLICA pReplica = NULL;
+    PTCHAR ptLdapServer = NULL;
+    BOOL bSucceeded = FALSE;
+
+    *pdwResultCount = 0;
+    *peStop = DirCrawlerStopNone;
+
+    // With replicas, the request waits for a slot on the least busy healthy DC
+    pReplica = (gs_sOptions.replicas.ptList != NULL) ? DirCrawlerReplicasAcquire(pReqDescr) : NULL;
+    ptLdapServer = (pReplica != NULL) ? pReplica->ptServer : pTarget->ldap.ptLdapServer;
+    REQ_LOG(pReqDescr, Dbg, _T("<thread:%#08x> <server:%s>"), GetCurrentThreadId(), ptLdapServer);
+
+    DIR_CRAWLER_TRACE_START(llTraceStart);
+    __try {
+        *pdwResultCount = DirCrawlerProcessLdapRequest(pReqDescr, pTarget, ptLdapServer, &gs_sOptions, dwAttempt, peStop);
+        InterlockedIncrement(gs_plSucceededRequestsCount);
+        bSucceeded = TRUE;
+    }
+#pragma warning(suppress: 6320)
+    __except (EXCEPTION_EXECUTE_HANDLER) {
+        REQ_LOG(pReqDescr, Err, _T("Abnormal termination <server:%s>"), ptLdapServer);
+        DirCrawlerFormatPoolAbortRequest();
+        DirCrawlerSinkAbortRequest();
+        DirCrawlerStatsAbortRequest();
+    }
+    DIR_CRAWLER_TRACE_STOP(llTraceStart, DirCrawlerTraceRequest, pReqDescr->infos.ptName);
+
+    if (pReplica != NULL) {
+        DirCrawlerReplicasRelease(pReplica, pReqDescr, bSucceeded);
+    }
+    return bSucceeded;
+}
+
 DWORD WINAPI DirCrawlerDoRequests(
     LPVOID lpThreadParameter
     ) {
@@ -682,24 +1420,92 @@ DWORD WINAPI DirCrawlerDoRequests(
 
     PSLIST_ENTRY pListEntry = NULL;
     PDIR_CRAWLER_REQ_LIST_ENTRY pReqListEntry = NULL;
+    DWORD dwResultCount = 0;
+    DIR_CRAWLER_STOP eStop = DirCrawlerStopNone;
+    BOOL bSucceeded = FALSE;
 
-    while ((pListEntry = InterlockedPopEntrySList(gs_pReqListHead)) != NULL) {
+    DirCrawlerHeapThreadStart();
+    // Rescheduled requests only run once all the others have been started
+    while ((pListEntry = InterlockedPopEntrySList(gs_pReqListHead)) != NULL || (pListEntry = InterlockedPopEntrySList(gs_pRetryListHead)) != NULL) {
         pReqListEntry = CONTAINING_RECORD(pListEntry, DIR_CRAWLER_REQ_LIST_ENTRY, sListEntry);
-        REQ_LOG(pReqListEntry->pReqDescr, Dbg, _T("<thread:%#08x>"), GetCurrentThreadId());
 
-        __try {
-            DirCrawlerProcessLdapRequest(pReqListEntry->pReqDescr, &gs_sOptions, gs_pRootDse);
-            InterlockedIncrement(gs_plSucceededRequestsCount);
-        }
-#pragma warning(suppress: 6320)
-        __except (EXCEPTION_EXECUTE_HANDLER) {
-            REQ_LOG(pReqListEntry->pReqDescr, Err, _T("Abnormal termination"));
+        // Past the deadline, the remaining requests are dropped instead of waiting for the threads
+        if (gs_ullRunDeadline > 0 && GetTickCount64() >= gs_ullRunDeadline) {
+            REQ_LOG(pReqListEntry->pReqDescr, Warn, _T("Skipped: run deadline reached"));
+            InterlockedIncrement(&gs_lDeadlineSkippedCount);
+            _aligned_free(pReqListEntry);
+            continue;
         }
 
+        bSucceeded = DirCrawlerRunRequest(pReqListEntry->pReqDescr, pReqListEntry->pTarget, pReqListEntry->dwAttempt, &dwResultCount, &eStop);
+        if (bSucceeded == TRUE && eStop == DirCrawlerStopTimeout && pReqListEntry->dwAttempt < DIR_CRAWLER_MAX_RESCHEDULES) {
+            pReqListEntry->dwAttempt += 1;
+            REQ_LOG(pReqListEntry->pReqDescr, Info, _T("Rescheduled after its timeout <attempt:%u>"), pReqListEntry->dwAttempt);
+            InterlockedIncrement(&gs_lRescheduledRequestsCount);
+            InterlockedPushEntrySList(gs_pRetryListHead, &pReqListEntry->sListEntry);
+            continue;
+        }
+        if (bSucceeded == TRUE && eStop != DirCrawlerStopNone) {
+            InterlockedIncrement(&gs_lPartialRequestsCount);
+        }
         _aligned_free(pReqListEntry);
     }
+    DirCrawlerHeapThreadEnd();
+
+    ASYNC_LOG(Dbg, _T("Exiting <thread:%#08x>"), GetCurrentThreadId());
+    return EXIT_SUCCESS;
+}
+
+DWORD WINAPI DirCrawlerDoClusterRequests(
+    LPVOID lpThreadParameter
+    ) {
+    UNREFERENCED_PARAMETER(lpThreadParameter);
+
+    PDIR_CRAWLER_CLUSTER_LINK pLink = NULL;
+    DWORD dwRequest = 0;
+    DWORD dwTarget = 0;
+    DWORD dwResultCount = 0;
+    DIR_CRAWLER_STOP eStop = DirCrawlerStopNone;
+    BOOL bSucceeded = FALSE;
+    BOOL bFailed = FALSE;
+    ULONGLONG ullTimeStart = 0;
+
+    // Same loop as 'DirCrawlerDoRequests', the requests coming from the coordinator instead of the local list
+    pLink = DirCrawlerClusterConnect(gs_sOptions.cluster.ptCoordinator, gs_pRequestsDescriptions->dwRequestCount, gs_dwTargetCount, gs_ullRunHash);
+    if (pLink == NULL) {
+        InterlockedIncrement(&gs_lClusterLinkFailures);
+        return EXIT_FAILURE;
+    }
+
+    DirCrawlerHeapThreadStart();
+    while (DirCrawlerClusterNextItem(pLink, &dwRequest, &dwTarget, &bFailed) == TRUE) {
+        if (dwRequest >= gs_pRequestsDescriptions->dwRequestCount || dwTarget >= gs_dwTargetCount) {
+            LOG(Err, _T("Invalid request from coordinator <request:%u> <target:%u>"), dwRequest, dwTarget);
+            bFailed = TRUE;
+            break;
+        }
+        InterlockedIncrement(&gs_lClusterItemsCount);
 
-    LOG(Dbg, _T("Exiting <thread:%#08x>"), GetCurrentThreadId());
+        ullTimeStart = GetTickCount64();
+        // Not rescheduled: a partial request is reported as succeeded to the coordinator, with the entries it wrote
+        bSucceeded = DirCrawlerRunRequest(&gs_pRequestsDescriptions->pRequestsDescriptions[dwRequest], &gs_pTargets[dwTarget], 0, &dwResultCount, &eStop);
+        if (bSucceeded == TRUE && eStop != DirCrawlerStopNone) {
+            InterlockedIncrement(&gs_lPartialRequestsCount);
+        }
+        if (DirCrawlerClusterReportItem(pLink, dwRequest, dwTarget, bSucceeded, dwResultCount, GetTickCount64() - ullTimeStart) == FALSE) {
+            LOG(Err, _T("Failed to report request <%s> to coordinator"), gs_pRequestsDescriptions->pRequestsDescriptions[dwRequest].infos.ptName);
+            bFailed = TRUE;
+            break;
+        }
+    }
+
+    DirCrawlerHeapThreadEnd();
+
+    if (bFailed == TRUE) {
+        InterlockedIncrement(&gs_lClusterLinkFailures);
+    }
+    DirCrawlerClusterDisconnect(&pLink);
+    ASYNC_LOG(Dbg, _T("Exiting <thread:%#08x>"), GetCurrentThreadId());
     return EXIT_SUCCESS;
 }
 
@@ -715,17 +1521,19 @@ int _tmain(
     BOOL globalSuccess = FALSE;
     DWORD dwResult = 0;
     DWORD i = 0;
+    DWORD j = 0;
     DWORD dwSentReqCount = 0;
-    PLDAP_CONNECT pConnection = NULL;
+    DWORD dwTotalReqCount = 0;
+    DWORD dwRunReqCount = 0;
+    PDIR_CRAWLER_TARGET pTarget = NULL;
     DIR_CRAWLER_REQ_DESCR_ARRAY sRequestsDescriptions = { 0 };
     ULONGLONG ullTimeStart = GetTickCount64();
     HANDLE *phThreads = NULL;
     PDIR_CRAWLER_REQ_LIST_ENTRY pReqListEntry = NULL;
-    PTCHAR ptRootFolderName = NULL;
-    TCHAR ptRootFolderPath[MAX_PATH] = { 0 };
-    TCHAR ptDefaultResultsFolderPath[MAX_PATH] = { 0 };
-    TCHAR ptDefaultLogPath[MAX_PATH] = { 0 };
     TCHAR atOutFileName[MAX_PATH] = { 0 };
+    TCHAR atInstanceName[MAX_LINE] = { 0 };
+    TCHAR atShardManifestName[MAX_LINE] = { 0 };
+    PTCHAR ptInstanceName = NULL;
 
     //
     // Init
@@ -747,6 +1555,15 @@ int _tmain(
         FATAL(_T("Failed to allocate request list header: <errno:%#08x>"), errno);
     }
     InitializeSListHead(gs_pReqListHead);
+    gs_pRetryListHead = _aligned_malloc(sizeof(SLIST_HEADER), MEMORY_ALLOCATION_ALIGNMENT);
+    if (gs_pRetryListHead == NULL) {
+        FATAL(_T("Failed to allocate retry list header: <errno:%#08x>"), errno);
+    }
+    InitializeSListHead(gs_pRetryListHead);
+    DirCrawlerStatsInit();
+#ifdef DIR_CRAWLER_TRACE
+    DirCrawlerTraceInit();
+#endif
 
     gs_plSucceededRequestsCount = _aligned_malloc(sizeof(LONG), MEMORY_ALLOCATION_ALIGNMENT);
     if (gs_plSucceededRequestsCount == NULL) {
@@ -765,10 +1582,77 @@ int _tmain(
 
     LOG(Succ, _T("Start"));
 
-    if (gs_sOptions.ldap.ptLdapServer == NULL) {
+    if (gs_sOptions.snapshot.ptLookupKey != NULL || gs_sOptions.snapshot.ptDiffFile != NULL) {
+        if (gs_sOptions.snapshot.ptFile == NULL) {
+            DirCrawlerUsage(argv[0], _T("Options '--lookup' and '--diff' need a '--snapshot' file"));
+        }
+        // Lookup or diff only: snapshots are mapped and read in place, nothing is crawled
+        if (gs_sOptions.snapshot.ptLookupKey != NULL) {
+            globalSuccess = DirCrawlerSnapshotLookup(gs_sOptions.snapshot.ptFile, gs_sOptions.snapshot.ptLookupKey);
+        }
+        else {
+            globalSuccess = DirCrawlerDiffSnapshots(gs_sOptions.snapshot.ptDiffFile, gs_sOptions.snapshot.ptFile, gs_sOptions.misc.dwMaxThreads);
+        }
+
+        DirCrawlerStatsCleanup();
+        UtilsHeapDestroy(&g_pDirCrawlerHeap);
+        _aligned_free(gs_plSucceededRequestsCount);
+        _aligned_free(gs_pReqListHead);
+        _aligned_free(gs_pRetryListHead);
+        LdapLibCleanup();
+        CsvLibCleanup();
+        JsonLibCleanup();
+        UtilsLibCleanup();
+        LogLibCleanup();
+        return globalSuccess ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (gs_sOptions.ldap.ptLdapServer == NULL && gs_sOptions.targets.dwCount == 0 && gs_sOptions.capture.ptReplayFile == NULL && gs_sOptions.bench.ptSyntheticSpec == NULL) {
         DirCrawlerUsage(argv[0], _T("Missing LDAP server"));
     }
 
+    if (gs_sOptions.targets.dwCount > 0) {
+        if (gs_sOptions.ldap.ptLdapServer != NULL || gs_sOptions.ldap.ptLogin != NULL || gs_sOptions.ldap.ptPassword != NULL || gs_sOptions.ldap.ptDnsName != NULL) {
+            DirCrawlerUsage(argv[0], _T("Option '--target' replaces options '-s', '-l', '-p' and '-d'"));
+        }
+        // Captures are keyed by request name only, they cannot tell the targets apart
+        if (gs_sOptions.capture.ptCaptureFile != NULL || gs_sOptions.capture.ptReplayFile != NULL || gs_sOptions.bench.ptSyntheticSpec != NULL) {
+            DirCrawlerUsage(argv[0], _T("Option '--target' cannot be used with '--capture', '--replay' or '--synthetic'"));
+        }
+    }
+
+    if (gs_sOptions.replicas.ptList != NULL && (gs_sOptions.targets.dwCount > 0 || gs_sOptions.capture.ptReplayFile != NULL || gs_sOptions.bench.ptSyntheticSpec != NULL)) {
+        DirCrawlerUsage(argv[0], _T("Option '--replicas' only applies to the '-s' server, without '--target', '--replay' or '--synthetic'"));
+    }
+
+    if (gs_sOptions.cluster.ptListenPort != NULL || gs_sOptions.cluster.ptCoordinator != NULL) {
+        if (gs_sOptions.cluster.ptListenPort != NULL && gs_sOptions.cluster.ptCoordinator != NULL) {
+            DirCrawlerUsage(argv[0], _T("Options '--coordinator' and '--worker' are mutually exclusive"));
+        }
+        // These outfiles are written once per run, by the process running all the requests
+        if (gs_sOptions.capture.ptCaptureFile != NULL || gs_sOptions.progress.ptMetricsFile != NULL || gs_sOptions.edges.bEnabled == TRUE || gs_sOptions.snapshot.ptFile != NULL || gs_sOptions.replicas.ptList != NULL) {
+            DirCrawlerUsage(argv[0], _T("Options '--coordinator' and '--worker' cannot be used with '--capture', '--progress', '--edges', '--memberships', '--snapshot' or '--replicas'"));
+        }
+        // Workers share the output directory: their logs and stats are told apart by their pid
+        if (gs_sOptions.cluster.ptCoordinator != NULL) {
+            _stprintf_s(atInstanceName, _countof(atInstanceName), _T("%s%u"), DIR_CRAWLER_CLUSTER_WORKER_PREFIX, GetCurrentProcessId());
+            ptInstanceName = atInstanceName;
+        }
+        DirCrawlerClusterInit();
+    }
+
+    if (gs_sOptions.capture.ptReplayFile != NULL && gs_sOptions.bench.ptSyntheticSpec != NULL) {
+        DirCrawlerUsage(argv[0], _T("Options '--replay' and '--synthetic' are mutually exclusive"));
+    }
+
+    if (gs_sOptions.capture.ptCaptureFile != NULL && gs_sOptions.capture.ptReplayFile != NULL) {
+        DirCrawlerUsage(argv[0], _T("Options '--capture' and '--replay' are mutually exclusive"));
+    }
+
+    if (gs_sOptions.sink.ptSpec != NULL && (gs_sOptions.shard.ullMaxRows > 0 || gs_sOptions.shard.ullMaxBytes > 0)) {
+        DirCrawlerUsage(argv[0], _T("Options '--shard-rows' and '--shard-size' only apply to CSV outfiles, not to '--sink'"));
+    }
+
     if (gs_sOptions.dump.ptOutputDir == NULL) {
         DirCrawlerUsage(argv[0], _T("Missing output directory"));
     }
@@ -777,56 +1661,66 @@ int _tmain(
         FATAL(_T("Invalid output directory <%s>"), gs_sOptions.dump.ptOutputDir);
     }
 
-    ptRootFolderName = DirCrawlerComputeOutputRootFolderName();
-    if (!ptRootFolderName) {
-       FATAL(_T("Unable to compute output directory architecture <%s>"), gs_sOptions.dump.ptOutputDir);
-    }
-
-    _stprintf_s(ptRootFolderPath, MAX_PATH, _T("%s\\%s"), gs_sOptions.dump.ptOutputDir, ptRootFolderName);
-    if (DirCrawlerCreateFolderRecursively(ptRootFolderPath) != TRUE) {
-       FATAL(_T("Unable to manually create directory architecture <%s>"), ptRootFolderPath);
-    }
-
-    _stprintf_s(ptDefaultResultsFolderPath, MAX_PATH, _T("%s\\%s\\Ldap"), gs_sOptions.dump.ptOutputDir, ptRootFolderName);
-    if (DirCrawlerCreateFolderRecursively(ptDefaultResultsFolderPath) != TRUE) {
-       FATAL(_T("Unable to manually create directory architecture <%s>"), ptDefaultResultsFolderPath);
+    //
+    // Targets: the '-s' server alone, or every '--target' (each with its own credentials and outfiles folder)
+    //
+    gs_dwTargetCount = max(1, gs_sOptions.targets.dwCount);
+    gs_pTargets = UtilsHeapAllocArrayHelper(g_pDirCrawlerHeap, DIR_CRAWLER_TARGET, gs_dwTargetCount);
+    if (gs_sOptions.targets.dwCount == 0) {
+        ZeroMemory(&gs_pTargets[0], sizeof(DIR_CRAWLER_TARGET));
+        gs_pTargets[0].ldap = gs_sOptions.ldap;
+    }
+    for (i = 0; i < gs_sOptions.targets.dwCount; i++) {
+        DirCrawlerParseTarget(gs_sOptions.targets.pptSpecs[i], gs_sOptions.ldap.dwLdapPort, &gs_pTargets[i]);
+        for (j = 0; j < i; j++) {
+            if (_tcsicmp(gs_pTargets[j].ldap.ptDnsName, gs_pTargets[i].ldap.ptDnsName) == 0) {
+                FATAL(_T("Target domain <%s> is specified twice"), gs_pTargets[i].ldap.ptDnsName);
+            }
+        }
     }
 
-    _stprintf_s(ptDefaultLogPath, MAX_PATH, _T("%s\\%s\\Logs"), gs_sOptions.dump.ptOutputDir, ptRootFolderName);
-    if (DirCrawlerCreateFolderRecursively(ptDefaultLogPath) != TRUE) {
-       FATAL(_T("Unable to manually create directory architecture <%s>"), ptDefaultLogPath);
+    for (i = 0; i < gs_dwTargetCount; i++) {
+        gs_pTargets[i].bForestNcs = TRUE; // until another target of the same forest is found before it
+        gs_pTargets[i].ptRootFolderName = DirCrawlerComputeOutputRootFolderName(gs_pTargets[i].ldap.ptDnsName);
+        if (!gs_pTargets[i].ptRootFolderName) {
+           FATAL(_T("Unable to compute output directory architecture <%s>"), gs_sOptions.dump.ptOutputDir);
+        }
+        DirCrawlerCreateOutputFolders(gs_sOptions.dump.ptOutputDir, &gs_pTargets[i]);
     }
 
     if (((gs_sOptions.ldap.ptLogin != NULL) ^ (gs_sOptions.ldap.ptPassword != NULL)) == TRUE) {
         DirCrawlerUsage(argv[0], _T("You must specify a username AND a password to use explicit authentication"));
     }
 
-    LOG(Info, SUB_LOG(_T("LDAP server <%s:%u>")), gs_sOptions.ldap.ptLdapServer, gs_sOptions.ldap.dwLdapPort);
-    if (gs_sOptions.ldap.ptLogin != NULL) {
-        LOG(Info, SUB_LOG(_T("LDAP explicit authentication with username <%s%s%s>")),
-            gs_sOptions.ldap.ptExplicitDomain != NULL ? gs_sOptions.ldap.ptExplicitDomain : EMPTY_STR,
-            gs_sOptions.ldap.ptExplicitDomain ? _T("\\") : EMPTY_STR,
-            gs_sOptions.ldap.ptLogin);
-    }
-    else {
-        TCHAR atUserName[MAX_LINE] = { 0 };
-        DWORD dwSize = MAX_LINE;
-        GetUserName(atUserName, &dwSize);
-        LOG(Info, SUB_LOG(_T("LDAP implicit authentication with username <%s>")), atUserName);
+    for (i = 0; i < gs_dwTargetCount; i++) {
+        LOG(Info, SUB_LOG(_T("LDAP server <%s:%u>")), gs_pTargets[i].ldap.ptLdapServer, gs_pTargets[i].ldap.dwLdapPort);
+        if (gs_pTargets[i].ldap.ptLogin != NULL) {
+            LOG(Info, SUB_LOG(_T("LDAP explicit authentication with username <%s%s%s>")),
+                gs_pTargets[i].ldap.ptExplicitDomain != NULL ? gs_pTargets[i].ldap.ptExplicitDomain : EMPTY_STR,
+                gs_pTargets[i].ldap.ptExplicitDomain ? _T("\\") : EMPTY_STR,
+                gs_pTargets[i].ldap.ptLogin);
+        }
+        else {
+            TCHAR atUserName[MAX_LINE] = { 0 };
+            DWORD dwSize = MAX_LINE;
+            GetUserName(atUserName, &dwSize);
+            LOG(Info, SUB_LOG(_T("LDAP implicit authentication with username <%s>")), atUserName);
+        }
     }
 
     if (gs_sOptions.dump.ptJsonFile == NULL) {
         DirCrawlerUsage(argv[0], _T("Missing JSON request file"));
     }
 
-    if (gs_sOptions.misc.dwMaxThreads > 1) {
+    // The coordinator runs no request itself
+    if (gs_sOptions.misc.dwMaxThreads > 1 && gs_sOptions.cluster.ptListenPort == NULL) {
         LOG(Info, SUB_LOG(_T("Using <%u> threads")), gs_sOptions.misc.dwMaxThreads);
         if (gs_sOptions.misc.dwMaxThreads >= MAXIMUM_WAIT_OBJECTS) {
             FATAL(_T("Cannot create more thread than 'MAXIMUM_WAIT_OBJECTS' <%u>"), MAXIMUM_WAIT_OBJECTS);
         }
         phThreads = UtilsHeapAllocArrayHelper(g_pDirCrawlerHeap, HANDLE, gs_sOptions.misc.dwMaxThreads);
         for (i = 0; i<gs_sOptions.misc.dwMaxThreads; i++){
-            phThreads[i] = CreateThread(NULL, 0, DirCrawlerDoRequests, NULL, CREATE_SUSPENDED, NULL);
+            phThreads[i] = CreateThread(NULL, 0, gs_sOptions.cluster.ptCoordinator != NULL ? DirCrawlerDoClusterRequests : DirCrawlerDoRequests, NULL, CREATE_SUSPENDED, NULL);
             if (phThreads[i] == NULL) {
                 FATAL(_T("Failed to create thread <%u/%u>: <gle:%#08x>"), i + 1, gs_sOptions.misc.dwMaxThreads, GLE());
             }
@@ -859,22 +1753,89 @@ int _tmain(
     LOG(Succ, SUB_LOG(_T("Read <%u> LDAP requests")), sRequestsDescriptions.dwRequestCount);
 
     //
-    // LDAP connexion
+    // LDAP connexion (or capture file when replaying)
     //
-    LOG(Succ, _T("Connecting to LDAP server..."));
-    bResult = LdapConnect(gs_sOptions.ldap.ptLdapServer, gs_sOptions.ldap.dwLdapPort, &pConnection, &gs_pRootDse);
-    if (!bResult) {
-        FATAL(_T("Failed to connect to LDAP server: <err:%#08x>"), LdapLastError());
+    if (gs_sOptions.capture.ptReplayFile != NULL) {
+        LOG(Succ, _T("Opening capture file..."));
+        DirCrawlerReplayInit(gs_sOptions.capture.ptReplayFile);
+    }
+    else if (gs_sOptions.bench.ptSyntheticSpec != NULL) {
+        LOG(Succ, _T("Generating synthetic directory..."));
+        DirCrawlerSyntheticInit(gs_sOptions.bench.ptSyntheticSpec);
+        if (gs_sOptions.capture.ptCaptureFile != NULL) {
+            DirCrawlerCaptureInit(gs_sOptions.capture.ptCaptureFile);
+        }
+    }
+    else {
+        LOG(Succ, _T("Connecting to LDAP server..."));
+        DirCrawlerTlsInit(gs_sOptions.tls.ptMode, gs_sOptions.tls.bInsecure, gs_sOptions.tls.bNoResume);
+        for (i = 0; i < gs_dwTargetCount; i++) {
+            pTarget = &gs_pTargets[i];
+            DIR_CRAWLER_TRACE_CALL(DirCrawlerTraceLdapConnect, pTarget->ldap.ptLdapServer, bResult = DirCrawlerTlsConnect(pTarget->ldap.ptLdapServer, pTarget->ldap.dwLdapPort, &pTarget->pConnection, &pTarget->pRootDse));
+            if (!bResult) {
+                FATAL(_T("Failed to connect to LDAP server <%s>: <err:%#08x>"), pTarget->ldap.ptLdapServer, LdapLastError());
+            }
+
+            for (j = 0; j < pTarget->pRootDse->computed.count.dwNamingContextsCount; j++) {
+                LOG(Info, SUB_LOG(_T("NC: <%s>")), pTarget->pRootDse->extracted.pptNamingContexts[j]);
+            }
+
+            // Configuration and schema NCs are replicated forest-wide: they are crawled through the first target of each forest
+            for (j = 0; j < i && pTarget->bForestNcs == TRUE; j++) {
+                if (_tcsicmp(gs_pTargets[j].pRootDse->extracted.ptConfigurationNamingContext, pTarget->pRootDse->extracted.ptConfigurationNamingContext) == 0) {
+                    LOG(Info, SUB_LOG(_T("Forest NCs of <%s> already crawled through <%s>")), pTarget->ldap.ptDnsName, gs_pTargets[j].ldap.ptDnsName);
+                    pTarget->bForestNcs = FALSE;
+                }
+            }
+        }
+
+        if (gs_sOptions.capture.ptCaptureFile != NULL) {
+            DirCrawlerCaptureInit(gs_sOptions.capture.ptCaptureFile);
+        }
+
+        LOG(Succ, _T("Loading schema catalog..."));
+        DirCrawlerSchemaLoad(gs_pTargets[0].pConnection, gs_pTargets[0].pRootDse, &gs_pTargets[0].ldap, gs_sOptions.schema.ptCacheFile);
+
+        if (gs_sOptions.replicas.ptList != NULL) {
+            LOG(Succ, _T("Checking replica DCs..."));
+            DirCrawlerReplicasInit(gs_sOptions.replicas.ptList, gs_pTargets[0].pConnection, gs_pTargets[0].pRootDse, &gs_pTargets[0].ldap, gs_sOptions.replicas.dwMaxRequests);
+        }
     }
 
-    for (i = 0; i < gs_pRootDse->computed.count.dwNamingContextsCount; i++) {
-        LOG(Info, SUB_LOG(_T("NC: <%s>")), gs_pRootDse->extracted.pptNamingContexts[i]);
+    // Without LDAP server, the catalog can only come from a previous run
+    if (gs_pTargets[0].pRootDse == NULL && gs_sOptions.schema.ptCacheFile != NULL) {
+        DirCrawlerSchemaLoadCache(gs_sOptions.schema.ptCacheFile);
     }
+    DirCrawlerSchemaResolveRequests(&sRequestsDescriptions);
 
+    if (gs_sOptions.edges.bEnabled == TRUE) {
+        DirCrawlerEdgesInit(gs_sOptions.edges.bMemberships);
+    }
+    DirCrawlerBudgetInit(gs_sOptions.budget.ullBytes);
+    DirCrawlerHeapInit(gs_sOptions.heap.bShared);
+
+    // The coordinator formats no entry
+    if (gs_sOptions.format.dwThreads > 0 && gs_sOptions.cluster.ptListenPort == NULL) {
+        DirCrawlerFormatPoolInit(gs_sOptions.format.dwThreads, DirCrawlerFormatAttributeTo, DirCrawlerFormatEntrySide);
+    }
+
+    if (gs_sOptions.snapshot.ptFile != NULL) {
+        DirCrawlerSnapshotInit(gs_sOptions.snapshot.ptFile);
+    }
+
+    for (i = 0; i < gs_dwTargetCount; i++) {
+        if (gs_sOptions.misc.ptOutfilesPrefix != NULL) {
+            gs_pTargets[i].ptOutfilesPrefix = gs_sOptions.misc.ptOutfilesPrefix;
+        }
+        else {
+            DirCrawlerSetDefaultPrefix(&gs_pTargets[i]);
+        }
+    }
+
+    // Outfiles that are not specific to a request (logs, stats, edges nodes...) go to the folder of the first target
     if (gs_sOptions.misc.ptOutfilesPrefix == NULL) {
-        DirCrawlerSetDefaultPrefix(&gs_sOptions, gs_pRootDse);
         if (gs_sOptions.log.ptLogFile == NULL) {
-           bResult = DirCrawlerFormatOutfile(atOutFileName, gs_sOptions.dump.ptOutputDir, DIR_CRAWLER_LOG_DIR, gs_sOptions.misc.ptOutfilesPrefix ? gs_sOptions.misc.ptOutfilesPrefix : DIR_CRAWLER_LOGFILE_PREFIX, DIR_CRAWLER_OUTFILES_KEYWORD, NULL, DIR_CRAWLER_LOGFILE_EXT);
+           bResult = DirCrawlerFormatOutfile(atOutFileName, gs_sOptions.dump.ptOutputDir, gs_pTargets[0].ptRootFolderName, DIR_CRAWLER_LOG_DIR, gs_pTargets[0].ptOutfilesPrefix ? gs_pTargets[0].ptOutfilesPrefix : DIR_CRAWLER_LOGFILE_PREFIX, DIR_CRAWLER_OUTFILES_KEYWORD, ptInstanceName, DIR_CRAWLER_LOGFILE_EXT);
            if (bResult == FALSE) {
               FATAL(_T("Failed to format outfile path"));
            }
@@ -885,28 +1846,80 @@ int _tmain(
         }
     }
 
+    // The coordinator writes no outfile
+    if (gs_sOptions.cluster.ptListenPort == NULL) {
+        DirCrawlerSinkInit(gs_sOptions.sink.ptSpec);
+    }
+
+    // Each worker has its own shards manifest
+    if ((gs_sOptions.shard.ullMaxRows > 0 || gs_sOptions.shard.ullMaxBytes > 0) && gs_sOptions.cluster.ptListenPort == NULL) {
+        if (ptInstanceName != NULL) {
+            _stprintf_s(atShardManifestName, _countof(atShardManifestName), _T("%s_%s"), ptInstanceName, DIR_CRAWLER_SHARD_MANIFEST_OUTFILE);
+        }
+        else {
+            _tcscpy_s(atShardManifestName, _countof(atShardManifestName), DIR_CRAWLER_SHARD_MANIFEST_OUTFILE);
+        }
+        bResult = DirCrawlerFormatOutfile(atOutFileName, gs_sOptions.dump.ptOutputDir, gs_pTargets[0].ptRootFolderName, DIR_CRAWLER_STATS_DIR, gs_pTargets[0].ptOutfilesPrefix, DIR_CRAWLER_OUTFILES_KEYWORD, atShardManifestName, DIR_CRAWLER_STATSFILE_EXT);
+        if (bResult == FALSE) {
+            FATAL(_T("Failed to format outfile path"));
+        }
+        DirCrawlerShardInit(gs_sOptions.shard.ullMaxRows, gs_sOptions.shard.ullMaxBytes, atOutFileName);
+    }
+
+    // Coordinator and workers check they agree on the requests, targets and outfiles before exchanging request indexes
+    gs_pRequestsDescriptions = &sRequestsDescriptions;
+    if (gs_sOptions.cluster.ptListenPort != NULL || gs_sOptions.cluster.ptCoordinator != NULL) {
+        gs_ullRunHash = DirCrawlerClusterRunHash(&sRequestsDescriptions, gs_pTargets, gs_dwTargetCount);
+    }
+
     //
     // Dump
     //
     LOG(Succ, _T("Starting LDAP requests..."));
-    for (i = sRequestsDescriptions.dwRequestCount - 1; i != (DWORD)-1; i--) {
+    dwTotalReqCount = sRequestsDescriptions.dwRequestCount * gs_dwTargetCount;
+    // Workers get their requests from the coordinator
+    for (i = sRequestsDescriptions.dwRequestCount - 1; i != (DWORD)-1 && gs_sOptions.cluster.ptCoordinator == NULL; i--) {
         // Skip requests not present in the sublist if one has been specified
         if (gs_sOptions.dump.requests.dwCount > 0 && IsInSetOfStrings(sRequestsDescriptions.pRequestsDescriptions[i].infos.ptName, gs_sOptions.dump.requests.pptList, gs_sOptions.dump.requests.dwCount, NULL) == FALSE) {
             LOG(Warn, SUB_LOG(_T("Skipping <%s>")), sRequestsDescriptions.pRequestsDescriptions[i].infos.ptName);
+            continue;
         }
-        // For all others requests: push them in the synchronized-linked-list
-        else {
+        // For all others requests: push them in the synchronized-linked-list, once per target (the targets of a request are popped in a row)
+        for (j = gs_dwTargetCount - 1; j != (DWORD)-1; j--) {
+            if (gs_pTargets[j].bForestNcs == FALSE && sRequestsDescriptions.pRequestsDescriptions[i].ldap.base.eType == DirCrawlerLdapBaseNcShortcut
+                && (sRequestsDescriptions.pRequestsDescriptions[i].ldap.base.value.eBaseNcShortcut == DirCrawlerLdapNcConfiguration || sRequestsDescriptions.pRequestsDescriptions[i].ldap.base.value.eBaseNcShortcut == DirCrawlerLdapNcSchema)) {
+                LOG(Dbg, SUB_LOG(_T("Skipping <%s> on <%s>: forest NC")), sRequestsDescriptions.pRequestsDescriptions[i].infos.ptName, gs_pTargets[j].ldap.ptDnsName);
+                continue;
+            }
             pReqListEntry = _aligned_malloc(sizeof(DIR_CRAWLER_REQ_LIST_ENTRY), MEMORY_ALLOCATION_ALIGNMENT);
             if (pReqListEntry == NULL) {
                 FATAL(_T("Failed to allocate request list entry: <errno:%#08x>"), errno);
             }
             pReqListEntry->pReqDescr = &sRequestsDescriptions.pRequestsDescriptions[i];
+            pReqListEntry->pTarget = &gs_pTargets[j];
+            pReqListEntry->dwAttempt = 0;
             InterlockedPushEntrySList(gs_pReqListHead, &pReqListEntry->sListEntry);
             dwSentReqCount += 1;
         }
     }
-    // Then either start all the waiting worker threads, or call the 'DirCrawlerDoRequests' method manually if we're single-threaded
-    if (gs_sOptions.misc.dwMaxThreads > 1) {
+    if (gs_sOptions.progress.ptMetricsFile != NULL) {
+        DirCrawlerProgressStart(gs_sOptions.progress.ptMetricsFile, gs_sOptions.progress.dwInterval, gs_pReqListHead);
+    }
+
+    // The deadline counts from the start of the requests, not from the preparation of the run
+    if (gs_sOptions.limits.dwDeadline > 0) {
+        gs_ullRunDeadline = GetTickCount64() + (ULONGLONG)gs_sOptions.limits.dwDeadline * 1000;
+    }
+
+    // Worker threads log through the flusher thread from now on
+    DirCrawlerLogStart(gs_sOptions.log.ptLogLevelConsole, gs_sOptions.log.ptLogLevelFile, gs_sOptions.log.dwBurst);
+
+    // Then either hand out the requests to the worker processes, start all the waiting worker threads, or call the 'DirCrawlerDoRequests' method manually if we're single-threaded
+    if (gs_sOptions.cluster.ptListenPort != NULL) {
+        // Coordinator
+        (*gs_plSucceededRequestsCount) = (LONG)DirCrawlerClusterServe(gs_sOptions.cluster.ptListenPort, gs_pReqListHead, dwSentReqCount, &sRequestsDescriptions, gs_pTargets, gs_dwTargetCount, gs_ullRunHash);
+    }
+    else if (gs_sOptions.misc.dwMaxThreads > 1) {
         // Multi-threaded
         for (i = 0; i < gs_sOptions.misc.dwMaxThreads; i++) {
             dwResult = ResumeThread(phThreads[i]);
@@ -922,26 +1935,99 @@ int _tmain(
     }
     else {
         // Single-threaded
-        DirCrawlerDoRequests(NULL);
+        if (gs_sOptions.cluster.ptCoordinator != NULL) {
+            DirCrawlerDoClusterRequests(NULL);
+        }
+        else {
+            DirCrawlerDoRequests(NULL);
+        }
     }
+    DirCrawlerLogStop();
+    DirCrawlerProgressStop();
+
+    if (gs_sOptions.cluster.ptCoordinator != NULL) {
+        dwSentReqCount = (DWORD)gs_lClusterItemsCount;
+        dwTotalReqCount = dwSentReqCount;
+    }
+    // Every attempt of a rescheduled request is counted, requests skipped by the deadline are failed
+    dwRunReqCount = dwSentReqCount + (DWORD)gs_lRescheduledRequestsCount;
 
     LOG(Succ, _T("Done: <total:%u> <filtered:%u> <kept:%u> <succ:%u/%u> <fail:%u/%u> <time:%.3fs>"),
-        sRequestsDescriptions.dwRequestCount,
-        (sRequestsDescriptions.dwRequestCount - dwSentReqCount),
+        dwTotalReqCount,
+        (dwTotalReqCount - dwSentReqCount),
         dwSentReqCount,
         (*gs_plSucceededRequestsCount),
-        dwSentReqCount,
-        dwSentReqCount - (*gs_plSucceededRequestsCount),
-        dwSentReqCount,
+        dwRunReqCount,
+        dwRunReqCount - (*gs_plSucceededRequestsCount),
+        dwRunReqCount,
         TIME_DIFF_SEC(ullTimeStart, GetTickCount64()));
+    if (gs_lPartialRequestsCount > 0 || gs_lRescheduledRequestsCount > 0 || gs_lDeadlineSkippedCount > 0) {
+        LOG(Warn, SUB_LOG(_T("Limits: <partial:%u> <rescheduled:%u> <skipped-by-deadline:%u>")), gs_lPartialRequestsCount, gs_lRescheduledRequestsCount, gs_lDeadlineSkippedCount);
+    }
 
-    if (dwSentReqCount - (*gs_plSucceededRequestsCount) == 0) {
+    if (gs_sOptions.bench.bReport == TRUE) {
+        DirCrawlerStatsReport();
+    }
+
+    if (gs_sOptions.cluster.ptListenPort != NULL) {
+        // The requests stats are in the stats outfiles of the workers
+        bResult = DirCrawlerFormatOutfile(atOutFileName, gs_sOptions.dump.ptOutputDir, gs_pTargets[0].ptRootFolderName, DIR_CRAWLER_STATS_DIR, gs_pTargets[0].ptOutfilesPrefix, DIR_CRAWLER_OUTFILES_KEYWORD, DIR_CRAWLER_CLUSTER_MANIFEST_OUTFILE, DIR_CRAWLER_STATSFILE_EXT);
+        if (bResult == FALSE) {
+            FATAL(_T("Failed to format outfile path"));
+        }
+        DirCrawlerClusterWriteManifest(atOutFileName);
+    }
+    else {
+        bResult = DirCrawlerFormatOutfile(atOutFileName, gs_sOptions.dump.ptOutputDir, gs_pTargets[0].ptRootFolderName, DIR_CRAWLER_STATS_DIR, gs_pTargets[0].ptOutfilesPrefix, DIR_CRAWLER_OUTFILES_KEYWORD, ptInstanceName, DIR_CRAWLER_STATSFILE_EXT);
+        if (bResult == FALSE) {
+            FATAL(_T("Failed to format outfile path"));
+        }
+        DirCrawlerStatsWriteJson(atOutFileName, gs_sOptions.misc.dwMaxThreads);
+    }
+
+    if (gs_sOptions.replicas.ptList != NULL) {
+        bResult = DirCrawlerFormatOutfile(atOutFileName, gs_sOptions.dump.ptOutputDir, gs_pTargets[0].ptRootFolderName, DIR_CRAWLER_STATS_DIR, gs_pTargets[0].ptOutfilesPrefix, DIR_CRAWLER_OUTFILES_KEYWORD, DIR_CRAWLER_REPLICAS_OUTFILE, DIR_CRAWLER_STATSFILE_EXT);
+        if (bResult == FALSE) {
+            FATAL(_T("Failed to format outfile path"));
+        }
+        DirCrawlerReplicasWriteJson(atOutFileName);
+    }
+
+    if (gs_sOptions.edges.bEnabled == TRUE) {
+        bResult = DirCrawlerFormatOutfile(atOutFileName, gs_sOptions.dump.ptOutputDir, gs_pTargets[0].ptRootFolderName, DIR_CRAWLER_OUTPUT_DIR, gs_pTargets[0].ptOutfilesPrefix, DIR_CRAWLER_OUTFILES_KEYWORD, DIR_CRAWLER_EDGES_NODES_OUTFILE, DIR_CRAWLER_EDGES_OUTFILES_EXT);
+        if (bResult == FALSE) {
+            FATAL(_T("Failed to format outfile path"));
+        }
+        DirCrawlerEdgesWriteNodes(atOutFileName);
+    }
+
+    if (gs_sOptions.edges.bMemberships == TRUE) {
+        bResult = DirCrawlerFormatOutfile(atOutFileName, gs_sOptions.dump.ptOutputDir, gs_pTargets[0].ptRootFolderName, DIR_CRAWLER_OUTPUT_DIR, gs_pTargets[0].ptOutfilesPrefix, DIR_CRAWLER_OUTFILES_KEYWORD, DIR_CRAWLER_MEMBERSHIP_OUTFILE, DIR_CRAWLER_EDGES_OUTFILES_EXT);
+        if (bResult == FALSE) {
+            FATAL(_T("Failed to format outfile path"));
+        }
+        DirCrawlerMembershipCompute(atOutFileName, gs_sOptions.misc.dwMaxThreads);
+    }
+
+    if (gs_sOptions.snapshot.ptFile != NULL) {
+        DirCrawlerSnapshotFinalize();
+    }
+
+#ifdef DIR_CRAWLER_TRACE
+    bResult = DirCrawlerFormatOutfile(atOutFileName, gs_sOptions.dump.ptOutputDir, gs_pTargets[0].ptRootFolderName, DIR_CRAWLER_STATS_DIR, gs_pTargets[0].ptOutfilesPrefix, DIR_CRAWLER_OUTFILES_KEYWORD, DIR_CRAWLER_TRACE_FILE_KEYWORD, DIR_CRAWLER_STATSFILE_EXT);
+    if (bResult == FALSE) {
+        FATAL(_T("Failed to format outfile path"));
+    }
+    DirCrawlerTraceWriteJson(atOutFileName);
+#endif
+
+    if (dwRunReqCount - (*gs_plSucceededRequestsCount) == 0 && gs_lClusterLinkFailures == 0) {
         globalSuccess = TRUE;
     }
     //
     // Cleanup & exit
     //
-    if (gs_sOptions.misc.dwMaxThreads > 1) {
+    if (phThreads != NULL) {
         for (i = 0; i < gs_sOptions.misc.dwMaxThreads; i++) {
             CloseHandle(phThreads[i]);
             phThreads[i] = INVALID_HANDLE_VALUE;
@@ -949,12 +2035,34 @@ int _tmain(
         UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, phThreads);
     }
     UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, gs_sOptions.dump.requests.pptList);
-    UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, ptRootFolderName);
+    UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, gs_sOptions.targets.pptSpecs);
     DirCrawlerJsonReleaseRequests(&sRequestsDescriptions);
-    LdapCloseConnection(&pConnection, &gs_pRootDse);
+    DirCrawlerFormatPoolCleanup();
+    DirCrawlerCaptureCleanup();
+    DirCrawlerReplayCleanup();
+    DirCrawlerStatsCleanup();
+    DirCrawlerSchemaCleanup();
+    DirCrawlerEdgesCleanup();
+    DirCrawlerSnapshotCleanup();
+    DirCrawlerShardCleanup();
+    DirCrawlerSinkCleanup();
+    DirCrawlerReplicasCleanup();
+    DirCrawlerClusterCleanup();
+#ifdef DIR_CRAWLER_TRACE
+    DirCrawlerTraceCleanup();
+#endif
+    for (i = 0; i < gs_dwTargetCount; i++) {
+        if (gs_pTargets[i].pConnection != NULL) {
+            LdapCloseConnection(&gs_pTargets[i].pConnection, &gs_pTargets[i].pRootDse);
+        }
+        UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, gs_pTargets[i].ptRootFolderName);
+    }
+    DirCrawlerTlsCleanup();
+    UtilsHeapFreeAndNullHelper(g_pDirCrawlerHeap, gs_pTargets);
     UtilsHeapDestroy(&g_pDirCrawlerHeap);
     _aligned_free(gs_plSucceededRequestsCount);
     _aligned_free(gs_pReqListHead);
+    _aligned_free(gs_pRetryListHead);
 
     LOG(Succ, _T("Exit."));
 
@@ -22,11 +22,13 @@
 #define DIR_CRAWLER_SEPARATOR_ESCAPE    _T('\\')
 
 //
-// Log for requests
+// Log for requests and worker threads, written by the log flusher thread (see DirCrawlerLog.h)
 //
-#define REQ_LOG(req, lvl, frmt, ...)    LOG(lvl, SUB_LOG(_T("[%s] ") ## frmt), (req)->infos.ptName, __VA_ARGS__)
+#define ASYNC_LOG(lvl, frmt, ...)       DirCrawlerLogAsync(DirCrawlerLog ## lvl, frmt, __VA_ARGS__)
+#define REQ_LOG(req, lvl, frmt, ...)    DirCrawlerLogAsync(DirCrawlerLog ## lvl, SUB_LOG(_T("[%s] ") ## frmt), (req)->infos.ptName, __VA_ARGS__)
 #define REQ_FATAL(req, frmt, ...)       MULTI_LINE_MACRO_BEGIN                      \
                                             REQ_LOG(req, Err, frmt, __VA_ARGS__);   \
+                                            DirCrawlerLogFlush();                   \
                                             GenerateException();                    \
                                         MULTI_LINE_MACRO_END
 
@@ -40,8 +42,62 @@
 #define DIR_CRAWLER_OUTFILES_EXT        _T("csv")
 #define DIR_CRAWLER_LOGFILE_EXT         _T("log")
 #define DIR_CRAWLER_LOGFILE_PREFIX      _T("XX")
+#define DIR_CRAWLER_STATS_DIR           _T("Stats")
+#define DIR_CRAWLER_STATSFILE_EXT       _T("json")
+#define DIR_CRAWLER_SINGLE_VALUE_MAX_LEN 256    // single-valued attributes formatted up to this len go through a stack buffer
+#define DIR_CRAWLER_MEASURED_ATTRS_MAX  64      // attributes lens kept on the stack between the measure and the formatting of a record
+
+//
+// Limits: a request stopped by its "timeout" or "maxentries", or by the '--deadline' of the run, keeps the entries already
+// written, and its outfile gets a '<outfile>.partial' marker (removed by a later complete run). Requests stopped by their
+// timeout are pushed back at the end of the run, with a timeout doubled on every attempt.
+//
+#define DIR_CRAWLER_PARTIAL_EXT         _T("partial")
+#define DIR_CRAWLER_MAX_RESCHEDULES     2
+
+//
+// Long-only options (values outside of the range of the short options)
+//
+#define DIR_CRAWLER_LONGOPT_CAPTURE     0x100
+#define DIR_CRAWLER_LONGOPT_REPLAY      0x101
+#define DIR_CRAWLER_LONGOPT_SYNTHETIC   0x102
+#define DIR_CRAWLER_LONGOPT_BENCH       0x103
+#define DIR_CRAWLER_LONGOPT_PROGRESS    0x104
+#define DIR_CRAWLER_LONGOPT_PROGRESS_INTERVAL 0x105
+#define DIR_CRAWLER_LONGOPT_SCHEMA_CACHE 0x106
+#define DIR_CRAWLER_LONGOPT_EDGES       0x107
+#define DIR_CRAWLER_LONGOPT_MEMBERSHIPS 0x108
+#define DIR_CRAWLER_LONGOPT_SNAPSHOT    0x109
+#define DIR_CRAWLER_LONGOPT_LOOKUP      0x10A
+#define DIR_CRAWLER_LONGOPT_DIFF        0x10B
+#define DIR_CRAWLER_LONGOPT_TARGET      0x10C
+#define DIR_CRAWLER_LONGOPT_REPLICAS    0x10D
+#define DIR_CRAWLER_LONGOPT_REPLICA_REQUESTS 0x10E
+#define DIR_CRAWLER_LONGOPT_COORDINATOR 0x10F
+#define DIR_CRAWLER_LONGOPT_WORKER      0x110
+#define DIR_CRAWLER_LONGOPT_MEMORY_BUDGET 0x111
+#define DIR_CRAWLER_LONGOPT_SHARED_HEAP 0x112
+#define DIR_CRAWLER_LONGOPT_LOG_BURST   0x113
+#define DIR_CRAWLER_LONGOPT_TLS         0x114
+#define DIR_CRAWLER_LONGOPT_TLS_INSECURE 0x115
+#define DIR_CRAWLER_LONGOPT_TLS_NO_RESUME 0x116
+#define DIR_CRAWLER_LONGOPT_SHARD_ROWS  0x117
+#define DIR_CRAWLER_LONGOPT_SHARD_SIZE  0x118
+#define DIR_CRAWLER_LONGOPT_DEADLINE    0x119
+#define DIR_CRAWLER_LONGOPT_SINK        0x11A
+#define DIR_CRAWLER_LONGOPT_FORMAT_THREADS 0x11B
 
 /* --- TYPES ---------------------------------------------------------------- */
+typedef enum _DIR_CRAWLER_LOG_LEVEL {   // LogLib levels, in the order of their names
+    DirCrawlerLogAll,
+    DirCrawlerLogDbg,
+    DirCrawlerLogInfo,
+    DirCrawlerLogWarn,
+    DirCrawlerLogErr,
+    DirCrawlerLogSucc,
+    DirCrawlerLogNone
+} DIR_CRAWLER_LOG_LEVEL;
+
 typedef struct _LDAP_OPTIONS {
     PTCHAR ptLogin;
     PTCHAR ptPassword;
@@ -68,8 +124,85 @@ typedef struct _DIR_CRAWLER_OPTIONS {
         PTCHAR ptLogFile;
         PTCHAR ptLogLevelFile;
         PTCHAR ptLogLevelConsole;
+        DWORD dwBurst;              // messages per call site and second of the worker threads below 'Err', 0 for no limit
     } log;
 
+    struct {
+        PTCHAR ptCaptureFile;
+        PTCHAR ptReplayFile;
+    } capture;
+
+    struct {
+        PTCHAR ptSyntheticSpec;
+        BOOL bReport;
+    } bench;
+
+    struct {
+        PTCHAR ptMetricsFile;
+        DWORD dwInterval;
+    } progress;
+
+    struct {
+        ULONGLONG ullBytes;     // formatted records held at once, 0 for unlimited
+    } budget;
+
+    struct {
+        BOOL bShared;           // worker threads allocate from g_pDirCrawlerHeap instead of their own heap
+    } heap;
+
+    struct {
+        DWORD dwThreads;        // pool formatting the entries of all the requests, 0 to format them in the search threads
+    } format;
+
+    struct {
+        PTCHAR ptMode;          // 'ldaps' or 'starttls', NULL for plaintext LDAP
+        BOOL bInsecure;
+        BOOL bNoResume;
+    } tls;
+
+    struct {
+        ULONGLONG ullMaxRows;   // rows per outfile shard, 0 for unlimited
+        ULONGLONG ullMaxBytes;  // estimated bytes per outfile shard, 0 for unlimited
+    } shard;
+
+    struct {
+        PTCHAR ptSpec;          // 'pipe:<name>', 'unix:<path>' or 'tcp:<host>:<port>', NULL for CSV outfiles
+    } sink;
+
+    struct {
+        DWORD dwDeadline;       // seconds after the start of the requests at which the run stops, 0 for none
+    } limits;
+
+    struct {
+        PTCHAR ptCacheFile;
+    } schema;
+
+    struct {
+        BOOL bEnabled;
+        BOOL bMemberships;      // implies bEnabled
+    } edges;
+
+    struct {
+        PTCHAR ptFile;
+        PTCHAR ptLookupKey;     // lookup in ptFile instead of crawling
+        PTCHAR ptDiffFile;      // diff ptFile against this older snapshot instead of crawling
+    } snapshot;
+
+    struct {
+        PTCHAR *pptSpecs;       // '<dns name>,<server>[,<username>,<password>]', replaces the 'ldap' options
+        DWORD dwCount;
+    } targets;
+
+    struct {
+        PTCHAR ptList;          // DCs to spread the requests over (comma separated), or 'auto'
+        DWORD dwMaxRequests;    // concurrent requests per DC (default: the thread count)
+    } replicas;
+
+    struct {
+        PTCHAR ptListenPort;    // coordinator: hands out the requests to the workers instead of running them
+        PTCHAR ptCoordinator;   // worker: '<host>:<port>' of the coordinator to get the requests from
+    } cluster;
+
     struct {
         BOOL bShowHelp;
         DWORD dwMaxThreads;
@@ -82,8 +215,22 @@ typedef enum _DIR_CRAWLER_TYPE {
     DirCrawlerTypeStr,
     DirCrawlerTypeInt,
     DirCrawlerTypeBin,
+    DirCrawlerTypeSd,       // attributes only: self-relative security descriptor, also flattened in '_sd' and '_ace' side outfiles
+    DirCrawlerTypeSid,      // attributes only: binary SID, written as 'S-1-5-...'
+    DirCrawlerTypeGuid,     // attributes only: binary GUID, written in canonical form
+    DirCrawlerTypeFiletime, // attributes only: FILETIME integer string (pwdLastSet, lastLogonTimestamp...), written as epoch seconds
+    DirCrawlerTypeGentime,  // attributes only: generalized time string (whenChanged...), written as epoch seconds
+    DirCrawlerTypeAuto,     // attributes only: resolved from the schema catalog before the requests are started
+    DirCrawlerTypeRaw,      // attributes only, internal: schema-checked values without separator, copied as is (integers, booleans)
 } DIR_CRAWLER_LDAP_ATTR_TYPE, DIR_CRAWLER_LDAP_CTRLVAL_TYPE;
 
+typedef enum _DIR_CRAWLER_STOP {  // why the searches of a request stopped before their last entry
+    DirCrawlerStopNone,
+    DirCrawlerStopTimeout,          // "timeout" of the request
+    DirCrawlerStopMaxEntries,       // "maxentries" of the request
+    DirCrawlerStopDeadline,         // '--deadline' of the run
+} DIR_CRAWLER_STOP, *PDIR_CRAWLER_STOP;
+
 typedef enum _DIR_CRAWLER_LDAP_CTRL_TYPE {
     DirCrawlerLdapCtrlServer,
     DirCrawlerLdapCtrlClient,
@@ -153,6 +300,11 @@ typedef struct _DIR_CRAWLER_REQ_DESCR {
         } controls;
 
     } ldap;
+
+    struct {
+        DWORD dwTimeout;        // seconds, 0 for none
+        DWORD dwMaxEntries;     // 0 for none
+    } limits;
 } DIR_CRAWLER_REQ_DESCR, *PDIR_CRAWLER_REQ_DESCR;
 
 typedef struct _DIR_CRAWLER_REQ_DESCR_ARRAY {
@@ -160,14 +312,51 @@ typedef struct _DIR_CRAWLER_REQ_DESCR_ARRAY {
     DWORD dwRequestCount;
 } DIR_CRAWLER_REQ_DESCR_ARRAY, *PDIR_CRAWLER_REQ_DESCR_ARRAY;
 
+typedef struct _DIR_CRAWLER_TARGET {
+    LDAP_OPTIONS ldap;
+    PTCHAR ptOutfilesPrefix;
+    TCHAR atDefaultPrefix[3];
+    PTCHAR ptRootFolderName;        // '<date>_<dns name>' folder of the outfiles, in the output directory
+    PLDAP_CONNECT pConnection;      // only used to read the RootDSE (and the schema catalog for the first target)
+    PLDAP_ROOT_DSE pRootDse;        // NULL when replaying or generating a synthetic directory
+    BOOL bForestNcs;                // first target of its forest: the only one crawling the configuration and schema NCs
+} DIR_CRAWLER_TARGET, *PDIR_CRAWLER_TARGET;
+
 typedef struct _DIR_CRAWLER_REQ_LIST_ENTRY {
     SLIST_ENTRY sListEntry;
     PDIR_CRAWLER_REQ_DESCR pReqDescr;
+    PDIR_CRAWLER_TARGET pTarget;
+    DWORD dwAttempt;            // 0, then the number of times the request was rescheduled after its timeout
 } DIR_CRAWLER_REQ_LIST_ENTRY, *PDIR_CRAWLER_REQ_LIST_ENTRY;
 
+typedef struct _DIR_CRAWLER_REQ_CONTEXT {
+    PDIR_CRAWLER_REQ_DESCR pReqDescr;
+    struct _DIR_CRAWLER_SINK *pSink;                    // CSV outfile (or its shards), or stream
+    struct _DIR_CRAWLER_CAPTURE_STREAM *pCaptureStream; // NULL when not capturing
+    struct _DIR_CRAWLER_REQ_STATS *pStats;
+    struct _DIR_CRAWLER_SD_OUTPUT *pSdOutput;           // NULL when the request has no 'sd' attribute
+    struct _DIR_CRAWLER_EDGES_OUTPUT *pEdgesOutput;     // NULL when edges are not extracted or the request has no edge attribute
+    struct _DIR_CRAWLER_SNAPSHOT_OUTPUT *pSnapshotOutput; // NULL when no snapshot is written
+    struct _DIR_CRAWLER_FORMAT_STREAM *pFormatStream;   // NULL when entries are formatted by the search thread
+    ULONGLONG ullDeadline;      // GetTickCount64 value at which the searches stop, 0 for none
+    BOOL bRunDeadline;          // ullDeadline is the one of the run, not the timeout of the request
+    DWORD dwMaxEntries;         // 0 for none
+    DWORD dwEntries;            // written by all the searches of the request
+    LONGLONG llConnectStart;    // of the connection of the request, 0 once its first bind is done
+    DIR_CRAWLER_STOP eStop;
+} DIR_CRAWLER_REQ_CONTEXT, *PDIR_CRAWLER_REQ_CONTEXT;
+
 /* --- VARIABLES ------------------------------------------------------------ */
 extern PUTILS_HEAP g_pDirCrawlerHeap;
 
 /* --- PROTOTYPES ----------------------------------------------------------- */
+void DirCrawlerLogAsync(
+    _In_ const DIR_CRAWLER_LOG_LEVEL eLevel,
+    _In_ const PTCHAR ptFormat,
+    ...
+    );
+
+void DirCrawlerLogFlush(
+    );
 
 #endif // __DIR_CRAWLER_H__
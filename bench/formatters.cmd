@@ -0,0 +1,37 @@
+@echo off
+rem Compares the formatting stage of the raw attribute types (hexadecimal SIDs and GUIDs,
+rem FILETIME and generalized time strings) with the typed formatters (sid, guid, filetime,
+rem gentime) on the same synthetic directory. Both profiles request the same attributes,
+rem only their types differ, so the <format:> timings and <MB/s> can be compared directly.
+rem
+rem Usage: formatters.cmd <DirectoryCrawler.exe> <results dir> [objects]
+
+setlocal EnableDelayedExpansion
+
+if "%~2"=="" (
+    echo Usage: %~nx0 ^<DirectoryCrawler.exe^> ^<results dir^> [objects]
+    exit /b 1
+)
+
+set CRAWLER=%~1
+set RESULTS=%~2
+set OBJECTS=%~3
+if "%OBJECTS%"=="" set OBJECTS=500000
+
+set PROFILES=raw typed
+set THREADS=1 4
+
+if not exist "%RESULTS%" mkdir "%RESULTS%"
+
+for %%P in (%PROFILES%) do (
+    for %%T in (%THREADS%) do (
+        set RUN=%%P-t%%T
+        echo [!RUN!] objects=%OBJECTS%
+        if exist "%RESULTS%\!RUN!" rmdir /s /q "%RESULTS%\!RUN!"
+        mkdir "%RESULTS%\!RUN!"
+        "%CRAWLER%" --synthetic objects=%OBJECTS%,fanout=1 -d bench.local --bench -t %%T -j "%~dp0formatters\%%P.json" -o "%RESULTS%\!RUN!" -c BE -v SUCC > "%RESULTS%\!RUN!.txt" 2>&1
+        findstr /c:"Total <entries" "%RESULTS%\!RUN!.txt"
+    )
+)
+
+endlocal
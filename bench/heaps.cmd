@@ -0,0 +1,43 @@
+@echo off
+rem Measures how throughput scales with the number of worker threads, with a heap per
+rem worker thread (default) and with all the threads sharing the process heap (--shared-heap).
+rem The request file holds 32 identical requests so that every thread always has one to run.
+rem Compare <entries/s> of the Total line, and <ns/alloc> of the Allocator line: the time
+rem spent in the allocator per allocation grows with the contention on the heap lock.
+rem
+rem Usage: heaps.cmd <DirectoryCrawler.exe> <results dir> [objects]
+
+setlocal EnableDelayedExpansion
+
+if "%~2"=="" (
+    echo Usage: %~nx0 ^<DirectoryCrawler.exe^> ^<results dir^> [objects]
+    exit /b 1
+)
+
+set CRAWLER=%~1
+set RESULTS=%~2
+set OBJECTS=%~3
+if "%OBJECTS%"=="" set OBJECTS=100000
+
+rem <name>:<heap option>
+set HEAPS=per-thread:- shared:--shared-heap
+set THREADS=1 2 4 8 16 32
+
+if not exist "%RESULTS%" mkdir "%RESULTS%"
+
+for %%H in (%HEAPS%) do (
+    for /f "tokens=1,* delims=:" %%A in ("%%H") do (
+        set HEAP_OPTION=%%B
+        if "!HEAP_OPTION!"=="-" set HEAP_OPTION=
+        for %%T in (%THREADS%) do (
+            set RUN=%%A-t%%T
+            echo [!RUN!] objects=%OBJECTS%
+            if exist "%RESULTS%\!RUN!" rmdir /s /q "%RESULTS%\!RUN!"
+            mkdir "%RESULTS%\!RUN!"
+            "%CRAWLER%" --synthetic objects=%OBJECTS%,strsize=24,binsize=64,fanout=8 -d bench.local --bench !HEAP_OPTION! -t %%T -j "%~dp0heaps\requests.json" -o "%RESULTS%\!RUN!" -c BE -v SUCC > "%RESULTS%\!RUN!.txt" 2>&1
+            findstr /c:"Total <entries" /c:"Allocator <heaps" "%RESULTS%\!RUN!.txt"
+        )
+    )
+)
+
+endlocal
@@ -0,0 +1,404 @@
+#!/usr/bin/env python3
+"""
+Generates an AD-shaped directory for the slapd benchmark harness:
+  - an OpenLDAP schema defining every attribute requested by the JSON profiles,
+    plus the AD object classes populated here
+  - a rootDSE file exposing the AD naming context attributes
+  - one LDIF per naming context (domain, configuration, schema), each loaded in
+    its own slapd database so that subtree searches do not cross NC boundaries
+  - copies of the JSON profiles without the request-specific AD controls, which
+    slapd does not support
+
+The output is deterministic for a given set of parameters.
+"""
+
+import argparse
+import base64
+import glob
+import json
+import os
+import random
+import re
+import struct
+
+DOMAIN_DN = 'DC=bench,DC=local'
+CONFIG_DN = 'CN=Configuration,' + DOMAIN_DN
+SCHEMA_DN = 'CN=Schema,' + CONFIG_DN
+DOMAIN_SID = (0x1A2B3C4D, 0x5E6F7081, 0x92A3B4C5)
+OID_ARC = '1.3.6.1.4.1.99999.1'  # private arc used for every generated definition
+
+SYNTAX = {
+    'str': "EQUALITY caseIgnoreMatch SUBSTR caseIgnoreSubstringsMatch SYNTAX 1.3.6.1.4.1.1466.115.121.1.15",
+    'int': "EQUALITY integerMatch ORDERING integerOrderingMatch SYNTAX 1.3.6.1.4.1.1466.115.121.1.27",
+    'bin': "EQUALITY octetStringMatch SYNTAX 1.3.6.1.4.1.1466.115.121.1.40",
+}
+
+# Attributes already defined by slapd itself or by core.schema/cosine.schema
+BUILTIN_ATTRIBUTES = set(a.lower() for a in (
+    'objectClass', 'cn', 'sn', 'name', 'dc', 'ou', 'uid', 'mail', 'description', 'member', 'info', 'userPassword',
+    'dmdName', 'cACertificate', 'authorityRevocationList', 'certificateRevocationList', 'deltaRevocationList',
+    'supportedApplicationContext', 'namingContexts', 'supportedControl', 'supportedLDAPVersion',
+    'supportedSASLMechanisms', 'subschemaSubentry', 'attributeTypes', 'objectClasses', 'dITContentRules',
+    'createTimestamp', 'modifyTimestamp', 'creatorsName', 'modifiersName', 'entryUUID', 'entryCSN',
+    'structuralObjectClass', 'hasSubordinates', 'entryDN', 'supportedExtension', 'supportedFeatures',
+    'vendorName', 'vendorVersion', 'altServer', 'ref', 'manager', 'host', 'seeAlso', 'owner', 'l', 'st',
+    'street', 'o', 'c', 'title', 'telephoneNumber', 'givenName', 'initials', 'postalCode', 'userCertificate',
+))
+
+# Built-in user attributes that the generated classes must allow
+BUILTIN_USER_ATTRIBUTES = ('cn', 'sn', 'dc', 'ou', 'uid', 'mail', 'description', 'member', 'info', 'userPassword', 'dmdName',
+                           'cACertificate', 'authorityRevocationList', 'certificateRevocationList', 'deltaRevocationList',
+                           'supportedApplicationContext')
+
+# Objects classes populated by the generator: name -> (superior, kind, must)
+AD_CLASSES = {
+    'user': ('organizationalPerson', 'STRUCTURAL', ()),
+    'computer': ('user', 'STRUCTURAL', ()),
+    'group': ('top', 'STRUCTURAL', ()),
+    'container': ('top', 'STRUCTURAL', ()),
+    'domainDNS': ('top', 'STRUCTURAL', ('dc',)),
+    'builtinDomain': ('top', 'STRUCTURAL', ()),
+    'groupPolicyContainer': ('container', 'STRUCTURAL', ()),
+    'configuration': ('top', 'STRUCTURAL', ()),
+    'crossRefContainer': ('top', 'STRUCTURAL', ()),
+    'crossRef': ('top', 'STRUCTURAL', ()),
+    'sitesContainer': ('top', 'STRUCTURAL', ()),
+    'site': ('top', 'STRUCTURAL', ()),
+    'serversContainer': ('top', 'STRUCTURAL', ()),
+    'server': ('top', 'STRUCTURAL', ()),
+    'nTDSDSA': ('top', 'STRUCTURAL', ()),
+    'dMD': ('top', 'STRUCTURAL', ()),
+    'attributeSchema': ('top', 'STRUCTURAL', ()),
+    'classSchema': ('top', 'STRUCTURAL', ()),
+    'adBenchExtensible': ('top', 'AUXILIARY', ()),  # lets core classes (organizationalUnit) carry AD attributes
+}
+
+# Schema NC description of each generated attribute: kind -> (attributeSyntax, oMSyntax)
+AD_SYNTAX = {
+    'str': ('2.5.5.12', 64),
+    'int': ('2.5.5.9', 2),
+    'bin': ('2.5.5.10', 4),
+}
+
+# Attributes whose AD syntax is not the one implied by their profile type
+AD_SYNTAX_OVERRIDES = dict((a.lower(), s) for a, s in (
+    ('objectClass', ('2.5.5.2', 6)),
+    ('member', ('2.5.5.1', 127)), ('memberOf', ('2.5.5.1', 127)), ('manager', ('2.5.5.1', 127)),
+    ('managedBy', ('2.5.5.1', 127)), ('nCName', ('2.5.5.1', 127)), ('msDS-HasDomainNCs', ('2.5.5.1', 127)),
+    ('defaultObjectCategory', ('2.5.5.1', 127)), ('objectCategory', ('2.5.5.1', 127)),
+    ('objectSid', ('2.5.5.17', 4)), ('sIDHistory', ('2.5.5.17', 4)),
+    ('nTSecurityDescriptor', ('2.5.5.15', 66)),
+    ('whenCreated', ('2.5.5.11', 24)), ('whenChanged', ('2.5.5.11', 24)),
+    ('uSNCreated', ('2.5.5.16', 65)), ('uSNChanged', ('2.5.5.16', 65)), ('pwdLastSet', ('2.5.5.16', 65)),
+    ('lastLogonTimestamp', ('2.5.5.16', 65)), ('lastLogon', ('2.5.5.16', 65)), ('accountExpires', ('2.5.5.16', 65)),
+    ('badPasswordTime', ('2.5.5.16', 65)), ('lockoutTime', ('2.5.5.16', 65)),
+    ('isSingleValued', ('2.5.5.8', 1)), ('isSynchronized', ('2.5.5.8', 1)), ('isGlobalCatalogReady', ('2.5.5.8', 1)),
+))
+
+# Multi-valued attributes, every other generated attribute is single-valued
+MULTI_VALUED_ATTRIBUTES = set(a.lower() for a in (
+    'objectClass', 'member', 'memberOf', 'servicePrincipalName', 'sIDHistory', 'msDS-HasDomainNCs', 'otherWellKnownObjects',
+    'wellKnownObjects', 'proxyAddresses', 'userCertificate', 'url', 'otherTelephone', 'description', 'subRefs',
+    'namingContexts', 'supportedCapabilities', 'supportedControl', 'supportedLDAPPolicies', 'supportedLDAPVersion',
+    'supportedSASLMechanisms', 'msDS-AllowedToDelegateTo', 'msDS-KeyCredentialLink', 'altSecurityIdentities',
+))
+
+SCHEMA_NC_ATTRIBUTES = (('attributeSyntax', 'str'), ('oMSyntax', 'int'), ('isSingleValued', 'str'))
+
+ROOTDSE_ATTRIBUTES = ('defaultNamingContext', 'configurationNamingContext', 'schemaNamingContext',
+                      'rootDomainNamingContext', 'dnsHostName', 'ldapServiceName', 'serverName', 'dsServiceName',
+                      'domainFunctionality', 'forestFunctionality', 'domainControllerFunctionality',
+                      'highestCommittedUSN', 'isSynchronized', 'isGlobalCatalogReady', 'supportedCapabilities',
+                      'supportedLDAPPolicies', 'currentTime')
+
+# Well-known GUIDs used as ACE object types (extended rights and property sets)
+# (little-endian binary form, as stored in ACEs)
+ACE_OBJECT_TYPES = [
+    bytes.fromhex('aaf63111079cd111f79f00c04fc2dcd2'),  # DS-Replication-Get-Changes
+    bytes.fromhex('adf63111079cd111f79f00c04fc2dcd2'),  # DS-Replication-Get-Changes-All
+    bytes.fromhex('709529006d24d011a76800aa006e0529'),  # User-Force-Change-Password
+    bytes.fromhex('c07996bfe60dd011a28500aa003049e2'),  # member / Self-Membership
+    bytes.fromhex('86b8b5774a94d111aebd0000f80367c1'),  # Personal-Information
+    bytes.fromhex('422fba59a279d011902000c04fc2d3cf'),  # General-Information
+    bytes.fromhex('0042164cc020d011a76800aa006e0529'),  # Account-Restrictions
+]
+ACE_MASKS = (0x000F01FF, 0x00020094, 0x00000130, 0x00000010, 0x00000020, 0x00000100)
+
+
+class Generator(object):
+    def __init__(self, args):
+        self.args = args
+        self.rnd = random.Random(args.seed)
+        self.usn = 10000
+        self.attributes = {}
+
+    #
+    # Binary values
+    #
+    @staticmethod
+    def sid(rid=None):
+        # S-1-5-21-<domain>[-<rid>]
+        subauthorities = (21,) + DOMAIN_SID + ((rid,) if rid is not None else ())
+        return struct.pack('<BB6s%uI' % len(subauthorities), 1, len(subauthorities), b'\x00\x00\x00\x00\x00\x05', *subauthorities)
+
+    def guid(self):
+        return bytes(self.rnd.getrandbits(8) for _ in range(16))
+
+    def security_descriptor(self, variant):
+        # Self-relative SECURITY_DESCRIPTOR, DACLs only depend on the variant so that many objects share the same one
+        aces = []
+        size = 20 + 28 + 28 + 8
+        i = 0
+        while True:
+            sid = self.sid(1000 + (variant * 31 + i) % 512)
+            flags = 0x12 if i % 3 == 0 else 0  # CONTAINER_INHERIT_ACE | INHERITED_ACE
+            mask = ACE_MASKS[(i + variant) % len(ACE_MASKS)]
+            if i % 2 == 0:
+                ace = struct.pack('<BBHI', 0, flags, 8 + len(sid), mask) + sid
+            else:
+                ace = struct.pack('<BBHII', 5, flags, 12 + 16 + len(sid), mask, 1) + ACE_OBJECT_TYPES[i % len(ACE_OBJECT_TYPES)] + sid
+            if size + len(ace) > self.args.sd_size:
+                break
+            aces.append(ace)
+            size += len(ace)
+            i += 1
+        dacl = b''.join(aces)
+        acl = struct.pack('<BBHHH', 4, 0, 8 + len(dacl), len(aces), 0) + dacl
+        header = struct.pack('<BBHIIII', 1, 0, 0x8404, 20, 48, 0, 76)  # SE_SELF_RELATIVE | SE_DACL_AUTO_INHERITED | SE_DACL_PRESENT
+        return header + self.sid(512) + self.sid(513) + acl
+
+    #
+    # LDIF output
+    #
+    @staticmethod
+    def ldif_value(attr, value):
+        if isinstance(value, bytes):
+            return '%s:: %s' % (attr, base64.b64encode(value).decode('ascii'))
+        value = str(value)
+        if value and (value[0] in ' :<' or value[-1] == ' ' or any(ord(c) > 127 or c in '\r\n' for c in value)):
+            return '%s:: %s' % (attr, base64.b64encode(value.encode('utf-8')).decode('ascii'))
+        return '%s: %s' % (attr, value)
+
+    def write_entry(self, out, dn, object_classes, attrs):
+        self.usn += 1
+        out.write('dn: %s\n' % dn)
+        for oc in object_classes:
+            out.write('objectClass: %s\n' % oc)
+        attrs.setdefault('objectGUID', self.guid())
+        attrs.setdefault('whenCreated', '20240101120000.0Z')
+        attrs.setdefault('whenChanged', '20240601120000.0Z')
+        attrs.setdefault('uSNCreated', self.usn)
+        attrs.setdefault('uSNChanged', self.usn)
+        attrs.setdefault('instanceType', 4)
+        attrs.setdefault('nTSecurityDescriptor', self.security_descriptor(self.rnd.randrange(self.args.sd_variants)))
+        for attr, values in attrs.items():
+            # Attributes no profile requests are not in the schema
+            if values is None or (attr.lower() not in self.attributes and attr.lower() not in BUILTIN_ATTRIBUTES):
+                continue
+            if not isinstance(values, (list, tuple)):
+                values = [values]
+            for value in values:
+                out.write(self.ldif_value(attr, value) + '\n')
+        out.write('\n')
+
+    #
+    # Schema
+    #
+    def load_profiles(self):
+        self.profiles = {}
+        for path in sorted(glob.glob(os.path.join(self.args.json_dir, '*.json'))):
+            with open(path, encoding='latin-1') as f:
+                text = re.sub(r',\s*([}\]])', r'\1', f.read())  # the profiles tolerate trailing commas
+            requests = json.loads(text)
+            self.profiles[os.path.basename(path)] = requests
+            for request in requests.values():
+                for attr in request['ldap'].get('attrs', []):
+                    current = self.attributes.get(attr['name'].lower())
+                    kind = attr['type'] if current is None or current[1] == attr['type'] else 'str'
+                    self.attributes[attr['name'].lower()] = (attr['name'], kind)
+        for name in ROOTDSE_ATTRIBUTES:
+            self.attributes.setdefault(name.lower(), (name, 'str'))
+        # The schema NC always describes the syntax and cardinality of its attributes
+        for name, kind in SCHEMA_NC_ATTRIBUTES:
+            self.attributes.setdefault(name.lower(), (name, kind))
+
+    def write_schema(self, path):
+        defined = sorted(v for k, v in self.attributes.items() if k not in BUILTIN_ATTRIBUTES)
+        names = [name for name, _ in defined]
+        with open(path, 'w', encoding='utf-8') as out:
+            out.write('# Generated by gen_ldif.py from the JSON profiles, do not edit\n\n')
+            for i, (name, kind) in enumerate(defined):
+                usage = ' USAGE dSAOperation' if name in ROOTDSE_ATTRIBUTES else ''
+                out.write("attributetype ( %s.1.%u NAME '%s' %s%s )\n\n" % (OID_ARC, i + 1, name, SYNTAX[kind], usage))
+            may = ' $ '.join(BUILTIN_USER_ATTRIBUTES + tuple(n for n in names if n not in ROOTDSE_ATTRIBUTES))
+            for i, (name, (sup, kind, must)) in enumerate(sorted(AD_CLASSES.items())):
+                must_clause = ' MUST ( %s )' % ' $ '.join(must) if must else ''
+                out.write("objectclass ( %s.2.%u NAME '%s' SUP %s %s%s MAY ( %s ) )\n\n" % (OID_ARC, i + 1, name, sup, kind, must_clause, may))
+
+    def write_rootdse(self, path):
+        with open(path, 'w', encoding='utf-8') as out:
+            out.write('dn:\n')
+            for attr, value in (
+                    ('defaultNamingContext', DOMAIN_DN),
+                    ('configurationNamingContext', CONFIG_DN),
+                    ('schemaNamingContext', SCHEMA_DN),
+                    ('rootDomainNamingContext', DOMAIN_DN),
+                    ('dnsHostName', 'dc01.bench.local'),
+                    ('ldapServiceName', 'bench.local:dc01$@BENCH.LOCAL'),
+                    ('serverName', 'CN=DC01,CN=Servers,CN=Default-First-Site-Name,CN=Sites,' + CONFIG_DN),
+                    ('dsServiceName', 'CN=NTDS Settings,CN=DC01,CN=Servers,CN=Default-First-Site-Name,CN=Sites,' + CONFIG_DN),
+                    ('domainFunctionality', 7),
+                    ('forestFunctionality', 7),
+                    ('domainControllerFunctionality', 7),
+                    ('isSynchronized', 'TRUE'),
+                    ('isGlobalCatalogReady', 'TRUE')):
+                out.write(self.ldif_value(attr, value) + '\n')
+
+    def write_profiles(self, directory):
+        os.makedirs(directory, exist_ok=True)
+        for name, requests in self.profiles.items():
+            for request in requests.values():
+                request['ldap'].pop('controls', None)
+            with open(os.path.join(directory, name), 'w', encoding='utf-8') as out:
+                json.dump(requests, out, indent=4)
+
+    #
+    # Naming contexts
+    #
+    def write_domain(self, path):
+        a = self.args
+        with open(path, 'w', encoding='utf-8') as out:
+            self.write_entry(out, DOMAIN_DN, ('top', 'domainDNS'), {
+                'dc': 'bench', 'objectSid': self.sid(), 'gPLink': '[LDAP://CN={31B2F340-016D-11D2-945F-00C04FB984F9},CN=Policies,CN=System,%s;0]' % DOMAIN_DN,
+                'ms-DS-MachineAccountQuota': 10, 'minPwdLength': 7, 'lockoutThreshold': 0, 'pwdHistoryLength': 24})
+            for cn in ('Users', 'Computers', 'System', 'Builtin'):
+                self.write_entry(out, 'CN=%s,%s' % (cn, DOMAIN_DN), ('top', 'builtinDomain' if cn == 'Builtin' else 'container'), {'cn': cn})
+            self.write_entry(out, 'CN=Policies,CN=System,' + DOMAIN_DN, ('top', 'container'), {'cn': 'Policies'})
+            self.write_entry(out, 'CN=AdminSDHolder,CN=System,' + DOMAIN_DN, ('top', 'container'), {'cn': 'AdminSDHolder'})
+            for i in range(a.gpos):
+                cn = '{%08X-0000-0000-0000-%012X}' % (i, i)
+                self.write_entry(out, 'CN=%s,CN=Policies,CN=System,%s' % (cn, DOMAIN_DN), ('top', 'container', 'groupPolicyContainer'), {
+                    'cn': cn, 'displayName': 'GPO %u' % i, 'gPCFileSysPath': '\\\\bench.local\\SysVol\\bench.local\\Policies\\%s' % cn,
+                    'versionNumber': i, 'flags': 0})
+
+            # OUs: ten top-level OUs, then every OU gets ten children until the count is reached
+            ous = []
+            for i in range(a.ous):
+                dn = 'OU=OU-%u,%s' % (i, DOMAIN_DN if i < 10 else ous[(i - 10) // 10])
+                ous.append(dn)
+                self.write_entry(out, dn, ('top', 'organizationalUnit', 'adBenchExtensible'), {'ou': 'OU-%u' % i})
+
+            # Group memberships: a few huge groups and a long tail of small ones
+            groups = [[] for _ in range(a.groups)]
+            member_of = {}
+            principals = a.users + a.computers
+            for g in range(a.groups):
+                size = max(1, min(principals, a.max_members // (g + 1)))
+                for p in self.rnd.sample(range(principals), size):
+                    groups[g].append(p)
+                    member_of.setdefault(p, []).append(g)
+
+            def group_dn(g):
+                return 'CN=group-%u,%s' % (g, ous[g % len(ous)] if ous else 'CN=Users,' + DOMAIN_DN)
+
+            def principal_dn(p):
+                if p < a.users:
+                    return 'CN=user-%u,%s' % (p, ous[p % len(ous)] if ous else 'CN=Users,' + DOMAIN_DN)
+                return 'CN=computer-%u,%s' % (p - a.users, 'CN=Computers,' + DOMAIN_DN)
+
+            for p in range(principals):
+                rid = 1100 + p
+                attrs = {
+                    'objectSid': self.sid(rid),
+                    'memberOf': [group_dn(g) for g in member_of.get(p, [])],
+                    'primaryGroupID': 513 if p < a.users else 515,
+                    'pwdLastSet': 133000000000000000 + p, 'lastLogonTimestamp': 133100000000000000 + p,
+                    'accountExpires': 9223372036854775807, 'badPwdCount': 0, 'logonCount': p % 1000,
+                    'sAMAccountType': 805306368 if p < a.users else 805306369,
+                }
+                if p < a.users:
+                    name = 'user-%u' % p
+                    attrs.update({'cn': name, 'sn': name, 'sAMAccountName': name, 'userPrincipalName': '%s@bench.local' % name,
+                                  'displayName': 'User %u' % p, 'userAccountControl': 512 if p % 50 else 66048,
+                                  'description': 'Synthetic user %u' % p})
+                    if p % 100 == 0:
+                        attrs['servicePrincipalName'] = ['HTTP/svc-%u.bench.local' % p, 'MSSQLSvc/svc-%u.bench.local:1433' % p]
+                    self.write_entry(out, principal_dn(p), ('top', 'person', 'organizationalPerson', 'user'), attrs)
+                else:
+                    c = p - a.users
+                    name = 'computer-%u' % c
+                    attrs.update({'cn': name, 'sn': name, 'sAMAccountName': name.upper() + '$', 'dNSHostName': '%s.bench.local' % name,
+                                  'userAccountControl': 4096, 'operatingSystem': 'Windows Server 2019 Standard',
+                                  'operatingSystemVersion': '10.0 (17763)',
+                                  'servicePrincipalName': ['%s/%s%s' % (s, name, d) for s in ('HOST', 'RestrictedKrbHost', 'TERMSRV', 'WSMAN') for d in ('', '.bench.local')]})
+                    self.write_entry(out, principal_dn(p), ('top', 'person', 'organizationalPerson', 'user', 'computer'), attrs)
+
+            for g in range(a.groups):
+                name = 'group-%u' % g
+                self.write_entry(out, group_dn(g), ('top', 'group'), {
+                    'cn': name, 'sAMAccountName': name, 'objectSid': self.sid(100000 + g), 'groupType': -2147483646,
+                    'sAMAccountType': 268435456, 'member': [principal_dn(p) for p in groups[g]],
+                    'adminCount': 1 if g < 10 else None, 'description': 'Synthetic group %u' % g})
+
+    def write_configuration(self, path):
+        sites = 'CN=Sites,' + CONFIG_DN
+        with open(path, 'w', encoding='utf-8') as out:
+            self.write_entry(out, CONFIG_DN, ('top', 'configuration'), {'cn': 'Configuration'})
+            self.write_entry(out, 'CN=Partitions,' + CONFIG_DN, ('top', 'crossRefContainer'), {'cn': 'Partitions'})
+            for cn, nc in (('BENCH', DOMAIN_DN), ('Enterprise Configuration', CONFIG_DN), ('Enterprise Schema', SCHEMA_DN)):
+                self.write_entry(out, 'CN=%s,CN=Partitions,%s' % (cn, CONFIG_DN), ('top', 'crossRef'), {'cn': cn, 'nCName': nc, 'dnsRoot': 'bench.local'})
+            self.write_entry(out, sites, ('top', 'sitesContainer'), {'cn': 'Sites'})
+            for s in range(self.args.sites):
+                site = 'CN=Site-%u,%s' % (s, sites)
+                self.write_entry(out, site, ('top', 'site'), {'cn': 'Site-%u' % s})
+                self.write_entry(out, 'CN=Servers,' + site, ('top', 'serversContainer'), {'cn': 'Servers'})
+                server = 'CN=DC%02u,CN=Servers,%s' % (s + 1, site)
+                self.write_entry(out, server, ('top', 'server'), {'cn': 'DC%02u' % (s + 1), 'dNSHostName': 'dc%02u.bench.local' % (s + 1)})
+                self.write_entry(out, 'CN=NTDS Settings,' + server, ('top', 'nTDSDSA'), {
+                    'cn': 'NTDS Settings', 'options': 1, 'invocationId': self.guid(), 'msDS-HasDomainNCs': DOMAIN_DN})
+
+    def write_schema_nc(self, path):
+        with open(path, 'w', encoding='utf-8') as out:
+            self.write_entry(out, SCHEMA_DN, ('top', 'dMD'), {'cn': 'Schema', 'schemaInfo': b'\xff' + struct.pack('>I', 88) + self.guid()})
+            for i, (name, kind) in enumerate(sorted(self.attributes.values())):
+                syntax, om_syntax = AD_SYNTAX_OVERRIDES.get(name.lower(), AD_SYNTAX[kind])
+                self.write_entry(out, 'CN=%s,%s' % (name, SCHEMA_DN), ('top', 'attributeSchema'), {
+                    'cn': name, 'lDAPDisplayName': name, 'attributeID': '1.2.840.113556.1.4.%u' % (i + 1),
+                    'attributeSyntax': syntax, 'oMSyntax': om_syntax,
+                    'isSingleValued': 'FALSE' if name.lower() in MULTI_VALUED_ATTRIBUTES else 'TRUE',
+                    'schemaIDGUID': self.guid(), 'searchFlags': 0, 'systemFlags': 16})
+            for name in sorted(AD_CLASSES):
+                self.write_entry(out, 'CN=%s,%s' % (name, SCHEMA_DN), ('top', 'classSchema'), {
+                    'cn': name, 'lDAPDisplayName': name, 'subClassOf': AD_CLASSES[name][0], 'schemaIDGUID': self.guid(),
+                    'defaultObjectCategory': 'CN=%s,%s' % (name, SCHEMA_DN)})
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Generates an AD-shaped directory for the slapd benchmark harness')
+    parser.add_argument('--json-dir', required=True, help='directory containing the JSON request profiles')
+    parser.add_argument('--out', required=True, help='output directory')
+    parser.add_argument('--users', type=int, default=100000)
+    parser.add_argument('--computers', type=int, default=20000)
+    parser.add_argument('--groups', type=int, default=5000)
+    parser.add_argument('--ous', type=int, default=500)
+    parser.add_argument('--gpos', type=int, default=200)
+    parser.add_argument('--sites', type=int, default=4)
+    parser.add_argument('--max-members', type=int, default=50000, help='size of the biggest group, group N has max/(N+1) members')
+    parser.add_argument('--sd-size', type=int, default=2048, help='approximate nTSecurityDescriptor size in bytes')
+    parser.add_argument('--sd-variants', type=int, default=64, help='number of distinct DACLs')
+    parser.add_argument('--seed', type=int, default=1)
+    args = parser.parse_args()
+
+    os.makedirs(args.out, exist_ok=True)
+    generator = Generator(args)
+    generator.load_profiles()
+    generator.write_schema(os.path.join(args.out, 'ad-bench.schema'))
+    generator.write_rootdse(os.path.join(args.out, 'rootdse.ldif'))
+    generator.write_profiles(os.path.join(args.out, 'profiles'))
+    generator.write_schema_nc(os.path.join(args.out, 'schema.ldif'))
+    generator.write_configuration(os.path.join(args.out, 'configuration.ldif'))
+    generator.write_domain(os.path.join(args.out, 'domain.ldif'))
+
+
+if __name__ == '__main__':
+    main()
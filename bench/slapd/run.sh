@@ -0,0 +1,97 @@
+#!/bin/sh
+# Runs DirectoryCrawler with every JSON profile and several thread counts against the
+# slapd instance started by setup.sh, and records the wall time and the server-side
+# operation counts (cn=Monitor) of each run in <results dir>/results.csv.
+#
+# Usage: run.sh <work dir> <DirectoryCrawler.exe> <results dir>
+# Environment: SLAPD_HOST (default localhost), SLAPD_PORT (default 3389), SLAPD_TLS_PORT (default 3636),
+#              BENCH_DOMAIN (default bench.local, the DNS name of the generated domain),
+#              THREADS (default "1 2 4 8"), TLS_MODES (default "none", any of "none ldaps starttls
+#              ldaps-noresume starttls-noresume"), BENCH_USER/BENCH_PASSWORD, CRAWLER_ARGS (extra options, ex: --bench)
+#
+# The crawler is a Windows binary: run this script from WSL (Windows binaries are
+# directly executable there) or from any Linux host with wine.
+
+set -e
+
+if [ $# -lt 3 ]; then
+    echo "Usage: $0 <work dir> <DirectoryCrawler.exe> <results dir>" >&2
+    exit 1
+fi
+
+WORK=$(cd "$1" && pwd)
+CRAWLER=$2
+RESULTS=$(mkdir -p "$3" && cd "$3" && pwd)
+
+SLAPD_HOST=${SLAPD_HOST:-localhost}
+SLAPD_PORT=${SLAPD_PORT:-3389}
+SLAPD_TLS_PORT=${SLAPD_TLS_PORT:-3636}
+BENCH_DOMAIN=${BENCH_DOMAIN:-bench.local}
+THREADS=${THREADS:-"1 2 4 8"}
+TLS_MODES=${TLS_MODES:-none}
+BENCH_USER=${BENCH_USER:-bench}
+BENCH_PASSWORD=${BENCH_PASSWORD:-bench}
+
+# Windows paths are needed when the crawler runs through WSL interop
+winpath() {
+    if command -v wslpath >/dev/null 2>&1; then wslpath -w "$1"; else echo "$1"; fi
+}
+
+# Prints "<initiated> <completed>" for the given operation type
+monitor_ops() {
+    ldapsearch -x -LLL -H "ldap://$SLAPD_HOST:$SLAPD_PORT/" -b "cn=$1,cn=Operations,cn=Monitor" -s base \
+        monitorOpInitiated monitorOpCompleted | awk '/^monitorOpInitiated:/ {i=$2} /^monitorOpCompleted:/ {c=$2} END {print i+0, c+0}'
+}
+
+monitor_entries() {
+    ldapsearch -x -LLL -H "ldap://$SLAPD_HOST:$SLAPD_PORT/" -b "cn=Entries,cn=Statistics,cn=Monitor" -s base \
+        monitorCounter | awk '/^monitorCounter:/ {print $2}'
+}
+
+# Prints the port and crawler options of a TLS mode
+tls_args() {
+    case "$1" in
+        none)               echo "$SLAPD_PORT" ;;
+        ldaps)              echo "$SLAPD_TLS_PORT --tls ldaps --tls-insecure" ;;
+        starttls)           echo "$SLAPD_PORT --tls starttls --tls-insecure" ;;
+        ldaps-noresume)     echo "$SLAPD_TLS_PORT --tls ldaps --tls-insecure --tls-no-resume" ;;
+        starttls-noresume)  echo "$SLAPD_PORT --tls starttls --tls-insecure --tls-no-resume" ;;
+        *)                  echo "Unknown TLS mode <$1>" >&2; exit 1 ;;
+    esac
+}
+
+# The counts include the handful of operations of the monitor queries themselves
+snapshot() {
+    echo "$(monitor_ops Bind) $(monitor_ops Search) $(monitor_entries)"
+}
+
+echo "profile,tls,threads,exit,wall_s,binds,searches,entries_sent,outfiles_bytes" > "$RESULTS/results.csv"
+
+for PROFILE in "$WORK"/profiles/*.json; do
+    NAME=$(basename "$PROFILE" .json)
+    for TLS in $TLS_MODES; do
+        TLS_ARGS=$(tls_args "$TLS")
+        PORT=${TLS_ARGS%% *}
+        TLS_OPTS=${TLS_ARGS#"$PORT"}
+        for T in $THREADS; do
+            RUN="$NAME-$TLS-t$T"
+            rm -rf "$RESULTS/$RUN"
+            mkdir -p "$RESULTS/$RUN"
+
+            set -- $(snapshot)
+            B0=$2; S0=$4; E0=$5
+            START=$(date +%s.%N)
+            RC=0
+            "$CRAWLER" -s "$SLAPD_HOST" -n "$PORT" -d "$BENCH_DOMAIN" -l "$BENCH_USER" -p "$BENCH_PASSWORD" -t "$T" -c BE -v SUCC $TLS_OPTS \
+                -j "$(winpath "$PROFILE")" -o "$(winpath "$RESULTS/$RUN")" $CRAWLER_ARGS > "$RESULTS/$RUN.txt" 2>&1 || RC=$?
+            END=$(date +%s.%N)
+            set -- $(snapshot)
+            B1=$2; S1=$4; E1=$5
+
+            BYTES=$(du -sb "$RESULTS/$RUN" | cut -f1)
+            LINE="$NAME,$TLS,$T,$RC,$(echo "$END - $START" | bc),$((B1 - B0)),$((S1 - S0)),$((E1 - E0)),$BYTES"
+            echo "$LINE" >> "$RESULTS/results.csv"
+            echo "[$RUN] $LINE"
+        done
+    done
+done
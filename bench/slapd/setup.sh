@@ -0,0 +1,59 @@
+#!/bin/sh
+# Generates the AD-like directory, loads it in a fresh slapd instance and starts it.
+#
+# Usage: setup.sh <work dir> [gen_ldif.py options...]
+# Environment: SLAPD_PORT (default 3389), SLAPD_TLS_PORT (ldaps, default 3636), SLAPD_SCHEMA_DIR, SLAPD_MODULE_DIR,
+#              BENCH_USER/BENCH_PASSWORD (SASL account used by DirectoryCrawler)
+
+set -e
+
+if [ $# -lt 1 ]; then
+    echo "Usage: $0 <work dir> [gen_ldif.py options...]" >&2
+    exit 1
+fi
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+WORK=$(mkdir -p "$1" && cd "$1" && pwd)
+shift
+
+SLAPD_PORT=${SLAPD_PORT:-3389}
+SLAPD_TLS_PORT=${SLAPD_TLS_PORT:-3636}
+SLAPD_SCHEMA_DIR=${SLAPD_SCHEMA_DIR:-/etc/ldap/schema}
+SLAPD_MODULE_DIR=${SLAPD_MODULE_DIR:-/usr/lib/ldap}
+BENCH_USER=${BENCH_USER:-bench}
+BENCH_PASSWORD=${BENCH_PASSWORD:-bench}
+
+if [ -f "$WORK/slapd.pid" ]; then
+    kill "$(cat "$WORK/slapd.pid")" 2>/dev/null || true
+    sleep 1
+fi
+rm -rf "$WORK/db"
+mkdir -p "$WORK/db/schema" "$WORK/db/configuration" "$WORK/db/domain"
+
+echo "[+] Generating directory in <$WORK>"
+python3 "$HERE/gen_ldif.py" --json-dir "$HERE/../../json" --out "$WORK" "$@"
+
+# Self-signed certificate for ldaps and StartTLS (the crawler runs with --tls-insecure)
+if [ ! -f "$WORK/slapd.crt" ]; then
+    echo "[+] Generating TLS certificate"
+    openssl req -x509 -newkey rsa:2048 -nodes -days 365 -subj "/CN=$(hostname)" \
+        -keyout "$WORK/slapd.key" -out "$WORK/slapd.crt" 2>/dev/null
+fi
+
+sed -e "s|@WORK@|$WORK|g" -e "s|@SCHEMA_DIR@|$SLAPD_SCHEMA_DIR|g" -e "s|@MODULE_DIR@|$SLAPD_MODULE_DIR|g" \
+    "$HERE/slapd.conf.in" > "$WORK/slapd.conf"
+
+echo "[+] Loading naming contexts"
+for NC in schema:"CN=Schema,CN=Configuration,DC=bench,DC=local" \
+          configuration:"CN=Configuration,DC=bench,DC=local" \
+          domain:"DC=bench,DC=local"; do
+    time slapadd -q -f "$WORK/slapd.conf" -b "${NC#*:}" -l "$WORK/${NC%%:*}.ldif"
+done
+
+if command -v saslpasswd2 >/dev/null 2>&1; then
+    echo "$BENCH_PASSWORD" | saslpasswd2 -p -c -u BENCH "$BENCH_USER" || echo "[!] Failed to create SASL account <$BENCH_USER>"
+fi
+
+echo "[+] Starting slapd on ports <$SLAPD_PORT> (ldap, StartTLS) and <$SLAPD_TLS_PORT> (ldaps)"
+slapd -f "$WORK/slapd.conf" -h "ldap://0.0.0.0:$SLAPD_PORT/ ldaps://0.0.0.0:$SLAPD_TLS_PORT/"
+echo "[+] Done, profiles without AD controls are in <$WORK/profiles>"
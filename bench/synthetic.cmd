@@ -0,0 +1,42 @@
+@echo off
+rem Runs DirectoryCrawler against its in-process synthetic directory for several
+rem directory profiles and thread counts, and keeps the benchmark report of each run.
+rem
+rem Usage: synthetic.cmd <DirectoryCrawler.exe> <json request file> <results dir>
+
+setlocal EnableDelayedExpansion
+
+if "%~3"=="" (
+    echo Usage: %~nx0 ^<DirectoryCrawler.exe^> ^<json request file^> ^<results dir^>
+    exit /b 1
+)
+
+set CRAWLER=%~1
+set JSON=%~2
+set RESULTS=%~3
+
+rem "<name>:<synthetic directory specification>", quoted so that 'for' does not split them on ',' and '='
+set PROFILES=^
+ "small:objects=200000,strsize=16,binsize=16,sdsize=256,fanout=2"^
+ "large-sd:objects=50000,strsize=32,binsize=64,sdsize=16384,fanout=4"^
+ "fanout:objects=50000,strsize=32,binsize=16,sdsize=1024,fanout=500"^
+ "latency:objects=100000,strsize=24,binsize=16,sdsize=1024,fanout=8,pagesize=1000,latency=20"
+
+set THREADS=1 2 4 8
+
+if not exist "%RESULTS%" mkdir "%RESULTS%"
+
+for %%P in (%PROFILES%) do (
+    for /f "tokens=1,* delims=:" %%A in ("%%~P") do (
+        for %%T in (%THREADS%) do (
+            set RUN=%%A-t%%T
+            echo [!RUN!] %%B
+            if exist "%RESULTS%\!RUN!" rmdir /s /q "%RESULTS%\!RUN!"
+            mkdir "%RESULTS%\!RUN!"
+            "%CRAWLER%" --synthetic %%B -d bench.local --bench -t %%T -j "%JSON%" -o "%RESULTS%\!RUN!" -c BE -v SUCC > "%RESULTS%\!RUN!.txt" 2>&1
+            findstr /c:"Total <entries" "%RESULTS%\!RUN!.txt"
+        )
+    )
+)
+
+endlocal